@@ -0,0 +1,237 @@
+#ifndef __ZNS_BENCH_UTIL_H
+#define __ZNS_BENCH_UTIL_H
+
+#include "ipinfo.hpp"
+#include "nsetypes.hpp"
+#include "timeutil.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <netinet/in.h>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <thread>
+#include <type_traits>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace znsbench
+{
+inline double thread_cpu_seconds()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+inline double wall_seconds()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+// One JSON object per line, so runs can be diffed and loaded without a parser of our own.
+class BenchResult
+{
+  public:
+    explicit BenchResult(std::string_view bench_name)
+    {
+        add("bench", bench_name);
+    }
+
+    BenchResult &add(std::string_view key, std::string_view value)
+    {
+        append_key(key);
+        m_line += '"';
+        m_line += value;
+        m_line += '"';
+        return *this;
+    }
+
+    BenchResult &add(std::string_view key, const char *value)
+    {
+        return add(key, std::string_view(value));
+    }
+
+    template <typename T>
+    requires std::is_arithmetic_v<T> BenchResult &add(std::string_view key, T value)
+    {
+        append_key(key);
+        if constexpr (std::is_floating_point_v<T>) {
+            char buf[64];
+            ::snprintf(buf, sizeof(buf), "%.3f", (double)value);
+            m_line += buf;
+        } else {
+            m_line += std::to_string(value);
+        }
+        return *this;
+    }
+
+    void print()
+    {
+        ::printf("%s}\n", m_line.c_str());
+        ::fflush(stdout);
+    }
+
+  private:
+    void append_key(std::string_view key)
+    {
+        m_line += m_line.empty() ? "{\"" : ", \"";
+        m_line += key;
+        m_line += "\": ";
+    }
+
+    std::string m_line;
+};
+
+// p of sorted, 0 when there are no samples.
+inline int64_t percentile(const std::vector<int64_t> &sorted, double p)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    return sorted[std::min<std::size_t>(sorted.size() - 1, sorted.size() * p)];
+}
+
+// streams streams on loopback, stream n on ports base_port + 2(n - 1) and the next one up.
+inline std::map<short, single_stream_info> loopback_config(short streams, uint16_t base_port)
+{
+    std::map<short, single_stream_info> config;
+    for (short stream_id = 1; stream_id <= streams; stream_id++) {
+        const uint16_t port = base_port + (stream_id - 1) * 2;
+        config.emplace(stream_id, single_stream_info(stream_id, port, port + 1, "", ""));
+    }
+    return config;
+}
+
+// 239.255.third_octet.stream_id. single_stream_info only views its addresses, so every name
+// handed out lives as long as the process. Not for concurrent use.
+inline const std::string &multicast_group(int third_octet, short stream_id)
+{
+    static std::map<std::pair<int, short>, std::string> groups;
+
+    auto [it, added] = groups.try_emplace(std::make_pair(third_octet, stream_id));
+    if (added) {
+        it->second = "239.255." + std::to_string(third_octet) + "." + std::to_string(stream_id);
+    }
+    return it->second;
+}
+
+// As loopback_config, joined to 239.255.third_octet.n on the primary line and
+// 239.255.(third_octet + 1).n on the secondary.
+inline std::map<short, single_stream_info> multicast_config(short streams, uint16_t base_port, int third_octet)
+{
+    std::map<short, single_stream_info> config;
+    for (short stream_id = 1; stream_id <= streams; stream_id++) {
+        const uint16_t port = base_port + (stream_id - 1) * 2;
+        config.emplace(stream_id, single_stream_info(stream_id, port, port + 1, multicast_group(third_octet, stream_id),
+                                                     multicast_group(third_octet + 1, stream_id)));
+    }
+    return config;
+}
+
+// The F&O stream addresses the capture benches write under, never joined.
+inline std::map<short, single_stream_info> capture_config(short streams)
+{
+    std::map<short, single_stream_info> config;
+    for (short stream_id = 1; stream_id <= streams; stream_id++) {
+        config.emplace(stream_id, single_stream_info(stream_id, 17740 + stream_id, 10830 + stream_id, "239.70.70.41",
+                                                     "239.70.70.31"));
+    }
+    return config;
+}
+
+// One 'N' order message, the bulk of the F&O feed, with an empty body. Only the first
+// msgLen bytes go on the wire.
+inline StreamPacket order_packet(short stream_id = 0, int seq_no = 0)
+{
+    StreamPacket packet;
+    std::memset(&packet, 0, sizeof(packet));
+    packet.streamHdr.msgLen = sizeof(StreamHeader) + 1 + sizeof(OrderData);
+    packet.streamHdr.streamId = stream_id;
+    packet.streamHdr.seqNo = seq_no;
+    packet.streamData.cMsgType = newOrderMsg;
+    return packet;
+}
+
+// Sends packets datagrams of packet_size bytes to loopback ports base_port up to
+// base_port + ports - 1 in turn. Each starts with its send time from realtime_ns and is 'N'
+// after that. Unpaced they go out in sendmmsg bursts of SEND_BURST, with an interval one at a
+// time after each sleep.
+inline constexpr unsigned int SEND_BURST = 64;
+
+inline void send_packets(uint16_t base_port, std::size_t ports, std::size_t packets, std::size_t packet_size,
+                         std::chrono::microseconds interval)
+{
+    int fd = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    std::vector<unsigned char> payloads(SEND_BURST * packet_size, 'N');
+
+    std::vector<struct sockaddr_in> addrs(ports);
+    for (std::size_t i = 0; i < addrs.size(); i++) {
+        std::memset(&addrs[i], 0, sizeof(addrs[i]));
+        addrs[i].sin_family = AF_INET;
+        addrs[i].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addrs[i].sin_port = htons(base_port + i);
+    }
+
+    const unsigned int max_burst = (interval.count() == 0) ? SEND_BURST : 1;
+    struct mmsghdr msgs[SEND_BURST];
+    struct iovec iovs[SEND_BURST];
+
+    std::size_t sent = 0;
+    while (sent < packets) {
+        if (interval.count() != 0) {
+            std::this_thread::sleep_for(interval);
+        }
+
+        const unsigned int burst = std::min<std::size_t>(max_burst, packets - sent);
+        const int64_t sent_ns = znsreader::realtime_ns();
+
+        for (unsigned int i = 0; i < burst; i++) {
+            unsigned char *payload = payloads.data() + (i * packet_size);
+            std::memcpy(payload, &sent_ns, std::min(sizeof(sent_ns), packet_size));
+            iovs[i].iov_base = payload;
+            iovs[i].iov_len = packet_size;
+
+            std::memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_name = (void *)&addrs[(sent + i) % addrs.size()];
+            msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int ret = ::sendmmsg(fd, msgs, burst, 0);
+        if (ret > 0) {
+            sent += ret;
+        }
+    }
+
+    ::close(fd);
+}
+
+// Waits for received to stop moving for 100ms, returns the seconds since wall_start up to
+// when it last moved.
+inline double wait_quiet(std::atomic<uint64_t> &received, double wall_start)
+{
+    uint64_t last = received.load(std::memory_order_relaxed);
+    for (;;) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        const uint64_t now = received.load(std::memory_order_relaxed);
+        if (now == last) {
+            return wall_seconds() - wall_start - 0.1;
+        }
+        last = now;
+    }
+}
+}
+
+#endif
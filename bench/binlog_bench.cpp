@@ -0,0 +1,129 @@
+// Hot path cost of one log call: ZNS_LOG into a BinaryLogger writing binary or text, against
+// the std::fstream the feed used to log through, flushed with std::endl and with '\n'. Calls
+// come in bursts that fit a thread's queue, with a pause after each for the background thread,
+// as the feed logs per packet batch. Each call is also timed on its own for the tail, the
+// timer's own cost is reported next to it. binlog_alternating switches between two loggers on
+// every call. Pass total calls and the output directory.
+
+#include "bench_util.hpp"
+#include "binlog.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+constexpr std::size_t BURST = 4096;
+
+template <typename LogCall>
+void run_case(const char *name, std::size_t calls, LogCall &&log_call, uint64_t (*dropped)() = nullptr)
+{
+    std::vector<int64_t> single_ns;
+    single_ns.reserve(calls / 2);
+    double burst_sec = 0;
+    short stream = 1;
+    int seq = 0;
+
+    // Alternate timed bursts with bursts timed per call.
+    for (std::size_t done = 0; done < calls; done += BURST) {
+        if ((done / BURST) % 2 == 0) {
+            const double start = znsbench::wall_seconds();
+            for (std::size_t i = 0; i < BURST; i++, seq++) {
+                log_call(stream, seq);
+            }
+            burst_sec += znsbench::wall_seconds() - start;
+        } else {
+            for (std::size_t i = 0; i < BURST; i++, seq++) {
+                const int64_t start = znsreader::monotonic_ns();
+                log_call(stream, seq);
+                single_ns.push_back(znsreader::monotonic_ns() - start);
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+
+    int64_t timer_ns = INT64_MAX;
+    for (int i = 0; i < 1000; i++) {
+        const int64_t start = znsreader::monotonic_ns();
+        timer_ns = std::min(timer_ns, znsreader::monotonic_ns() - start);
+    }
+
+    std::sort(single_ns.begin(), single_ns.end());
+    const std::size_t burst_calls = ((calls / BURST + 1) / 2) * BURST;
+
+    znsbench::BenchResult result("binlog");
+    result.add("case", name)
+        .add("calls", calls)
+        .add("ns_per_call", burst_sec * 1e9 / burst_calls)
+        .add("p50_ns", single_ns[single_ns.size() / 2])
+        .add("p99_ns", single_ns[single_ns.size() * 99 / 100])
+        .add("p999_ns", single_ns[single_ns.size() * 999 / 1000])
+        .add("max_ns", single_ns.back())
+        .add("timer_ns", timer_ns);
+    if (dropped != nullptr) {
+        result.add("dropped", dropped());
+    }
+    result.print();
+}
+
+znsreader::BinaryLogger *active_logger = nullptr;
+
+uint64_t active_dropped()
+{
+    return active_logger->dropped();
+}
+}
+
+int main(int argc, char **argv)
+{
+    const std::size_t calls = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : (1 << 21);
+    const std::string dir = (argc > 2) ? argv[2] : "/tmp";
+
+    {
+        znsreader::BinaryLogger logger(dir + "/zns_binlog_bench.bin", znsreader::LogOutput::binary);
+        active_logger = &logger;
+        run_case(
+            "binlog_binary", calls, [&logger](short stream, int seq) { ZNS_LOG(logger, "{}:{}", stream, seq); },
+            active_dropped);
+    }
+    {
+        znsreader::BinaryLogger logger(dir + "/zns_binlog_bench.txt", znsreader::LogOutput::text);
+        active_logger = &logger;
+        run_case(
+            "binlog_text", calls, [&logger](short stream, int seq) { ZNS_LOG(logger, "{}:{}", stream, seq); },
+            active_dropped);
+    }
+    {
+        // Every call switches logger, each thread must keep one queue per logger.
+        znsreader::BinaryLogger feed_logger(dir + "/zns_binlog_bench_feed.bin", znsreader::LogOutput::binary);
+        znsreader::BinaryLogger order_logger(dir + "/zns_binlog_bench_order.bin", znsreader::LogOutput::binary);
+        active_logger = &order_logger;
+        run_case(
+            "binlog_alternating", calls,
+            [&feed_logger, &order_logger](short stream, int seq) {
+                if (seq & 1) {
+                    ZNS_LOG(feed_logger, "{}:{}", stream, seq);
+                } else {
+                    ZNS_LOG(order_logger, "{}:{}", stream, seq);
+                }
+            },
+            active_dropped);
+    }
+    {
+        std::fstream log_file(dir + "/zns_binlog_bench_endl.txt", std::ios::out | std::ios::trunc);
+        run_case("fstream_endl", calls,
+                 [&log_file](short stream, int seq) { log_file << stream << ":" << seq << std::endl; });
+    }
+    {
+        std::fstream log_file(dir + "/zns_binlog_bench_newline.txt", std::ios::out | std::ios::trunc);
+        run_case("fstream_newline", calls,
+                 [&log_file](short stream, int seq) { log_file << stream << ":" << seq << '\n'; });
+    }
+
+    return 0;
+}
@@ -0,0 +1,163 @@
+// Sustained capture rate of PacketToFileWriter (write() per header) against
+// BufferedPacketToFileWriter (block copy + writev on an I/O thread) and SegmentedCaptureStore
+// (copy into preallocated mapped segments). Synthetic NSE order packets, round robin over 16
+// streams, under a fresh temp directory. Time runs until every byte has been handed to the
+// kernel, i.e. including the flush. The store is then reopened to time a restart, replayed
+// in full and seeked by seqNo and by time.
+
+#include "bench_util.hpp"
+#include "capturestore.hpp"
+#include "capturewriter.hpp"
+#include "nsetypes.hpp"
+#include "pcapwriter.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+constexpr short STREAM_COUNT = 16;
+constexpr int64_t RECV_TIMESTAMP_NS = 1700000000000000000;
+
+uint64_t file_bytes(const std::string &dir)
+{
+    uint64_t total = 0;
+    for (const auto &entry : std::filesystem::directory_iterator(dir)) {
+        total += entry.file_size();
+    }
+    return total;
+}
+
+template <typename Writer>
+void run_writer(const char *name, const std::map<short, single_stream_info> &config, std::size_t packets,
+                const std::string &dir)
+{
+    StreamPacket packet = znsbench::order_packet();
+
+    const double wall_start = znsbench::wall_seconds();
+    const double cpu_start = znsbench::thread_cpu_seconds();
+    double ingest_cpu_sec;
+    {
+        Writer writer(config, true, false);
+
+        for (std::size_t i = 0; i < packets; i++) {
+            packet.streamHdr.streamId = 1 + (i % STREAM_COUNT);
+            packet.streamHdr.seqNo = 1 + (i / STREAM_COUNT);
+            writer.ingest_packet((const unsigned char *)&packet, packet.streamHdr.msgLen, RECV_TIMESTAMP_NS + i);
+        }
+
+        ingest_cpu_sec = znsbench::thread_cpu_seconds() - cpu_start;
+    }
+    const double wall_sec = znsbench::wall_seconds() - wall_start;
+
+    znsbench::BenchResult("capture")
+        .add("writer", name)
+        .add("records", packets)
+        .add("record_bytes", packet.streamHdr.msgLen)
+        .add("file_bytes", file_bytes(dir))
+        .add("wall_sec", wall_sec)
+        .add("ingest_cpu_sec", ingest_cpu_sec)
+        .add("records_per_sec", packets / wall_sec)
+        .add("records_per_ingest_cpu_sec", packets / ingest_cpu_sec)
+        .print();
+}
+
+void run_store(std::size_t packets, const std::string &dir)
+{
+    StreamPacket packet = znsbench::order_packet();
+    const std::string store_dir = dir + "/segments";
+    // Small enough segments that a default run rotates a few times.
+    const std::size_t segment_size = (std::size_t)64 << 20;
+
+    const double wall_start = znsbench::wall_seconds();
+    const double cpu_start = znsbench::thread_cpu_seconds();
+    double ingest_cpu_sec;
+    uint64_t segments;
+    {
+        znsreader::SegmentedCaptureStore store(store_dir, segment_size);
+
+        for (std::size_t i = 0; i < packets; i++) {
+            packet.streamHdr.streamId = 1 + (i % STREAM_COUNT);
+            packet.streamHdr.seqNo = 1 + (i / STREAM_COUNT);
+            store.ingest_packet((const unsigned char *)&packet, packet.streamHdr.msgLen, RECV_TIMESTAMP_NS + i);
+        }
+
+        ingest_cpu_sec = znsbench::thread_cpu_seconds() - cpu_start;
+        segments = store.segment_index() + 1;
+    }
+    const double wall_sec = znsbench::wall_seconds() - wall_start;
+
+    const double resume_start = znsbench::wall_seconds();
+    int64_t resumed_seq_no;
+    {
+        znsreader::SegmentedCaptureStore store(store_dir, segment_size);
+        resumed_seq_no = store.latest_seq_no(STREAM_COUNT);
+    }
+    const double resume_sec = znsbench::wall_seconds() - resume_start;
+
+    // Full replay through the reader, then seeks spread over the capture.
+    znsreader::CaptureStoreReader reader(store_dir);
+    const double replay_start = znsbench::wall_seconds();
+    uint64_t replayed = 0;
+    znsreader::CaptureStoreReader::Cursor cursor = reader.begin();
+    while (cursor.next()) {
+        replayed++;
+    }
+    const double replay_sec = znsbench::wall_seconds() - replay_start;
+
+    constexpr std::size_t SEEKS = 10000;
+    const int64_t last_seq_no = packets / STREAM_COUNT;
+    uint64_t found = 0;
+    const double seek_start = znsbench::wall_seconds();
+    for (std::size_t i = 0; i < SEEKS; i++) {
+        const int64_t seq_no = 1 + (int64_t)((i * 7919) % last_seq_no);
+        found += reader.seek_seq(1 + (i % STREAM_COUNT), seq_no).next().has_value();
+        found += reader.seek_time(RECV_TIMESTAMP_NS + (seq_no - 1) * STREAM_COUNT).next().has_value();
+    }
+    const double seek_sec = znsbench::wall_seconds() - seek_start;
+
+    znsbench::BenchResult("capture")
+        .add("writer", "segment_mmap")
+        .add("records", packets)
+        .add("record_bytes", packet.streamHdr.msgLen)
+        .add("file_bytes", file_bytes(store_dir))
+        .add("segments", segments)
+        .add("wall_sec", wall_sec)
+        .add("ingest_cpu_sec", ingest_cpu_sec)
+        .add("records_per_sec", packets / wall_sec)
+        .add("records_per_ingest_cpu_sec", packets / ingest_cpu_sec)
+        .add("resume_sec", resume_sec)
+        .add("resumed_seq_no", resumed_seq_no)
+        .add("replayed", replayed)
+        .add("replay_records_per_sec", replayed / replay_sec)
+        .add("seeks_found", found)
+        .add("seek_us", seek_sec * 1e6 / (2 * SEEKS))
+        .print();
+}
+}
+
+int main(int argc, char **argv)
+{
+    const std::size_t packets = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : 2000000;
+    std::string dir = (argc > 2) ? argv[2] : "/tmp";
+
+    dir += "/zns_capture_bench_XXXXXX";
+    if (::mkdtemp(dir.data()) == nullptr || ::chdir(dir.c_str()) != 0) {
+        perror("capture directory error:");
+        return 1;
+    }
+
+    // Both writers name files the same way, each run truncates the previous one's.
+    const std::map<short, single_stream_info> config = znsbench::capture_config(STREAM_COUNT);
+    run_writer<znsreader::PacketToFileWriter>("write_per_header", config, packets, dir);
+    run_writer<znsreader::BufferedPacketToFileWriter>("buffered_writev", config, packets, dir);
+    run_store(packets, dir);
+
+    std::filesystem::remove_all(dir);
+    return 0;
+}
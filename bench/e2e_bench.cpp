@@ -0,0 +1,229 @@
+// End to end loopback multicast through the subscription manager: sockets joined to real
+// groups, the pinned writer thread, the ring and the pinned reader thread, as the feed runs.
+// The runtime chain is SubscriptionManager's own, AggregatedPacketReader with a record
+// callback; the static chain is the one main resolves at compile time. The sender loops its
+// multicast back with TTL 0, nothing leaves the host. A flood run gives packets per second,
+// a paced run gives send to handler latency. BasicSubscriptionManager pins to cores 0 and 1,
+// so the bench needs two cpus. Pass the flood packets and the paced packets.
+
+#include "bench_util.hpp"
+#include "nsereader.hpp"
+#include "nsetypes.hpp"
+#include "ringrecord.hpp"
+#include "udpreader.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+constexpr std::size_t PACKET_SIZE = 64;
+constexpr short STREAM_COUNT = 8;
+constexpr uint16_t BASE_PORT = 31700;
+// Lines join 239.255.70.n and 239.255.71.n.
+constexpr int GROUP_OCTET = 70;
+
+// Counts records and, when timed, keeps the latency of each from the stamp after its
+// StreamHeader. Only the reader thread calls it.
+struct E2eSink {
+    std::atomic<uint64_t> received{ 0 };
+    std::vector<int64_t> latency_ns;
+
+    std::size_t consume(znsreader::RingRecordRange records)
+    {
+        const int64_t now = latency_ns.capacity() != 0 ? znsreader::realtime_ns() : 0;
+        uint64_t count = 0;
+
+        for (const znsreader::RingRecord record : records) {
+            if (now != 0 && record.payload_len() >= sizeof(StreamHeader) + sizeof(int64_t)
+                && latency_ns.size() < latency_ns.capacity()) {
+                int64_t sent_ns;
+                ::memcpy(&sent_ns, record.payload() + sizeof(StreamHeader), sizeof(sent_ns));
+                latency_ns.push_back(now - sent_ns);
+            }
+            count++;
+        }
+
+        received.store(received.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+        return records.size_bytes();
+    }
+};
+
+struct SinkHandler {
+    E2eSink *sink;
+
+    std::size_t operator()(znsreader::RingRecordRange records)
+    {
+        return sink->consume(records);
+    }
+};
+
+using RuntimeFeed = znsreader::BasicSubscriptionManager<znsreader::AggregatedPacketReader>;
+using StaticFeed = znsreader::BasicSubscriptionManager<
+    znsreader::BasicAggregatedPacketReader<znsreader::RecordRecvWriter<16>, znsreader::RingRecordReader<SinkHandler>>>;
+
+// Round robin over both lines of every stream. interval 0 floods in sendmmsg bursts, else one
+// packet per interval stamped as it goes out.
+void send_multicast(std::size_t packets, std::chrono::nanoseconds interval)
+{
+    int fd = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    unsigned char ttl = 0;
+    unsigned char loop = 1;
+    ::setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    ::setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+
+    std::vector<struct sockaddr_in> addrs;
+    for (short stream_id = 1; stream_id <= STREAM_COUNT; stream_id++) {
+        for (int line = 0; line < 2; line++) {
+            struct sockaddr_in addr;
+            std::memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = inet_addr(znsbench::multicast_group(GROUP_OCTET + line, stream_id).c_str());
+            addr.sin_port = htons(BASE_PORT + (stream_id - 1) * 2 + line);
+            addrs.push_back(addr);
+        }
+    }
+
+    unsigned char payloads[ZNS_MAX_RECV_BATCH][PACKET_SIZE];
+    struct mmsghdr msgs[ZNS_MAX_RECV_BATCH];
+    struct iovec iovecs[ZNS_MAX_RECV_BATCH];
+    const unsigned int batch = (interval.count() == 0) ? ZNS_MAX_RECV_BATCH : 1;
+    auto next = std::chrono::steady_clock::now();
+
+    std::size_t sent = 0;
+    while (sent < packets) {
+        const unsigned int burst = std::min<std::size_t>(batch, packets - sent);
+        const int64_t now_ns = znsreader::realtime_ns();
+
+        for (unsigned int i = 0; i < burst; i++) {
+            const std::size_t n = sent + i;
+            StreamHeader hdr;
+            hdr.msgLen = PACKET_SIZE;
+            hdr.streamId = 1 + (n / 2) % STREAM_COUNT;
+            hdr.seqNo = (int)(n / (STREAM_COUNT * 2)) + 1;
+            std::memset(payloads[i], 'N', PACKET_SIZE);
+            std::memcpy(payloads[i], &hdr, sizeof(hdr));
+            std::memcpy(payloads[i] + sizeof(hdr), &now_ns, sizeof(now_ns));
+
+            iovecs[i].iov_base = payloads[i];
+            iovecs[i].iov_len = PACKET_SIZE;
+            std::memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_name = (void *)&addrs[n % addrs.size()];
+            msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        const int ret = ::sendmmsg(fd, msgs, burst, 0);
+        if (ret > 0) {
+            sent += ret;
+        }
+
+        if (interval.count() != 0) {
+            next += interval;
+            while (std::chrono::steady_clock::now() < next) {
+            }
+        }
+    }
+
+    ::close(fd);
+}
+
+template <typename Feed, typename... FeedArgs>
+void run_case(const char *chain, const char *mode, std::size_t packets, std::chrono::nanoseconds interval,
+              E2eSink &sink, FeedArgs &&...feed_args)
+{
+    double wall_sec = 0;
+    {
+        Feed feed(std::forward<FeedArgs>(feed_args)...);
+
+        const double start = znsbench::wall_seconds();
+        std::thread sender(send_multicast, packets, interval);
+        if (std::thread::hardware_concurrency() > 2) {
+            znsreader::zns_set_thread_affinity(sender, 2);
+        }
+        sender.join();
+
+        // Done once nothing more arrives for 100ms.
+        uint64_t last = sink.received.load(std::memory_order_relaxed);
+        for (;;) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            const uint64_t now = sink.received.load(std::memory_order_relaxed);
+            if (now == last) {
+                break;
+            }
+            last = now;
+        }
+        wall_sec = znsbench::wall_seconds() - start - 0.1;
+        feed.stop();
+    }
+
+    const uint64_t received = sink.received.load(std::memory_order_relaxed);
+    znsbench::BenchResult result("e2e");
+    result.add("chain", chain)
+        .add("mode", mode)
+        .add("streams", STREAM_COUNT)
+        .add("sent", packets)
+        .add("received", received)
+        .add("wall_sec", wall_sec)
+        .add("pkts_per_sec", received / wall_sec);
+
+    if (!sink.latency_ns.empty()) {
+        std::vector<int64_t> &values = sink.latency_ns;
+        std::sort(values.begin(), values.end());
+        result.add("p50_ns", values[values.size() / 2])
+            .add("p99_ns", values[values.size() * 99 / 100])
+            .add("p999_ns", values[values.size() * 999 / 1000])
+            .add("max_ns", values.back());
+    }
+    result.print();
+}
+
+void run_chains(const char *mode, std::size_t packets, std::chrono::nanoseconds interval)
+{
+    auto config = znsbench::multicast_config(STREAM_COUNT, BASE_PORT, GROUP_OCTET);
+
+    {
+        E2eSink sink;
+        if (interval.count() != 0) {
+            sink.latency_ns.reserve(packets);
+        }
+        znsreader::AggregatedPacketReader::RecordReaderCallBack callback = [&sink](znsreader::RingRecordRange records) {
+            return sink.consume(records);
+        };
+        run_case<RuntimeFeed>("runtime", mode, packets, interval, sink, config, false, callback, 16);
+    }
+    {
+        E2eSink sink;
+        if (interval.count() != 0) {
+            sink.latency_ns.reserve(packets);
+        }
+        run_case<StaticFeed>("static", mode, packets, interval, sink, config, false,
+                             znsreader::RingRecordReader<SinkHandler>(SinkHandler{ &sink }));
+    }
+}
+}
+
+int main(int argc, char **argv)
+{
+    const std::size_t flood_packets = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : 2000000;
+    const std::size_t paced_packets = (argc > 2) ? std::strtoull(argv[2], nullptr, 10) : 100000;
+
+    if (std::thread::hardware_concurrency() < 2) {
+        znsbench::BenchResult("e2e").add("skipped", "needs two cpus").print();
+        return 0;
+    }
+
+    run_chains("flood", flood_packets, std::chrono::nanoseconds(0));
+    run_chains("paced", paced_packets, std::chrono::microseconds(10));
+
+    return 0;
+}
@@ -0,0 +1,128 @@
+// BroadcastRingBuffer throughput with 1 to N block consumers, each on its own thread, and
+// with a deliberately slow drop consumer next to them: the producer and the block
+// consumers must keep their pace while the slow one is skipped ahead. No sockets, the
+// producer copies fixed size pushes into the ring. Pass total bytes and the max consumers.
+
+#include "bench_util.hpp"
+#include "broadcastring.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace
+{
+constexpr std::size_t RING_BYTES = 64 << 20;
+constexpr std::size_t PUSH_BYTES = 8192;
+
+struct CopyWriter {
+    const unsigned char *source;
+
+    std::size_t operator()(int, unsigned char *buf, std::size_t len) const
+    {
+        ::memcpy(buf, source, len);
+        return len;
+    }
+};
+
+struct TouchReader {
+    uint64_t checksum = 0;
+    uint64_t bytes = 0;
+    uint32_t stall_us = 0;
+
+    std::size_t operator()(const unsigned char *data, std::size_t size)
+    {
+        // Touch every cache line the way a decoder would.
+        for (std::size_t i = 0; i < size; i += 64) {
+            checksum += data[i];
+        }
+        bytes += size;
+        if (stall_us != 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(stall_us));
+        }
+        return size;
+    }
+};
+
+using Consumers = std::vector<znsreader::BroadcastConsumer<TouchReader>>;
+using Ring = znsreader::BroadcastRingBuffer<CopyWriter, Consumers>;
+
+void run_case(std::size_t block_consumers, bool slow_drop_consumer, std::size_t total_bytes)
+{
+    std::vector<unsigned char> source(PUSH_BYTES, 0x5a);
+    Consumers consumers(block_consumers);
+    if (slow_drop_consumer) {
+        consumers.push_back({ TouchReader{ 0, 0, 2000 }, znsreader::SlowConsumerPolicy::drop, -1 });
+    }
+
+    Ring ring(RING_BYTES, false, CopyWriter{ source.data() }, std::move(consumers));
+    std::atomic<bool> running(true);
+    std::vector<std::thread> threads;
+
+    for (std::size_t i = 0; i < ring.consumer_count(); i++) {
+        threads.emplace_back([&ring, &running, i] {
+            while (running.load(std::memory_order_relaxed)) {
+                if (ring.pop_all(i) == 0) {
+                    std::this_thread::yield();
+                }
+            }
+            ring.pop_all(i);
+        });
+    }
+
+    uint64_t producer_stalls = 0;
+    const double start = znsbench::wall_seconds();
+    for (std::size_t pushed = 0; pushed < total_bytes; pushed += PUSH_BYTES) {
+        while (ring.push(0, PUSH_BYTES) == 0) {
+            producer_stalls++;
+            std::this_thread::yield();
+        }
+    }
+    const double produce_sec = znsbench::wall_seconds() - start;
+
+    running.store(false, std::memory_order_relaxed);
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    const double elapsed = znsbench::wall_seconds() - start;
+
+    uint64_t block_bytes = 0;
+    for (std::size_t i = 0; i < block_consumers; i++) {
+        block_bytes += ring.consumer(i).m_reader.bytes;
+    }
+
+    znsbench::BenchResult result("fanout");
+    result.add("block_consumers", block_consumers)
+        .add("slow_drop_consumer", (int)slow_drop_consumer)
+        .add("bytes", total_bytes)
+        .add("produce_sec", produce_sec)
+        .add("sec", elapsed)
+        .add("producer_gb_per_sec", total_bytes / produce_sec / 1e9)
+        .add("delivered_gb_per_sec", block_bytes / elapsed / 1e9)
+        .add("producer_stalls", producer_stalls)
+        .add("block_bytes_each", block_consumers ? block_bytes / block_consumers : 0);
+    if (slow_drop_consumer) {
+        const std::size_t drop = block_consumers;
+        result.add("drop_read_bytes", ring.consumer(drop).m_reader.bytes)
+            .add("drop_skipped_bytes", ring.dropped_bytes(drop))
+            .add("drop_overruns", ring.overruns(drop));
+    }
+    result.print();
+}
+}
+
+int main(int argc, char **argv)
+{
+    const std::size_t total_bytes = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : (2ull << 30);
+    const std::size_t max_consumers = (argc > 2) ? std::strtoull(argv[2], nullptr, 10) : 4;
+
+    for (std::size_t consumers = 1; consumers <= max_consumers; consumers *= 2) {
+        run_case(consumers, false, total_bytes);
+        run_case(consumers, true, total_bytes);
+    }
+
+    return 0;
+}
@@ -0,0 +1,142 @@
+// Synthetic feed generator. First its own ceiling: an unpaced run over sixteen streams with
+// no one listening, packets per second built and sent on both lines. Then a paced run with
+// every fault switched on into a loopback reader, the per line feed counters set against what
+// the generator injected. A reordered packet shows up as a missing seqNo and later as a
+// duplicate, so it counts towards both. Pass the unpaced packets, the paced packets and the
+// paced rate.
+
+#include "bench_util.hpp"
+#include "feedgenerator.hpp"
+#include "ringrecord.hpp"
+#include "udpreader.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+
+namespace
+{
+constexpr short STREAM_COUNT = 16;
+constexpr uint16_t BASE_PORT = 31800;
+// Lines join 239.255.72.n and 239.255.73.n.
+constexpr int GROUP_OCTET = 72;
+
+void bench_unpaced(uint64_t packets)
+{
+    znsreader::FeedModel model;
+    znsreader::SyntheticFeedGenerator generator(znsbench::multicast_config(STREAM_COUNT, BASE_PORT, GROUP_OCTET), model);
+    const znsreader::GeneratorStats stats = generator.run(0, packets);
+
+    znsbench::BenchResult("feedgen")
+        .add("case", "unpaced")
+        .add("streams", STREAM_COUNT)
+        .add("packets", stats.packets)
+        .add("datagrams", stats.datagrams)
+        .add("sec", stats.elapsed_sec)
+        .add("ns_per_packet", stats.elapsed_sec * 1e9 / stats.packets)
+        .add("pkts_per_sec", stats.achieved_pps)
+        .add("new", stats.by_type['N'])
+        .add("modify", stats.by_type['M'])
+        .add("cancel", stats.by_type['X'])
+        .add("trade", stats.by_type['T'])
+        .add("spread", stats.by_type['G'] + stats.by_type['H'] + stats.by_type['J'] + stats.by_type['K'])
+        .print();
+}
+
+struct CountHandler {
+    uint64_t *records;
+
+    std::size_t operator()(znsreader::RingRecordRange records)
+    {
+        for (const znsreader::RingRecord record : records) {
+            (void)record;
+            (*this->records)++;
+        }
+        return records.size_bytes();
+    }
+};
+
+using LoopbackReader =
+    znsreader::BasicAggregatedPacketReader<znsreader::RecordRecvWriter<1>, znsreader::RingRecordReader<CountHandler>>;
+
+void bench_faults(uint64_t packets, double rate_pps)
+{
+    constexpr short streams = 4;
+    const auto config = znsbench::multicast_config(streams, BASE_PORT, GROUP_OCTET);
+
+    znsreader::FeedModel model;
+    model.heartbeat_ms = 100;
+    znsreader::FeedFaults faults;
+    faults.gap = 0.01;
+    faults.duplicate = 0.005;
+    faults.reorder = 0.002;
+    faults.reorder_depth = 3;
+    faults.ab_skew_us = 50;
+
+    uint64_t records = 0;
+    LoopbackReader reader(
+        config, false, [](const znsreader::MulticastSocketSet &sockets) { return znsreader::RecordRecvWriter<1>(sockets); },
+        znsreader::RingRecordReader<CountHandler>(CountHandler{ &records }), 16 * 1024 * 1024);
+
+    std::thread writer(&LoopbackReader::write_packets_to_ringbuf, &reader);
+    std::thread consumer(&LoopbackReader::read_packets_from_ringbuf, &reader);
+
+    znsreader::SyntheticFeedGenerator generator(config, model, faults, 7);
+    const znsreader::GeneratorStats stats = generator.run(rate_pps, packets);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    reader.stop();
+    writer.join();
+    consumer.join();
+    reader.drain_ringbuf();
+
+    znsbench::BenchResult("feedgen")
+        .add("case", "faults")
+        .add("streams", streams)
+        .add("target_pps", stats.target_pps)
+        .add("achieved_pps", stats.achieved_pps)
+        .add("packets", stats.packets)
+        .add("heartbeats", stats.heartbeats)
+        .add("datagrams", stats.datagrams)
+        .add("records", records)
+        .add("lost_both_lines", stats.lost)
+        .print();
+
+    uint64_t missing[2] = { 0, 0 };
+    uint64_t duplicates[2] = { 0, 0 };
+    uint64_t drops[2] = { 0, 0 };
+    for (const int fd : reader.sockets()) {
+        const int line = (reader.source(fd).m_line == znsreader::FeedLine::primary) ? 0 : 1;
+        const znsreader::SocketCounters &counters = reader.socket_counters(fd);
+        missing[line] += counters.seq_missing.load();
+        duplicates[line] += counters.duplicates.load();
+        drops[line] += counters.kernel_drops.load();
+    }
+
+    for (int line = 0; line < 2; line++) {
+        znsbench::BenchResult("feedgen")
+            .add("case", "faults_line")
+            .add("line", (line == 0) ? "primary" : "secondary")
+            .add("injected_gaps", stats.gaps[line])
+            .add("injected_duplicates", stats.duplicates[line])
+            .add("injected_reorders", stats.reordered[line])
+            .add("seq_missing", missing[line])
+            .add("expected_missing", stats.gaps[line] + stats.reordered[line])
+            .add("duplicates", duplicates[line])
+            .add("expected_duplicates", stats.duplicates[line] + stats.reordered[line])
+            .add("kernel_drops", drops[line])
+            .print();
+    }
+}
+}
+
+int main(int argc, char **argv)
+{
+    const uint64_t unpaced_packets = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : 2000000;
+    const uint64_t paced_packets = (argc > 2) ? std::strtoull(argv[2], nullptr, 10) : 200000;
+    const double paced_rate = (argc > 3) ? std::atof(argv[3]) : 100000;
+
+    bench_unpaced(unpaced_packets);
+    bench_faults(paced_packets, paced_rate);
+
+    return 0;
+}
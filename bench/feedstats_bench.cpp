@@ -0,0 +1,233 @@
+// Cost and accuracy of the feed counters. First the hot path: ns per count_datagram, the
+// counting every received datagram now goes through. Then ns per FeedStatsPublisher snapshot
+// and per FeedStatsReader read of the page. Last a loopback feed with a known number of
+// skipped and repeated seqNos on every primary line, counted through the receive path and
+// read back from the shared page as feed_stats would. Pass the datagram count and the
+// loopback packet count per line.
+
+#include "bench_util.hpp"
+#include "feedstats.hpp"
+#include "nsetypes.hpp"
+#include "ringrecord.hpp"
+#include "udpreader.hpp"
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <netinet/in.h>
+#include <numeric>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+namespace
+{
+constexpr std::size_t PAYLOAD_SIZE = 64;
+constexpr short STREAM_COUNT = 4;
+// Every primary line skips each GAP_EVERY-th seqNo and sends each other DUP_EVERY-th twice.
+constexpr uint32_t GAP_EVERY = 100;
+constexpr uint32_t DUP_EVERY = 250;
+
+void fill_packet(unsigned char *payload, short stream_id, uint32_t seq)
+{
+    StreamHeader hdr;
+    hdr.msgLen = PAYLOAD_SIZE;
+    hdr.streamId = stream_id;
+    hdr.seqNo = (int)seq;
+    std::memset(payload, 'N', PAYLOAD_SIZE);
+    std::memcpy(payload, &hdr, sizeof(hdr));
+}
+
+void bench_count(std::size_t count, uint16_t base_port)
+{
+    znsreader::MulticastSocketSet sockets(znsbench::loopback_config(STREAM_COUNT, base_port));
+    const int fd = sockets.sockets().front();
+    unsigned char payload[PAYLOAD_SIZE];
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    fill_packet(payload, 1, 1);
+
+    const double start = znsbench::wall_seconds();
+    for (std::size_t i = 0; i < count; i++) {
+        // Write the seqNo in place, as a new datagram would arrive.
+        const int seq = (int)i + 1;
+        std::memcpy(payload + offsetof(StreamHeader, seqNo), &seq, sizeof(seq));
+        sockets.count_datagram(fd, payload, sizeof(payload), &msg);
+    }
+    const double elapsed = znsbench::wall_seconds() - start;
+
+    const znsreader::SocketCounters &counters = sockets.socket_counters(fd);
+    znsbench::BenchResult("feedstats")
+        .add("case", "count_datagram")
+        .add("datagrams", count)
+        .add("ns_per_datagram", elapsed * 1e9 / count)
+        .add("packets", counters.packets.load())
+        .add("seq_gaps", counters.seq_gaps.load())
+        .print();
+}
+
+void bench_snapshot(uint16_t base_port)
+{
+    constexpr std::size_t rounds = 20000;
+    znsreader::MulticastSocketSet sockets(znsbench::loopback_config(STREAM_COUNT, base_port));
+    znsreader::RingCounters ring;
+    // Long interval, only the snapshots taken here.
+    znsreader::FeedStatsPublisher publisher("zns_feedstats_bench_snapshot", std::chrono::milliseconds(60000));
+    publisher.add_source(sockets, &ring);
+    znsreader::FeedStatsReader reader("zns_feedstats_bench_snapshot");
+    auto data = std::make_unique<znsreader::FeedStatsData>();
+
+    double start = znsbench::wall_seconds();
+    for (std::size_t i = 0; i < rounds; i++) {
+        publisher.publish_now();
+    }
+    const double publish_sec = znsbench::wall_seconds() - start;
+
+    std::size_t complete = 0;
+    start = znsbench::wall_seconds();
+    for (std::size_t i = 0; i < rounds; i++) {
+        complete += reader.read(*data);
+    }
+    const double read_sec = znsbench::wall_seconds() - start;
+
+    znsbench::BenchResult("feedstats")
+        .add("case", "snapshot")
+        .add("lines", data->line_count)
+        .add("publish_ns", publish_sec * 1e9 / rounds)
+        .add("read_ns", read_sec * 1e9 / rounds)
+        .add("complete_reads", complete)
+        .print();
+}
+
+struct CountHandler {
+    uint64_t *records;
+
+    std::size_t operator()(znsreader::RingRecordRange records)
+    {
+        for (const znsreader::RingRecord record : records) {
+            (void)record;
+            (*this->records)++;
+        }
+        return records.size_bytes();
+    }
+};
+
+using LoopbackReader =
+    znsreader::BasicAggregatedPacketReader<znsreader::RecordRecvWriter<1>, znsreader::RingRecordReader<CountHandler>>;
+
+// Primary then secondary of every stream in turn, paced so the socket queues never drop.
+void send_lines(uint16_t base_port, uint32_t packets)
+{
+    int fd = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    unsigned char payload[PAYLOAD_SIZE];
+
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    auto send_to = [&](uint16_t port) {
+        addr.sin_port = htons(port);
+        ::sendto(fd, payload, sizeof(payload), 0, (struct sockaddr *)&addr, sizeof(addr));
+    };
+
+    for (uint32_t seq = 1; seq <= packets; seq++) {
+        for (short stream_id = 1; stream_id <= STREAM_COUNT; stream_id++) {
+            const uint16_t port = base_port + (stream_id - 1) * 2;
+            fill_packet(payload, stream_id, seq);
+
+            if (seq % GAP_EVERY != 0) {
+                send_to(port);
+                if (seq % DUP_EVERY == 0) {
+                    send_to(port);
+                }
+            }
+            send_to(port + 1);
+        }
+        if (seq % 64 == 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    }
+
+    ::close(fd);
+}
+
+void bench_loopback(uint32_t packets, uint16_t base_port)
+{
+    uint64_t records = 0;
+    LoopbackReader reader(
+        znsbench::loopback_config(STREAM_COUNT, base_port), false,
+        [](const znsreader::MulticastSocketSet &sockets) { return znsreader::RecordRecvWriter<1>(sockets); },
+        znsreader::RingRecordReader<CountHandler>(CountHandler{ &records }), 1024 * 1024);
+    auto data = std::make_unique<znsreader::FeedStatsData>();
+
+    {
+        znsreader::FeedStatsPublisher publisher("zns_feedstats_bench", std::chrono::milliseconds(100));
+        publisher.add_reader(reader);
+
+        std::thread writer(&LoopbackReader::write_packets_to_ringbuf, &reader);
+        std::thread consumer(&LoopbackReader::read_packets_from_ringbuf, &reader);
+        const double start = znsbench::wall_seconds();
+        std::thread sender(send_lines, base_port, packets);
+        sender.join();
+        const double send_sec = znsbench::wall_seconds() - start;
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        reader.stop();
+        writer.join();
+        consumer.join();
+        reader.drain_ringbuf();
+
+        publisher.publish_now();
+        znsreader::FeedStatsReader stats("zns_feedstats_bench");
+        if (!stats.read(*data)) {
+            fprintf(stderr, "No complete feed stats snapshot\n");
+            return;
+        }
+
+        znsbench::BenchResult("feedstats")
+            .add("case", "loopback")
+            .add("records", records)
+            .add("send_sec", send_sec)
+            .add("ring_capacity", data->rings[0].capacity)
+            .add("ring_high_watermark", data->rings[0].high_watermark)
+            .add("ring_full_stalls", data->rings[0].full_stalls)
+            .print();
+    }
+
+    // A skipped last seqNo is never followed by anything that shows the gap.
+    const uint64_t expected_gaps = (packets - 1) / GAP_EVERY;
+    const uint64_t expected_dups = (packets / DUP_EVERY) - (packets / std::lcm(GAP_EVERY, DUP_EVERY));
+    for (uint32_t i = 0; i < data->line_count; i++) {
+        const znsreader::FeedLineStats &line = data->lines[i];
+        const bool primary = line.line == znsreader::FeedLine::primary;
+
+        znsbench::BenchResult("feedstats")
+            .add("case", "loopback_line")
+            .add("stream", line.stream_id)
+            .add("line", primary ? "primary" : "secondary")
+            .add("packets", line.packets)
+            .add("kernel_drops", line.kernel_drops)
+            .add("seq_gaps", line.seq_gaps)
+            .add("expected_gaps", primary ? expected_gaps : 0)
+            .add("seq_missing", line.seq_missing)
+            .add("duplicates", line.duplicates)
+            .add("expected_duplicates", primary ? expected_dups : 0)
+            .add("last_seq", line.last_seq)
+            .print();
+    }
+}
+}
+
+int main(int argc, char **argv)
+{
+    const std::size_t datagrams = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : (1 << 24);
+    const uint32_t packets = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 20001;
+
+    bench_count(datagrams, 31300);
+    bench_snapshot(31310);
+    bench_loopback(packets, 31320);
+
+    return 0;
+}
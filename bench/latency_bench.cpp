@@ -0,0 +1,105 @@
+// Send to handler latency of the blocking, spin and hybrid receive modes on loopback UDP.
+// The sender stamps CLOCK_REALTIME into every packet and the handler subtracts it from
+// its own clock. Kernel to handler latency comes from the SO_TIMESTAMPNS record stamp.
+
+#include "bench_util.hpp"
+#include "ringrecord.hpp"
+#include "udpreader.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace
+{
+constexpr std::size_t PACKET_SIZE = 64;
+constexpr short STREAM_COUNT = 4;
+
+struct LatencyRecorder {
+    std::vector<int64_t> *m_samples;
+    std::vector<int64_t> *m_kernel_samples;
+
+    std::size_t operator()(znsreader::RingRecordRange records)
+    {
+        const int64_t now_ns = znsreader::realtime_ns();
+        for (const znsreader::RingRecord record : records) {
+            int64_t sent_ns;
+            ::memcpy(&sent_ns, record.payload(), sizeof(sent_ns));
+            m_samples->push_back(now_ns - sent_ns);
+            m_kernel_samples->push_back(now_ns - record.header().recv_timestamp_ns);
+        }
+        return records.size_bytes();
+    }
+};
+
+using LatencyReader = znsreader::BasicAggregatedPacketReader<znsreader::RecordRecvWriter<1>,
+                                                             znsreader::RingRecordReader<LatencyRecorder>>;
+
+void run_mode(const char *name, const znsreader::ReceivePolicy &policy, std::size_t packets,
+              std::chrono::microseconds interval, uint16_t base_port)
+{
+    std::vector<int64_t> samples;
+    std::vector<int64_t> kernel_samples;
+    samples.reserve(packets);
+    kernel_samples.reserve(packets);
+
+    double writer_cpu_sec = 0;
+    {
+        LatencyReader reader(znsbench::loopback_config(STREAM_COUNT, base_port), false,
+                             znsreader::RingRecordReader<LatencyRecorder>(LatencyRecorder{ &samples, &kernel_samples }),
+                             16 * 1024 * 1024, policy);
+
+        std::thread writer([&reader, &writer_cpu_sec]() {
+            const double cpu_start = znsbench::thread_cpu_seconds();
+            reader.write_packets_to_ringbuf();
+            writer_cpu_sec = znsbench::thread_cpu_seconds() - cpu_start;
+        });
+        std::thread consumer(&LatencyReader::read_packets_from_ringbuf, &reader);
+        // One packet per interval, the sender sleeps in between so a spinning receiver on the
+        // same core still gets the CPU.
+        std::thread sender(znsbench::send_packets, base_port, STREAM_COUNT * 2, packets, PACKET_SIZE, interval);
+        sender.join();
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        reader.stop();
+        writer.join();
+        consumer.join();
+        reader.drain_ringbuf();
+    }
+
+    std::sort(samples.begin(), samples.end());
+    std::sort(kernel_samples.begin(), kernel_samples.end());
+    znsbench::BenchResult("latency")
+        .add("mode", name)
+        .add("spin_us", policy.m_spin_us)
+        .add("busy_poll_us", policy.m_busy_poll_us)
+        .add("sent", packets)
+        .add("received", samples.size())
+        .add("p50_ns", znsbench::percentile(samples, 0.50))
+        .add("p99_ns", znsbench::percentile(samples, 0.99))
+        .add("p999_ns", znsbench::percentile(samples, 0.999))
+        .add("max_ns", samples.empty() ? 0 : samples.back())
+        .add("kernel_p50_ns", znsbench::percentile(kernel_samples, 0.50))
+        .add("kernel_p99_ns", znsbench::percentile(kernel_samples, 0.99))
+        .add("writer_cpu_sec", writer_cpu_sec)
+        .print();
+}
+}
+
+int main(int argc, char **argv)
+{
+    const std::size_t packets = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : 20000;
+    const auto interval = std::chrono::microseconds((argc > 2) ? std::atoi(argv[2]) : 100);
+    const uint16_t base_port = (argc > 3) ? std::atoi(argv[3]) : 31000;
+
+    using znsreader::ReceiveMode;
+    run_mode("blocking", { ReceiveMode::blocking, 0, 0, false }, packets, interval, base_port);
+    run_mode("blocking_busy_poll", { ReceiveMode::blocking, 0, 50, true }, packets, interval, base_port);
+    run_mode("spin", { ReceiveMode::spin, 0, 0, false }, packets, interval, base_port);
+    run_mode("hybrid", { ReceiveMode::hybrid, 50, 0, false }, packets, interval, base_port);
+    run_mode("hybrid_long", { ReceiveMode::hybrid, 500, 0, false }, packets, interval, base_port);
+
+    return 0;
+}
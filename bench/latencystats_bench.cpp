@@ -0,0 +1,196 @@
+// Cost and accuracy of the per stream latency histograms. First the hot path: ns per
+// LatencyHistogram::record, and ns per record a TimedRecordReader adds over the bare reader
+// on records already in memory. Then the histogram percentiles against exact ones of the same
+// samples. Last a loopback UDP feed through TimedRecordWriter and TimedRecordReader with a
+// LatencyExporter writing every 100ms, printing each stage's percentiles over every stream.
+// Pass the record count, the loopback packet count and the export file.
+
+#include "bench_util.hpp"
+#include "latencystats.hpp"
+#include "ringrecord.hpp"
+#include "udpreader.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace
+{
+constexpr std::size_t PAYLOAD_SIZE = 64;
+constexpr std::size_t RECORDS_PER_PUSH = 16;
+constexpr short STREAM_COUNT = 4;
+
+struct SumHandler {
+    uint64_t *sum;
+
+    std::size_t operator()(znsreader::RingRecordRange records)
+    {
+        for (const znsreader::RingRecord record : records) {
+            *sum += record.payload()[0] + record.header().stream_id;
+        }
+        return records.size_bytes();
+    }
+};
+
+using PlainReader = znsreader::RingRecordReader<SumHandler>;
+using TimedReader = znsreader::TimedRecordReader<PlainReader>;
+
+std::vector<int64_t> lognormal_ns(std::size_t count)
+{
+    std::mt19937_64 rng(7);
+    std::lognormal_distribution<double> dist(std::log(2000.0), 1.0);
+    std::vector<int64_t> values(count);
+
+    for (auto &value : values) {
+        value = (int64_t)dist(rng);
+    }
+    return values;
+}
+
+void bench_record(std::size_t count)
+{
+    const std::vector<int64_t> values = lognormal_ns(count);
+    znsreader::LatencyHistogram histogram;
+
+    const double start = znsbench::wall_seconds();
+    for (int64_t value : values) {
+        histogram.record(value);
+    }
+    const double elapsed = znsbench::wall_seconds() - start;
+
+    std::vector<int64_t> sorted(values);
+    std::sort(sorted.begin(), sorted.end());
+    znsreader::LatencyHistogram::counts_type counts;
+    histogram.snapshot(counts);
+
+    znsbench::BenchResult result("latencystats");
+    result.add("case", "histogram_record").add("values", count).add("ns_per_record", elapsed * 1e9 / count);
+    const std::pair<const char *, double> fractions[] = { { "p50", 0.5 }, { "p99", 0.99 }, { "p999", 0.999 } };
+    for (const auto &[name, fraction] : fractions) {
+        const int64_t exact = sorted[std::min(sorted.size() - 1, (std::size_t)(fraction * sorted.size()))];
+        const int64_t binned = znsreader::LatencyHistogram::percentile(counts, count, fraction);
+        result.add(std::string(name) + "_exact_ns", exact).add(std::string(name) + "_hist_ns", binned);
+    }
+    result.print();
+}
+
+void bench_reader(std::size_t count)
+{
+    const std::size_t record_size = znsreader::ring_record_size(PAYLOAD_SIZE);
+    const std::size_t push_bytes = record_size * RECORDS_PER_PUSH;
+    std::vector<unsigned char> records(record_size * count, 0);
+
+    for (std::size_t i = 0; i < count; i++) {
+        znsreader::RingRecordHeader hdr{};
+        hdr.length = PAYLOAD_SIZE;
+        hdr.stream_id = 1 + (i % STREAM_COUNT);
+        hdr.recv_timestamp_ns = znsreader::realtime_ns();
+        ::memcpy(records.data() + (i * record_size), &hdr, sizeof(hdr));
+    }
+
+    uint64_t checksum = 0;
+    PlainReader plain(SumHandler{ &checksum });
+    double start = znsbench::wall_seconds();
+    for (std::size_t offset = 0; offset < records.size(); offset += push_bytes) {
+        plain(records.data() + offset, std::min(push_bytes, records.size() - offset));
+    }
+    const double plain_sec = znsbench::wall_seconds() - start;
+
+    // Stamps are queued as the writer would, a push at a time, just ahead of the read.
+    znsreader::LatencyRecorder recorder;
+    TimedReader timed(PlainReader(SumHandler{ &checksum }), recorder);
+    start = znsbench::wall_seconds();
+    for (std::size_t offset = 0; offset < records.size(); offset += push_bytes) {
+        const std::size_t size = std::min(push_bytes, records.size() - offset);
+        recorder.stamp_push({ offset, offset + size, znsreader::TscClock::ticks(), znsreader::realtime_ns() });
+        timed(records.data() + offset, size);
+    }
+    const double timed_sec = znsbench::wall_seconds() - start;
+
+    znsbench::BenchResult("latencystats")
+        .add("case", "timed_reader")
+        .add("records", count)
+        .add("plain_ns_per_record", plain_sec * 1e9 / count)
+        .add("timed_ns_per_record", timed_sec * 1e9 / count)
+        .add("added_ns_per_record", (timed_sec - plain_sec) * 1e9 / count)
+        .add("unstamped", recorder.unstamped())
+        .add("checksum", checksum)
+        .print();
+}
+
+using LoopbackReader =
+    znsreader::BasicAggregatedPacketReader<znsreader::TimedRecordWriter<znsreader::RecordRecvWriter<1>>, TimedReader>;
+
+void bench_loopback(std::size_t packets, const std::string &export_file, uint16_t base_port)
+{
+    znsreader::LatencyRecorder recorder;
+    uint64_t checksum = 0;
+    {
+        znsreader::LatencyExporter exporter(recorder, export_file, std::chrono::milliseconds(100));
+        LoopbackReader reader(
+            znsbench::loopback_config(STREAM_COUNT, base_port), false,
+            [&recorder](const znsreader::MulticastSocketSet &sockets) {
+                return znsreader::TimedRecordWriter<znsreader::RecordRecvWriter<1>>(
+                    znsreader::RecordRecvWriter<1>(sockets), recorder);
+            },
+            TimedReader(PlainReader(SumHandler{ &checksum }), recorder), 16 * 1024 * 1024);
+
+        std::thread writer(&LoopbackReader::write_packets_to_ringbuf, &reader);
+        std::thread consumer(&LoopbackReader::read_packets_from_ringbuf, &reader);
+        std::thread sender(znsbench::send_packets, base_port, STREAM_COUNT * 2, packets, PAYLOAD_SIZE,
+                           std::chrono::microseconds(100));
+        sender.join();
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        reader.stop();
+        writer.join();
+        consumer.join();
+        reader.drain_ringbuf();
+    }
+
+    for (std::size_t stage = 0; stage < znsreader::ZNS_LATENCY_STAGES; stage++) {
+        znsreader::LatencyHistogram::counts_type all{};
+        znsreader::LatencyHistogram::counts_type counts;
+        uint64_t total = 0;
+
+        for (std::size_t slot = 0; slot < ZNS_LATENCY_MAX_STREAMS; slot++) {
+            recorder.histogram((znsreader::LatencyStage)stage, slot).snapshot(counts);
+            for (std::size_t i = 0; i < counts.size(); i++) {
+                all[i] += counts[i];
+                total += counts[i];
+            }
+        }
+
+        znsbench::BenchResult("latencystats")
+            .add("case", "loopback")
+            .add("stage", znsreader::latency_stage_name((znsreader::LatencyStage)stage))
+            .add("sent", packets)
+            .add("records", total)
+            .add("p50_ns", znsreader::LatencyHistogram::percentile(all, total, 0.5))
+            .add("p99_ns", znsreader::LatencyHistogram::percentile(all, total, 0.99))
+            .add("p999_ns", znsreader::LatencyHistogram::percentile(all, total, 0.999))
+            .add("max_ns", znsreader::LatencyHistogram::percentile(all, total, 1.0))
+            .add("unstamped", recorder.unstamped())
+            .print();
+    }
+}
+}
+
+int main(int argc, char **argv)
+{
+    const std::size_t records = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : (1 << 22);
+    const std::size_t packets = (argc > 2) ? std::strtoull(argv[2], nullptr, 10) : 20000;
+    const std::string export_file = (argc > 3) ? argv[3] : "/tmp/zns_latencystats_bench.jsonl";
+
+    bench_record(records);
+    bench_reader(records);
+    bench_loopback(packets, export_file, 31200);
+
+    return 0;
+}
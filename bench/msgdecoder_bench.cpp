@@ -0,0 +1,186 @@
+// Message decode throughput over back to back StreamPackets held in memory, a mix of
+// orders, trades, spread messages and heartbeats. decode_packets with a handler for every
+// kind, with an orders only handler that lets the rest compile away, and a switch that
+// copies each packet into a local StreamPacket before reading it, as a decoder that
+// realigns its input would. Pass the buffer size in MB and the passes over it.
+
+#include "bench_util.hpp"
+#include "msgdecoder.hpp"
+#include "nsetypes.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+template <typename Body>
+void append_packet(std::vector<unsigned char> &buf, nseMsgType type, int seq_no)
+{
+    const std::size_t offset = buf.size();
+    buf.resize(offset + znsreader::message_size<Body>());
+
+    StreamPacket *stream_packet = (StreamPacket *)(buf.data() + offset);
+    stream_packet->streamHdr.msgLen = znsreader::message_size<Body>();
+    stream_packet->streamHdr.streamId = 1;
+    stream_packet->streamHdr.seqNo = seq_no;
+    stream_packet->streamData.cMsgType = type;
+}
+
+// 100 message cycle: 70 orders, 20 trades, 4 spread orders, 1 spread trade, 5 heartbeats.
+std::vector<unsigned char> build_feed(std::size_t target_bytes, uint64_t &messages)
+{
+    static const nseMsgType order_types[] = { newOrderMsg, modOrderMsg, cancelOrderMsg };
+    std::vector<unsigned char> buf;
+    buf.reserve(target_bytes + 64);
+    messages = 0;
+
+    while (buf.size() < target_bytes) {
+        const int seq_no = messages + 1;
+        const int slot = messages % 100;
+        if (slot < 70) {
+            append_packet<OrderData>(buf, order_types[slot % 3], seq_no);
+            ((OrderData *)(buf.data() + buf.size() - sizeof(OrderData)))->quantity = slot;
+        } else if (slot < 90) {
+            append_packet<TradeData>(buf, tradeMesg, seq_no);
+            ((TradeData *)(buf.data() + buf.size() - sizeof(TradeData)))->quantity = slot;
+        } else if (slot < 94) {
+            append_packet<SpreadOrderData>(buf, newSpreadOrderMsg, seq_no);
+        } else if (slot < 95) {
+            append_packet<SpreadTradeData>(buf, spreadTradeMsg, seq_no);
+        } else {
+            append_packet<HeartBeatData>(buf, heartBeatMsg, seq_no);
+        }
+        messages++;
+    }
+
+    return buf;
+}
+
+struct FullHandler {
+    uint64_t sum = 0;
+
+    void on_message(const znsreader::OrderMessage &message)
+    {
+        sum += message.order.quantity + message.type;
+    }
+
+    void on_message(const znsreader::TradeMessage &message)
+    {
+        sum += message.trade.quantity;
+    }
+
+    void on_message(const znsreader::SpreadOrderMessage &message)
+    {
+        sum += message.header.seqNo;
+    }
+
+    void on_message(const znsreader::SpreadTradeMessage &message)
+    {
+        sum += message.header.seqNo;
+    }
+
+    void on_message(const znsreader::HeartbeatMessage &message)
+    {
+        sum += message.header.seqNo;
+    }
+};
+
+struct OrdersOnlyHandler {
+    uint64_t sum = 0;
+
+    void on_message(const znsreader::OrderMessage &message)
+    {
+        sum += message.order.quantity + message.type;
+    }
+};
+
+// Reads the same fields as FullHandler from a copy of each packet.
+struct CopySwitch {
+    uint64_t sum = 0;
+
+    std::size_t operator()(const unsigned char *buf, std::size_t buf_len)
+    {
+        std::size_t offset = 0;
+        while (offset + sizeof(StreamHeader) <= buf_len) {
+            const short msg_len = ((const StreamHeader *)(buf + offset))->msgLen;
+            if (msg_len < (short)sizeof(StreamHeader) || offset + msg_len > buf_len) {
+                break;
+            }
+
+            StreamPacket packet;
+            std::memcpy(&packet, buf + offset, std::min<std::size_t>(msg_len, sizeof(packet)));
+            switch (packet.streamData.cMsgType) {
+            case newOrderMsg:
+            case modOrderMsg:
+            case cancelOrderMsg:
+                sum += packet.streamData.p.orderData.quantity + packet.streamData.cMsgType;
+                break;
+            case tradeMesg:
+                sum += packet.streamData.p.tradeData.quantity;
+                break;
+            case newSpreadOrderMsg:
+            case modSpreadOrderMsg:
+            case cancelSpreadOrderMsg:
+            case spreadTradeMsg:
+            case heartBeatMsg:
+                sum += packet.streamHdr.seqNo;
+                break;
+            default:
+                break;
+            }
+            offset += msg_len;
+        }
+        return offset;
+    }
+};
+
+template <typename Pass>
+void run(const char *decoder, const std::vector<unsigned char> &feed, uint64_t messages, int passes, Pass pass)
+{
+    uint64_t checksum = 0;
+    const double wall_start = znsbench::wall_seconds();
+    for (int i = 0; i < passes; i++) {
+        checksum += pass();
+    }
+    const double wall_sec = znsbench::wall_seconds() - wall_start;
+    const double total = (double)messages * passes;
+
+    znsbench::BenchResult("msgdecoder")
+        .add("decoder", decoder)
+        .add("messages", messages)
+        .add("passes", passes)
+        .add("feed_bytes", feed.size())
+        .add("checksum", checksum)
+        .add("wall_sec", wall_sec)
+        .add("messages_per_sec", total / wall_sec)
+        .add("ns_per_message", wall_sec * 1e9 / total)
+        .print();
+}
+}
+
+int main(int argc, char **argv)
+{
+    const std::size_t megabytes = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : 64;
+    const int passes = (argc > 2) ? std::atoi(argv[2]) : 10;
+
+    uint64_t messages;
+    const std::vector<unsigned char> feed = build_feed(megabytes << 20, messages);
+
+    run("typed_dispatch", feed, messages, passes, [&] {
+        FullHandler handler;
+        znsreader::decode_packets(feed.data(), feed.size(), handler);
+        return handler.sum;
+    });
+    run("typed_orders_only", feed, messages, passes, [&] {
+        OrdersOnlyHandler handler;
+        znsreader::decode_packets(feed.data(), feed.size(), handler);
+        return handler.sum;
+    });
+    run("copy_switch", feed, messages, passes, [&] {
+        CopySwitch decoder;
+        decoder(feed.data(), feed.size());
+        return decoder.sum;
+    });
+
+    return 0;
+}
@@ -0,0 +1,285 @@
+// Order book build rate over a synthetic tick by tick feed held in memory: new orders,
+// modifies, cancels and trades spread over a few thousand tokens around a drifting price,
+// with tens of thousands of orders resting. OrderBookEngine, fed through MessageDecoder,
+// runs against the std::map and std::unordered_map book consumers tend to write. Both
+// must agree on every token's top of book. realtime_factor compares the rate with a
+// session of day_messages over 09:15 to 15:30; pass messages, tokens, day_messages and the
+// resting order cap.
+
+#include "bench_util.hpp"
+#include "msgdecoder.hpp"
+#include "nsetypes.hpp"
+#include "orderbook.hpp"
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+constexpr double SESSION_SEC = 6.25 * 3600;
+
+struct live_order {
+    double id;
+    int token;
+    char side;
+    int price;
+    int quantity;
+};
+
+template <typename Body>
+Body &append_packet(std::vector<unsigned char> &buf, nseMsgType type, int seq_no)
+{
+    const std::size_t offset = buf.size();
+    buf.resize(offset + znsreader::message_size<Body>());
+
+    StreamPacket *stream_packet = (StreamPacket *)(buf.data() + offset);
+    stream_packet->streamHdr.msgLen = znsreader::message_size<Body>();
+    stream_packet->streamHdr.streamId = 1;
+    stream_packet->streamHdr.seqNo = seq_no;
+    stream_packet->streamData.cMsgType = type;
+    return *(Body *)(buf.data() + offset + sizeof(StreamHeader) + 1);
+}
+
+// Roughly the F&O mix: 40% new, 25% modify, 30% cancel, 5% trade, new orders turning into
+// modifies while max_live rest. Orders sit within 40 ticks of their token's price, which
+// takes a step now and then.
+std::vector<unsigned char> build_feed(uint64_t messages, int tokens, std::size_t max_live)
+{
+    std::mt19937_64 rng(42);
+    std::vector<unsigned char> buf;
+    buf.reserve(messages * znsreader::message_size<TradeData>());
+
+    std::vector<int> mid(tokens);
+    for (int &price : mid) {
+        price = 10000 + (rng() % 100000) * 5;
+    }
+
+    std::vector<live_order> live;
+    double next_id = 1300000000000000.0;
+    int64_t timestamp = 1700000000000000000;
+
+    for (uint64_t i = 0; i < messages; i++) {
+        const int seq_no = i + 1;
+        const unsigned int roll = rng() % 100;
+        timestamp += 1000;
+
+        if (live.size() < 1000 || (roll < 40 && live.size() < max_live)) {
+            live_order order;
+            order.id = next_id++;
+            order.token = rng() % tokens;
+            order.side = (rng() & 1) ? 'B' : 'S';
+            const int ticks = 1 + rng() % 40;
+            order.price = mid[order.token] + ((order.side == 'B') ? -ticks : ticks) * 5;
+            order.quantity = (1 + rng() % 20) * 25;
+            live.push_back(order);
+
+            OrderData &data = append_packet<OrderData>(buf, newOrderMsg, seq_no);
+            data = OrderData{ timestamp, order.id, order.token, order.side, order.price, order.quantity };
+            continue;
+        }
+
+        const std::size_t pick = rng() % live.size();
+        live_order &order = live[pick];
+
+        if (roll < 65) {
+            order.price += ((int)(rng() % 5) - 2) * 5;
+            order.quantity = (1 + rng() % 20) * 25;
+            OrderData &data = append_packet<OrderData>(buf, modOrderMsg, seq_no);
+            data = OrderData{ timestamp, order.id, order.token, order.side, order.price, order.quantity };
+        } else if (roll < 95) {
+            OrderData &data = append_packet<OrderData>(buf, cancelOrderMsg, seq_no);
+            data = OrderData{ timestamp, order.id, order.token, order.side, order.price, 0 };
+            live[pick] = live.back();
+            live.pop_back();
+        } else {
+            // Resting order traded against an aggressor that never rested, the way most
+            // trades print. A fill of the whole order takes it off the book.
+            TradeData &data = append_packet<TradeData>(buf, tradeMesg, seq_no);
+            data = TradeData{ timestamp, (order.side == 'B') ? order.id : 0, (order.side == 'S') ? order.id : 0,
+                              order.token, order.price, 25 };
+            if (rng() % 8 == 0) {
+                mid[order.token] += ((int)(rng() % 3) - 1) * 5;
+            }
+            if ((order.quantity -= 25) == 0) {
+                live[pick] = live.back();
+                live.pop_back();
+            }
+        }
+    }
+
+    return buf;
+}
+
+// The book a consumer writes without thinking about the data structures.
+struct MapBooks {
+    struct order {
+        int token;
+        char side;
+        int price;
+        int quantity;
+    };
+    struct book {
+        std::map<int, int64_t, std::greater<int>> bids;
+        std::map<int, int64_t> asks;
+
+        void add(char side, int price, int64_t quantity)
+        {
+            if (side == 'S') {
+                asks[price] += quantity;
+            } else {
+                bids[price] += quantity;
+            }
+        }
+
+        template <typename Levels>
+        static void take(Levels &levels, int price, int64_t quantity)
+        {
+            auto it = levels.find(price);
+            if (it != levels.end() && (it->second -= quantity) <= 0) {
+                levels.erase(it);
+            }
+        }
+
+        void remove(char side, int price, int64_t quantity)
+        {
+            if (side == 'S') {
+                take(asks, price, quantity);
+            } else {
+                take(bids, price, quantity);
+            }
+        }
+    };
+
+    std::unordered_map<double, order> orders;
+    std::unordered_map<int, book> books;
+
+    void on_message(const znsreader::OrderMessage &message)
+    {
+        const OrderData &data = message.order;
+        const double id = data.orderID;
+        auto it = orders.find(id);
+
+        if (it != orders.end()) {
+            books[it->second.token].remove(it->second.side, it->second.price, it->second.quantity);
+            orders.erase(it);
+        }
+        if (message.type != cancelOrderMsg) {
+            orders[id] = order{ data.tokenID, data.orderType, data.price, data.quantity };
+            books[data.tokenID].add(data.orderType, data.price, data.quantity);
+        }
+    }
+
+    void fill(double id, int quantity)
+    {
+        auto it = orders.find(id);
+        if (id == 0 || it == orders.end()) {
+            return;
+        }
+
+        const int filled = std::min(quantity, it->second.quantity);
+        books[it->second.token].remove(it->second.side, it->second.price, filled);
+        if ((it->second.quantity -= filled) == 0) {
+            orders.erase(it);
+        }
+    }
+
+    void on_message(const znsreader::TradeMessage &message)
+    {
+        fill(message.trade.buyOrderID, message.trade.quantity);
+        fill(message.trade.sellOrderID, message.trade.quantity);
+    }
+};
+
+// Sums every token's best bid and ask, price and quantity, so the two books can be compared.
+uint64_t engine_top_checksum(const znsreader::OrderBookEngine &engine, int tokens)
+{
+    uint64_t sum = 0;
+    for (int token = 0; token < tokens; token++) {
+        const znsreader::OrderBook *book = engine.book(token);
+        if (book == nullptr) {
+            continue;
+        }
+        if (const znsreader::PriceLevel *bid = book->best_bid()) {
+            sum += bid->price * 31 + bid->quantity;
+        }
+        if (const znsreader::PriceLevel *ask = book->best_ask()) {
+            sum += ask->price * 37 + ask->quantity;
+        }
+    }
+    return sum;
+}
+
+uint64_t map_top_checksum(const MapBooks &books, int tokens)
+{
+    uint64_t sum = 0;
+    for (int token = 0; token < tokens; token++) {
+        auto it = books.books.find(token);
+        if (it == books.books.end()) {
+            continue;
+        }
+        if (!it->second.bids.empty()) {
+            sum += it->second.bids.begin()->first * 31 + it->second.bids.begin()->second;
+        }
+        if (!it->second.asks.empty()) {
+            sum += it->second.asks.begin()->first * 37 + it->second.asks.begin()->second;
+        }
+    }
+    return sum;
+}
+
+void report(const char *engine, uint64_t messages, double wall_sec, uint64_t resting, uint64_t checksum,
+            uint64_t day_messages)
+{
+    const double rate = messages / wall_sec;
+
+    znsbench::BenchResult("orderbook")
+        .add("engine", engine)
+        .add("messages", messages)
+        .add("wall_sec", wall_sec)
+        .add("messages_per_sec", rate)
+        .add("ns_per_message", wall_sec * 1e9 / messages)
+        .add("resting_orders", resting)
+        .add("top_checksum", checksum)
+        .add("day_messages", day_messages)
+        .add("day_sec", day_messages / rate)
+        .add("realtime_factor", rate * SESSION_SEC / day_messages)
+        .print();
+}
+}
+
+int main(int argc, char **argv)
+{
+    const uint64_t messages = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : 10000000;
+    const int tokens = (argc > 2) ? std::atoi(argv[2]) : 4000;
+    const uint64_t day_messages = (argc > 3) ? std::strtoull(argv[3], nullptr, 10) : 500000000;
+    const std::size_t max_live = (argc > 4) ? std::strtoull(argv[4], nullptr, 10) : 100000;
+
+    const std::vector<unsigned char> feed = build_feed(messages, tokens, max_live);
+
+    {
+        znsreader::OrderBookEngine engine(max_live);
+        znsreader::MessageDecoder<znsreader::OrderBookEngine &> decoder(engine);
+
+        const double wall_start = znsbench::wall_seconds();
+        znsreader::decode_packets(feed.data(), feed.size(), decoder.handler());
+        const double wall_sec = znsbench::wall_seconds() - wall_start;
+
+        report("flat", messages, wall_sec, engine.resting_orders(), engine_top_checksum(engine, tokens),
+               day_messages);
+    }
+
+    {
+        MapBooks books;
+
+        const double wall_start = znsbench::wall_seconds();
+        znsreader::decode_packets(feed.data(), feed.size(), books);
+        const double wall_sec = znsbench::wall_seconds() - wall_start;
+
+        report("std_map", messages, wall_sec, books.orders.size(), map_top_checksum(books, tokens), day_messages);
+    }
+
+    return 0;
+}
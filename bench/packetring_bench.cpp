@@ -0,0 +1,124 @@
+// Per socket receive (recvmmsg into the record ring) against the AF_PACKET TPACKET_V3
+// engine on the same traffic. Needs CAP_NET_RAW; pass a veth end as the interface to run
+// it off loopback.
+
+#include "bench_util.hpp"
+#include "packetring.hpp"
+#include "ringrecord.hpp"
+#include "udpreader.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+namespace
+{
+constexpr std::size_t PACKET_SIZE = 100;
+constexpr short STREAM_COUNT = 16;
+
+struct RecordCounter {
+    std::atomic<uint64_t> *m_received;
+
+    std::size_t operator()(znsreader::RingRecordRange records)
+    {
+        uint64_t count = 0;
+        for (const znsreader::RingRecord record : records) {
+            count += (record.payload_len() == PACKET_SIZE);
+        }
+        m_received->fetch_add(count, std::memory_order_relaxed);
+        return records.size_bytes();
+    }
+};
+
+void report(const char *engine, std::size_t packets, uint64_t received, double wall_sec, double cpu_sec)
+{
+    znsbench::BenchResult("packetring")
+        .add("engine", engine)
+        .add("sent", packets)
+        .add("received", received)
+        .add("wall_sec", wall_sec)
+        .add("rx_cpu_sec", cpu_sec)
+        .add("pkts_per_core_sec", received / cpu_sec)
+        .print();
+}
+
+void run_sockets(std::size_t packets, uint16_t base_port)
+{
+    using Reader = znsreader::BasicAggregatedPacketReader<znsreader::RecordRecvWriter<32>,
+                                                          znsreader::RingRecordReader<RecordCounter>>;
+
+    std::atomic<uint64_t> received = 0;
+    double cpu_sec = 0;
+    Reader reader(znsbench::loopback_config(STREAM_COUNT, base_port), false,
+                  znsreader::RingRecordReader<RecordCounter>(RecordCounter{ &received }), 64 * 1024 * 1024);
+
+    // Receive thread CPU is what gets compared, the ring is drained lazily on the side.
+    std::thread rx([&]() {
+        const double cpu_start = znsbench::thread_cpu_seconds();
+        reader.write_packets_to_ringbuf();
+        cpu_sec = znsbench::thread_cpu_seconds() - cpu_start;
+    });
+
+    std::atomic<bool> running = true;
+    std::thread consumer([&]() {
+        while (running.load(std::memory_order_relaxed)) {
+            reader.drain_ringbuf();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        reader.drain_ringbuf();
+    });
+
+    const double wall_start = znsbench::wall_seconds();
+    std::thread sender(znsbench::send_packets, base_port, STREAM_COUNT * 2, packets, PACKET_SIZE,
+                       std::chrono::microseconds(0));
+    sender.join();
+    const double wall_sec = znsbench::wait_quiet(received, wall_start);
+    reader.stop();
+    rx.join();
+    running.store(false, std::memory_order_relaxed);
+    consumer.join();
+
+    report("sockets", packets, received.load(), wall_sec, cpu_sec);
+}
+
+void run_packet_ring(std::size_t packets, uint16_t base_port, const std::string &interface)
+{
+    using Reader = znsreader::BasicPacketRingReader<RecordCounter>;
+
+    znsreader::PacketRingConfig ring_config;
+    ring_config.m_interface = interface;
+
+    std::atomic<uint64_t> received = 0;
+    double cpu_sec = 0;
+    Reader reader(znsbench::loopback_config(STREAM_COUNT, base_port), ring_config, RecordCounter{ &received });
+
+    std::thread rx([&]() {
+        const double cpu_start = znsbench::thread_cpu_seconds();
+        reader.read_packets();
+        cpu_sec = znsbench::thread_cpu_seconds() - cpu_start;
+    });
+
+    const double wall_start = znsbench::wall_seconds();
+    std::thread sender(znsbench::send_packets, base_port, STREAM_COUNT * 2, packets, PACKET_SIZE,
+                       std::chrono::microseconds(0));
+    sender.join();
+    const double wall_sec = znsbench::wait_quiet(received, wall_start);
+    reader.stop();
+    rx.join();
+
+    report("tpacket_v3", packets, received.load(), wall_sec, cpu_sec);
+}
+}
+
+int main(int argc, char **argv)
+{
+    const std::size_t packets = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : 2000000;
+    const std::string interface = (argc > 2) ? argv[2] : "lo";
+    const uint16_t base_port = (argc > 3) ? std::atoi(argv[3]) : 33000;
+
+    run_sockets(packets, base_port);
+    run_packet_ring(packets, base_port, interface);
+
+    return 0;
+}
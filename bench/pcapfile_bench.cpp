@@ -0,0 +1,254 @@
+// Offline pcap iteration: PcapFileReader over the mapped file against a stdio loop that
+// copies every record into a buffer the way libpcap's offline reader does, and libpcap
+// itself when the bench is built with it. Each pass parses down to the UDP payload and
+// touches it. The capture is one stream written by BufferedPacketToFileWriter, read warm
+// from the page cache; pass a size in MB, a full day of one F&O stream is a few GB. First
+// both capture writers are checked to round trip: every packet written comes back from
+// PcapFileReader with the same bytes, the run fails otherwise.
+
+#include "bench_util.hpp"
+#include "capturewriter.hpp"
+#include "nsetypes.hpp"
+#include "pcapfile.hpp"
+#include "pcapwriter.hpp"
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#ifdef ZNS_BENCH_LIBPCAP
+#include <pcap/pcap.h>
+#endif
+
+namespace
+{
+constexpr int64_t RECV_TIMESTAMP_NS = 1700000000000000000;
+
+std::string write_capture(std::size_t target_bytes)
+{
+    const std::map<short, single_stream_info> config = znsbench::capture_config(1);
+    StreamPacket packet = znsbench::order_packet(1);
+
+    const std::size_t record_bytes =
+        sizeof(znsreader::PcapRecordHeader) + ZNS_CAPTURE_NET_HDR_SIZE + packet.streamHdr.msgLen;
+    {
+        znsreader::BufferedPacketToFileWriter writer(config, true, false);
+        for (std::size_t i = 0; i < target_bytes / record_bytes; i++) {
+            packet.streamHdr.seqNo = 1 + i;
+            writer.ingest_packet((const unsigned char *)&packet, packet.streamHdr.msgLen, RECV_TIMESTAMP_NS + i * 1000);
+        }
+    }
+
+    return std::filesystem::directory_iterator(".")->path().string();
+}
+
+// Orders and trades in turn, so records differ in length as well as content.
+std::vector<unsigned char> round_trip_packet(uint32_t i)
+{
+    StreamPacket stream_packet;
+    std::memset(&stream_packet, 0, sizeof(stream_packet));
+    stream_packet.streamHdr.streamId = 1;
+    stream_packet.streamHdr.seqNo = 1 + i;
+
+    std::size_t len;
+    if (i % 2 == 0) {
+        len = sizeof(StreamHeader) + 1 + sizeof(OrderData);
+        stream_packet.streamData.cMsgType = newOrderMsg;
+        stream_packet.streamData.p.orderData = OrderData{ RECV_TIMESTAMP_NS + i, 1.0 + i, 35000, 'B', 10000, (int)i };
+    } else {
+        len = sizeof(StreamHeader) + 1 + sizeof(TradeData);
+        stream_packet.streamData.cMsgType = tradeMesg;
+        stream_packet.streamData.p.tradeData = TradeData{ RECV_TIMESTAMP_NS + i, 1.0 + i, 0, 35000, 10000, (int)i };
+    }
+    stream_packet.streamHdr.msgLen = len;
+
+    std::vector<unsigned char> packet(len);
+    std::memcpy(packet.data(), &stream_packet, len);
+    return packet;
+}
+
+template <typename Writer>
+bool check_round_trip(const char *writer_name)
+{
+    constexpr uint32_t packets = 10000;
+    const std::map<short, single_stream_info> config = znsbench::capture_config(1);
+
+    {
+        Writer writer(config, true, false);
+        for (uint32_t i = 0; i < packets; i++) {
+            const std::vector<unsigned char> packet = round_trip_packet(i);
+            writer.ingest_packet(packet.data(), packet.size(), RECV_TIMESTAMP_NS + i * 1000);
+        }
+    }
+
+    const std::string file_name = znsreader::capture_file_name(config.at(1), 1, true);
+    uint64_t read = 0;
+    uint64_t matched = 0;
+    uint64_t skipped = 0;
+    {
+        znsreader::PcapFileReader reader(file_name);
+        znsreader::PcapPacket packet;
+        while (reader.next(packet)) {
+            const std::vector<unsigned char> expected = round_trip_packet(read);
+            if (packet.payload_len == expected.size()
+                && std::memcmp(packet.payload, expected.data(), expected.size()) == 0
+                && packet.timestamp_ns == RECV_TIMESTAMP_NS + (int64_t)read * 1000 && packet.dst_port == 17741) {
+                matched++;
+            }
+            read++;
+        }
+        skipped = reader.skipped();
+    }
+    std::filesystem::remove(file_name);
+
+    const bool ok = (read == packets && matched == packets && skipped == 0);
+    znsbench::BenchResult("pcapfile")
+        .add("check", "round_trip")
+        .add("writer", writer_name)
+        .add("written", packets)
+        .add("read", read)
+        .add("matched", matched)
+        .add("skipped", skipped)
+        .add("result", ok ? "pass" : "fail")
+        .print();
+    return ok;
+}
+
+void run_mapped(const std::string &file_name)
+{
+    znsreader::PcapFileReader reader(file_name);
+    znsreader::PcapPacket packet;
+    uint64_t packets = 0;
+    uint64_t payload_sum = 0;
+
+    const double wall_start = znsbench::wall_seconds();
+    while (reader.next(packet)) {
+        payload_sum += packet.payload_len + packet.payload[0];
+        packets++;
+    }
+    const double wall_sec = znsbench::wall_seconds() - wall_start;
+
+    znsbench::BenchResult("pcapfile")
+        .add("reader", "mmap")
+        .add("packets", packets)
+        .add("payload_sum", payload_sum)
+        .add("file_bytes", reader.size_bytes())
+        .add("wall_sec", wall_sec)
+        .add("gb_per_sec", reader.size_bytes() / wall_sec / 1e9)
+        .add("packets_per_sec", packets / wall_sec)
+        .print();
+}
+
+void run_stdio(const std::string &file_name)
+{
+    FILE *file = std::fopen(file_name.c_str(), "rb");
+    unsigned char file_header[24];
+    if (file == nullptr || std::fread(file_header, sizeof(file_header), 1, file) != 1) {
+        perror("capture open error:");
+        return;
+    }
+
+    std::vector<unsigned char> buffer(0x10000);
+    znsreader::PcapRecordHeader hdr;
+    znsreader::PcapPacket packet;
+    uint64_t packets = 0;
+    uint64_t payload_sum = 0;
+
+    const double wall_start = znsbench::wall_seconds();
+    while (std::fread(&hdr, sizeof(hdr), 1, file) == 1 && hdr.caplen <= buffer.size()
+           && std::fread(buffer.data(), hdr.caplen, 1, file) == 1) {
+        if (znsreader::parse_udp_frame(*(const uint32_t *)(file_header + 20), buffer.data(), hdr.caplen, packet)) {
+            payload_sum += packet.payload_len + packet.payload[0];
+            packets++;
+        }
+    }
+    const double wall_sec = znsbench::wall_seconds() - wall_start;
+    const std::size_t file_bytes = std::ftell(file);
+    std::fclose(file);
+
+    znsbench::BenchResult("pcapfile")
+        .add("reader", "stdio_copy")
+        .add("packets", packets)
+        .add("payload_sum", payload_sum)
+        .add("file_bytes", file_bytes)
+        .add("wall_sec", wall_sec)
+        .add("gb_per_sec", file_bytes / wall_sec / 1e9)
+        .add("packets_per_sec", packets / wall_sec)
+        .print();
+}
+
+#ifdef ZNS_BENCH_LIBPCAP
+void run_libpcap(const std::string &file_name)
+{
+    char errbuf[PCAP_ERRBUF_SIZE];
+    pcap_t *pcap = pcap_open_offline_with_tstamp_precision(file_name.c_str(), PCAP_TSTAMP_PRECISION_NANO, errbuf);
+    if (pcap == nullptr) {
+        fprintf(stderr, "libpcap error: %s\n", errbuf);
+        return;
+    }
+
+    const int linktype = pcap_datalink(pcap);
+    struct pcap_pkthdr *hdr;
+    const unsigned char *data;
+    znsreader::PcapPacket packet;
+    uint64_t packets = 0;
+    uint64_t payload_sum = 0;
+
+    const double wall_start = znsbench::wall_seconds();
+    while (pcap_next_ex(pcap, &hdr, &data) == 1) {
+        if (znsreader::parse_udp_frame(linktype, data, hdr->caplen, packet)) {
+            payload_sum += packet.payload_len + packet.payload[0];
+            packets++;
+        }
+    }
+    const double wall_sec = znsbench::wall_seconds() - wall_start;
+    const std::size_t file_bytes = std::filesystem::file_size(file_name);
+    pcap_close(pcap);
+
+    znsbench::BenchResult("pcapfile")
+        .add("reader", "libpcap")
+        .add("packets", packets)
+        .add("payload_sum", payload_sum)
+        .add("file_bytes", file_bytes)
+        .add("wall_sec", wall_sec)
+        .add("gb_per_sec", file_bytes / wall_sec / 1e9)
+        .add("packets_per_sec", packets / wall_sec)
+        .print();
+}
+#endif
+}
+
+int main(int argc, char **argv)
+{
+    const std::size_t megabytes = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : 1024;
+    std::string dir = (argc > 2) ? argv[2] : "/tmp";
+
+    dir += "/zns_pcapfile_bench_XXXXXX";
+    if (::mkdtemp(dir.data()) == nullptr || ::chdir(dir.c_str()) != 0) {
+        perror("capture directory error:");
+        return 1;
+    }
+
+    if (!check_round_trip<znsreader::BufferedPacketToFileWriter>("buffered")
+        | !check_round_trip<znsreader::PacketToFileWriter>("legacy")) {
+        std::filesystem::remove_all(dir);
+        return 1;
+    }
+
+    const std::string file_name = write_capture(megabytes << 20);
+
+    // Second round of each runs with the file fully cached.
+    for (int round = 0; round < 2; round++) {
+        run_mapped(file_name);
+        run_stdio(file_name);
+#ifdef ZNS_BENCH_LIBPCAP
+        run_libpcap(file_name);
+#endif
+    }
+
+    std::filesystem::remove_all(dir);
+    return 0;
+}
@@ -0,0 +1,177 @@
+// Tick recovery end to end: TickRecoveryClient and RecoverySplicer against a local
+// TickRecoveryServer. The capture holds seqNos 1 to 20 of one stream with 12 missing. Live
+// delivers 1 to 3, a gap for 4 to 14, then 15 to 20, which the splicer parks until the
+// recovery returns. The handler must see 1 to 11 and 13 to 20 in order, 4 to 11 and 13 to 14
+// on the recovery line, and exactly one gap, for 12. Exits 1 when any round does not. Pass
+// the rounds and a directory for the capture.
+
+#include "bench_util.hpp"
+#include "nsetypes.hpp"
+#include "recoveryserver.hpp"
+#include "ringrecord.hpp"
+#include "tickrecovery.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+constexpr short STREAM_ID = 1;
+constexpr int LAST_SEQ = 20;
+constexpr int GAP_START = 4;
+constexpr int GAP_END = 14;
+constexpr int MISSING_SEQ = 12;
+
+// StreamPackets back to back, as TickRecoveryServer reads them.
+void write_capture(const std::filesystem::path &file_name)
+{
+    std::ofstream capture(file_name, std::ios::binary | std::ios::trunc);
+    for (int seq_no = 1; seq_no <= LAST_SEQ; seq_no++) {
+        if (seq_no != MISSING_SEQ) {
+            const StreamPacket packet = znsbench::order_packet(STREAM_ID, seq_no);
+            capture.write((const char *)&packet, packet.streamHdr.msgLen);
+        }
+    }
+}
+
+std::vector<unsigned char> live_record(int seq_no)
+{
+    const StreamPacket packet = znsbench::order_packet(STREAM_ID, seq_no);
+    std::vector<unsigned char> record(znsreader::ring_record_size(packet.streamHdr.msgLen), 0);
+
+    znsreader::RingRecordHeader header{};
+    header.length = packet.streamHdr.msgLen;
+    header.line = znsreader::FeedLine::primary;
+    header.stream_id = STREAM_ID;
+    std::memcpy(record.data(), &header, sizeof(header));
+    std::memcpy(record.data() + sizeof(header), &packet, packet.streamHdr.msgLen);
+    return record;
+}
+
+struct delivered {
+    int64_t seq_no;
+    znsreader::FeedLine line;
+};
+
+struct RecordingHandler {
+    std::vector<delivered> records;
+    std::vector<znsreader::SequenceGap> gaps;
+
+    void on_record(const znsreader::RingRecord &record)
+    {
+        records.push_back(delivered{ ((const StreamHeader *)record.payload())->seqNo, record.header().line });
+    }
+
+    void on_gap(const znsreader::SequenceGap &gap)
+    {
+        gaps.push_back(gap);
+    }
+};
+
+bool check(const RecordingHandler &handler)
+{
+    std::vector<int64_t> expected;
+    for (int seq_no = 1; seq_no <= LAST_SEQ; seq_no++) {
+        if (seq_no != MISSING_SEQ) {
+            expected.push_back(seq_no);
+        }
+    }
+
+    if (handler.records.size() != expected.size()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < expected.size(); i++) {
+        const bool recovered = expected[i] >= GAP_START && expected[i] <= GAP_END;
+        if (handler.records[i].seq_no != expected[i]
+            || (handler.records[i].line == znsreader::FeedLine::recovery) != recovered) {
+            return false;
+        }
+    }
+
+    return handler.gaps.size() == 1 && handler.gaps[0].stream_id == STREAM_ID
+           && handler.gaps[0].start_seq == MISSING_SEQ && handler.gaps[0].end_seq == MISSING_SEQ;
+}
+
+// One round on a fresh client, returns the time from the gap to the parked packets going out,
+// or a negative value when the handler saw the wrong thing.
+double run_round(uint16_t port, const std::map<short, single_stream_info> &config)
+{
+    znsreader::TickRecoveryClient client("127.0.0.1", port);
+    znsreader::RecoverySplicer<RecordingHandler> splicer(config, client, RecordingHandler());
+
+    for (int seq_no = 1; seq_no < GAP_START; seq_no++) {
+        const std::vector<unsigned char> record = live_record(seq_no);
+        splicer.on_record(znsreader::RingRecord(record.data()));
+    }
+
+    const double start = znsbench::wall_seconds();
+    splicer.on_gap(znsreader::SequenceGap{ STREAM_ID, GAP_START, GAP_END });
+
+    for (int seq_no = GAP_END + 1; seq_no <= LAST_SEQ; seq_no++) {
+        const std::vector<unsigned char> record = live_record(seq_no);
+        splicer.on_record(znsreader::RingRecord(record.data()));
+    }
+
+    // Nothing past the gap may go out before the recovery does.
+    if (splicer.handler().records.size() != GAP_START - 1) {
+        return -1;
+    }
+
+    while (splicer.handler().records.size() < LAST_SEQ - 1 && znsbench::wall_seconds() - start < 5) {
+        splicer.poll();
+        std::this_thread::yield();
+    }
+    const double elapsed = znsbench::wall_seconds() - start;
+
+    return check(splicer.handler()) ? elapsed : -1;
+}
+}
+
+int main(int argc, char **argv)
+{
+    const int rounds = (argc > 1) ? std::atoi(argv[1]) : 100;
+    const std::string dir = (argc > 2) ? argv[2] : "/tmp";
+    const std::filesystem::path file_name = std::filesystem::path(dir) / "zns_recovery_bench.bin";
+
+    write_capture(file_name);
+
+    // serveRequests never returns, the server lives as long as the process.
+    znsreader::TickRecoveryServer *server = new znsreader::TickRecoveryServer(file_name, 0);
+    std::thread(&znsreader::TickRecoveryServer::serveRequests, server).detach();
+
+    std::map<short, single_stream_info> config;
+    config.emplace(STREAM_ID, single_stream_info(STREAM_ID, 0, 0, "239.255.0.1", "239.255.0.2"));
+
+    std::vector<double> latencies;
+    int failed = 0;
+    for (int i = 0; i < rounds; i++) {
+        const double elapsed = run_round(server->port(), config);
+        if (elapsed < 0) {
+            failed++;
+        } else {
+            latencies.push_back(elapsed);
+        }
+    }
+
+    std::filesystem::remove(file_name);
+    std::sort(latencies.begin(), latencies.end());
+
+    znsbench::BenchResult("recovery")
+        .add("case", "splice")
+        .add("rounds", rounds)
+        .add("failed", failed)
+        .add("recovered", GAP_END - GAP_START)
+        .add("parked", LAST_SEQ - GAP_END)
+        .add("p50_us", latencies.empty() ? 0.0 : latencies[latencies.size() / 2] * 1e6)
+        .add("max_us", latencies.empty() ? 0.0 : latencies.back() * 1e6)
+        .print();
+
+    return (failed == 0) ? 0 : 1;
+}
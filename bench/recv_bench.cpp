@@ -0,0 +1,173 @@
+// Compares the single recv() writer against the recvmmsg() batch writer on loopback UDP.
+// Reports packets drained per second of receive thread CPU time.
+
+#include "bench_util.hpp"
+#include "ringbuffer.hpp"
+#include "udpreader.hpp"
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+constexpr std::size_t PACKET_SIZE = 100;
+
+struct LoopbackSockets {
+    std::vector<int> fds;
+    std::vector<struct sockaddr_in> addrs;
+
+    explicit LoopbackSockets(int count)
+    {
+        for (int i = 0; i < count; i++) {
+            int fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP);
+            if (fd < 0) {
+                throw std::runtime_error("socket failed");
+            }
+
+            int rcvBufSize = 134217728;
+            ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvBufSize, sizeof(rcvBufSize));
+
+            struct sockaddr_in addr;
+            std::memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            addr.sin_port = 0;
+            if (::bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+                throw std::runtime_error("bind failed");
+            }
+
+            socklen_t len = sizeof(addr);
+            ::getsockname(fd, (struct sockaddr *)&addr, &len);
+
+            fds.push_back(fd);
+            addrs.push_back(addr);
+        }
+    }
+
+    ~LoopbackSockets()
+    {
+        for (int fd : fds) {
+            ::close(fd);
+        }
+    }
+};
+
+void send_packets(const LoopbackSockets &sockets, std::size_t packets, std::atomic<bool> &done)
+{
+    int fd = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    unsigned char payload[PACKET_SIZE];
+    std::memset(payload, 'N', sizeof(payload));
+
+    struct mmsghdr msgs[ZNS_MAX_RECV_BATCH];
+    struct iovec iov;
+    iov.iov_base = payload;
+    iov.iov_len = sizeof(payload);
+
+    std::size_t sent = 0;
+    while (sent < packets) {
+        const std::size_t target = sent % sockets.addrs.size();
+        const unsigned int burst = std::min<std::size_t>(ZNS_MAX_RECV_BATCH, packets - sent);
+
+        for (unsigned int i = 0; i < burst; i++) {
+            std::memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_name = (void *)&sockets.addrs[target];
+            msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+            msgs[i].msg_hdr.msg_iov = &iov;
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int ret = ::sendmmsg(fd, msgs, burst, 0);
+        if (ret > 0) {
+            sent += ret;
+        }
+    }
+
+    ::close(fd);
+    done.store(true, std::memory_order_release);
+}
+
+void run_variant(std::size_t batch, std::size_t packets, int socket_count)
+{
+    LoopbackSockets sockets(socket_count);
+    std::size_t received_bytes = 0;
+
+    znsreader::RingBuffer ring(
+        64 * 1024 * 1024, false,
+        (batch > 1) ? znsreader::AggregatedPacketReader::socket_to_ringbuf_batch_writer
+                    : znsreader::AggregatedPacketReader::socket_to_ringbuf_writer,
+        [&received_bytes](const unsigned char *, std::size_t size) {
+            received_bytes += size;
+            return size;
+        });
+
+    const std::size_t push_size = (batch > 1) ? batch * ZNS_MAX_DATAGRAM_SIZE : 131072;
+
+    int epollfd = ::epoll_create1(0);
+    for (int fd : sockets.fds) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        ::epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    std::atomic<bool> sender_done = false;
+    std::thread sender(send_packets, std::cref(sockets), packets, std::ref(sender_done));
+
+    struct epoll_event eventList[1024];
+    const double cpu_start = znsbench::thread_cpu_seconds();
+    const double wall_start = znsbench::wall_seconds();
+
+    for (;;) {
+        int activeFds = ::epoll_wait(epollfd, eventList, 1024, 100);
+        if (activeFds == 0 && sender_done.load(std::memory_order_acquire)) {
+            break;
+        }
+
+        for (int i = 0; i < activeFds; i++) {
+            while (ring.push(eventList[i].data.fd, push_size) == 0) {
+                ring.pop_all();
+            }
+        }
+
+        ring.pop_all();
+    }
+
+    // Exclude the final idle epoll timeout from the wall clock.
+    const double wall_sec = znsbench::wall_seconds() - wall_start - 0.1;
+    const double cpu_sec = znsbench::thread_cpu_seconds() - cpu_start;
+    sender.join();
+    ::close(epollfd);
+
+    const std::size_t received = received_bytes / PACKET_SIZE;
+    znsbench::BenchResult("recv")
+        .add("variant", (batch > 1) ? "recvmmsg" : "recv")
+        .add("batch", batch)
+        .add("sockets", socket_count)
+        .add("sent", packets)
+        .add("received", received)
+        .add("cpu_sec", cpu_sec)
+        .add("wall_sec", wall_sec)
+        .add("pkts_per_core_sec", received / cpu_sec)
+        .print();
+}
+}
+
+int main(int argc, char **argv)
+{
+    const std::size_t packets = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : 2000000;
+    const int socket_count = (argc > 2) ? std::atoi(argv[2]) : 32;
+
+    for (std::size_t batch : { 1, 8, 16, 32, 64 }) {
+        run_variant(batch, packets, socket_count);
+    }
+
+    return 0;
+}
@@ -0,0 +1,151 @@
+// CaptureReplayServer on 16 pcap files written by BufferedPacketToFileWriter, redirected to
+// loopback sockets that a drain thread empties. The capture comes in bursts of BURST
+// packets every BURST_GAP_NS, replayed at capture pacing, at 4x and at the maximum rate.
+// Reports achieved against target rate, send lag behind schedule and how much arrived.
+
+#include "bench_util.hpp"
+#include "capturereplay.hpp"
+#include "capturewriter.hpp"
+#include "nsetypes.hpp"
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+constexpr short STREAM_COUNT = 16;
+constexpr std::size_t BURST = 32;
+constexpr int64_t BURST_GAP_NS = 200000;
+constexpr int64_t RECV_TIMESTAMP_NS = 1700000000000000000;
+
+void write_capture(std::size_t packets)
+{
+    StreamPacket packet = znsbench::order_packet();
+
+    znsreader::BufferedPacketToFileWriter writer(znsbench::capture_config(STREAM_COUNT), true, false);
+    for (std::size_t i = 0; i < packets; i++) {
+        packet.streamHdr.streamId = 1 + (i % STREAM_COUNT);
+        packet.streamHdr.seqNo = 1 + (i / STREAM_COUNT);
+        writer.ingest_packet((const unsigned char *)&packet, packet.streamHdr.msgLen,
+                             RECV_TIMESTAMP_NS + (i / BURST) * BURST_GAP_NS);
+    }
+}
+
+// Counts datagrams on every socket until stopped.
+void drain(const std::vector<int> &socks, std::atomic<bool> &running, std::atomic<uint64_t> &received)
+{
+    unsigned char bufs[64][256];
+    struct mmsghdr msgs[64];
+    struct iovec iovs[64];
+    for (int i = 0; i < 64; i++) {
+        iovs[i].iov_base = bufs[i];
+        iovs[i].iov_len = sizeof(bufs[i]);
+        std::memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while (running.load(std::memory_order_relaxed)) {
+        bool idle = true;
+        for (int fd : socks) {
+            int ret = ::recvmmsg(fd, msgs, 64, MSG_DONTWAIT, nullptr);
+            if (ret > 0) {
+                received.fetch_add(ret, std::memory_order_relaxed);
+                idle = false;
+            }
+        }
+        if (idle) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void run_replay(const char *mode, double speed, const std::vector<std::filesystem::path> &files, uint16_t base_port)
+{
+    std::vector<int> socks;
+    for (short stream_id = 1; stream_id <= STREAM_COUNT; stream_id++) {
+        int fd = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        int rcvbuf = 8 * 1024 * 1024;
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+        struct sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(base_port + stream_id);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        ::bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+        socks.push_back(fd);
+    }
+
+    znsreader::CaptureReplayServer server(files, speed);
+    for (short stream_id = 1; stream_id <= STREAM_COUNT; stream_id++) {
+        server.redirect(stream_id, "", base_port + stream_id);
+    }
+
+    std::atomic<bool> running = true;
+    std::atomic<uint64_t> received = 0;
+    std::thread drainer(drain, std::cref(socks), std::ref(running), std::ref(received));
+
+    const double cpu_start = znsbench::thread_cpu_seconds();
+    const znsreader::ReplayStats stats = server.replay();
+    const double cpu_sec = znsbench::thread_cpu_seconds() - cpu_start;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    running.store(false);
+    drainer.join();
+    for (int fd : socks) {
+        ::close(fd);
+    }
+
+    znsbench::BenchResult("replay")
+        .add("mode", mode)
+        .add("speed", speed)
+        .add("sent", stats.packets_sent)
+        .add("received", received.load())
+        .add("batches", stats.batches)
+        .add("capture_span_sec", stats.capture_span_sec)
+        .add("elapsed_sec", stats.elapsed_sec)
+        .add("send_cpu_sec", cpu_sec)
+        .add("target_pps", stats.target_pps)
+        .add("achieved_pps", stats.achieved_pps)
+        .add("mean_lag_ns", stats.mean_lag_ns)
+        .add("max_lag_ns", stats.max_lag_ns)
+        .print();
+}
+}
+
+int main(int argc, char **argv)
+{
+    const std::size_t packets = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : 200000;
+    const uint16_t base_port = (argc > 2) ? std::atoi(argv[2]) : 36000;
+    std::string dir = (argc > 3) ? argv[3] : "/tmp";
+
+    dir += "/zns_replay_bench_XXXXXX";
+    if (::mkdtemp(dir.data()) == nullptr || ::chdir(dir.c_str()) != 0) {
+        perror("capture directory error:");
+        return 1;
+    }
+
+    write_capture(packets);
+
+    std::vector<std::filesystem::path> files;
+    for (const auto &entry : std::filesystem::directory_iterator(dir)) {
+        files.push_back(entry.path());
+    }
+
+    run_replay("original", 1, files, base_port);
+    run_replay("scaled", 4, files, base_port);
+    run_replay("max_rate", 0, files, base_port);
+
+    std::filesystem::remove_all(dir);
+    return 0;
+}
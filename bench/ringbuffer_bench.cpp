@@ -0,0 +1,110 @@
+// RingBuffer push/pop throughput over packet sizes from a bare header to a jumbo burst, under
+// three wrap conditions: a pop after every push, pops lagging a few pushes behind so many
+// pushes straddle the end of a small ring, and a producer that runs the ring full before
+// every pop. straddled is the share of pushes that crossed the end of the buffer. Pass the
+// bytes per case.
+
+#include "bench_util.hpp"
+#include "ringbuffer.hpp"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+struct CopyWriter {
+    const unsigned char *source;
+
+    std::size_t operator()(int, unsigned char *buf, std::size_t len) const
+    {
+        ::memcpy(buf, source, len);
+        return len;
+    }
+};
+
+struct TouchReader {
+    uint64_t *checksum;
+
+    std::size_t operator()(const unsigned char *data, std::size_t size) const
+    {
+        // Touch every cache line the way a decoder would.
+        for (std::size_t i = 0; i < size; i += 64) {
+            *checksum += data[i];
+        }
+        return size;
+    }
+};
+
+struct WrapCondition {
+    const char *name;
+    std::size_t pushes_per_pop; // 0 pushes until the ring is full
+};
+
+constexpr std::size_t RING_SIZE = 256 * 1024;
+
+template <typename Ring>
+void run_case(const char *dispatch, std::size_t chunk_size, const WrapCondition &condition, std::size_t total_bytes)
+{
+    std::vector<unsigned char> source(chunk_size, 0x5a);
+    uint64_t checksum = 0;
+    std::size_t popped = 0;
+    std::size_t pop_calls = 0;
+    std::size_t push_calls = 0;
+    std::size_t straddled = 0;
+
+    Ring ring(RING_SIZE, false, CopyWriter{ source.data() }, TouchReader{ &checksum });
+    const std::size_t capacity = ring.capacity();
+    const std::size_t pushes_per_pop = (condition.pushes_per_pop != 0) ? condition.pushes_per_pop : SIZE_MAX;
+
+    const double start = znsbench::wall_seconds();
+    std::size_t pushed = 0;
+    while (pushed < total_bytes) {
+        for (std::size_t i = 0; i < pushes_per_pop; i++) {
+            const std::size_t offset = ring.write_position() & (capacity - 1);
+            if (ring.push(0, chunk_size) == 0) {
+                break;
+            }
+            straddled += (offset + chunk_size) > capacity;
+            push_calls++;
+            pushed += chunk_size;
+        }
+
+        popped += ring.pop_all();
+        pop_calls++;
+    }
+    popped += ring.pop_all();
+    const double elapsed = znsbench::wall_seconds() - start;
+
+    znsbench::BenchResult("ringbuffer")
+        .add("dispatch", dispatch)
+        .add("wrap", condition.name)
+        .add("ring_bytes", capacity)
+        .add("chunk_bytes", chunk_size)
+        .add("bytes", popped)
+        .add("pop_calls", pop_calls)
+        .add("straddled", (double)straddled / push_calls)
+        .add("sec", elapsed)
+        .add("gb_per_sec", popped / elapsed / 1e9)
+        .add("ns_per_push", elapsed * 1e9 / push_calls)
+        .add("checksum", checksum)
+        .print();
+}
+}
+
+int main(int argc, char **argv)
+{
+    const std::size_t total_bytes = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : (1ull << 30);
+    const WrapCondition conditions[] = { { "pop_each", 1 }, { "lagging", 3 }, { "full", 0 } };
+
+    // Header only, small order, full MTU, odd mid size, jumbo burst.
+    for (std::size_t chunk : { 8, 100, 1500, 8191, 65531 }) {
+        for (const WrapCondition &condition : conditions) {
+            run_case<znsreader::RingBuffer>("std::function", chunk, condition, total_bytes);
+            run_case<znsreader::BasicRingBuffer<CopyWriter, TouchReader, RING_SIZE>>("static", chunk, condition,
+                                                                                    total_bytes);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,87 @@
+// Receive throughput of ShardedSubscriptionManager from 1 to N shards on loopback UDP.
+// 16 streams with both lines on local ports, a sender thread sprays them round robin.
+
+#include "bench_util.hpp"
+#include "nsereader.hpp"
+#include "ringrecord.hpp"
+#include "udpreader.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+
+namespace
+{
+constexpr std::size_t PACKET_SIZE = 100;
+constexpr short STREAM_COUNT = 16;
+
+struct RecordCounter {
+    std::atomic<uint64_t> *m_received;
+
+    std::size_t operator()(znsreader::RingRecordRange records)
+    {
+        uint64_t count = 0;
+        for (const znsreader::RingRecord record : records) {
+            (void)record;
+            count++;
+        }
+        m_received->fetch_add(count, std::memory_order_relaxed);
+        return records.size_bytes();
+    }
+};
+
+using ShardedFeed = znsreader::ShardedSubscriptionManager<znsreader::RecordRecvWriter<16>,
+                                                          znsreader::RingRecordReader<RecordCounter>>;
+
+void run_shards(std::size_t shard_count, std::size_t packets, uint16_t base_port)
+{
+    const auto config = znsbench::loopback_config(STREAM_COUNT, base_port);
+
+    // Pin sender to 0, consumer to 1 and shards from 2 when there are enough cores.
+    const bool pinned = std::thread::hardware_concurrency() >= shard_count + 2;
+    const auto shards = znsreader::round_robin_shards(config, shard_count, pinned ? 2 : -1);
+
+    std::atomic<uint64_t> received = 0;
+    const double wall_start = znsbench::wall_seconds();
+    double wall_sec = 0;
+
+    {
+        ShardedFeed feed(config, shards, pinned ? 1 : -1, false,
+                         znsreader::RingRecordReader<RecordCounter>(RecordCounter{ &received }), 64 * 1024 * 1024);
+
+        std::thread sender(znsbench::send_packets, base_port, STREAM_COUNT * 2, packets, PACKET_SIZE,
+                           std::chrono::microseconds(0));
+        if (pinned) {
+            znsreader::zns_set_thread_affinity(sender, 0);
+        }
+        sender.join();
+
+        wall_sec = znsbench::wait_quiet(received, wall_start);
+        feed.stop();
+    }
+
+    const uint64_t got = received.load(std::memory_order_relaxed);
+    znsbench::BenchResult("shard")
+        .add("shards", shard_count)
+        .add("pinned", pinned ? "yes" : "no")
+        .add("streams", STREAM_COUNT)
+        .add("sent", packets)
+        .add("received", got)
+        .add("wall_sec", wall_sec)
+        .add("pkts_per_sec", got / wall_sec)
+        .print();
+}
+}
+
+int main(int argc, char **argv)
+{
+    const std::size_t packets = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : 2000000;
+    const std::size_t max_shards = (argc > 2) ? std::strtoull(argv[2], nullptr, 10) : 8;
+    const uint16_t base_port = (argc > 3) ? std::atoi(argv[3]) : 30000;
+
+    for (std::size_t shard_count = 1; shard_count <= max_shards; shard_count *= 2) {
+        run_shards(shard_count, packets, base_port);
+    }
+
+    return 0;
+}
@@ -0,0 +1,189 @@
+// Cross process distribution through ShmFeedPublisher: the parent publishes fixed size
+// records into a named segment, N forked readers attach with ShmFeedReader, check every
+// record's sequence and fill, and print their own line. Records carry a sequence number so a
+// reader can tell a torn or missing one; overruns are what the readers were skipped past.
+// A second run publishes at 400 MB/s into a small ring to one reader that sleeps in its
+// callback after the first record, so the publisher laps it mid read; it must see overruns
+// and never a bad record. Pass total bytes, reader count and the publish rate in MB/s, 0 for
+// unpaced. A reader that sees a bad record fails the run.
+
+#include "bench_util.hpp"
+#include "shmfeed.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+constexpr std::size_t RECORD_BYTES = 256;
+constexpr std::size_t RECORDS_PER_PUBLISH = 32;
+constexpr std::size_t SHM_BYTES = 256 << 20;
+constexpr std::size_t SLOW_SHM_BYTES = 4 << 20;
+
+struct CheckingReader {
+    uint64_t expected = 0;
+    uint64_t records = 0;
+    uint64_t bad = 0;
+    uint64_t bytes = 0;
+    int sleep_us = 0;
+    bool resync = true;
+
+    std::size_t operator()(const unsigned char *data, std::size_t size)
+    {
+        for (std::size_t offset = 0; offset + RECORD_BYTES <= size; offset += RECORD_BYTES) {
+            uint64_t seq;
+            ::memcpy(&seq, data + offset, sizeof(seq));
+            // Only an overrun may move the sequence on by more than one.
+            if ((resync ? seq < expected : seq != expected) || data[offset + RECORD_BYTES - 1] != (unsigned char)seq) {
+                bad++;
+            }
+            resync = false;
+            expected = seq + 1;
+            records++;
+
+            if (offset == 0 && sleep_us != 0) {
+                // Long enough for the publisher to write over the rest of the span.
+                std::this_thread::sleep_for(std::chrono::microseconds(sleep_us));
+            }
+        }
+        bytes += size;
+        return size;
+    }
+
+    void on_overrun(std::size_t)
+    {
+        resync = true;
+    }
+};
+
+int run_reader(const std::string &name, int ready_fd, std::size_t index, int sleep_us)
+{
+    znsreader::ShmFeedReader feed(name, true);
+    CheckingReader reader;
+    reader.sleep_us = sleep_us;
+    const char ready = 1;
+
+    if (::write(ready_fd, &ready, 1) != 1) {
+        return 1;
+    }
+    ::close(ready_fd);
+
+    const double start = znsbench::wall_seconds();
+    for (;;) {
+        const bool closed = feed.closed();
+        if (feed.poll(reader) == 0) {
+            if (closed) {
+                break;
+            }
+            std::this_thread::yield();
+        }
+    }
+    const double elapsed = znsbench::wall_seconds() - start;
+
+    znsbench::BenchResult("shmfeed")
+        .add("side", "reader")
+        .add("reader", index)
+        .add("slow", sleep_us != 0 ? "yes" : "no")
+        .add("records", reader.records)
+        .add("bytes", reader.bytes)
+        .add("sec", elapsed)
+        .add("gb_per_sec", reader.bytes / elapsed / 1e9)
+        .add("bad_records", reader.bad)
+        .add("overruns", feed.overruns())
+        .add("dropped_bytes", feed.dropped_bytes())
+        .print();
+    return (reader.bad == 0) ? 0 : 1;
+}
+
+// Publishes total_bytes to readers forked readers, each sleeping sleep_us per callback.
+int run_feed(const std::string &name, std::size_t ring_bytes, std::size_t total_bytes, std::size_t readers,
+             double rate_mb, int sleep_us)
+{
+    int ready_pipe[2];
+    if (::pipe(ready_pipe) < 0) {
+        perror("pipe error:");
+        return 1;
+    }
+
+    std::vector<pid_t> children;
+    {
+        znsreader::ShmFeedPublisher publisher(name, znsreader::ShmFeedFormat::stream_packets, ring_bytes);
+
+        for (std::size_t i = 0; i < readers; i++) {
+            const pid_t pid = ::fork();
+            if (pid == 0) {
+                ::close(ready_pipe[0]);
+                std::exit(run_reader(name, ready_pipe[1], i, sleep_us));
+            }
+            children.push_back(pid);
+        }
+        ::close(ready_pipe[1]);
+
+        for (std::size_t i = 0; i < readers; i++) {
+            char ready;
+            if (::read(ready_pipe[0], &ready, 1) != 1) {
+                perror("reader start error:");
+                return 1;
+            }
+        }
+        ::close(ready_pipe[0]);
+
+        std::vector<unsigned char> batch(RECORD_BYTES * RECORDS_PER_PUBLISH);
+        uint64_t seq = 0;
+        const double start = znsbench::wall_seconds();
+        for (std::size_t published = 0; published < total_bytes; published += batch.size()) {
+            for (std::size_t r = 0; r < RECORDS_PER_PUBLISH; r++, seq++) {
+                unsigned char *record = batch.data() + r * RECORD_BYTES;
+                ::memcpy(record, &seq, sizeof(seq));
+                ::memset(record + sizeof(seq), (unsigned char)seq, RECORD_BYTES - sizeof(seq));
+            }
+            publisher.publish(batch.data(), batch.size());
+
+            if (rate_mb > 0) {
+                const double due = start + (published + batch.size()) / (rate_mb * 1e6);
+                while (znsbench::wall_seconds() < due) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+        const double elapsed = znsbench::wall_seconds() - start;
+
+        znsbench::BenchResult("shmfeed")
+            .add("side", "publisher")
+            .add("readers", readers)
+            .add("huge_pages", (int)publisher.huge_pages())
+            .add("ring_bytes", publisher.capacity())
+            .add("target_mb_per_sec", rate_mb)
+            .add("bytes", total_bytes)
+            .add("sec", elapsed)
+            .add("gb_per_sec", total_bytes / elapsed / 1e9)
+            .print();
+    }
+
+    int failed = 0;
+    for (pid_t pid : children) {
+        int status = 0;
+        ::waitpid(pid, &status, 0);
+        failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+    return failed;
+}
+}
+
+int main(int argc, char **argv)
+{
+    const std::size_t total_bytes = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : (1ull << 30);
+    const std::size_t readers = (argc > 2) ? std::strtoull(argv[2], nullptr, 10) : 2;
+    const double rate_mb = (argc > 3) ? std::atof(argv[3]) : 200;
+    const std::string name = "zns_shmfeed_bench_" + std::to_string(::getpid());
+
+    const int failed = run_feed(name, SHM_BYTES, total_bytes, readers, rate_mb, 0);
+    return failed | run_feed(name + "_slow", SLOW_SHM_BYTES, std::min<std::size_t>(total_bytes, 128 << 20), 1, 400, 20000);
+}
@@ -0,0 +1,233 @@
+// Cross core handoff latency between two pinned threads. A ping pong over a pair of SpscQueues
+// gives the round trip, halved for one way. Then one way through a BasicRingBuffer the way the
+// receive thread hands records to the reader: the producer stamps the TSC into each push and
+// the consumer, spinning on pop_all, subtracts it from its own. Last the streaming rate of an
+// SpscQueue with the consumer never idle. Both threads spin; with a single cpu they yield
+// instead and the numbers are only scheduling. Pass the producer core, the consumer core and
+// the round trips.
+
+#include "bench_util.hpp"
+#include "latencystats.hpp"
+#include "ringbuffer.hpp"
+#include "spscqueue.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <thread>
+#include <vector>
+
+namespace
+{
+bool single_cpu = false;
+
+// Pins the calling thread, false when the core is not available to the process.
+bool pin_self(int core)
+{
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core, &cpus);
+    return ::pthread_setaffinity_np(::pthread_self(), sizeof(cpus), &cpus) == 0;
+}
+
+inline void wait_once()
+{
+    if (single_cpu) {
+        std::this_thread::yield();
+    } else {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+}
+
+void add_percentiles(znsbench::BenchResult &result, std::vector<int64_t> &values)
+{
+    std::sort(values.begin(), values.end());
+    result.add("p50_ns", values[values.size() / 2])
+        .add("p90_ns", values[values.size() * 9 / 10])
+        .add("p99_ns", values[values.size() * 99 / 100])
+        .add("p999_ns", values[values.size() * 999 / 1000])
+        .add("max_ns", values.back());
+}
+
+void bench_ping_pong(int producer_core, int consumer_core, std::size_t round_trips, bool pinned)
+{
+    znsreader::SpscQueue<uint64_t, 64> ping;
+    znsreader::SpscQueue<uint64_t, 64> pong;
+    std::vector<int64_t> one_way_ns(round_trips);
+
+    std::thread echo([&]() {
+        pin_self(consumer_core);
+        uint64_t value;
+        for (std::size_t i = 0; i < round_trips + 1000; i++) {
+            while (!ping.try_pop(value)) {
+                wait_once();
+            }
+            while (!pong.try_push(value)) {
+                wait_once();
+            }
+        }
+    });
+
+    pin_self(producer_core);
+    uint64_t value;
+    // The first thousand warm the caches and the clock.
+    for (std::size_t i = 0; i < round_trips + 1000; i++) {
+        const uint64_t start = znsreader::TscClock::ticks();
+        while (!ping.try_push(i)) {
+            wait_once();
+        }
+        while (!pong.try_pop(value)) {
+            wait_once();
+        }
+        if (i >= 1000) {
+            one_way_ns[i - 1000] = znsreader::TscClock::to_ns(znsreader::TscClock::ticks() - start) / 2;
+        }
+    }
+    echo.join();
+
+    znsbench::BenchResult result("spsc");
+    result.add("case", "spsc_queue_ping_pong")
+        .add("producer_core", producer_core)
+        .add("consumer_core", consumer_core)
+        .add("pinned", pinned ? "yes" : "no")
+        .add("round_trips", round_trips);
+    add_percentiles(result, one_way_ns);
+    result.print();
+}
+
+// One small record per push, stamped with the TSC when the writer fills it.
+struct StampWriter {
+    std::size_t operator()(int, unsigned char *buf, std::size_t) const
+    {
+        const uint64_t now = znsreader::TscClock::ticks();
+        ::memcpy(buf, &now, sizeof(now));
+        return 64;
+    }
+};
+
+struct StampReader {
+    std::vector<int64_t> *one_way_ns;
+    std::size_t *received;
+
+    std::size_t operator()(const unsigned char *data, std::size_t size) const
+    {
+        const uint64_t now = znsreader::TscClock::ticks();
+        for (std::size_t offset = 0; offset < size; offset += 64) {
+            uint64_t stamp;
+            ::memcpy(&stamp, data + offset, sizeof(stamp));
+            if (*received < one_way_ns->size()) {
+                (*one_way_ns)[*received] = znsreader::TscClock::to_ns(now - stamp);
+            }
+            (*received)++;
+        }
+        return size;
+    }
+};
+
+void bench_ring_one_way(int producer_core, int consumer_core, std::size_t pushes, bool pinned)
+{
+    std::vector<int64_t> one_way_ns(pushes);
+    std::size_t received = 0;
+    znsreader::BasicRingBuffer<StampWriter, StampReader, 1024 * 1024> ring(
+        1024 * 1024, false, StampWriter{}, StampReader{ &one_way_ns, &received });
+    std::atomic<bool> done(false);
+
+    std::thread consumer([&]() {
+        pin_self(consumer_core);
+        while (!done.load(std::memory_order_relaxed)) {
+            if (ring.pop_all() == 0) {
+                wait_once();
+            }
+        }
+        ring.pop_all();
+    });
+
+    pin_self(producer_core);
+    const uint64_t gap_ticks = (uint64_t)(2000 / znsreader::TscClock::ns_per_tick());
+    for (std::size_t i = 0; i < pushes; i++) {
+        while (ring.push(0, 64) == 0) {
+            wait_once();
+        }
+        // Space the pushes so each one is handed over on its own, as packets arrive.
+        const uint64_t until = znsreader::TscClock::ticks() + gap_ticks;
+        while (znsreader::TscClock::ticks() < until) {
+            wait_once();
+        }
+    }
+    done.store(true, std::memory_order_relaxed);
+    consumer.join();
+
+    znsbench::BenchResult result("spsc");
+    result.add("case", "ring_one_way")
+        .add("producer_core", producer_core)
+        .add("consumer_core", consumer_core)
+        .add("pinned", pinned ? "yes" : "no")
+        .add("pushes", received);
+    add_percentiles(result, one_way_ns);
+    result.print();
+}
+
+void bench_queue_stream(int producer_core, int consumer_core, std::size_t items, bool pinned)
+{
+    static znsreader::SpscQueue<uint64_t, 4096> queue;
+    uint64_t sum = 0;
+
+    std::thread consumer([&]() {
+        pin_self(consumer_core);
+        uint64_t value;
+        for (std::size_t i = 0; i < items; i++) {
+            while (!queue.try_pop(value)) {
+                wait_once();
+            }
+            sum += value;
+        }
+    });
+
+    pin_self(producer_core);
+    const double start = znsbench::wall_seconds();
+    for (std::size_t i = 0; i < items; i++) {
+        while (!queue.try_push(i)) {
+            wait_once();
+        }
+    }
+    consumer.join();
+    const double elapsed = znsbench::wall_seconds() - start;
+
+    znsbench::BenchResult("spsc")
+        .add("case", "spsc_queue_stream")
+        .add("producer_core", producer_core)
+        .add("consumer_core", consumer_core)
+        .add("pinned", pinned ? "yes" : "no")
+        .add("items", items)
+        .add("ns_per_item", elapsed * 1e9 / items)
+        .add("mitems_per_sec", items / elapsed / 1e6)
+        .add("checksum", sum)
+        .print();
+}
+}
+
+int main(int argc, char **argv)
+{
+    const int producer_core = (argc > 1) ? std::atoi(argv[1]) : 0;
+    const int consumer_core = (argc > 2) ? std::atoi(argv[2]) : 1;
+    const std::size_t round_trips = (argc > 3) ? std::strtoull(argv[3], nullptr, 10) : 1000000;
+
+    single_cpu = std::thread::hardware_concurrency() < 2;
+    // Both cores must be usable, checked from a throwaway thread so main stays unpinned.
+    bool pinned = false;
+    std::thread probe([&]() { pinned = pin_self(producer_core) && pin_self(consumer_core); });
+    probe.join();
+    if (!pinned) {
+        fprintf(stderr, "Cores %d and %d not both available, running unpinned\n", producer_core, consumer_core);
+    }
+
+    bench_ping_pong(producer_core, consumer_core, single_cpu ? round_trips / 100 : round_trips, pinned);
+    bench_ring_one_way(producer_core, consumer_core, single_cpu ? round_trips / 100 : round_trips / 10, pinned);
+    bench_queue_stream(producer_core, consumer_core, round_trips * 10, pinned);
+
+    return 0;
+}
@@ -0,0 +1,109 @@
+// epoll + recvmmsg record writer against the io_uring multishot engine, both behind
+// BasicAggregatedPacketReader on the same loopback traffic. A flood run gives packets per
+// second, a paced run gives send to handler latency percentiles.
+
+#include "bench_util.hpp"
+#include "ringrecord.hpp"
+#include "udpreader.hpp"
+#include "uringrecv.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace
+{
+constexpr std::size_t PACKET_SIZE = 100;
+constexpr short STREAM_COUNT = 16;
+
+// Counts every record and keeps its send to handler latency.
+struct LatencyRecorder {
+    std::atomic<uint64_t> *m_received;
+    std::vector<int64_t> *m_samples;
+
+    std::size_t operator()(znsreader::RingRecordRange records)
+    {
+        const int64_t now_ns = znsreader::realtime_ns();
+        uint64_t count = 0;
+        for (const znsreader::RingRecord record : records) {
+            int64_t sent_ns;
+            ::memcpy(&sent_ns, record.payload(), sizeof(sent_ns));
+            m_samples->push_back(now_ns - sent_ns);
+            count++;
+        }
+        m_received->fetch_add(count, std::memory_order_relaxed);
+        return records.size_bytes();
+    }
+};
+
+template <typename Writer>
+void run_engine(const char *engine, const char *traffic, std::size_t packets, std::chrono::microseconds interval,
+                uint16_t base_port)
+{
+    using Reader = znsreader::BasicAggregatedPacketReader<Writer, znsreader::RingRecordReader<LatencyRecorder>>;
+
+    std::atomic<uint64_t> received = 0;
+    std::vector<int64_t> samples;
+    samples.reserve(packets);
+
+    double cpu_sec = 0;
+    double wall_sec = 0;
+    {
+        Reader reader(znsbench::loopback_config(STREAM_COUNT, base_port), false,
+                      znsreader::RingRecordReader<LatencyRecorder>(LatencyRecorder{ &received, &samples }),
+                      64 * 1024 * 1024);
+
+        std::thread rx([&]() {
+            const double cpu_start = znsbench::thread_cpu_seconds();
+            reader.write_packets_to_ringbuf();
+            cpu_sec = znsbench::thread_cpu_seconds() - cpu_start;
+        });
+        std::thread consumer(&Reader::read_packets_from_ringbuf, &reader);
+
+        const double wall_start = znsbench::wall_seconds();
+        std::thread sender(znsbench::send_packets, base_port, STREAM_COUNT * 2, packets, PACKET_SIZE, interval);
+        sender.join();
+        wall_sec = znsbench::wait_quiet(received, wall_start);
+        reader.stop();
+        rx.join();
+        consumer.join();
+        reader.drain_ringbuf();
+    }
+
+    std::sort(samples.begin(), samples.end());
+    znsbench::BenchResult("uring")
+        .add("engine", engine)
+        .add("traffic", traffic)
+        .add("sent", packets)
+        .add("received", received.load())
+        .add("wall_sec", wall_sec)
+        .add("rx_cpu_sec", cpu_sec)
+        .add("pkts_per_sec", received.load() / wall_sec)
+        .add("pkts_per_core_sec", received.load() / cpu_sec)
+        .add("p50_ns", znsbench::percentile(samples, 0.50))
+        .add("p99_ns", znsbench::percentile(samples, 0.99))
+        .add("p999_ns", znsbench::percentile(samples, 0.999))
+        .print();
+}
+}
+
+int main(int argc, char **argv)
+{
+    const std::size_t flood_packets = (argc > 1) ? std::strtoull(argv[1], nullptr, 10) : 2000000;
+    const std::size_t paced_packets = (argc > 2) ? std::strtoull(argv[2], nullptr, 10) : 20000;
+    const auto interval = std::chrono::microseconds((argc > 3) ? std::atoi(argv[3]) : 100);
+    const uint16_t base_port = (argc > 4) ? std::atoi(argv[4]) : 35000;
+
+    using EpollWriter = znsreader::RecordRecvWriter<32>;
+    using UringWriter = znsreader::UringRecvWriter;
+
+    run_engine<EpollWriter>("epoll", "flood", flood_packets, std::chrono::microseconds(0), base_port);
+    run_engine<UringWriter>("io_uring", "flood", flood_packets, std::chrono::microseconds(0), base_port);
+    run_engine<EpollWriter>("epoll", "paced", paced_packets, interval, base_port);
+    run_engine<UringWriter>("io_uring", "paced", paced_packets, interval, base_port);
+
+    return 0;
+}
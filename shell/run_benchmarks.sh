@@ -0,0 +1,46 @@
+#!/bin/bash
+
+# Runs the core benchmarks at fixed sizes into one JSON lines file, and compares it with a
+# baseline run when one is given, failing on a regression past THRESHOLD_PCT (default 10).
+#   shell/run_benchmarks.sh <build_dir> <results.jsonl> [baseline.jsonl]
+
+set -euo pipefail
+
+if [ $# -lt 2 ]; then
+  echo 1>&2 "$0: requires the build directory and the results file, optionally a baseline"
+  exit 2
+fi
+
+BUILD_DIR=$1
+RESULTS=$2
+BASELINE=${3:-}
+THRESHOLD_PCT=${THRESHOLD_PCT:-10}
+SCRATCH_DIR=$(mktemp -d)
+trap 'rm -rf ${SCRATCH_DIR}' EXIT
+
+: > ${RESULTS}
+
+run() {
+    echo 1>&2 "Running $*"
+    # Only the JSON lines, the benches also log setup to stdout.
+    "${BUILD_DIR}/bench/$1" "${@:2}" | grep '^{' >> ${RESULTS}
+}
+
+run ringbuffer_bench $((256 << 20))
+run spsc_bench 0 1 200000
+run capture_bench 500000 ${SCRATCH_DIR}
+run msgdecoder_bench 16 5
+run orderbook_bench 2000000 4000
+run recv_bench 500000 16
+run e2e_bench 500000 50000
+run binlog_bench $((1 << 20)) ${SCRATCH_DIR}
+run latencystats_bench $((1 << 20)) 10000 ${SCRATCH_DIR}/latency.jsonl
+run feedstats_bench $((1 << 22)) 10001
+run feedgen_bench 500000 100000 50000
+run recovery_bench 200 ${SCRATCH_DIR}
+
+echo 1>&2 "Results in ${RESULTS}"
+
+if [ -n "${BASELINE}" ]; then
+    "${BUILD_DIR}/tools/bench_compare" ${BASELINE} ${RESULTS} ${THRESHOLD_PCT}
+fi
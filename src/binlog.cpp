@@ -0,0 +1,414 @@
+#include "binlog.hpp"
+#include "timeutil.hpp"
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#define ZNS_LOG_FILE_BUFFER (1 << 20)
+// Records taken from one thread's queue before the next queue gets a turn.
+#define ZNS_LOG_DRAIN_BATCH 1024
+
+namespace znsreader
+{
+namespace
+{
+// Binary log layout: log_file_header, then entries, each a log_entry_header and its body.
+struct log_file_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t record_size;
+};
+
+enum class log_entry_type : uint32_t {
+    site = 1,    // log_site_entry, then the format and the file name
+    record = 2,  // LogRecord
+    dropped = 3, // log_dropped_entry
+};
+
+struct log_entry_header {
+    log_entry_type type;
+    uint32_t size; // body bytes
+};
+
+struct log_site_entry {
+    uint32_t id;
+    uint32_t line;
+    uint32_t arg_count;
+    uint32_t format_len;
+    uint32_t file_len;
+    LogArgType types[ZNS_LOG_MAX_ARGS];
+};
+
+struct log_dropped_entry {
+    uint32_t thread;
+    uint64_t count; // records lost since the previous entry for the thread
+    int64_t timestamp_ns;
+};
+
+// Every site that has logged, by id - 1. Sites are statics, so the pointers stay valid.
+struct site_registry {
+    std::mutex lock;
+    std::vector<LogSite *> sites;
+};
+
+site_registry &log_sites()
+{
+    static site_registry registry;
+    return registry;
+}
+
+std::atomic<uint64_t> next_instance(1);
+
+void append_arg(std::string &out, LogArgType type, uint64_t bits)
+{
+    char buf[32];
+    std::to_chars_result result{ buf, std::errc() };
+
+    switch (type) {
+    case LogArgType::int64:
+        result = std::to_chars(buf, buf + sizeof(buf), (int64_t)bits);
+        break;
+    case LogArgType::uint64:
+        result = std::to_chars(buf, buf + sizeof(buf), bits);
+        break;
+    case LogArgType::float64: {
+        double value;
+        ::memcpy(&value, &bits, sizeof(value));
+        result = std::to_chars(buf, buf + sizeof(buf), value);
+        break;
+    }
+    case LogArgType::none:
+        break;
+    }
+
+    out.append(buf, result.ptr);
+}
+
+void append_prefix(std::string &out, int64_t timestamp_ns, uint32_t thread)
+{
+    // Records come in time order per thread, the date only changes once a second.
+    static thread_local time_t date_sec = -1;
+    static thread_local char date[32];
+    const time_t sec = timestamp_ns / 1000000000;
+    long ns = timestamp_ns % 1000000000;
+    char digits[9];
+
+    if (sec != date_sec) {
+        struct tm local;
+        ::localtime_r(&sec, &local);
+        ::strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &local);
+        date_sec = sec;
+    }
+    for (int i = 8; i >= 0; i--, ns /= 10) {
+        digits[i] = '0' + (ns % 10);
+    }
+
+    out += date;
+    out += '.';
+    out.append(digits, sizeof(digits));
+    out += " t";
+    append_arg(out, LogArgType::uint64, thread);
+    out += ' ';
+}
+
+std::string format_prefix(int64_t timestamp_ns, uint32_t thread)
+{
+    std::string prefix;
+    append_prefix(prefix, timestamp_ns, thread);
+    return prefix;
+}
+
+void append_message(std::string &out, const LogSiteInfo &site, const LogRecord &record)
+{
+    std::size_t arg = 0;
+
+    for (std::size_t i = 0; i < site.format.size(); i++) {
+        if (site.format[i] == '{' && i + 1 < site.format.size() && site.format[i + 1] == '}'
+            && arg < site.arg_count) {
+            append_arg(out, site.types[arg], record.args[arg]);
+            arg++;
+            i++;
+        } else {
+            out += site.format[i];
+        }
+    }
+}
+
+LogSiteInfo make_site_info(const LogSite &site)
+{
+    LogSiteInfo info;
+    info.format = site.format;
+    info.file = site.file;
+    info.line = site.line;
+    for (std::size_t i = 0; i < ZNS_LOG_MAX_ARGS && site.types[i] != LogArgType::none; i++) {
+        info.types[i] = site.types[i];
+        info.arg_count++;
+    }
+    return info;
+}
+
+void write_entry(FILE *file, log_entry_type type, const void *body, std::size_t size)
+{
+    const log_entry_header header{ type, (uint32_t)size };
+    ::fwrite(&header, sizeof(header), 1, file);
+    ::fwrite(body, size, 1, file);
+}
+}
+
+uint32_t register_log_site(LogSite &site, const LogArgType *types, std::size_t count)
+{
+    site_registry &registry = log_sites();
+    std::lock_guard<std::mutex> guard(registry.lock);
+
+    if (site.id.load(std::memory_order_relaxed) == 0) {
+        std::copy(types, types + count, site.types);
+        registry.sites.push_back(&site);
+        site.id.store((uint32_t)registry.sites.size(), std::memory_order_release);
+    }
+
+    return site.id.load(std::memory_order_relaxed);
+}
+
+std::string render_log_record(const LogSiteInfo &site, const LogRecord &record)
+{
+    std::string out;
+    append_message(out, site, record);
+    return out;
+}
+
+std::string format_log_line(const LogSiteInfo &site, const LogRecord &record)
+{
+    const std::size_t slash = site.file.rfind('/');
+    std::string line;
+
+    line.reserve(64 + site.format.size());
+    append_prefix(line, record.timestamp_ns, record.thread);
+    line.append(site.file, (slash == std::string::npos) ? 0 : slash + 1);
+    line += ':';
+    append_arg(line, LogArgType::uint64, site.line);
+    line += ' ';
+    append_message(line, site, record);
+    return line;
+}
+
+std::size_t decode_binary_log(const std::string &file_name, FILE *out)
+{
+    FILE *file = ::fopen(file_name.c_str(), "rb");
+    if (file == nullptr) {
+        perror("binary log open error:");
+        throw std::runtime_error("Failed to open binary log");
+    }
+
+    log_file_header header;
+    if (::fread(&header, sizeof(header), 1, file) != 1 || header.magic != ZNS_LOG_MAGIC
+        || header.version != ZNS_LOG_VERSION || header.record_size != sizeof(LogRecord)) {
+        ::fclose(file);
+        throw std::runtime_error("File is not a binary log of this version");
+    }
+
+    std::vector<LogSiteInfo> sites;
+    std::vector<char> body;
+    std::size_t records = 0;
+    log_entry_header entry;
+
+    // A log cut short by a crash ends at the last complete entry.
+    while (::fread(&entry, sizeof(entry), 1, file) == 1) {
+        body.resize(entry.size);
+        if (entry.size != 0 && ::fread(body.data(), entry.size, 1, file) != 1) {
+            break;
+        }
+
+        if (entry.type == log_entry_type::site && entry.size >= sizeof(log_site_entry)) {
+            log_site_entry site;
+            ::memcpy(&site, body.data(), sizeof(site));
+            if (site.id == 0 || sizeof(site) + site.format_len + site.file_len > entry.size
+                || site.arg_count > ZNS_LOG_MAX_ARGS) {
+                break;
+            }
+
+            if (sites.size() < site.id) {
+                sites.resize(site.id);
+            }
+            LogSiteInfo &info = sites[site.id - 1];
+            info.format.assign(body.data() + sizeof(site), site.format_len);
+            info.file.assign(body.data() + sizeof(site) + site.format_len, site.file_len);
+            info.line = site.line;
+            info.arg_count = site.arg_count;
+            std::copy(site.types, site.types + ZNS_LOG_MAX_ARGS, info.types);
+        } else if (entry.type == log_entry_type::record && entry.size == sizeof(LogRecord)) {
+            LogRecord record;
+            ::memcpy(&record, body.data(), sizeof(record));
+            if (record.site == 0 || record.site > sites.size()) {
+                fprintf(out, "%sunknown site %u\n", format_prefix(record.timestamp_ns, record.thread).c_str(),
+                        record.site);
+            } else {
+                fprintf(out, "%s\n", format_log_line(sites[record.site - 1], record).c_str());
+            }
+            records++;
+        } else if (entry.type == log_entry_type::dropped && entry.size == sizeof(log_dropped_entry)) {
+            log_dropped_entry dropped;
+            ::memcpy(&dropped, body.data(), sizeof(dropped));
+            fprintf(out, "%sdropped %lu records, queue full\n",
+                    format_prefix(dropped.timestamp_ns, dropped.thread).c_str(), (unsigned long)dropped.count);
+        }
+    }
+
+    ::fclose(file);
+    return records;
+}
+
+BinaryLogger::BinaryLogger(const std::string &file_name, LogOutput output)
+    : m_instance(next_instance.fetch_add(1, std::memory_order_relaxed)), m_output(output),
+      m_file_buffer(ZNS_LOG_FILE_BUFFER), m_queue_count(0), m_running(true)
+{
+    m_file = ::fopen(file_name.c_str(), (output == LogOutput::binary) ? "wb" : "w");
+    if (m_file == nullptr) {
+        perror("log file open error:");
+        throw std::runtime_error("Failed to open log file");
+    }
+    ::setvbuf(m_file, m_file_buffer.data(), _IOFBF, m_file_buffer.size());
+
+    if (m_output == LogOutput::binary) {
+        const log_file_header header{ ZNS_LOG_MAGIC, ZNS_LOG_VERSION, sizeof(LogRecord) };
+        ::fwrite(&header, sizeof(header), 1, m_file);
+    }
+
+    m_thread = std::thread(&BinaryLogger::run, this);
+}
+
+BinaryLogger::~BinaryLogger()
+{
+    m_running.store(false, std::memory_order_release);
+    m_thread.join();
+    ::fclose(m_file);
+}
+
+uint64_t BinaryLogger::dropped() const
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+    uint64_t total = 0;
+
+    for (const auto &queue : m_queues) {
+        total += queue->dropped.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+BinaryLogger::thread_queue *BinaryLogger::add_thread_queue()
+{
+    std::lock_guard<std::mutex> guard(m_lock);
+
+    m_queues.push_back(std::make_unique<thread_queue>());
+    m_queues.back()->index = (uint32_t)(m_queues.size() - 1);
+    m_queue_count.store(m_queues.size(), std::memory_order_release);
+    return m_queues.back().get();
+}
+
+void BinaryLogger::run()
+{
+    bool unflushed = false;
+
+    while (m_running.load(std::memory_order_acquire)) {
+        if (drain()) {
+            unflushed = true;
+            continue;
+        }
+
+        // Idle: hand what was written to the kernel, so a tail of the log shows it.
+        if (unflushed) {
+            ::fflush(m_file);
+            unflushed = false;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+
+    while (drain()) {
+    }
+    ::fflush(m_file);
+}
+
+bool BinaryLogger::drain()
+{
+    if (m_queue_count.load(std::memory_order_acquire) != m_drain_queues.size()) {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_drain_queues.clear();
+        for (const auto &queue : m_queues) {
+            m_drain_queues.push_back(queue.get());
+        }
+    }
+
+    bool drained = false;
+    LogRecord record;
+
+    for (thread_queue *queue : m_drain_queues) {
+        for (std::size_t i = 0; i < ZNS_LOG_DRAIN_BATCH && queue->records.try_pop(record); i++) {
+            write_record(record);
+            drained = true;
+        }
+
+        if (queue->dropped.load(std::memory_order_relaxed) != queue->dropped_reported) {
+            write_dropped(*queue);
+        }
+    }
+
+    return drained;
+}
+
+const LogSiteInfo &BinaryLogger::site_info(uint32_t id)
+{
+    if (m_sites.size() < id) {
+        site_registry &registry = log_sites();
+        std::lock_guard<std::mutex> guard(registry.lock);
+
+        // Sites are defined in the file in id order, before the first record that uses one.
+        while (m_sites.size() < id) {
+            const uint32_t next = (uint32_t)m_sites.size() + 1;
+            m_sites.push_back(make_site_info(*registry.sites[next - 1]));
+
+            if (m_output == LogOutput::binary) {
+                const LogSiteInfo &info = m_sites.back();
+                std::vector<char> body(sizeof(log_site_entry) + info.format.size() + info.file.size());
+                log_site_entry site{ next, info.line, info.arg_count, (uint32_t)info.format.size(),
+                                     (uint32_t)info.file.size(), {} };
+                std::copy(info.types, info.types + ZNS_LOG_MAX_ARGS, site.types);
+
+                ::memcpy(body.data(), &site, sizeof(site));
+                ::memcpy(body.data() + sizeof(site), info.format.data(), info.format.size());
+                ::memcpy(body.data() + sizeof(site) + info.format.size(), info.file.data(), info.file.size());
+                write_entry(m_file, log_entry_type::site, body.data(), body.size());
+            }
+        }
+    }
+
+    return m_sites[id - 1];
+}
+
+void BinaryLogger::write_record(const LogRecord &record)
+{
+    const LogSiteInfo &site = site_info(record.site);
+
+    if (m_output == LogOutput::binary) {
+        write_entry(m_file, log_entry_type::record, &record, sizeof(record));
+    } else {
+        const std::string line = format_log_line(site, record);
+        ::fwrite(line.data(), line.size(), 1, m_file);
+        ::fputc('\n', m_file);
+    }
+}
+
+void BinaryLogger::write_dropped(thread_queue &queue)
+{
+    const uint64_t dropped = queue.dropped.load(std::memory_order_relaxed);
+    const log_dropped_entry entry{ queue.index, dropped - queue.dropped_reported, realtime_ns() };
+    queue.dropped_reported = dropped;
+
+    if (m_output == LogOutput::binary) {
+        write_entry(m_file, log_entry_type::dropped, &entry, sizeof(entry));
+    } else {
+        fprintf(m_file, "%sdropped %lu records, queue full\n", format_prefix(entry.timestamp_ns, entry.thread).c_str(),
+                (unsigned long)entry.count);
+    }
+}
+}
@@ -0,0 +1,243 @@
+#ifndef __ZNS_BIN_LOG_H
+#define __ZNS_BIN_LOG_H
+
+#include "spscqueue.hpp"
+#include "timeutil.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#define ZNS_LOG_MAX_ARGS    6
+// Records each logging thread can have in flight, 64 bytes apiece.
+#define ZNS_LOG_QUEUE_DEPTH 16384
+#define ZNS_LOG_MAGIC       0x31474f4c4e49425aULL // "ZBINLOG1"
+#define ZNS_LOG_VERSION     1
+
+// Logs one record from the calling thread. fmt is a string literal with a {} per argument,
+// checked when compiling, arguments are integers, enums, bools or floating point. Only the
+// site id, a timestamp and the raw argument values are queued, formatting happens on the
+// logger's thread or offline. The site is constant initialised, so it costs no guard check.
+#define ZNS_LOG(logger, fmt, ...)                                                                                  \
+    do {                                                                                                           \
+        static_assert(::znsreader::log_placeholder_count(fmt)                                                    \
+                          == decltype(::znsreader::log_arg_count(__VA_ARGS__))::value,                           \
+                      "ZNS_LOG: placeholder and argument counts differ");                                        \
+        static ::znsreader::LogSite zns_log_site_{ fmt, __FILE__, __LINE__ };                                    \
+        (logger).log(zns_log_site_ __VA_OPT__(, ) __VA_ARGS__);                                                  \
+    } while (0)
+
+namespace znsreader
+{
+enum class LogArgType : uint8_t {
+    none = 0,
+    int64 = 1,
+    uint64 = 2,
+    float64 = 3,
+};
+
+// binary dumps the records for binlog_decode, text formats them on the logger's thread.
+enum class LogOutput : uint8_t {
+    binary = 0,
+    text = 1,
+};
+
+consteval std::size_t log_placeholder_count(std::string_view fmt)
+{
+    std::size_t count = 0;
+    for (std::size_t i = 0; i + 1 < fmt.size(); i++) {
+        if (fmt[i] == '{' && fmt[i + 1] == '}') {
+            count++;
+            i++;
+        }
+    }
+    return count;
+}
+
+// Only named in ZNS_LOG's static_assert. Takes copies, so packed fields can be passed.
+template <typename... Args>
+std::integral_constant<std::size_t, sizeof...(Args)> log_arg_count(Args...);
+
+// One ZNS_LOG call site. id is given out process wide on the site's first call, from 1.
+struct LogSite {
+    const char *format;
+    const char *file;
+    uint32_t line;
+    std::atomic<uint32_t> id{ 0 };
+    LogArgType types[ZNS_LOG_MAX_ARGS] = {};
+};
+
+struct LogRecord {
+    uint32_t site;
+    uint32_t thread; // logging thread, in the order threads first logged
+    int64_t timestamp_ns;
+    uint64_t args[ZNS_LOG_MAX_ARGS];
+};
+
+static_assert(sizeof(LogRecord) == 64, "Type: LogRecord is not one cache line");
+
+template <typename T>
+constexpr LogArgType log_arg_type()
+{
+    using U = std::remove_cvref_t<T>;
+    static_assert(std::is_arithmetic_v<U> || std::is_enum_v<U>, "ZNS_LOG arguments must be numbers or enums");
+
+    if constexpr (std::is_floating_point_v<U>) {
+        return LogArgType::float64;
+    } else if constexpr (std::is_enum_v<U>) {
+        return std::is_signed_v<std::underlying_type_t<U>> ? LogArgType::int64 : LogArgType::uint64;
+    } else {
+        return std::is_signed_v<U> ? LogArgType::int64 : LogArgType::uint64;
+    }
+}
+
+template <typename T>
+inline uint64_t log_arg_bits(const T &value)
+{
+    using U = std::remove_cvref_t<T>;
+
+    if constexpr (std::is_floating_point_v<U>) {
+        const double widened = value;
+        uint64_t bits;
+        __builtin_memcpy(&bits, &widened, sizeof(bits));
+        return bits;
+    } else if constexpr (std::is_enum_v<U>) {
+        return (uint64_t)(std::underlying_type_t<U>)value;
+    } else if constexpr (std::is_signed_v<U>) {
+        return (uint64_t)(int64_t)value;
+    } else {
+        return (uint64_t)value;
+    }
+}
+
+// A site as read back from a log, for rendering.
+struct LogSiteInfo {
+    std::string format;
+    std::string file;
+    uint32_t line = 0;
+    uint32_t arg_count = 0;
+    LogArgType types[ZNS_LOG_MAX_ARGS] = {};
+};
+
+// Gives site its id, once, and records its argument types for the loggers to write out.
+uint32_t register_log_site(LogSite &site, const LogArgType *types, std::size_t count);
+
+// The record's format with every {} replaced by its argument.
+std::string render_log_record(const LogSiteInfo &site, const LogRecord &record);
+
+// "date time.ns tN file:line message", as the text output and binlog_decode print it.
+std::string format_log_line(const LogSiteInfo &site, const LogRecord &record);
+
+// Renders a binary log written by BinaryLogger to out, one line per record, in the order the
+// background thread wrote them. Returns the records rendered.
+std::size_t decode_binary_log(const std::string &file_name, FILE *out);
+
+// Writes LogRecords to file_name from a background thread. Each logging thread gets its own
+// SpscQueue the first time it logs, so log() never takes a lock or makes a syscall on the
+// way. A full queue drops the record and counts it, the count is written to the log. In
+// binary mode the file holds site definitions, records and drop notes as written, for
+// binlog_decode. Sites are written before the first record that needs them.
+class BinaryLogger
+{
+  public:
+    BinaryLogger() = delete;
+    explicit BinaryLogger(const std::string &file_name, LogOutput output = LogOutput::binary);
+    ~BinaryLogger();
+
+    BinaryLogger(const BinaryLogger &) = delete;
+    BinaryLogger &operator=(BinaryLogger const &) = delete;
+
+    template <typename... Args>
+    void log(LogSite &site, Args... args)
+    {
+        static_assert(sizeof...(Args) <= ZNS_LOG_MAX_ARGS, "ZNS_LOG takes at most ZNS_LOG_MAX_ARGS arguments");
+
+        uint32_t id = site.id.load(std::memory_order_acquire);
+        if (id == 0) [[unlikely]] {
+            const LogArgType types[] = { log_arg_type<Args>()..., LogArgType::none };
+            id = register_log_site(site, types, sizeof...(Args));
+        }
+
+        thread_queue *queue = local_queue();
+
+        LogRecord record{};
+        record.site = id;
+        record.thread = queue->index;
+        record.timestamp_ns = realtime_ns();
+        [[maybe_unused]] std::size_t i = 0;
+        ((record.args[i++] = log_arg_bits(args)), ...);
+
+        if (!queue->records.try_push(record)) {
+            queue->dropped.store(queue->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+    }
+
+    // Records dropped on full queues so far, over every thread.
+    uint64_t dropped() const;
+
+  private:
+    struct thread_queue {
+        uint32_t index;
+        std::atomic<uint64_t> dropped{ 0 };
+        // Owned by the background thread.
+        uint64_t dropped_reported = 0;
+        SpscQueue<LogRecord, ZNS_LOG_QUEUE_DEPTH> records;
+    };
+
+    thread_queue *local_queue()
+    {
+        // This thread's queue in every logger it has logged to, by instance number since a
+        // new logger can take a destroyed one's address. The one used last is tried first,
+        // so alternating loggers costs a short scan rather than a new queue.
+        static thread_local std::vector<std::pair<uint64_t, thread_queue *>> cached_queues;
+        static thread_local std::size_t last_used = 0;
+
+        if (last_used < cached_queues.size() && cached_queues[last_used].first == m_instance) [[likely]] {
+            return cached_queues[last_used].second;
+        }
+
+        for (last_used = 0; last_used < cached_queues.size(); last_used++) {
+            if (cached_queues[last_used].first == m_instance) {
+                return cached_queues[last_used].second;
+            }
+        }
+
+        cached_queues.emplace_back(m_instance, add_thread_queue());
+        return cached_queues[last_used].second;
+    }
+
+    thread_queue *add_thread_queue();
+    void run();
+    bool drain();
+    void write_record(const LogRecord &record);
+    void write_dropped(thread_queue &queue);
+    const LogSiteInfo &site_info(uint32_t id);
+
+    const uint64_t m_instance;
+    FILE *m_file;
+    LogOutput m_output;
+    std::vector<char> m_file_buffer;
+
+    mutable std::mutex m_lock;
+    // Guarded by m_lock, grows as threads first log.
+    std::vector<std::unique_ptr<thread_queue>> m_queues;
+    std::atomic<std::size_t> m_queue_count;
+    // Owned by the background thread: its copy of m_queues and the sites written so far.
+    std::vector<thread_queue *> m_drain_queues;
+    std::vector<LogSiteInfo> m_sites;
+
+    std::atomic<bool> m_running;
+    std::thread m_thread;
+};
+}
+
+#endif // __ZNS_BIN_LOG_H
@@ -0,0 +1,271 @@
+#ifndef __ZNS_BROADCAST_RING_H
+#define __ZNS_BROADCAST_RING_H
+
+#include "ringbuffer.hpp"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// Most a drop consumer may fall behind before it skips to the newest data, and the size of
+// the copy it reads through.
+#define ZNS_BROADCAST_DROP_LAG ((std::size_t)16 << 20)
+
+namespace znsreader
+{
+// block holds the producer back until the consumer has read, drop lets the producer run
+// over it, the consumer then skips ahead and reports the bytes it lost.
+enum class SlowConsumerPolicy : uint8_t {
+    block = 0,
+    drop = 1,
+};
+
+// One reader of a BroadcastRingBuffer. cpu_core < 0 leaves its thread unpinned.
+template <typename Reader>
+struct BroadcastConsumer {
+    Reader m_reader;
+    SlowConsumerPolicy m_policy = SlowConsumerPolicy::block;
+    int32_t m_cpu_core = -1;
+};
+
+// Readers that want to hear about the bytes a drop consumer skipped.
+template <typename Reader>
+concept OverrunReader = requires(Reader &reader) { reader.on_overrun(std::size_t()); };
+
+// Single producer byte ring read by every consumer in Consumers, a std::vector of
+// BroadcastConsumer, each from its own cursor on its own thread. push() has the interface
+// of BasicRingBuffer::push(), so the ring drops into BasicAggregatedPacketReader, and
+// every push ends on a record or packet boundary.
+//
+// The producer only waits for the slowest block consumer. It keeps the cursor it last
+// found there and scans the others only once that one no longer leaves room. Block
+// consumers read the ring in place. Drop consumers copy what they read out first, then
+// check the producer had not claimed any of it for writing meanwhile, the way a seqlock
+// reader does, and skip to the newest push when it had or when they fall
+// ZNS_BROADCAST_DROP_LAG behind.
+template <typename Writer, typename Consumers, std::size_t Capacity = ZNS_DYNAMIC_CAPACITY>
+class BroadcastRingBuffer
+{
+    static_assert(Capacity == ZNS_DYNAMIC_CAPACITY || std::has_single_bit(Capacity),
+                  "BroadcastRingBuffer capacity must be a power of two");
+
+  public:
+    using consumer_type = typename Consumers::value_type;
+
+    BroadcastRingBuffer() = delete;
+    // max_size is ignored when Capacity is fixed at compile time.
+    BroadcastRingBuffer(std::size_t max_size, bool use_huge_pages, Writer writer_fn, Consumers consumers)
+        : m_writer(std::move(writer_fn)),
+          m_memory(ring_size(max_size, use_huge_pages), use_huge_pages),
+          m_mask(m_memory.size() - 1),
+          m_consumers(std::move(consumers)),
+          m_cursors(std::make_unique<consumer_cursor[]>(m_consumers.size())),
+          m_has_drop_consumers(false),
+          m_gating_index(0),
+          m_write_index(0),
+          m_claim_index(0)
+    {
+        if (m_consumers.empty()) {
+            throw std::runtime_error("BroadcastRingBuffer needs a consumer");
+        }
+
+        const std::size_t drop_lag = std::min(ZNS_BROADCAST_DROP_LAG, capacity());
+        for (std::size_t i = 0; i < m_consumers.size(); i++) {
+            if (m_consumers[i].m_policy == SlowConsumerPolicy::drop) {
+                m_cursors[i].scratch.resize(drop_lag);
+                m_has_drop_consumers = true;
+            }
+        }
+    }
+
+    BroadcastRingBuffer(const BroadcastRingBuffer &) = delete;
+    BroadcastRingBuffer &operator=(BroadcastRingBuffer const &) = delete;
+
+    std::size_t capacity() const
+    {
+        return mask() + 1;
+    }
+
+    std::size_t consumer_count() const
+    {
+        return m_consumers.size();
+    }
+
+    const consumer_type &consumer(std::size_t index) const
+    {
+        return m_consumers[index];
+    }
+
+    std::size_t push(int fd, std::size_t max_bytes)
+    {
+        const size_t write_index = m_write_index.load(std::memory_order_relaxed);
+
+        if ((capacity() - (write_index - m_gating_index)) < max_bytes) {
+            m_gating_index = slowest_cursor(write_index);
+            if ((capacity() - (write_index - m_gating_index)) < max_bytes) {
+                return 0;
+            }
+        }
+
+        if (m_has_drop_consumers) {
+            // Drop consumers must see the claim before any byte it covers changes.
+            m_claim_index.store(write_index + max_bytes, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        // Writes past the end land in the mirror, i.e. at the start of the buffer.
+        const std::size_t written_bytes = m_writer(fd, m_memory.data() + (write_index & mask()), max_bytes);
+
+        m_write_index.store(write_index + written_bytes, std::memory_order_release);
+
+        return max_bytes;
+    }
+
+    // Only for the writer thread.
+    Writer &writer()
+    {
+        return m_writer;
+    }
+
+    // Total bytes ever written, only meaningful on the writer thread.
+    std::size_t write_position() const
+    {
+        return m_write_index.load(std::memory_order_relaxed);
+    }
+
+    // Hands everything consumer index has not read yet to its reader. Only for that
+    // consumer's thread. Returns the bytes read, 0 as well when it had to skip.
+    std::size_t pop_all(std::size_t index)
+    {
+        consumer_cursor &cursor = m_cursors[index];
+        const size_t write_index = m_write_index.load(std::memory_order_acquire);
+        const size_t read_index = cursor.read_index.load(std::memory_order_relaxed);
+        const size_t avail = write_index - read_index;
+
+        if (avail == 0) {
+            return 0;
+        }
+
+        if (m_consumers[index].m_policy == SlowConsumerPolicy::block) {
+            // Readable region may run into the mirror, reader still sees it as one span.
+            m_consumers[index].m_reader((const unsigned char *)m_memory.data() + (read_index & mask()), avail);
+        } else {
+            if (avail > cursor.scratch.size()) {
+                skip(index, read_index);
+                return 0;
+            }
+
+            ::memcpy(cursor.scratch.data(), m_memory.data() + (read_index & mask()), avail);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (m_claim_index.load(std::memory_order_relaxed) - read_index > capacity()) {
+                skip(index, read_index);
+                return 0;
+            }
+
+            m_consumers[index].m_reader((const unsigned char *)cursor.scratch.data(), avail);
+        }
+
+        cursor.read_index.store(read_index + avail, std::memory_order_release);
+        return avail;
+    }
+
+    // Bytes a drop consumer skipped and how many times it had to.
+    uint64_t dropped_bytes(std::size_t index) const
+    {
+        return m_cursors[index].dropped_bytes.load(std::memory_order_relaxed);
+    }
+
+    uint64_t overruns(std::size_t index) const
+    {
+        return m_cursors[index].overruns.load(std::memory_order_relaxed);
+    }
+
+  private:
+    struct alignas(64) consumer_cursor {
+        std::atomic<size_t> read_index{ 0 };
+        std::atomic<uint64_t> dropped_bytes{ 0 };
+        std::atomic<uint64_t> overruns{ 0 };
+        // Drop consumers only, what they read is copied here and checked before the reader
+        // sees it.
+        std::vector<unsigned char> scratch;
+    };
+
+    // Lowest cursor of the block consumers, write_index when there are none.
+    size_t slowest_cursor(size_t write_index) const
+    {
+        size_t slowest = write_index;
+
+        for (std::size_t i = 0; i < m_consumers.size(); i++) {
+            if (m_consumers[i].m_policy == SlowConsumerPolicy::block) {
+                const size_t read_index = m_cursors[i].read_index.load(std::memory_order_acquire);
+                if (write_index - read_index > write_index - slowest) {
+                    slowest = read_index;
+                }
+            }
+        }
+
+        return slowest;
+    }
+
+    // Moves a lapped drop consumer to the newest push, always a record boundary.
+    void skip(std::size_t index, size_t read_index)
+    {
+        consumer_cursor &cursor = m_cursors[index];
+        const size_t write_index = m_write_index.load(std::memory_order_acquire);
+        const std::size_t skipped = write_index - read_index;
+
+        cursor.dropped_bytes.store(cursor.dropped_bytes.load(std::memory_order_relaxed) + skipped,
+                                   std::memory_order_relaxed);
+        cursor.overruns.store(cursor.overruns.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        cursor.read_index.store(write_index, std::memory_order_release);
+
+        if constexpr (OverrunReader<decltype(m_consumers[index].m_reader)>) {
+            m_consumers[index].m_reader.on_overrun(skipped);
+        }
+    }
+
+    static inline size_t ring_size(size_t max_size, bool huge_page)
+    {
+        const size_t page = MirroredMapping::page_size(huge_page);
+
+        if constexpr (Capacity != ZNS_DYNAMIC_CAPACITY) {
+            if (Capacity < page) {
+                throw std::runtime_error("BroadcastRingBuffer capacity is smaller than a page");
+            }
+            return Capacity;
+        }
+
+        return std::bit_ceil(std::max(max_size, page));
+    }
+
+    inline size_t mask() const
+    {
+        if constexpr (Capacity != ZNS_DYNAMIC_CAPACITY) {
+            return Capacity - 1;
+        }
+
+        return m_mask;
+    }
+
+    [[no_unique_address]] Writer m_writer;
+    MirroredMapping m_memory;
+    size_t m_mask;
+    Consumers m_consumers;
+    std::unique_ptr<consumer_cursor[]> m_cursors;
+    bool m_has_drop_consumers;
+    // Producer's copy of the slowest block cursor, only rescanned when it runs out of room.
+    size_t m_gating_index;
+    // Indices run freely, only masked when turned into an address.
+    alignas(64) std::atomic<size_t> m_write_index;
+    // Write index plus the push in progress, what drop consumers check their copy against.
+    std::atomic<size_t> m_claim_index;
+};
+}
+
+#endif // __ZNS_BROADCAST_RING_H
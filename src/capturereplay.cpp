@@ -0,0 +1,203 @@
+#include "capturereplay.hpp"
+#include "nsetypes.hpp"
+#include "timeutil.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+
+namespace znsreader
+{
+CaptureReplayServer::CaptureReplayServer(const std::vector<std::filesystem::path> &files, double speed)
+    : m_speed(speed), m_sock(-1), m_batch_count(0)
+{
+    if (speed < 0) {
+        throw std::runtime_error("replay speed must not be negative");
+    }
+
+    for (const auto &file_name : files) {
+        m_files.push_back(std::make_unique<PcapFileReader>(file_name));
+    }
+
+    m_sock = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (m_sock < 0) {
+        throw std::runtime_error("Failed to create socket");
+    }
+
+    std::memset(m_msgs, 0, sizeof(m_msgs));
+    for (unsigned int i = 0; i < ZNS_REPLAY_BATCH; i++) {
+        m_msgs[i].msg_hdr.msg_name = &m_addrs[i];
+        m_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        m_msgs[i].msg_hdr.msg_iov = &m_iovs[i];
+        m_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+}
+
+CaptureReplayServer::~CaptureReplayServer()
+{
+    if (m_sock >= 0) {
+        ::close(m_sock);
+    }
+}
+
+void CaptureReplayServer::redirect(short stream_id, std::string_view ip, uint16_t port)
+{
+    if (stream_id < 0) {
+        throw std::runtime_error("stream ids are incorrect in redirect");
+    }
+
+    if ((std::size_t)stream_id >= m_redirects.size()) {
+        struct sockaddr_in unset;
+        std::memset(&unset, 0, sizeof(unset));
+        m_redirects.resize(stream_id + 1, unset);
+    }
+
+    struct sockaddr_in &addr = m_redirects[stream_id];
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = ip.empty() ? htonl(INADDR_LOOPBACK) : inet_addr(std::string(ip).c_str());
+}
+
+ReplayStats CaptureReplayServer::replay()
+{
+    ReplayStats stats;
+
+    // Earliest next packet over all files on top.
+    using next_packet = std::pair<int64_t, std::size_t>;
+    std::priority_queue<next_packet, std::vector<next_packet>, std::greater<next_packet>> merge;
+
+    for (std::size_t i = 0; i < m_files.size(); i++) {
+        m_files[i]->rewind();
+        int64_t timestamp_ns;
+        if (m_files[i]->peek_timestamp(timestamp_ns)) {
+            merge.push({ timestamp_ns, i });
+        }
+    }
+
+    if (merge.empty()) {
+        return stats;
+    }
+
+    const int64_t first_ts = merge.top().first;
+    int64_t last_ts = first_ts;
+    const int64_t start_ns = monotonic_ns();
+    m_batch_count = 0;
+
+    PcapPacket packet;
+
+    while (!merge.empty()) {
+        const std::size_t file_index = merge.top().second;
+        merge.pop();
+
+        PcapFileReader &file = *m_files[file_index];
+        const bool found = file.next(packet);
+
+        int64_t next_ts;
+        if (file.peek_timestamp(next_ts)) {
+            merge.push({ next_ts, file_index });
+        }
+
+        if (!found) {
+            continue;
+        }
+
+        last_ts = std::max(last_ts, packet.timestamp_ns);
+        int64_t due_ns = 0;
+
+        if (m_speed > 0) {
+            due_ns = start_ns + (int64_t)((packet.timestamp_ns - first_ts) / m_speed);
+            // Whatever is already due goes out before waiting for this one.
+            if (due_ns > monotonic_ns()) {
+                send_batch(stats);
+                wait_until(due_ns);
+            }
+        }
+
+        add_to_batch(packet, due_ns);
+        if (m_batch_count == ZNS_REPLAY_BATCH) {
+            send_batch(stats);
+        }
+    }
+
+    send_batch(stats);
+
+    for (const auto &file : m_files) {
+        stats.packets_skipped += file->skipped();
+    }
+    stats.elapsed_sec = (monotonic_ns() - start_ns) / 1e9;
+    stats.capture_span_sec = (last_ts - first_ts) / 1e9;
+    stats.achieved_pps = (stats.elapsed_sec > 0) ? stats.packets_sent / stats.elapsed_sec : 0;
+    if (m_speed > 0 && stats.capture_span_sec > 0) {
+        stats.target_pps = stats.packets_sent / (stats.capture_span_sec / m_speed);
+    }
+    if (m_speed > 0 && stats.packets_sent != 0) {
+        stats.mean_lag_ns /= (int64_t)stats.packets_sent;
+    }
+
+    return stats;
+}
+
+void CaptureReplayServer::add_to_batch(const PcapPacket &packet, int64_t due_ns)
+{
+    struct sockaddr_in &addr = m_addrs[m_batch_count];
+    const short stream_id =
+        (packet.payload_len >= sizeof(StreamHeader)) ? ((const StreamHeader *)packet.payload)->streamId : -1;
+
+    if (stream_id >= 0 && (std::size_t)stream_id < m_redirects.size() && m_redirects[stream_id].sin_family != 0) {
+        addr = m_redirects[stream_id];
+    } else {
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(packet.dst_port);
+        addr.sin_addr = packet.dst_ip;
+    }
+
+    m_iovs[m_batch_count].iov_base = (void *)packet.payload;
+    m_iovs[m_batch_count].iov_len = packet.payload_len;
+    m_due_ns[m_batch_count] = due_ns;
+    m_batch_count++;
+}
+
+void CaptureReplayServer::send_batch(ReplayStats &stats)
+{
+    unsigned int sent = 0;
+
+    while (sent < m_batch_count) {
+        int ret = ::sendmmsg(m_sock, m_msgs + sent, m_batch_count - sent, 0);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("sendmmsg failed");
+            throw std::runtime_error("sendmmsg failed:");
+        }
+        sent += ret;
+    }
+
+    if (m_batch_count != 0) {
+        stats.batches++;
+        stats.packets_sent += m_batch_count;
+
+        if (m_speed > 0) {
+            const int64_t now = monotonic_ns();
+            for (unsigned int i = 0; i < m_batch_count; i++) {
+                stats.mean_lag_ns += now - m_due_ns[i];
+                stats.max_lag_ns = std::max(stats.max_lag_ns, now - m_due_ns[i]);
+            }
+        }
+    }
+
+    m_batch_count = 0;
+}
+}
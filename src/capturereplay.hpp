@@ -0,0 +1,73 @@
+#ifndef __ZNS_CAPTURE_REPLAY_H
+#define __ZNS_CAPTURE_REPLAY_H
+
+#include "pcapfile.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <netinet/in.h>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <vector>
+
+// Packets handed to one sendmmsg.
+#define ZNS_REPLAY_BATCH 64
+
+namespace znsreader
+{
+// Outcome of one replay. Lag is how long after its scheduled time a packet left, only
+// measured when pacing.
+struct ReplayStats {
+    uint64_t packets_sent = 0;
+    uint64_t packets_skipped = 0; // not IPv4/UDP
+    uint64_t batches = 0;
+    double capture_span_sec = 0;
+    double elapsed_sec = 0;
+    double target_pps = 0; // 0 when not pacing
+    double achieved_pps = 0;
+    int64_t mean_lag_ns = 0;
+    int64_t max_lag_ns = 0;
+};
+
+// Replays pcap captures, as written by either capture writer or by tcpdump, merged across
+// files by capture timestamp and read through PcapFileReader. Each datagram goes to the
+// IPv4/UDP destination recorded in front of it unless its stream is redirected. speed 1
+// keeps the captured gaps between packets, N plays N times faster and 0 sends as fast as the
+// socket takes them. Packets that are due together leave in one sendmmsg, straight from the
+// mapped files.
+class CaptureReplayServer
+{
+  public:
+    CaptureReplayServer() = delete;
+    CaptureReplayServer(const std::vector<std::filesystem::path> &files, double speed);
+    ~CaptureReplayServer();
+
+    CaptureReplayServer(const CaptureReplayServer &) = delete;
+    CaptureReplayServer &operator=(CaptureReplayServer const &) = delete;
+
+    // Sends stream_id's packets to ip:port instead, an empty ip is loopback.
+    void redirect(short stream_id, std::string_view ip, uint16_t port);
+    // Plays every file once from the start. Throws when a send fails.
+    ReplayStats replay();
+
+  private:
+    void add_to_batch(const PcapPacket &packet, int64_t due_ns);
+    void send_batch(ReplayStats &stats);
+
+    std::vector<std::unique_ptr<PcapFileReader>> m_files;
+    double m_speed;
+    int m_sock;
+    // Indexed by stream id, sin_family is 0 for streams that are not redirected.
+    std::vector<struct sockaddr_in> m_redirects;
+
+    unsigned int m_batch_count;
+    struct mmsghdr m_msgs[ZNS_REPLAY_BATCH];
+    struct iovec m_iovs[ZNS_REPLAY_BATCH];
+    struct sockaddr_in m_addrs[ZNS_REPLAY_BATCH];
+    int64_t m_due_ns[ZNS_REPLAY_BATCH];
+};
+}
+
+#endif // __ZNS_CAPTURE_REPLAY_H
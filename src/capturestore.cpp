@@ -0,0 +1,731 @@
+#include "capturestore.hpp"
+#include "nsetypes.hpp"
+#include "timeutil.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace znsreader
+{
+static_assert(ZNS_SEGMENT_SYNC_BYTES % ZNS_SEGMENT_PAGE_SIZE == 0, "ZNS_SEGMENT_SYNC_BYTES is not page aligned");
+
+std::filesystem::path capture_segment_path(const std::filesystem::path &directory, uint64_t index)
+{
+    char file_name[32];
+    std::snprintf(file_name, sizeof(file_name), "segment_%08llu.zseg", (unsigned long long)index);
+    return directory / file_name;
+}
+
+// Indices of the segment files in directory, ascending.
+static std::vector<uint64_t> segment_indices(const std::filesystem::path &directory)
+{
+    std::vector<uint64_t> indices;
+    for (const auto &entry : std::filesystem::directory_iterator(directory)) {
+        const std::string name = entry.path().filename().string();
+        if (name.size() == 21 && name.compare(0, 8, "segment_") == 0 && name.compare(16, 5, ".zseg") == 0) {
+            indices.push_back(std::strtoull(name.c_str() + 8, nullptr, 10));
+        }
+    }
+    std::sort(indices.begin(), indices.end());
+    return indices;
+}
+
+// Room for an entry per index block, whether or not records end up filling them all.
+static std::size_t segment_index_capacity(std::size_t segment_size)
+{
+    return (segment_size / ZNS_SEGMENT_INDEX_BLOCK) + 1;
+}
+
+std::size_t segment_index_offset(std::size_t segment_size)
+{
+    const std::size_t index_bytes = segment_index_capacity(segment_size) * sizeof(SegmentIndexEntry);
+    return segment_size - ZNS_SEGMENT_PAGE_SIZE
+           - ((index_bytes + ZNS_SEGMENT_PAGE_SIZE - 1) & ~(std::size_t)(ZNS_SEGMENT_PAGE_SIZE - 1));
+}
+
+static std::size_t next_index_boundary(std::size_t record_offset)
+{
+    return ((record_offset / ZNS_SEGMENT_INDEX_BLOCK) + 1) * ZNS_SEGMENT_INDEX_BLOCK;
+}
+
+static void index_record(SegmentIndexEntry *entries, SegmentFooter &footer, std::size_t record_offset,
+                         int64_t timestamp_ns, const int64_t *seq_no_before)
+{
+    SegmentIndexEntry &entry = entries[footer.index_count];
+    entry.offset = record_offset;
+    entry.timestamp_ns = timestamp_ns;
+    std::memcpy(entry.seq_no_before, seq_no_before, sizeof(entry.seq_no_before));
+    footer.index_count++;
+}
+
+SegmentedCaptureStore::SegmentedCaptureStore(const std::filesystem::path &directory, std::size_t segment_size,
+                                             std::chrono::seconds rotate_after)
+    : m_directory(directory),
+      m_segment_size(segment_size),
+      m_rotate_after_ns(std::chrono::duration_cast<std::chrono::nanoseconds>(rotate_after).count()),
+      m_latest_seq_no(ZNS_SEGMENT_MAX_STREAMS, 0),
+      m_active(nullptr),
+      m_sync_requested(0),
+      m_next_index(0),
+      m_spare_index(0),
+      m_active_published(nullptr),
+      m_running(true),
+      m_work_pending(0),
+      m_retired(std::make_unique<SpscQueue<segment_file *, 4>>()),
+      m_spares(std::make_unique<SpscQueue<segment_file *, 4>>())
+{
+    // Room for the header, the footer and the largest record RingRecordHeader can frame.
+    if (segment_size % ZNS_SEGMENT_PAGE_SIZE != 0 || segment_size < ((std::size_t)1 << 20)) {
+        throw std::runtime_error("segment size must be a multiple of ZNS_SEGMENT_PAGE_SIZE and at least 1MB");
+    }
+
+    std::filesystem::create_directories(m_directory);
+    resume();
+
+    m_sync_requested = m_active->footer->data_end;
+    // No spare is prepared yet.
+    m_spare_index = m_active->index;
+    m_active_published.store(m_active, std::memory_order_release);
+    m_io_thread = std::thread(&SegmentedCaptureStore::run, this);
+}
+
+SegmentedCaptureStore::~SegmentedCaptureStore()
+{
+    // The I/O thread seals the active segment on its way out.
+    m_active_published.store(nullptr, std::memory_order_release);
+    m_retired->try_push(m_active);
+    m_running.store(false, std::memory_order_release);
+    wake();
+    m_io_thread.join();
+
+    // A spare that was never used is not worth its preallocated space on disk.
+    segment_file *spare;
+    while (m_spares->try_pop(spare)) {
+        const std::filesystem::path path = capture_segment_path(m_directory, spare->index);
+        release_segment(spare);
+        ::unlink(path.c_str());
+    }
+}
+
+uint64_t SegmentedCaptureStore::segment_index() const
+{
+    return m_active->index;
+}
+
+int64_t SegmentedCaptureStore::latest_seq_no(short stream_id) const
+{
+    if (stream_id < 0 || stream_id >= ZNS_SEGMENT_MAX_STREAMS) {
+        return 0;
+    }
+    return m_latest_seq_no[stream_id];
+}
+
+int SegmentedCaptureStore::ingest_record(const RingRecord &record)
+{
+    return append(record.header(), record.payload());
+}
+
+int SegmentedCaptureStore::ingest_packet(const unsigned char *packet, size_t packet_len, int64_t recv_timestamp_ns)
+{
+    if (packet_len > UINT16_MAX) {
+        return -1;
+    }
+
+    if (recv_timestamp_ns == 0) {
+        recv_timestamp_ns = realtime_ns();
+    }
+
+    RingRecordHeader hdr;
+    hdr.length = packet_len;
+    hdr.line = FeedLine::primary;
+    hdr.flags = 0;
+    hdr.stream_id = 0;
+    hdr.reserved2 = 0;
+    hdr.recv_timestamp_ns = recv_timestamp_ns;
+
+    return append(hdr, packet);
+}
+
+int SegmentedCaptureStore::append(const RingRecordHeader &hdr, const unsigned char *payload)
+{
+    if (hdr.length < sizeof(StreamHeader)) {
+        return -1;
+    }
+
+    const short stream_id = ((const StreamPacket *)payload)->streamHdr.streamId;
+    const int seq_number = ((const StreamPacket *)payload)->streamHdr.seqNo;
+
+    if (stream_id < 0 || stream_id >= ZNS_SEGMENT_MAX_STREAMS) {
+        return -1;
+    }
+
+    if (seq_number != 0 && seq_number <= m_latest_seq_no[stream_id]) {
+        return 0;
+    }
+
+    const std::size_t record_size = ring_record_size(hdr.length);
+    SegmentFooter *footer = m_active->footer;
+
+    if ((footer->data_end + record_size) > m_active->data_limit
+        || (m_rotate_after_ns != 0 && footer->record_count != 0
+            && (hdr.recv_timestamp_ns - footer->first_timestamp_ns) >= m_rotate_after_ns)) {
+        rotate();
+        footer = m_active->footer;
+    }
+
+    // The record first, then the footer that covers it.
+    unsigned char *dst = m_active->base + footer->data_end;
+    RingRecordHeader *stored = (RingRecordHeader *)dst;
+    *stored = hdr;
+    stored->stream_id = stream_id;
+    ::memcpy(dst + sizeof(RingRecordHeader), payload, hdr.length);
+
+    if (footer->data_end >= m_active->next_index_at) {
+        index_record(m_active->index_entries, *footer, footer->data_end, hdr.recv_timestamp_ns,
+                     m_latest_seq_no.data());
+        m_active->next_index_at = next_index_boundary(footer->data_end);
+    }
+
+    if (footer->record_count == 0) {
+        footer->first_timestamp_ns = hdr.recv_timestamp_ns;
+    }
+    footer->last_timestamp_ns = hdr.recv_timestamp_ns;
+    footer->last_record = footer->data_end;
+    footer->data_end += record_size;
+    footer->record_count++;
+
+    if (seq_number != 0) {
+        m_latest_seq_no[stream_id] = seq_number;
+        footer->last_seq_no[stream_id] = seq_number;
+    }
+
+    m_active->written.store(footer->data_end, std::memory_order_release);
+    if ((footer->data_end - m_sync_requested) >= ZNS_SEGMENT_SYNC_BYTES) {
+        m_sync_requested = footer->data_end;
+        wake();
+    }
+
+    return hdr.length;
+}
+
+void SegmentedCaptureStore::flush()
+{
+    m_sync_requested = m_active->footer->data_end;
+    wake();
+}
+
+void SegmentedCaptureStore::rotate()
+{
+    segment_file *spare;
+
+    // Only when the I/O thread is still preallocating the spare, or failing to.
+    while (!m_spares->try_pop(spare)) {
+        wake();
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    activate(*spare);
+
+    segment_file *retired = m_active;
+    m_active = spare;
+    m_sync_requested = m_active->footer->data_end;
+    // The spare just taken is the last one the I/O thread prepared, so m_spare_index already
+    // names it and the I/O thread prepares the next once it sees it published.
+    m_active_published.store(m_active, std::memory_order_release);
+
+    // Never full, a spare is only handed out when the previous one has been taken.
+    m_retired->try_push(retired);
+    wake();
+}
+
+void SegmentedCaptureStore::activate(segment_file &segment)
+{
+    SegmentFooter *footer = segment.footer;
+
+    footer->record_count = 0;
+    footer->data_end = ZNS_SEGMENT_PAGE_SIZE;
+    footer->last_record = ZNS_SEGMENT_PAGE_SIZE;
+    footer->index_count = 0;
+    footer->first_timestamp_ns = 0;
+    footer->last_timestamp_ns = 0;
+    for (std::size_t i = 0; i < ZNS_SEGMENT_MAX_STREAMS; i++) {
+        footer->last_seq_no[i] = m_latest_seq_no[i];
+    }
+    footer->state = SegmentState::open;
+
+    segment.next_index_at = ZNS_SEGMENT_PAGE_SIZE;
+    segment.written.store(footer->data_end, std::memory_order_release);
+}
+
+void SegmentedCaptureStore::wake()
+{
+    m_work_pending.fetch_add(1, std::memory_order_release);
+    m_work_pending.notify_one();
+}
+
+void SegmentedCaptureStore::resume()
+{
+    std::vector<uint64_t> indices = segment_indices(m_directory);
+    std::reverse(indices.begin(), indices.end());
+
+    // Spares hold nothing and are overwritten, unreadable files are left alone.
+    uint64_t next_free = 0;
+    SegmentFooter newest;
+    bool found = false;
+
+    for (const uint64_t index : indices) {
+        if (!read_footer(index, newest)) {
+            std::cout << "Skipping unreadable capture segment: " << capture_segment_path(m_directory, index)
+                      << std::endl;
+            next_free = std::max(next_free, index + 1);
+            continue;
+        }
+
+        if (newest.state != SegmentState::spare) {
+            found = true;
+            next_free = std::max(next_free, index + 1);
+            if (newest.state == SegmentState::open) {
+                const std::size_t size = std::filesystem::file_size(capture_segment_path(m_directory, index));
+                m_active = map_segment(index, size, false);
+                if (!footer_matches_records(*m_active)) {
+                    rescan(*m_active);
+                }
+                newest = *m_active->footer;
+            }
+            break;
+        }
+    }
+
+    if (found) {
+        for (std::size_t i = 0; i < ZNS_SEGMENT_MAX_STREAMS; i++) {
+            m_latest_seq_no[i] = newest.last_seq_no[i];
+        }
+    }
+
+    if (m_active == nullptr) {
+        m_active = map_segment(next_free, m_segment_size, true);
+        activate(*m_active);
+        next_free++;
+    }
+
+    m_next_index = std::max(next_free, m_active->index + 1);
+}
+
+bool SegmentedCaptureStore::read_footer(uint64_t index, SegmentFooter &footer)
+{
+    const std::filesystem::path path = capture_segment_path(m_directory, index);
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat file_stat;
+    bool ok = ::fstat(fd, &file_stat) == 0 && file_stat.st_size >= 2 * ZNS_SEGMENT_PAGE_SIZE
+              && ::pread(fd, &footer, sizeof(footer), file_stat.st_size - ZNS_SEGMENT_PAGE_SIZE)
+                     == (ssize_t)sizeof(footer)
+              && footer.magic == ZNS_SEGMENT_MAGIC;
+
+    ::close(fd);
+    return ok;
+}
+
+bool SegmentedCaptureStore::footer_matches_records(const segment_file &segment)
+{
+    const SegmentFooter &footer = *segment.footer;
+
+    if (footer.data_end < ZNS_SEGMENT_PAGE_SIZE || footer.data_end > segment.data_limit
+        || footer.index_count > segment_index_capacity(segment.size)) {
+        return false;
+    }
+    if (footer.record_count == 0) {
+        return footer.data_end == ZNS_SEGMENT_PAGE_SIZE && footer.index_count == 0;
+    }
+    if (footer.last_record < ZNS_SEGMENT_PAGE_SIZE || footer.last_record + sizeof(RingRecordHeader) > footer.data_end
+        || footer.index_count == 0 || segment.index_entries[footer.index_count - 1].offset > footer.last_record) {
+        return false;
+    }
+
+    // The record the footer calls the last one has to end exactly at data_end and carry the
+    // seqNo the footer has for its stream.
+    const RingRecord last(segment.base + footer.last_record);
+    const short stream_id = last.header().stream_id;
+    if (last.payload_len() < sizeof(StreamHeader) || footer.last_record + last.record_size() != footer.data_end
+        || stream_id < 0 || stream_id >= ZNS_SEGMENT_MAX_STREAMS) {
+        return false;
+    }
+
+    const int seq_number = ((const StreamPacket *)last.payload())->streamHdr.seqNo;
+    return seq_number == 0 || footer.last_seq_no[stream_id] == seq_number;
+}
+
+void SegmentedCaptureStore::rescan(segment_file &segment)
+{
+    std::cout << "Capture segment footer does not match its records, rescanning: "
+              << capture_segment_path(m_directory, segment.index) << std::endl;
+
+    SegmentFooter &footer = *segment.footer;
+    SegmentFooter previous;
+    if (segment.index == 0 || !read_footer(segment.index - 1, previous)) {
+        std::memset(previous.last_seq_no, 0, sizeof(previous.last_seq_no));
+    }
+
+    footer.record_count = 0;
+    footer.data_end = ZNS_SEGMENT_PAGE_SIZE;
+    footer.last_record = ZNS_SEGMENT_PAGE_SIZE;
+    footer.index_count = 0;
+    footer.first_timestamp_ns = 0;
+    footer.last_timestamp_ns = 0;
+    std::memcpy(footer.last_seq_no, previous.last_seq_no, sizeof(footer.last_seq_no));
+    segment.next_index_at = ZNS_SEGMENT_PAGE_SIZE;
+
+    // Preallocated space reads back as zeroes, so the walk stops at the first empty header.
+    const std::size_t limit = segment.data_limit;
+    std::size_t offset = ZNS_SEGMENT_PAGE_SIZE;
+
+    while (offset + sizeof(RingRecordHeader) <= limit) {
+        const RingRecord record(segment.base + offset);
+        const short stream_id = record.header().stream_id;
+        if (record.payload_len() < sizeof(StreamHeader) || stream_id < 0 || stream_id >= ZNS_SEGMENT_MAX_STREAMS
+            || offset + record.record_size() > limit) {
+            break;
+        }
+
+        if (offset >= segment.next_index_at) {
+            index_record(segment.index_entries, footer, offset, record.header().recv_timestamp_ns, footer.last_seq_no);
+            segment.next_index_at = next_index_boundary(offset);
+        }
+
+        const int seq_number = ((const StreamPacket *)record.payload())->streamHdr.seqNo;
+        if (seq_number != 0) {
+            footer.last_seq_no[stream_id] = std::max<int64_t>(footer.last_seq_no[stream_id], seq_number);
+        }
+
+        if (footer.record_count == 0) {
+            footer.first_timestamp_ns = record.header().recv_timestamp_ns;
+        }
+        footer.last_timestamp_ns = record.header().recv_timestamp_ns;
+        footer.last_record = offset;
+        footer.record_count++;
+        offset += record.record_size();
+        footer.data_end = offset;
+    }
+
+    segment.written.store(footer.data_end, std::memory_order_release);
+}
+
+SegmentedCaptureStore::segment_file *SegmentedCaptureStore::map_segment(uint64_t index, std::size_t size, bool fresh)
+{
+    const std::filesystem::path path = capture_segment_path(m_directory, index);
+
+    int fd = ::open(path.c_str(), O_CREAT | O_RDWR, (S_IRUSR | S_IWUSR | S_IWGRP | S_IRGRP));
+    if (fd < 0) {
+        perror("open error:");
+        throw std::runtime_error("Failed to create/open segment: " + path.string());
+    }
+
+    // Whole extents up front, so appends never allocate blocks or grow the file. A filesystem
+    // without fallocate gets a sparse file instead.
+    if (fresh && (::ftruncate(fd, size) != 0 || (::fallocate(fd, 0, 0, size) != 0 && errno != EOPNOTSUPP))) {
+        perror("fallocate error:");
+        ::close(fd);
+        throw std::runtime_error("Failed to preallocate segment: " + path.string());
+    }
+
+    void *base = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        perror("mmap error:");
+        ::close(fd);
+        throw std::runtime_error("Failed to map segment: " + path.string());
+    }
+
+    segment_file *segment = new segment_file;
+    segment->fd = fd;
+    segment->index = index;
+    segment->size = size;
+    segment->base = (unsigned char *)base;
+    segment->index_entries = (SegmentIndexEntry *)(segment->base + segment_index_offset(size));
+    segment->footer = (SegmentFooter *)(segment->base + size - ZNS_SEGMENT_PAGE_SIZE);
+    segment->data_limit = segment_index_offset(size);
+
+    if (fresh) {
+        SegmentFileHeader *header = (SegmentFileHeader *)segment->base;
+        header->magic = ZNS_SEGMENT_MAGIC;
+        header->version = 1;
+        header->reserved = 0;
+        header->segment_index = index;
+        header->segment_size = size;
+
+        std::memset(segment->footer, 0, sizeof(SegmentFooter));
+        segment->footer->magic = ZNS_SEGMENT_MAGIC;
+        segment->footer->state = SegmentState::spare;
+        segment->footer->data_end = ZNS_SEGMENT_PAGE_SIZE;
+        segment->footer->last_record = ZNS_SEGMENT_PAGE_SIZE;
+    }
+
+    const uint64_t index_count = segment->footer->index_count;
+    segment->next_index_at = (index_count == 0 || index_count > segment_index_capacity(size))
+                                 ? ZNS_SEGMENT_PAGE_SIZE
+                                 : next_index_boundary(segment->index_entries[index_count - 1].offset);
+    segment->written.store(segment->footer->data_end, std::memory_order_relaxed);
+    segment->synced = segment->footer->data_end & ~(std::size_t)(ZNS_SEGMENT_PAGE_SIZE - 1);
+
+    return segment;
+}
+
+void SegmentedCaptureStore::run()
+{
+    for (;;) {
+        m_work_pending.wait(0, std::memory_order_acquire);
+        m_work_pending.exchange(0, std::memory_order_acq_rel);
+        const bool stopping = !m_running.load(std::memory_order_acquire);
+
+        // A retired segment is only ever released here, so the active one read below stays
+        // mapped while it is synced even if the ingest thread retires it meanwhile.
+        segment_file *segment;
+        while (m_retired->try_pop(segment)) {
+            seal_segment(segment);
+        }
+
+        segment_file *active = m_active_published.load(std::memory_order_acquire);
+        if (active != nullptr) {
+            sync_segment(*active);
+
+            if (active->index == m_spare_index && !stopping) {
+                try {
+                    segment_file *spare = map_segment(m_next_index, m_segment_size, true);
+                    m_spare_index = m_next_index++;
+                    m_spares->try_push(spare);
+                } catch (const std::exception &e) {
+                    // Retried on the next wake up, the ingest thread keeps waking us while it waits.
+                    std::cout << "Failed to preallocate capture segment: " << e.what() << std::endl;
+                }
+            }
+        }
+
+        if (stopping) {
+            return;
+        }
+    }
+}
+
+void SegmentedCaptureStore::sync_segment(segment_file &segment)
+{
+    const std::size_t written = segment.written.load(std::memory_order_acquire);
+
+    if (written > segment.synced) {
+        if (::msync(segment.base + segment.synced, written - segment.synced, MS_SYNC) != 0) {
+            perror("msync error:");
+        }
+
+        // Whole pages behind the writer are clean now and never touched again.
+        const std::size_t done = written & ~(std::size_t)(ZNS_SEGMENT_PAGE_SIZE - 1);
+        if (done > segment.synced) {
+            ::madvise(segment.base + segment.synced, done - segment.synced, MADV_DONTNEED);
+            segment.synced = done;
+        }
+    }
+
+    // Index and footer, only their dirty pages are written.
+    if (::msync(segment.index_entries, segment.size - segment.data_limit, MS_SYNC) != 0) {
+        perror("msync error:");
+    }
+}
+
+void SegmentedCaptureStore::seal_segment(segment_file *segment)
+{
+    // Nothing to keep, its footer only repeats the previous segment's seqNos.
+    if (segment->footer->record_count == 0) {
+        const std::filesystem::path path = capture_segment_path(m_directory, segment->index);
+        release_segment(segment);
+        ::unlink(path.c_str());
+        return;
+    }
+
+    segment->footer->state = SegmentState::sealed;
+    if (::msync(segment->base, segment->size, MS_SYNC) != 0) {
+        perror("msync error:");
+    }
+    release_segment(segment);
+}
+
+void SegmentedCaptureStore::release_segment(segment_file *segment)
+{
+    ::munmap(segment->base, segment->size);
+    ::close(segment->fd);
+    delete segment;
+}
+
+// First record at or after offset that match() accepts, data_end when there is none.
+template <typename Match>
+static std::size_t walk_records(const unsigned char *base, std::size_t offset, std::size_t data_end, Match match)
+{
+    while (offset < data_end) {
+        const RingRecord record(base + offset);
+        if (match(record)) {
+            return offset;
+        }
+        offset += record.record_size();
+    }
+    return data_end;
+}
+
+CaptureSegmentReader::CaptureSegmentReader(const std::filesystem::path &file_name)
+{
+    int fd = ::open(file_name.c_str(), O_RDONLY);
+    if (fd < 0) {
+        perror("open error:");
+        throw std::runtime_error("Failed to open segment: " + file_name.string());
+    }
+
+    struct stat file_stat;
+    if (::fstat(fd, &file_stat) != 0 || file_stat.st_size < ((off_t)1 << 20)
+        || file_stat.st_size % ZNS_SEGMENT_PAGE_SIZE != 0) {
+        ::close(fd);
+        throw std::runtime_error("Not a capture segment: " + file_name.string());
+    }
+
+    m_size = file_stat.st_size;
+    void *base = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+        perror("mmap error:");
+        throw std::runtime_error("Failed to map segment: " + file_name.string());
+    }
+
+    m_base = (const unsigned char *)base;
+    m_index_entries = (const SegmentIndexEntry *)(m_base + segment_index_offset(m_size));
+    m_footer = *(const SegmentFooter *)(m_base + m_size - ZNS_SEGMENT_PAGE_SIZE);
+
+    if (m_footer.magic != ZNS_SEGMENT_MAGIC || m_footer.data_end < ZNS_SEGMENT_PAGE_SIZE
+        || m_footer.data_end > segment_index_offset(m_size) || m_footer.index_count > segment_index_capacity(m_size)) {
+        ::munmap(base, m_size);
+        throw std::runtime_error("Corrupt capture segment footer: " + file_name.string());
+    }
+}
+
+CaptureSegmentReader::~CaptureSegmentReader()
+{
+    ::munmap((void *)m_base, m_size);
+}
+
+std::size_t CaptureSegmentReader::find_time(int64_t timestamp_ns) const
+{
+    // The last indexed block starting before timestamp_ns holds the first record at or after it.
+    const SegmentIndexEntry *end = m_index_entries + m_footer.index_count;
+    const SegmentIndexEntry *after = std::partition_point(m_index_entries, end, [timestamp_ns](const SegmentIndexEntry &e) {
+        return e.timestamp_ns < timestamp_ns;
+    });
+    const std::size_t offset = (after == m_index_entries) ? ZNS_SEGMENT_PAGE_SIZE : (after - 1)->offset;
+
+    return walk_records(m_base, offset, m_footer.data_end, [timestamp_ns](const RingRecord &record) {
+        return record.header().recv_timestamp_ns >= timestamp_ns;
+    });
+}
+
+std::size_t CaptureSegmentReader::find_seq(short stream_id, int64_t seq_no) const
+{
+    if (stream_id < 0 || stream_id >= ZNS_SEGMENT_MAX_STREAMS) {
+        return m_footer.data_end;
+    }
+
+    // seqNos only grow per stream, so the entries' seq_no_before do too.
+    const SegmentIndexEntry *end = m_index_entries + m_footer.index_count;
+    const SegmentIndexEntry *after =
+        std::partition_point(m_index_entries, end, [stream_id, seq_no](const SegmentIndexEntry &e) {
+            return e.seq_no_before[stream_id] < seq_no;
+        });
+    const std::size_t offset = (after == m_index_entries) ? ZNS_SEGMENT_PAGE_SIZE : (after - 1)->offset;
+
+    return walk_records(m_base, offset, m_footer.data_end, [stream_id, seq_no](const RingRecord &record) {
+        return record.header().stream_id == stream_id
+               && ((const StreamPacket *)record.payload())->streamHdr.seqNo >= seq_no;
+    });
+}
+
+CaptureStoreReader::CaptureStoreReader(const std::filesystem::path &directory)
+{
+    for (const uint64_t index : segment_indices(directory)) {
+        auto segment = std::make_unique<CaptureSegmentReader>(capture_segment_path(directory, index));
+        if (segment->footer().state != SegmentState::spare) {
+            m_segments.push_back(std::move(segment));
+        }
+    }
+}
+
+CaptureStoreReader::Cursor CaptureStoreReader::begin() const
+{
+    return Cursor(*this, 0, ZNS_SEGMENT_PAGE_SIZE, -1);
+}
+
+CaptureStoreReader::Cursor CaptureStoreReader::seek_time(int64_t timestamp_ns) const
+{
+    const auto segment = std::partition_point(m_segments.begin(), m_segments.end(),
+                                              [timestamp_ns](const std::unique_ptr<CaptureSegmentReader> &s) {
+                                                  return s->footer().last_timestamp_ns < timestamp_ns;
+                                              });
+    if (segment == m_segments.end()) {
+        return Cursor(*this, m_segments.size(), 0, -1);
+    }
+
+    return Cursor(*this, segment - m_segments.begin(), (*segment)->find_time(timestamp_ns), -1);
+}
+
+CaptureStoreReader::Cursor CaptureStoreReader::seek_seq(short stream_id, int64_t seq_no) const
+{
+    if (stream_id < 0 || stream_id >= ZNS_SEGMENT_MAX_STREAMS) {
+        return Cursor(*this, m_segments.size(), 0, stream_id);
+    }
+
+    const auto segment = std::partition_point(m_segments.begin(), m_segments.end(),
+                                              [stream_id, seq_no](const std::unique_ptr<CaptureSegmentReader> &s) {
+                                                  return s->footer().last_seq_no[stream_id] < seq_no;
+                                              });
+    if (segment == m_segments.end()) {
+        return Cursor(*this, m_segments.size(), 0, stream_id);
+    }
+
+    return Cursor(*this, segment - m_segments.begin(), (*segment)->find_seq(stream_id, seq_no), stream_id);
+}
+
+CaptureStoreReader::Cursor::Cursor(const CaptureStoreReader &reader, std::size_t segment, std::size_t offset,
+                                   short stream_id)
+    : m_reader(&reader), m_segment(segment), m_pos(nullptr), m_end(nullptr), m_stream_id(stream_id)
+{
+    if (m_segment < m_reader->m_segments.size()) {
+        const RingRecordRange records = m_reader->m_segments[m_segment]->records(offset);
+        m_pos = records.data();
+        m_end = records.data() + records.size_bytes();
+    }
+}
+
+std::optional<RingRecord> CaptureStoreReader::Cursor::next()
+{
+    for (;;) {
+        while (m_pos < m_end) {
+            const RingRecord record(m_pos);
+            m_pos += record.record_size();
+            if (m_stream_id < 0 || record.header().stream_id == m_stream_id) {
+                return record;
+            }
+        }
+
+        if (m_segment + 1 >= m_reader->m_segments.size()) {
+            m_segment = m_reader->m_segments.size();
+            return std::nullopt;
+        }
+
+        const RingRecordRange records = m_reader->m_segments[++m_segment]->records();
+        m_pos = records.data();
+        m_end = records.data() + records.size_bytes();
+    }
+}
+}
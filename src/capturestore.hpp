@@ -0,0 +1,248 @@
+#ifndef __ZNS_CAPTURE_STORE_H
+#define __ZNS_CAPTURE_STORE_H
+
+#include "ringrecord.hpp"
+#include "spscqueue.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+// Segment header and footer each take one page, records sit between them.
+#define ZNS_SEGMENT_PAGE_SIZE    4096
+#define ZNS_SEGMENT_DEFAULT_SIZE ((std::size_t)256 << 20)
+// Appended bytes after which the I/O thread is woken to msync them and drop them from the mapping.
+#define ZNS_SEGMENT_SYNC_BYTES   ((std::size_t)8 << 20)
+#define ZNS_SEGMENT_MAX_STREAMS  64
+// Record bytes covered by one sparse index entry, the most a seek walks past its entry.
+#define ZNS_SEGMENT_INDEX_BLOCK  (64 * 1024)
+#define ZNS_SEGMENT_MAGIC        0x31474553534e5aULL // "ZNSSEG1"
+
+namespace znsreader
+{
+enum class SegmentState : uint32_t {
+    spare = 0, // preallocated ahead of time, holds no records
+    open = 1,  // being appended to, or the process stopped before sealing it
+    sealed = 2,
+};
+
+// First page of a segment file.
+struct SegmentFileHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t segment_index;
+    uint64_t segment_size;
+};
+
+// Last page of a segment file. Every append updates it in the mapping, so a restart reads
+// it instead of the records.
+struct SegmentFooter {
+    uint64_t magic;
+    SegmentState state;
+    uint32_t reserved;
+    uint64_t record_count;
+    uint64_t data_end;    // file offset one past the last record
+    uint64_t last_record; // file offset of the last record, meaningless while record_count is 0
+    uint64_t index_count;
+    int64_t first_timestamp_ns;
+    int64_t last_timestamp_ns;
+    // Highest seqNo stored per stream id, including the segments before this one. 0 for none.
+    int64_t last_seq_no[ZNS_SEGMENT_MAX_STREAMS];
+};
+
+// Written for the first record that starts at or past each ZNS_SEGMENT_INDEX_BLOCK boundary.
+// Entries sit in front of the footer page, in record order.
+struct SegmentIndexEntry {
+    uint64_t offset;
+    int64_t timestamp_ns;
+    // Highest seqNo per stream stored ahead of this record, like SegmentFooter::last_seq_no.
+    int64_t seq_no_before[ZNS_SEGMENT_MAX_STREAMS];
+};
+
+static_assert(sizeof(SegmentFileHeader) <= ZNS_SEGMENT_PAGE_SIZE, "Type: SegmentFileHeader exceeds a page");
+static_assert(sizeof(SegmentFooter) <= ZNS_SEGMENT_PAGE_SIZE, "Type: SegmentFooter exceeds a page");
+
+// <directory>/segment_<index>.zseg
+std::filesystem::path capture_segment_path(const std::filesystem::path &directory, uint64_t index);
+// File offset where the index entries start, records end before it.
+std::size_t segment_index_offset(std::size_t segment_size);
+
+// Capture store made of fixed size segment files, each preallocated with fallocate and
+// written through a shared mapping: a SegmentFileHeader page, ring records (RingRecordHeader
+// and the StreamPacket, as framed in the ring), the sparse SegmentIndexEntry array and a
+// SegmentFooter page. The active segment
+// is sealed once the next record does not fit, or once it spans rotate_after of receive time
+// when that is non zero. An I/O thread msyncs appended ranges and drops them from the
+// mapping, seals retired segments and keeps the next segment preallocated.
+//
+// The constructor resumes from the newest segment's footer. An open segment is appended to
+// after checking the footer against the last record it names, and only rescanned when that
+// check fails. ingest_*() and flush() are for a single thread.
+class SegmentedCaptureStore
+{
+  public:
+    SegmentedCaptureStore() = delete;
+    explicit SegmentedCaptureStore(const std::filesystem::path &directory,
+                                   std::size_t segment_size = ZNS_SEGMENT_DEFAULT_SIZE,
+                                   std::chrono::seconds rotate_after = std::chrono::seconds(0));
+    ~SegmentedCaptureStore();
+
+    SegmentedCaptureStore(const SegmentedCaptureStore &) = delete;
+    SegmentedCaptureStore &operator=(SegmentedCaptureStore const &) = delete;
+
+    // recv_timestamp_ns is CLOCK_REALTIME, 0 stamps the packet with the current time.
+    // Returns packet_len once stored, 0 for a duplicate and -1 for an unusable packet.
+    int ingest_packet(const unsigned char *packet, size_t packet_len, int64_t recv_timestamp_ns = 0);
+    // Keeps the line, flags and receive timestamp the record was framed with.
+    int ingest_record(const RingRecord &record);
+    // Has the I/O thread msync everything appended so far, e.g. while the feed is quiet.
+    // Does not wait for it.
+    void flush();
+
+    uint64_t segment_index() const;
+    int64_t latest_seq_no(short stream_id) const;
+
+  private:
+    struct segment_file {
+        int fd;
+        uint64_t index;
+        std::size_t size;
+        unsigned char *base;
+        SegmentIndexEntry *index_entries;
+        SegmentFooter *footer;
+        std::size_t data_limit;
+        // Offset past which the next record gets an index entry.
+        std::size_t next_index_at;
+        // Published by the ingest thread, the I/O thread syncs up to it.
+        std::atomic<std::size_t> written;
+        // Page aligned, owned by the I/O thread.
+        std::size_t synced;
+    };
+
+    segment_file *map_segment(uint64_t index, std::size_t size, bool fresh);
+    bool read_footer(uint64_t index, SegmentFooter &footer);
+    void resume();
+    bool footer_matches_records(const segment_file &segment);
+    void rescan(segment_file &segment);
+    void activate(segment_file &segment);
+    int append(const RingRecordHeader &hdr, const unsigned char *payload);
+    void rotate();
+    void wake();
+    void run();
+    void sync_segment(segment_file &segment);
+    void seal_segment(segment_file *segment);
+    void release_segment(segment_file *segment);
+
+    std::filesystem::path m_directory;
+    std::size_t m_segment_size;
+    int64_t m_rotate_after_ns;
+    // Indexed by stream id.
+    std::vector<int64_t> m_latest_seq_no;
+    // Owned by the ingest thread.
+    segment_file *m_active;
+    std::size_t m_sync_requested;
+    // Owned by the I/O thread once it runs.
+    uint64_t m_next_index;
+    // Index of the last prepared spare, a new one is due once it is the active segment.
+    uint64_t m_spare_index;
+    std::atomic<segment_file *> m_active_published;
+    std::atomic<bool> m_running;
+    std::atomic<uint32_t> m_work_pending;
+    std::unique_ptr<SpscQueue<segment_file *, 4>> m_retired;
+    std::unique_ptr<SpscQueue<segment_file *, 4>> m_spares;
+    std::thread m_io_thread;
+};
+
+// Read only view of one segment file. Covers the records up to the footer's data_end as it
+// was when the segment was opened, the store may still be appending to it.
+class CaptureSegmentReader
+{
+  public:
+    CaptureSegmentReader() = delete;
+    explicit CaptureSegmentReader(const std::filesystem::path &file_name);
+    ~CaptureSegmentReader();
+
+    CaptureSegmentReader(const CaptureSegmentReader &) = delete;
+    CaptureSegmentReader &operator=(CaptureSegmentReader const &) = delete;
+
+    const SegmentFooter &footer() const
+    {
+        return m_footer;
+    }
+
+    // Offset of the first record received at or after timestamp_ns, data_end() when there is
+    // none. Receive time is taken to be non decreasing through the segment.
+    std::size_t find_time(int64_t timestamp_ns) const;
+    // Offset of the first record of stream_id with a seqNo at or after seq_no, data_end() when
+    // there is none.
+    std::size_t find_seq(short stream_id, int64_t seq_no) const;
+
+    // Records from offset, a record boundary, to data_end().
+    RingRecordRange records(std::size_t offset = ZNS_SEGMENT_PAGE_SIZE) const
+    {
+        return RingRecordRange(m_base + offset, m_footer.data_end - offset);
+    }
+
+    std::size_t data_end() const
+    {
+        return m_footer.data_end;
+    }
+
+  private:
+    const unsigned char *m_base;
+    std::size_t m_size;
+    const SegmentIndexEntry *m_index_entries;
+    SegmentFooter m_footer;
+};
+
+// Reads every segment of a SegmentedCaptureStore directory in order, straight from the
+// mappings. A seek picks the segment by its footer and the index block by binary search,
+// then walks at most one block of records.
+class CaptureStoreReader
+{
+  public:
+    class Cursor
+    {
+      public:
+        // Nothing once the end of the store is reached. The record points into the mapping
+        // and stays valid as long as the reader.
+        std::optional<RingRecord> next();
+
+      private:
+        friend class CaptureStoreReader;
+        Cursor(const CaptureStoreReader &reader, std::size_t segment, std::size_t offset, short stream_id);
+
+        const CaptureStoreReader *m_reader;
+        std::size_t m_segment;
+        const unsigned char *m_pos;
+        const unsigned char *m_end;
+        // -1 for every stream.
+        short m_stream_id;
+    };
+
+    CaptureStoreReader() = delete;
+    explicit CaptureStoreReader(const std::filesystem::path &directory);
+
+    Cursor begin() const;
+    // Every stream, from the first record received at or after timestamp_ns.
+    Cursor seek_time(int64_t timestamp_ns) const;
+    // Only stream_id, from its first record with a seqNo at or after seq_no.
+    Cursor seek_seq(short stream_id, int64_t seq_no) const;
+
+    std::size_t segment_count() const
+    {
+        return m_segments.size();
+    }
+
+  private:
+    std::vector<std::unique_ptr<CaptureSegmentReader>> m_segments;
+};
+}
+
+#endif // __ZNS_CAPTURE_STORE_H
@@ -0,0 +1,367 @@
+#include "capturewriter.hpp"
+#include "nsetypes.hpp"
+#include "timeutil.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <net/ethernet.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <pcap/dlt.h>
+#include <pcap/pcap.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace znsreader
+{
+static_assert(sizeof(struct ether_header) + sizeof(struct ip) + sizeof(struct udphdr) == ZNS_CAPTURE_NET_HDR_SIZE,
+              "ZNS_CAPTURE_NET_HDR_SIZE does not match the header structs");
+
+std::string capture_file_name(const single_stream_info &stream_info, short stream_id, bool write_to_pcap)
+{
+    const std::time_t now = std::time(nullptr);
+    struct tm local_now;
+    ::localtime_r(&now, &local_now);
+
+    char date_today[16];
+    std::strftime(date_today, sizeof(date_today), "%Y_%m_%d", &local_now);
+
+    std::string primary_ip = std::string(stream_info.m_primary_ip);
+    std::replace(primary_ip.begin(), primary_ip.end(), '.', '_');
+    auto full_name = primary_ip + "__" + std::to_string(stream_info.m_primary_port) + "__" + std::to_string(stream_id)
+                     + "__" + date_today;
+
+    if (write_to_pcap) {
+        return full_name + ".pcap";
+    } else {
+        return full_name + ".bin";
+    }
+}
+
+int open_capture_file(const std::string &file_name, bool write_to_pcap, bool append_existing)
+{
+    int fd;
+
+    if (append_existing) {
+        fd = ::open(file_name.c_str(), O_RDWR | O_APPEND);
+    } else {
+        fd = ::open(file_name.c_str(), O_CREAT | O_RDWR | O_TRUNC, (S_IRUSR | S_IWUSR | S_IWGRP | S_IRGRP));
+        if (fd < 0) {
+            perror("open error:");
+            if (errno == EEXIST) {
+                fd = ::open(file_name.c_str(), O_RDWR | O_APPEND);
+            }
+        }
+    }
+
+    if (fd < 0) {
+        throw std::runtime_error("Failed to create/open file: " + file_name);
+    }
+
+    // .bin files stay bare StreamPackets, that is what the recovery server reads.
+    if (write_to_pcap && !append_existing) {
+        struct pcap_file_header file_header;
+
+        file_header.magic = 0xa1b23c4d; // 0xa1b2c3d4
+        file_header.version_major = 2;
+        file_header.version_minor = 4;
+        file_header.thiszone = 0;
+        file_header.sigfigs = 0;
+        file_header.snaplen = 0x10000;
+        file_header.linktype = DLT_EN10MB; // records carry Ethernet, IPv4 and UDP headers
+
+        if (::write(fd, (void *)&file_header, sizeof(struct pcap_file_header)) != sizeof(struct pcap_file_header)) {
+            ::close(fd);
+            throw std::runtime_error("Failed to write pcap header: " + file_name);
+        }
+    }
+
+    return fd;
+}
+
+void fill_capture_net_header(const single_stream_info &stream_info, unsigned char *net_hdr)
+{
+    struct ether_header eth_hdr;
+    std::memset(&eth_hdr, 0, sizeof(eth_hdr));
+    eth_hdr.ether_type = htons(ETHERTYPE_IP);
+
+    struct ip ip_hdr;
+    std::memset(&ip_hdr, 0, sizeof(ip_hdr));
+    ip_hdr.ip_hl = 5;
+    ip_hdr.ip_v = 4;
+    ip_hdr.ip_ttl = 1;
+    ip_hdr.ip_p = IPPROTO_UDP;
+    ip_hdr.ip_dst.s_addr = inet_addr(std::string(stream_info.m_primary_ip).c_str());
+
+    struct udphdr udp_hdr;
+    std::memset(&udp_hdr, 0, sizeof(udp_hdr));
+    udp_hdr.dest = htons(stream_info.m_primary_port);
+
+    ::memcpy(net_hdr, &eth_hdr, sizeof(eth_hdr));
+    ::memcpy(net_hdr + sizeof(eth_hdr), &ip_hdr, sizeof(ip_hdr));
+    ::memcpy(net_hdr + sizeof(eth_hdr) + sizeof(ip_hdr), &udp_hdr, sizeof(udp_hdr));
+}
+
+void fill_capture_record_prefix(const unsigned char *net_hdr, std::size_t packet_len, int64_t recv_timestamp_ns,
+                                unsigned char *dst)
+{
+    if (recv_timestamp_ns == 0) {
+        recv_timestamp_ns = realtime_ns();
+    }
+
+    // caplen and len cover the frame only, not this record header.
+    const uint32_t total_len = ZNS_CAPTURE_NET_HDR_SIZE + packet_len;
+    PcapRecordHeader pcap_hdr;
+    pcap_hdr.tv_sec = recv_timestamp_ns / 1000000000;
+    pcap_hdr.tv_nsec = recv_timestamp_ns % 1000000000;
+    pcap_hdr.caplen = total_len;
+    pcap_hdr.len = total_len;
+
+    ::memcpy(dst, &pcap_hdr, sizeof(pcap_hdr));
+    dst += sizeof(pcap_hdr);
+
+    ::memcpy(dst, net_hdr, ZNS_CAPTURE_NET_HDR_SIZE);
+    struct ip *ip_hdr = (struct ip *)(dst + sizeof(struct ether_header));
+    struct udphdr *udp_hdr = (struct udphdr *)(dst + sizeof(struct ether_header) + sizeof(struct ip));
+    ip_hdr->ip_len = htons(total_len - sizeof(struct ether_header));
+    udp_hdr->len = htons(sizeof(struct udphdr) + packet_len);
+}
+
+BufferedPacketToFileWriter::BufferedPacketToFileWriter(const std::map<short, single_stream_info> &stream_config,
+                                                       bool write_to_pcap, bool append_existing)
+    : m_write_to_pcap(write_to_pcap),
+      m_block_memory(MAP_FAILED),
+      m_running(true),
+      m_blocks_pending(0),
+      m_full_blocks(std::make_unique<SpscQueue<capture_block *, ZNS_CAPTURE_BLOCK_COUNT>>()),
+      m_free_blocks(std::make_unique<SpscQueue<capture_block *, ZNS_CAPTURE_BLOCK_COUNT>>())
+{
+    if (stream_config.empty() || stream_config.begin()->first < 0) {
+        throw std::runtime_error("stream ids are incorrect in config");
+    }
+
+    // Every stream holds a block while filling it, the rest is room for queued I/O.
+    if (stream_config.size() > (ZNS_CAPTURE_BLOCK_COUNT / 2)) {
+        throw std::runtime_error("too many streams for ZNS_CAPTURE_BLOCK_COUNT");
+    }
+
+    stream_sink unused;
+    std::memset(&unused, 0, sizeof(unused));
+    unused.fd = -1;
+    m_sinks.resize(stream_config.rbegin()->first + 1, unused);
+
+    for (auto &one_stream : stream_config) {
+        stream_sink &sink = m_sinks[one_stream.first];
+        sink.fd = open_capture_file(capture_file_name(one_stream.second, one_stream.first, write_to_pcap),
+                                    write_to_pcap, append_existing);
+
+        fill_capture_net_header(one_stream.second, sink.net_hdr);
+    }
+
+    m_block_memory = ::mmap(nullptr, (std::size_t)ZNS_CAPTURE_BLOCK_SIZE * ZNS_CAPTURE_BLOCK_COUNT,
+                            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (m_block_memory == MAP_FAILED) {
+        perror("mmap error:");
+        for (stream_sink &sink : m_sinks) {
+            if (sink.fd >= 0) {
+                ::close(sink.fd);
+            }
+        }
+        throw std::runtime_error("Failed to map capture blocks");
+    }
+
+    m_blocks.resize(ZNS_CAPTURE_BLOCK_COUNT);
+    for (std::size_t i = 0; i < m_blocks.size(); i++) {
+        m_blocks[i].fd = -1;
+        m_blocks[i].used = 0;
+        m_blocks[i].data = (unsigned char *)m_block_memory + (i * ZNS_CAPTURE_BLOCK_SIZE);
+        m_free_blocks->try_push(&m_blocks[i]);
+    }
+
+    m_io_thread = std::thread(&BufferedPacketToFileWriter::run, this);
+}
+
+BufferedPacketToFileWriter::~BufferedPacketToFileWriter()
+{
+    flush();
+
+    // The I/O thread writes whatever is queued before it exits.
+    m_running.store(false, std::memory_order_release);
+    m_blocks_pending.fetch_add(1, std::memory_order_release);
+    m_blocks_pending.notify_one();
+    m_io_thread.join();
+
+    for (stream_sink &sink : m_sinks) {
+        if (sink.fd >= 0) {
+            ::close(sink.fd);
+        }
+    }
+
+    ::munmap(m_block_memory, (std::size_t)ZNS_CAPTURE_BLOCK_SIZE * ZNS_CAPTURE_BLOCK_COUNT);
+}
+
+int BufferedPacketToFileWriter::ingest_record(const RingRecord &record)
+{
+    return ingest_packet(record.payload(), record.payload_len(), record.header().recv_timestamp_ns);
+}
+
+int BufferedPacketToFileWriter::ingest_packet(const unsigned char *packet, size_t packet_len,
+                                              int64_t recv_timestamp_ns)
+{
+    const size_t net_len = m_write_to_pcap ? (sizeof(PcapRecordHeader) + ZNS_CAPTURE_NET_HDR_SIZE) : 0;
+
+    if (packet_len < sizeof(StreamHeader) || (net_len + packet_len) > ZNS_CAPTURE_BLOCK_SIZE) {
+        return -1;
+    }
+
+    const short stream_id = ((const StreamPacket *)packet)->streamHdr.streamId;
+    const int seq_number = ((const StreamPacket *)packet)->streamHdr.seqNo;
+
+    if (stream_id < 0 || (size_t)stream_id >= m_sinks.size() || m_sinks[stream_id].fd < 0) {
+        return -1;
+    }
+
+    stream_sink &sink = m_sinks[stream_id];
+
+    if (seq_number != 0) {
+        if (seq_number <= sink.latest_seq_no) {
+            return 0;
+        }
+        sink.latest_seq_no = seq_number;
+    }
+
+    if (sink.block == nullptr) {
+        sink.block = take_block();
+        sink.block->fd = sink.fd;
+    } else if ((sink.block->used + net_len + packet_len) > ZNS_CAPTURE_BLOCK_SIZE) {
+        submit_block(sink);
+        sink.block = take_block();
+        sink.block->fd = sink.fd;
+    }
+
+    unsigned char *dst = sink.block->data + sink.block->used;
+
+    if (m_write_to_pcap) {
+        fill_capture_record_prefix(sink.net_hdr, packet_len, recv_timestamp_ns, dst);
+        dst += sizeof(PcapRecordHeader) + ZNS_CAPTURE_NET_HDR_SIZE;
+    }
+
+    ::memcpy(dst, packet, packet_len);
+    sink.block->used += net_len + packet_len;
+
+    return packet_len;
+}
+
+void BufferedPacketToFileWriter::flush()
+{
+    for (stream_sink &sink : m_sinks) {
+        if (sink.block != nullptr && sink.block->used != 0) {
+            submit_block(sink);
+            sink.block = nullptr;
+        }
+    }
+}
+
+BufferedPacketToFileWriter::capture_block *BufferedPacketToFileWriter::take_block()
+{
+    capture_block *block;
+
+    // Only when the I/O thread is a whole pool of blocks behind.
+    while (!m_free_blocks->try_pop(block)) {
+        std::this_thread::sleep_for(std::chrono::microseconds(10));
+    }
+
+    block->used = 0;
+    return block;
+}
+
+void BufferedPacketToFileWriter::submit_block(stream_sink &sink)
+{
+    // Never full, there are only ZNS_CAPTURE_BLOCK_COUNT blocks.
+    m_full_blocks->try_push(sink.block);
+    m_blocks_pending.fetch_add(1, std::memory_order_release);
+    m_blocks_pending.notify_one();
+}
+
+void BufferedPacketToFileWriter::run()
+{
+    std::vector<capture_block *> batch;
+    batch.reserve(ZNS_CAPTURE_BLOCK_COUNT);
+
+    for (;;) {
+        m_blocks_pending.wait(0, std::memory_order_acquire);
+        m_blocks_pending.exchange(0, std::memory_order_acq_rel);
+        const bool stopping = !m_running.load(std::memory_order_acquire);
+
+        capture_block *block;
+        while (m_full_blocks->try_pop(block)) {
+            batch.push_back(block);
+        }
+
+        write_blocks(batch);
+
+        for (capture_block *done : batch) {
+            m_free_blocks->try_push(std::move(done));
+        }
+        batch.clear();
+
+        if (stopping) {
+            return;
+        }
+    }
+}
+
+void BufferedPacketToFileWriter::write_blocks(std::vector<capture_block *> &blocks)
+{
+    // Order within a file is kept, different files are written one after the other.
+    std::stable_sort(blocks.begin(), blocks.end(),
+                     [](const capture_block *a, const capture_block *b) { return a->fd < b->fd; });
+
+    struct iovec iov[ZNS_CAPTURE_BLOCK_COUNT];
+    std::size_t first = 0;
+
+    while (first < blocks.size()) {
+        const int fd = blocks[first]->fd;
+        int iov_count = 0;
+
+        for (std::size_t i = first; i < blocks.size() && blocks[i]->fd == fd; i++) {
+            iov[iov_count].iov_base = blocks[i]->data;
+            iov[iov_count].iov_len = blocks[i]->used;
+            iov_count++;
+        }
+        first += iov_count;
+
+        struct iovec *next = iov;
+        while (iov_count > 0) {
+            ssize_t ret = ::writev(fd, next, std::min(iov_count, IOV_MAX));
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("capture writev error:");
+                break;
+            }
+
+            // Short write, skip what made it out and retry the rest.
+            while (iov_count > 0 && (std::size_t)ret >= next->iov_len) {
+                ret -= next->iov_len;
+                next++;
+                iov_count--;
+            }
+            if (iov_count > 0) {
+                next->iov_base = (unsigned char *)next->iov_base + ret;
+                next->iov_len -= ret;
+            }
+        }
+    }
+}
+}
@@ -0,0 +1,97 @@
+#ifndef __ZNS_CAPTURE_WRITER_H
+#define __ZNS_CAPTURE_WRITER_H
+
+#include "ipinfo.hpp"
+#include "ringrecord.hpp"
+#include "spscqueue.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Capture blocks are filled by the ingest thread and written out whole by the I/O thread.
+#define ZNS_CAPTURE_BLOCK_SIZE  (1 << 20)
+#define ZNS_CAPTURE_BLOCK_COUNT 64
+// Ethernet, IPv4 and UDP header written in front of every pcap record.
+#define ZNS_CAPTURE_NET_HDR_SIZE 42
+
+namespace znsreader
+{
+// Files use the nanosecond pcap magic, so the second field holds nanoseconds.
+struct PcapRecordHeader {
+    uint32_t tv_sec;
+    uint32_t tv_nsec;
+    uint32_t caplen;
+    uint32_t len;
+};
+
+// <primary ip>__<primary port>__<stream id>__<local date>, .pcap or .bin.
+std::string capture_file_name(const single_stream_info &stream_info, short stream_id, bool write_to_pcap);
+// Opens a stream's capture file, a new pcap file starts with the file header. Throws on failure.
+int open_capture_file(const std::string &file_name, bool write_to_pcap, bool append_existing);
+// Ethernet, IPv4 and UDP headers for a stream's records in network order, all but the lengths.
+void fill_capture_net_header(const single_stream_info &stream_info, unsigned char *net_hdr);
+// Writes the pcap record header and net_hdr with the lengths of a packet_len payload into dst,
+// sizeof(PcapRecordHeader) + ZNS_CAPTURE_NET_HDR_SIZE bytes. recv_timestamp_ns 0 is now.
+void fill_capture_record_prefix(const unsigned char *net_hdr, std::size_t packet_len, int64_t recv_timestamp_ns,
+                                unsigned char *dst);
+
+// Same files as PacketToFileWriter, but ingest only copies into memory. Every stream fills
+// its own large page aligned block from precomputed headers, and full blocks go through an
+// SPSC queue to an I/O thread that writes them with one writev per file. ingest_packet()
+// and flush() are for a single thread; it waits only when every block is queued for I/O.
+class BufferedPacketToFileWriter
+{
+  public:
+    BufferedPacketToFileWriter() = delete;
+    BufferedPacketToFileWriter(const std::map<short, single_stream_info> &, bool write_to_pcap,
+                               bool append_existing);
+    ~BufferedPacketToFileWriter();
+
+    BufferedPacketToFileWriter(const BufferedPacketToFileWriter &) = delete;
+    BufferedPacketToFileWriter &operator=(BufferedPacketToFileWriter const &) = delete;
+
+    // recv_timestamp_ns is CLOCK_REALTIME, 0 stamps the packet with the current time.
+    // Returns packet_len once buffered, 0 for a duplicate and -1 for an unknown stream.
+    int ingest_packet(const unsigned char *packet, size_t packet_len, int64_t recv_timestamp_ns = 0);
+    int ingest_record(const RingRecord &record);
+    // Queues every partly filled block, e.g. while the feed is quiet. Does not wait for I/O.
+    void flush();
+
+  private:
+    struct capture_block {
+        int fd;
+        std::size_t used;
+        unsigned char *data;
+    };
+
+    struct stream_sink {
+        int fd;
+        int64_t latest_seq_no;
+        capture_block *block;
+        unsigned char net_hdr[ZNS_CAPTURE_NET_HDR_SIZE];
+    };
+
+    capture_block *take_block();
+    void submit_block(stream_sink &sink);
+    void run();
+    void write_blocks(std::vector<capture_block *> &blocks);
+
+    bool m_write_to_pcap;
+    // Indexed by stream id, fd is -1 for ids not in the config.
+    std::vector<stream_sink> m_sinks;
+    void *m_block_memory;
+    std::vector<capture_block> m_blocks;
+    std::atomic<bool> m_running;
+    std::atomic<uint32_t> m_blocks_pending;
+    std::unique_ptr<SpscQueue<capture_block *, ZNS_CAPTURE_BLOCK_COUNT>> m_full_blocks;
+    std::unique_ptr<SpscQueue<capture_block *, ZNS_CAPTURE_BLOCK_COUNT>> m_free_blocks;
+    std::thread m_io_thread;
+};
+}
+
+#endif // __ZNS_CAPTURE_WRITER_H
@@ -0,0 +1,45 @@
+#ifndef __ZNS_FEED_COUNTERS_H
+#define __ZNS_FEED_COUNTERS_H
+
+#include <atomic>
+#include <cstdint>
+
+namespace znsreader
+{
+// Counters have one writer thread each, which adds with a plain load and store instead of a
+// locked read-modify-write. Any thread may read them meanwhile.
+inline void counter_add(std::atomic<uint64_t> &counter, uint64_t value)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+inline void counter_max(std::atomic<uint64_t> &counter, uint64_t value)
+{
+    if (value > counter.load(std::memory_order_relaxed)) {
+        counter.store(value, std::memory_order_relaxed);
+    }
+}
+
+// One socket, i.e. one line of one stream, written by the thread receiving on it. Sequence
+// counters only look at this line: a gap here with no kernel drops was lost before the host.
+struct alignas(64) SocketCounters {
+    std::atomic<uint64_t> packets{ 0 };
+    std::atomic<uint64_t> bytes{ 0 };
+    std::atomic<uint64_t> kernel_drops{ 0 }; // SO_RXQ_OVFL, datagrams the socket queue dropped
+    std::atomic<uint64_t> seq_gaps{ 0 };     // jumps past the next seqNo
+    std::atomic<uint64_t> seq_missing{ 0 };  // seqNos jumped over
+    std::atomic<uint64_t> duplicates{ 0 };   // seqNo at or below the highest seen
+    std::atomic<int64_t> last_seq{ 0 };      // highest seqNo seen
+};
+
+// One ring, written by its receive thread.
+struct alignas(64) RingCounters {
+    std::atomic<uint64_t> capacity{ 0 };
+    std::atomic<uint64_t> used{ 0 };           // bytes waiting after the last push
+    std::atomic<uint64_t> high_watermark{ 0 }; // most bytes ever waiting
+    std::atomic<uint64_t> full_stalls{ 0 };    // pushes that found the ring full and had to wait
+    std::atomic<uint64_t> stall_spins{ 0 };    // push attempts made while waiting
+};
+}
+
+#endif // __ZNS_FEED_COUNTERS_H
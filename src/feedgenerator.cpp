@@ -0,0 +1,472 @@
+#include "feedgenerator.hpp"
+#include "msgdecoder.hpp"
+#include "nsetypes.hpp"
+#include "timeutil.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+namespace znsreader
+{
+namespace
+{
+// Message kinds in the order of the FeedModel weights.
+enum generated_kind { new_kind, modify_kind, cancel_kind, trade_kind, spread_order_kind, spread_trade_kind };
+
+// First token id, each stream gets its own range of FeedModel::tokens ids after it.
+constexpr int FIRST_TOKEN_ID = 35000;
+
+struct sockaddr_in line_address(std::string_view ip, uint16_t port)
+{
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = ip.empty() ? htonl(INADDR_LOOPBACK) : inet_addr(std::string(ip).c_str());
+    return addr;
+}
+
+bool in_burst(const FeedModel &model, int64_t elapsed_ns)
+{
+    return model.burst_ms != 0 && model.burst_period_ms != 0
+           && (elapsed_ns / 1000000) % model.burst_period_ms < model.burst_ms;
+}
+
+double burst_multiplier(const FeedModel &model, int64_t elapsed_ns)
+{
+    return in_burst(model, elapsed_ns) ? model.burst_factor : 1.0;
+}
+
+// Seconds of traffic at the base rate sent by elapsed_ns into a run, bursts count burst_factor
+// times over.
+double model_seconds(const FeedModel &model, int64_t elapsed_ns)
+{
+    const double elapsed = elapsed_ns / 1e9;
+    if (model.burst_ms == 0 || model.burst_period_ms == 0) {
+        return elapsed;
+    }
+
+    const double period = model.burst_period_ms / 1e3;
+    const double burst = std::min(model.burst_ms, model.burst_period_ms) / 1e3;
+    const double periods = std::floor(elapsed / period);
+    const double burst_sec = (periods * burst) + std::min(elapsed - (periods * period), burst);
+    return elapsed + ((model.burst_factor - 1) * burst_sec);
+}
+}
+
+SyntheticFeedGenerator::SyntheticFeedGenerator(const std::map<short, single_stream_info> &streams,
+                                               const FeedModel &model, const FeedFaults &faults, uint64_t seed,
+                                               std::string_view interface_ip, int ttl)
+    : m_model(model), m_faults(faults), m_sock(-1), m_stop(false), m_rng(seed), m_chance(0.0, 1.0), m_batch_count(0)
+{
+    if (streams.empty()) {
+        throw std::runtime_error("feed generator needs at least one stream");
+    }
+    if (model.tokens <= 0 || model.burst_factor <= 0) {
+        throw std::runtime_error("feed model needs tokens and a positive burst factor");
+    }
+
+    const double weights[] = { model.new_order, model.modify_order, model.cancel_order,
+                               model.trade,     model.spread_order, model.spread_trade };
+    if (std::any_of(std::begin(weights), std::end(weights), [](double weight) { return weight < 0; })
+        || model.new_order <= 0) {
+        throw std::runtime_error("feed model weights must not be negative and new orders must be sent");
+    }
+    m_kinds = std::discrete_distribution<int>(std::begin(weights), std::end(weights));
+
+    // Zipf over token ranks, rank 1 the busiest.
+    std::vector<double> token_weights(model.tokens);
+    for (int rank = 0; rank < model.tokens; rank++) {
+        token_weights[rank] = 1.0 / std::pow(rank + 1, model.token_skew);
+    }
+    m_token_pick = std::discrete_distribution<int>(token_weights.begin(), token_weights.end());
+
+    for (const auto &[stream_id, info] : streams) {
+        stream_state stream;
+        stream.stream_id = stream_id;
+        stream.next_order_id = 1300000000000000.0 + (stream_id * 10000000000.0);
+        stream.addrs[0] = line_address(info.m_primary_ip, info.m_primary_port);
+        stream.addrs[1] = line_address(info.m_secondary_ip, info.m_secondary_port);
+        stream.mid.resize(model.tokens);
+        for (int &price : stream.mid) {
+            price = 10000 + (m_rng() % 100000) * 5;
+        }
+        stream.live.reserve(std::min<std::size_t>(model.max_live, 1 << 20));
+        m_streams.push_back(std::move(stream));
+    }
+
+    m_sock = ::socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (m_sock < 0) {
+        throw std::runtime_error("Failed to create socket");
+    }
+
+    unsigned char multicast_ttl = ttl;
+    unsigned char loop = 1;
+    if (0 != setsockopt(m_sock, IPPROTO_IP, IP_MULTICAST_TTL, &multicast_ttl, sizeof(multicast_ttl))
+        || 0 != setsockopt(m_sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop))) {
+        perror("setsockopt failed");
+        ::close(m_sock);
+        throw std::runtime_error("Failed to set multicast options");
+    }
+
+    if (!interface_ip.empty()) {
+        struct in_addr interface;
+        interface.s_addr = inet_addr(std::string(interface_ip).c_str());
+        if (0 != setsockopt(m_sock, IPPROTO_IP, IP_MULTICAST_IF, &interface, sizeof(interface))) {
+            perror("setsockopt failed");
+            ::close(m_sock);
+            throw std::runtime_error("Failed to set multicast interface");
+        }
+    }
+
+    // A deep send queue so a saturating run is limited by the receivers, not by blocking here.
+    int sndBufSize = 8 * 1024 * 1024;
+    setsockopt(m_sock, SOL_SOCKET, SO_SNDBUF, &sndBufSize, sizeof(sndBufSize));
+
+    std::memset(m_msgs, 0, sizeof(m_msgs));
+    for (unsigned int i = 0; i < ZNS_GENERATOR_BATCH; i++) {
+        m_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        m_msgs[i].msg_hdr.msg_iov = &m_iovs[i];
+        m_msgs[i].msg_hdr.msg_iovlen = 1;
+        m_iovs[i].iov_base = m_batch[i].data;
+    }
+}
+
+SyntheticFeedGenerator::~SyntheticFeedGenerator()
+{
+    if (m_sock >= 0) {
+        ::close(m_sock);
+    }
+}
+
+void SyntheticFeedGenerator::stop()
+{
+    m_stop.store(true, std::memory_order_relaxed);
+}
+
+GeneratorStats SyntheticFeedGenerator::run(double rate_pps, uint64_t packets)
+{
+    if (rate_pps < 0) {
+        throw std::runtime_error("generator rate must not be negative");
+    }
+
+    GeneratorStats stats;
+    m_stop.store(false, std::memory_order_relaxed);
+
+    const int64_t start_ns = monotonic_ns();
+    const int64_t heartbeat_ns = (int64_t)m_model.heartbeat_ms * 1000000;
+    for (stream_state &stream : m_streams) {
+        stream.next_heartbeat_ns = start_ns + heartbeat_ns;
+    }
+
+    unsigned char packet[ZNS_GENERATOR_MAX_PACKET];
+    std::size_t next_stream = 0;
+
+    while (!m_stop.load(std::memory_order_relaxed) && (packets == 0 || stats.packets < packets)) {
+        const int64_t now = monotonic_ns();
+
+        // Unpaced runs build a batch worth for both lines at a time.
+        uint64_t due = ZNS_GENERATOR_BATCH / 2;
+        if (rate_pps > 0) {
+            const double target = rate_pps * model_seconds(m_model, now - start_ns);
+            due = (target > stats.packets) ? std::min<uint64_t>((uint64_t)target - stats.packets, due) : 0;
+        }
+        if (packets != 0) {
+            due = std::min(due, packets - stats.packets);
+        }
+
+        if (heartbeat_ns != 0) {
+            for (stream_state &stream : m_streams) {
+                if (now >= stream.next_heartbeat_ns) {
+                    StreamPacket *heartbeat = (StreamPacket *)packet;
+                    heartbeat->streamHdr.msgLen = message_size<HeartBeatData>();
+                    heartbeat->streamHdr.streamId = stream.stream_id;
+                    heartbeat->streamHdr.seqNo = 0;
+                    heartbeat->streamData.cMsgType = heartBeatMsg;
+                    heartbeat->streamData.p.hbData.seqNo = stream.seq_no;
+                    emit(stream, packet, message_size<HeartBeatData>(), false, now, stats);
+                    stream.next_heartbeat_ns += heartbeat_ns;
+                    stats.heartbeats++;
+                }
+            }
+        }
+
+        for (uint64_t i = 0; i < due; i++) {
+            stream_state &stream = m_streams[next_stream];
+            next_stream = (next_stream + 1) % m_streams.size();
+
+            const uint32_t len = build_packet(stream, packet);
+            stats.by_type[(unsigned char)((StreamPacket *)packet)->streamData.cMsgType & 0x7f]++;
+            stats.packets++;
+            emit(stream, packet, len, true, now, stats);
+        }
+
+        flush_due(now, stats);
+
+        if (due == 0 && rate_pps > 0) {
+            // Until the next packet at the current rate, or sooner when a skewed one falls due.
+            const double rate = rate_pps * burst_multiplier(m_model, now - start_ns);
+            int64_t until = now + (int64_t)(1e9 / rate);
+            for (const auto &pending : m_pending) {
+                if (!pending.empty()) {
+                    until = std::min(until, pending.front().due_ns);
+                }
+            }
+            wait_until(until);
+        }
+    }
+
+    // Releases what reordering still holds, then waits out the skewed line.
+    for (stream_state &stream : m_streams) {
+        for (int line = 0; line < 2; line++) {
+            if (stream.held[line].held) {
+                queue(line, stream.held[line].packet);
+                stream.held[line].held = false;
+            }
+        }
+    }
+    while (!m_pending[0].empty() || !m_pending[1].empty()) {
+        int64_t until = INT64_MAX;
+        for (const auto &pending : m_pending) {
+            if (!pending.empty()) {
+                until = std::min(until, pending.front().due_ns);
+            }
+        }
+        wait_until(until);
+        flush_due(monotonic_ns(), stats);
+    }
+
+    stats.elapsed_sec = (monotonic_ns() - start_ns) / 1e9;
+    stats.achieved_pps = (stats.elapsed_sec > 0) ? stats.packets / stats.elapsed_sec : 0;
+    if (rate_pps > 0 && stats.elapsed_sec > 0) {
+        stats.target_pps = rate_pps * model_seconds(m_model, (int64_t)(stats.elapsed_sec * 1e9)) / stats.elapsed_sec;
+    }
+
+    return stats;
+}
+
+uint32_t SyntheticFeedGenerator::build_packet(stream_state &stream, unsigned char *packet)
+{
+    switch (m_kinds(m_rng)) {
+    case new_kind:
+        return build_order(stream, stream.live, false, 0, packet);
+    case modify_kind:
+        return build_order(stream, stream.live, false, 1, packet);
+    case cancel_kind:
+        return build_order(stream, stream.live, false, 2, packet);
+    case trade_kind:
+        return build_order(stream, stream.live, false, 3, packet);
+    case spread_order_kind: {
+        // New, modify and cancel weighted as they are for single orders.
+        const double roll = m_chance(m_rng) * (m_model.new_order + m_model.modify_order + m_model.cancel_order);
+        const int action = (roll < m_model.new_order) ? 0 : (roll < m_model.new_order + m_model.modify_order) ? 1 : 2;
+        return build_order(stream, stream.live_spread, true, action, packet);
+    }
+    default:
+        return build_order(stream, stream.live_spread, true, 3, packet);
+    }
+}
+
+uint32_t SyntheticFeedGenerator::build_order(stream_state &stream, std::vector<live_order> &live, bool spread,
+                                             int action, unsigned char *packet)
+{
+    StreamPacket *stream_packet = (StreamPacket *)packet;
+    stream_packet->streamHdr.streamId = stream.stream_id;
+    stream_packet->streamHdr.seqNo = ++stream.seq_no;
+
+    const int64_t timestamp = realtime_ns();
+    const int token_base = FIRST_TOKEN_ID + ((stream.stream_id - 1) * m_model.tokens);
+
+    // An empty book can only take new orders, a full one only loses them.
+    if (live.empty()) {
+        action = 0;
+    } else if (action == 0 && live.size() >= m_model.max_live) {
+        action = 2;
+    }
+
+    auto write_order = [&](nseMsgType type, nseMsgType spread_type, const live_order &order, int quantity) {
+        stream_packet->streamHdr.msgLen = message_size<OrderData>();
+        if (spread) {
+            stream_packet->streamData.cMsgType = spread_type;
+            stream_packet->streamData.p.spdOrderData =
+                SpreadOrderData{ timestamp, order.id, token_base + order.token, order.side, order.price, quantity };
+        } else {
+            stream_packet->streamData.cMsgType = type;
+            stream_packet->streamData.p.orderData =
+                OrderData{ timestamp, order.id, token_base + order.token, order.side, order.price, quantity };
+        }
+        return (uint32_t)message_size<OrderData>();
+    };
+
+    if (action == 0) {
+        live_order order;
+        order.id = stream.next_order_id++;
+        order.token = m_token_pick(m_rng);
+        order.side = (m_rng() & 1) ? 'B' : 'S';
+        const int ticks = 1 + m_rng() % 40;
+        // Spreads are quoted as the price difference of their legs, around zero.
+        const int mid = spread ? 0 : stream.mid[order.token];
+        order.price = mid + ((order.side == 'B') ? -ticks : ticks) * 5;
+        order.quantity = (1 + m_rng() % 20) * 25;
+        live.push_back(order);
+        return write_order(newOrderMsg, newSpreadOrderMsg, order, order.quantity);
+    }
+
+    const std::size_t pick = m_rng() % live.size();
+    live_order &order = live[pick];
+
+    if (action == 1) {
+        order.price += ((int)(m_rng() % 5) - 2) * 5;
+        order.quantity = (1 + m_rng() % 20) * 25;
+        return write_order(modOrderMsg, modSpreadOrderMsg, order, order.quantity);
+    }
+
+    if (action == 2) {
+        const uint32_t len = write_order(cancelOrderMsg, cancelSpreadOrderMsg, order, 0);
+        live[pick] = live.back();
+        live.pop_back();
+        return len;
+    }
+
+    // Resting order traded against an aggressor that never rested, the way most trades print.
+    // A fill of the whole order takes it off the book.
+    const double buy_id = (order.side == 'B') ? order.id : 0;
+    const double sell_id = (order.side == 'S') ? order.id : 0;
+    stream_packet->streamHdr.msgLen = message_size<TradeData>();
+    if (spread) {
+        stream_packet->streamData.cMsgType = spreadTradeMsg;
+        stream_packet->streamData.p.spdTradeData =
+            SpreadTradeData{ timestamp, buy_id, sell_id, token_base + order.token, order.price, 25 };
+    } else {
+        stream_packet->streamData.cMsgType = tradeMesg;
+        stream_packet->streamData.p.tradeData =
+            TradeData{ timestamp, buy_id, sell_id, token_base + order.token, order.price, 25 };
+        if (m_rng() % 8 == 0) {
+            stream.mid[order.token] += ((int)(m_rng() % 3) - 1) * 5;
+        }
+    }
+    if ((order.quantity -= 25) == 0) {
+        live[pick] = live.back();
+        live.pop_back();
+    }
+    return message_size<TradeData>();
+}
+
+void SyntheticFeedGenerator::emit(stream_state &stream, const unsigned char *packet, uint32_t len, bool sequenced,
+                                  int64_t now_ns, GeneratorStats &stats)
+{
+    const int64_t skew_ns = m_faults.ab_skew_us * 1000;
+    bool gapped[2] = { false, false };
+
+    for (int line = 0; line < 2; line++) {
+        if (sequenced && m_faults.gap > 0 && m_chance(m_rng) < m_faults.gap) {
+            gapped[line] = true;
+            stats.gaps[line]++;
+            continue;
+        }
+
+        datagram out;
+        out.due_ns = now_ns + ((line == 0) ? std::max<int64_t>(-skew_ns, 0) : std::max<int64_t>(skew_ns, 0));
+        out.addr = &stream.addrs[line];
+        out.len = len;
+        std::memcpy(out.data, packet, len);
+
+        held_datagram &held = stream.held[line];
+        if (sequenced && !held.held && m_faults.reorder > 0 && m_chance(m_rng) < m_faults.reorder) {
+            held.held = true;
+            held.countdown = std::max<uint32_t>(m_faults.reorder_depth, 1);
+            held.packet = out;
+            stats.reordered[line]++;
+            continue;
+        }
+
+        queue(line, out);
+        if (sequenced && m_faults.duplicate > 0 && m_chance(m_rng) < m_faults.duplicate) {
+            queue(line, out);
+            stats.duplicates[line]++;
+        }
+
+        if (sequenced && held.held && --held.countdown == 0) {
+            held.packet.due_ns = out.due_ns;
+            queue(line, held.packet);
+            held.held = false;
+        }
+    }
+
+    if (gapped[0] && gapped[1]) {
+        stats.lost++;
+    }
+}
+
+void SyntheticFeedGenerator::queue(int line, const datagram &packet)
+{
+    m_pending[line].push_back(packet);
+}
+
+void SyntheticFeedGenerator::flush_due(int64_t now_ns, GeneratorStats &stats)
+{
+    for (;;) {
+        // Earlier of the two line heads, so a skewed line interleaves in due order.
+        std::deque<datagram> *next = nullptr;
+        for (auto &pending : m_pending) {
+            if (!pending.empty() && pending.front().due_ns <= now_ns
+                && (next == nullptr || pending.front().due_ns < next->front().due_ns)) {
+                next = &pending;
+            }
+        }
+        if (next == nullptr) {
+            break;
+        }
+
+        const datagram &packet = next->front();
+        datagram &slot = m_batch[m_batch_count];
+        slot.addr = packet.addr;
+        slot.len = packet.len;
+        std::memcpy(slot.data, packet.data, packet.len);
+        next->pop_front();
+
+        if (++m_batch_count == ZNS_GENERATOR_BATCH) {
+            send_batch(stats);
+        }
+    }
+
+    send_batch(stats);
+}
+
+void SyntheticFeedGenerator::send_batch(GeneratorStats &stats)
+{
+    for (unsigned int i = 0; i < m_batch_count; i++) {
+        m_msgs[i].msg_hdr.msg_name = (void *)m_batch[i].addr;
+        m_iovs[i].iov_len = m_batch[i].len;
+    }
+
+    unsigned int sent = 0;
+    while (sent < m_batch_count) {
+        int ret = ::sendmmsg(m_sock, m_msgs + sent, m_batch_count - sent, 0);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("sendmmsg failed");
+            throw std::runtime_error("sendmmsg failed:");
+        }
+        sent += ret;
+    }
+
+    if (m_batch_count != 0) {
+        stats.batches++;
+        stats.datagrams += m_batch_count;
+    }
+
+    m_batch_count = 0;
+}
+}
@@ -0,0 +1,165 @@
+#ifndef __ZNS_FEED_GENERATOR_H
+#define __ZNS_FEED_GENERATOR_H
+
+#include "ipinfo.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <netinet/in.h>
+#include <random>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <vector>
+
+// Datagrams handed to one sendmmsg.
+#define ZNS_GENERATOR_BATCH 64
+// Largest packet the generator builds, a StreamHeader and a TradeData with room to spare.
+#define ZNS_GENERATOR_MAX_PACKET 64
+
+namespace znsreader
+{
+// What the generated traffic looks like. The message weights are relative, per cent by
+// default, and tokens are drawn with a Zipf skew so a few instruments carry most of the
+// flow as they do on the exchange. Bursts multiply the rate by burst_factor for burst_ms out
+// of every burst_period_ms.
+struct FeedModel {
+    double new_order = 40;
+    double modify_order = 25;
+    double cancel_order = 28;
+    double trade = 5;
+    double spread_order = 1.5; // new, modify and cancel in the same proportions
+    double spread_trade = 0.5;
+
+    int tokens = 4000;         // per stream
+    double token_skew = 1.0;   // Zipf exponent, 0 is uniform
+    std::size_t max_live = 50000; // resting orders per stream
+    uint32_t heartbeat_ms = 1000; // per stream while it is sending, 0 for none
+
+    double burst_factor = 1;
+    uint32_t burst_ms = 0;
+    uint32_t burst_period_ms = 1000;
+};
+
+// Faults injected on each line on its own, probabilities per packet. A gap on both lines is
+// a packet the reader cannot arbitrate back, which happens at gap squared. A reordered packet
+// goes out after the next reorder_depth packets of its line. ab_skew_us delays the secondary
+// line against the primary, negative delays the primary instead.
+struct FeedFaults {
+    double gap = 0;
+    double duplicate = 0;
+    double reorder = 0;
+    uint32_t reorder_depth = 3;
+    int64_t ab_skew_us = 0;
+};
+
+// Outcome of one run, the fault counts are per line and summed over streams.
+struct GeneratorStats {
+    uint64_t packets = 0;    // sequenced packets generated
+    uint64_t heartbeats = 0;
+    uint64_t datagrams = 0;  // sent over both lines, faults included
+    uint64_t batches = 0;
+    uint64_t gaps[2] = { 0, 0 };
+    uint64_t duplicates[2] = { 0, 0 };
+    uint64_t reordered[2] = { 0, 0 };
+    uint64_t lost = 0;       // gapped on both lines
+    uint64_t by_type[128] = {}; // sequenced packets by cMsgType
+    double elapsed_sec = 0;
+    double target_pps = 0;   // 0 when not pacing
+    double achieved_pps = 0;
+};
+
+// Builds StreamPackets for every stream in the config from a FeedModel and publishes each on
+// both of the stream's multicast lines, faults applied per line. Streams take turns so their
+// seqNos advance together. The multicast TTL is 0 by default, which keeps the traffic on the
+// host and loops it back to local sockets; interface_ip picks the sending interface.
+class SyntheticFeedGenerator
+{
+  public:
+    SyntheticFeedGenerator() = delete;
+    SyntheticFeedGenerator(const std::map<short, single_stream_info> &streams, const FeedModel &model,
+                           const FeedFaults &faults = FeedFaults(), uint64_t seed = 1,
+                           std::string_view interface_ip = "", int ttl = 0);
+    ~SyntheticFeedGenerator();
+
+    SyntheticFeedGenerator(const SyntheticFeedGenerator &) = delete;
+    SyntheticFeedGenerator &operator=(SyntheticFeedGenerator const &) = delete;
+
+    // Sends `packets` sequenced packets over all streams, or until stop() when 0, at rate_pps
+    // before bursts. rate_pps 0 sends as fast as the socket takes them, which finds where the
+    // host or the reader saturates. Sequence numbers carry on from the previous run. Throws
+    // when a send fails.
+    GeneratorStats run(double rate_pps, uint64_t packets);
+    // Ends a run from any thread, what is held back for reordering or skew is still sent.
+    void stop();
+
+  private:
+    struct live_order {
+        double id;
+        int token;
+        char side;
+        int price;
+        int quantity;
+    };
+
+    struct datagram {
+        int64_t due_ns;
+        const struct sockaddr_in *addr;
+        uint32_t len;
+        unsigned char data[ZNS_GENERATOR_MAX_PACKET];
+    };
+
+    // A packet held back on one line and how many more of the line's packets go first.
+    struct held_datagram {
+        bool held = false;
+        uint32_t countdown = 0;
+        datagram packet;
+    };
+
+    struct stream_state {
+        short stream_id;
+        int seq_no = 0;
+        double next_order_id;
+        int64_t next_heartbeat_ns = 0;
+        struct sockaddr_in addrs[2];
+        held_datagram held[2];
+        std::vector<int> mid;
+        std::vector<live_order> live;
+        std::vector<live_order> live_spread;
+    };
+
+    // Fills the next sequenced packet of a stream into packet, returns its length.
+    uint32_t build_packet(stream_state &stream, unsigned char *packet);
+    // action is 0 new, 1 modify, 2 cancel and 3 trade, falling back to what the book allows.
+    uint32_t build_order(stream_state &stream, std::vector<live_order> &live, bool spread, int action,
+                         unsigned char *packet);
+    void emit(stream_state &stream, const unsigned char *packet, uint32_t len, bool sequenced, int64_t now_ns,
+              GeneratorStats &stats);
+    void queue(int line, const datagram &packet);
+    void flush_due(int64_t now_ns, GeneratorStats &stats);
+    void send_batch(GeneratorStats &stats);
+
+    std::vector<stream_state> m_streams;
+    FeedModel m_model;
+    FeedFaults m_faults;
+    int m_sock;
+    std::atomic<bool> m_stop;
+
+    std::mt19937_64 m_rng;
+    std::discrete_distribution<int> m_kinds;
+    std::discrete_distribution<int> m_token_pick;
+    std::uniform_real_distribution<double> m_chance;
+
+    // Per line, in due order since every packet of a line carries the same delay.
+    std::deque<datagram> m_pending[2];
+
+    unsigned int m_batch_count;
+    struct mmsghdr m_msgs[ZNS_GENERATOR_BATCH];
+    struct iovec m_iovs[ZNS_GENERATOR_BATCH];
+    datagram m_batch[ZNS_GENERATOR_BATCH];
+};
+}
+
+#endif // __ZNS_FEED_GENERATOR_H
@@ -0,0 +1,242 @@
+#include "feedstats.hpp"
+#include "timeutil.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ZNS_SHM_DIR "/dev/shm"
+
+namespace znsreader
+{
+namespace
+{
+uint64_t relaxed(const std::atomic<uint64_t> &counter)
+{
+    return counter.load(std::memory_order_relaxed);
+}
+}
+
+FeedStatsPublisher::FeedStatsPublisher(const std::string &name, std::chrono::milliseconds interval)
+    : m_interval(interval), m_running(true)
+{
+    if (name.empty() || name.find('/') != std::string::npos) {
+        throw std::runtime_error("Feed stats name must be a plain file name");
+    }
+
+    m_path = ZNS_SHM_DIR "/" + name;
+    const std::string tmp_path = ZNS_SHM_DIR "/." + name + "." + std::to_string(::getpid());
+
+    int fd = ::open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || ::ftruncate(fd, sizeof(FeedStatsPage)) < 0) {
+        perror("feed stats page error:");
+        if (fd >= 0) {
+            ::close(fd);
+            ::unlink(tmp_path.c_str());
+        }
+        throw std::runtime_error("Failed to create feed stats page");
+    }
+
+    void *mapping = ::mmap(nullptr, sizeof(FeedStatsPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        perror("mmap error:");
+        ::unlink(tmp_path.c_str());
+        throw std::runtime_error("Failed to map feed stats page");
+    }
+
+    // The file starts out zeroed, data is empty and sequence even until the first snapshot.
+    m_page = (FeedStatsPage *)mapping;
+    m_page->magic = ZNS_FEED_STATS_MAGIC;
+    m_page->version = ZNS_FEED_STATS_VERSION;
+    m_page->data_size = sizeof(FeedStatsData);
+    m_page->publisher_pid = ::getpid();
+    m_page->interval_ms = (uint32_t)m_interval.count();
+
+    // Readers only find the name once the header is complete, a page left by a publisher
+    // that died is replaced.
+    if (::rename(tmp_path.c_str(), m_path.c_str()) < 0) {
+        perror("rename error:");
+        ::munmap(m_page, sizeof(FeedStatsPage));
+        ::unlink(tmp_path.c_str());
+        throw std::runtime_error("Failed to publish feed stats page");
+    }
+
+    std::cout << "Publishing feed stats " << m_path << " every " << m_interval.count() << "ms" << std::endl;
+
+    m_thread = std::thread(&FeedStatsPublisher::run, this);
+}
+
+FeedStatsPublisher::~FeedStatsPublisher()
+{
+    m_running.store(false, std::memory_order_release);
+    m_thread.join();
+    ::unlink(m_path.c_str());
+    ::munmap(m_page, sizeof(FeedStatsPage));
+}
+
+void FeedStatsPublisher::add_source(const MulticastSocketSet &sockets, const RingCounters *ring)
+{
+    std::lock_guard<std::mutex> guard(m_sources_lock);
+    m_sources.push_back({ &sockets, ring });
+}
+
+void FeedStatsPublisher::remove_source(const MulticastSocketSet &sockets)
+{
+    std::lock_guard<std::mutex> guard(m_sources_lock);
+    std::erase_if(m_sources, [&sockets](const stats_source &source) { return source.m_sockets == &sockets; });
+}
+
+void FeedStatsPublisher::run()
+{
+    auto next = std::chrono::steady_clock::now() + m_interval;
+
+    while (m_running.load(std::memory_order_acquire)) {
+        // Short sleeps, so the destructor is not held up by a long interval.
+        std::this_thread::sleep_for(std::min(m_interval, std::chrono::milliseconds(50)));
+        if (std::chrono::steady_clock::now() >= next) {
+            publish_now();
+            next += m_interval;
+        }
+    }
+}
+
+void FeedStatsPublisher::publish_now()
+{
+    std::lock_guard<std::mutex> guard(m_sources_lock);
+    FeedStatsData &data = m_page->data;
+    const uint64_t sequence = m_page->sequence.load(std::memory_order_relaxed);
+
+    m_page->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    data.line_count = 0;
+    data.ring_count = 0;
+
+    for (const stats_source &source : m_sources) {
+        const uint8_t ring = (uint8_t)data.ring_count;
+        if (source.m_ring != nullptr && data.ring_count < ZNS_FEED_STATS_MAX_RINGS) {
+            const RingCounters &counters = *source.m_ring;
+            data.rings[data.ring_count++] = { relaxed(counters.capacity), relaxed(counters.used),
+                                              relaxed(counters.high_watermark), relaxed(counters.full_stalls),
+                                              relaxed(counters.stall_spins) };
+        }
+
+        for (int fd : source.m_sockets->sockets()) {
+            if (data.line_count == ZNS_FEED_STATS_MAX_LINES) {
+                break;
+            }
+
+            const MulticastSocketSet::socket_source &socket = source.m_sockets->source(fd);
+            const SocketCounters &counters = source.m_sockets->socket_counters(fd);
+            FeedLineStats &line = data.lines[data.line_count++];
+
+            line.stream_id = socket.m_stream_id;
+            line.line = socket.m_line;
+            line.ring = (source.m_ring != nullptr) ? ring : UINT8_MAX;
+            line.fd = fd;
+            line.packets = relaxed(counters.packets);
+            line.bytes = relaxed(counters.bytes);
+            line.kernel_drops = relaxed(counters.kernel_drops);
+            line.seq_gaps = relaxed(counters.seq_gaps);
+            line.seq_missing = relaxed(counters.seq_missing);
+            line.duplicates = relaxed(counters.duplicates);
+            line.last_seq = counters.last_seq.load(std::memory_order_relaxed);
+        }
+    }
+
+    std::sort(data.lines, data.lines + data.line_count, [](const FeedLineStats &lhs, const FeedLineStats &rhs) {
+        return (lhs.stream_id != rhs.stream_id) ? (lhs.stream_id < rhs.stream_id) : (lhs.line < rhs.line);
+    });
+
+    data.stream_count = 0;
+    for (uint32_t i = 0; i < data.line_count; i++) {
+        const FeedLineStats &line = data.lines[i];
+        if (data.stream_count == 0 || data.streams[data.stream_count - 1].stream_id != line.stream_id) {
+            if (data.stream_count == ZNS_FEED_STATS_MAX_STREAMS) {
+                break;
+            }
+            data.streams[data.stream_count++] = { line.stream_id, 0, 0, 0, 0, 0, 0, 0, 0 };
+        }
+
+        FeedStreamStats &stream = data.streams[data.stream_count - 1];
+        stream.lines++;
+        stream.packets += line.packets;
+        stream.bytes += line.bytes;
+        stream.kernel_drops += line.kernel_drops;
+        stream.seq_gaps += line.seq_gaps;
+        stream.seq_missing += line.seq_missing;
+        stream.duplicates += line.duplicates;
+        stream.last_seq = std::max(stream.last_seq, line.last_seq);
+    }
+
+    data.updated_ns = realtime_ns();
+    data.snapshots++;
+
+    std::atomic_thread_fence(std::memory_order_release);
+    m_page->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+FeedStatsReader::FeedStatsReader(const std::string &name)
+{
+    const int fd = ::open((ZNS_SHM_DIR "/" + name).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("feed stats open error:");
+        throw std::runtime_error("Feed stats are not published");
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) < 0 || (std::size_t)st.st_size != sizeof(FeedStatsPage)) {
+        ::close(fd);
+        throw std::runtime_error("Feed stats page does not match this reader");
+    }
+
+    void *mapping = ::mmap(nullptr, sizeof(FeedStatsPage), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        perror("mmap error:");
+        throw std::runtime_error("Failed to map feed stats page");
+    }
+
+    m_page = (const FeedStatsPage *)mapping;
+    if (m_page->magic != ZNS_FEED_STATS_MAGIC || m_page->version != ZNS_FEED_STATS_VERSION
+        || m_page->data_size != sizeof(FeedStatsData)) {
+        ::munmap(mapping, sizeof(FeedStatsPage));
+        throw std::runtime_error("Feed stats page does not match this reader");
+    }
+}
+
+FeedStatsReader::~FeedStatsReader()
+{
+    ::munmap((void *)m_page, sizeof(FeedStatsPage));
+}
+
+bool FeedStatsReader::read(FeedStatsData &data) const
+{
+    for (int attempt = 0; attempt < 8; attempt++) {
+        const uint64_t before = m_page->sequence.load(std::memory_order_acquire);
+        if (before == 0) {
+            return false;
+        }
+        if (before & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::memcpy(&data, (const void *)&m_page->data, sizeof(data));
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_page->sequence.load(std::memory_order_relaxed) == before) {
+            return true;
+        }
+    }
+
+    return false;
+}
+}
@@ -0,0 +1,166 @@
+#ifndef __ZNS_FEED_STATS_H
+#define __ZNS_FEED_STATS_H
+
+#include "feedcounters.hpp"
+#include "udpreader.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define ZNS_FEED_STATS_MAGIC       0x5354415453464e5aULL // "ZNFSTATS"
+#define ZNS_FEED_STATS_VERSION     1
+#define ZNS_FEED_STATS_MAX_LINES   256
+#define ZNS_FEED_STATS_MAX_STREAMS 128
+#define ZNS_FEED_STATS_MAX_RINGS   16
+
+namespace znsreader
+{
+// One socket, i.e. one line of one stream, as its SocketCounters stood at the snapshot.
+struct FeedLineStats {
+    int16_t stream_id;
+    FeedLine line;
+    uint8_t ring; // index into FeedStatsData::rings of the ring the socket feeds
+    int32_t fd;
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t kernel_drops;
+    uint64_t seq_gaps;
+    uint64_t seq_missing;
+    uint64_t duplicates;
+    int64_t last_seq;
+};
+
+// Every line of a stream summed, last_seq is the highest of them. A seqNo both lines missed
+// is counted once per line here, the arbitrator's gap callback tells what was really lost.
+struct FeedStreamStats {
+    int16_t stream_id;
+    uint16_t lines;
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t kernel_drops;
+    uint64_t seq_gaps;
+    uint64_t seq_missing;
+    uint64_t duplicates;
+    int64_t last_seq;
+};
+
+struct FeedRingStats {
+    uint64_t capacity;
+    uint64_t used;
+    uint64_t high_watermark;
+    uint64_t full_stalls;
+    uint64_t stall_spins;
+};
+
+// One snapshot, ordered by stream then line.
+struct FeedStatsData {
+    int64_t updated_ns; // CLOCK_REALTIME of the snapshot
+    uint64_t snapshots;
+    uint32_t line_count;
+    uint32_t stream_count;
+    uint32_t ring_count;
+    FeedLineStats lines[ZNS_FEED_STATS_MAX_LINES];
+    FeedStreamStats streams[ZNS_FEED_STATS_MAX_STREAMS];
+    FeedRingStats rings[ZNS_FEED_STATS_MAX_RINGS];
+};
+
+// Shared page under /dev/shm. Every field before sequence is set once before the name is
+// visible. data is guarded by sequence as a seqlock: odd while the publisher rewrites it, a
+// reader copies data and keeps the copy only when sequence was even and unchanged around it.
+struct FeedStatsPage {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t data_size;
+    int32_t publisher_pid;
+    uint32_t interval_ms;
+    alignas(64) std::atomic<uint64_t> sequence;
+    alignas(64) FeedStatsData data;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Feed stats sequence must be lock free");
+
+// Snapshots the counters of every added socket set and ring into a FeedStatsPage published
+// as /dev/shm/<name>, every interval from its own thread, for feed_stats or any other
+// process to read live. The hot path only ever writes its own counters, all the reading and
+// summing happens here. The name is removed again when the publisher goes.
+class FeedStatsPublisher
+{
+  public:
+    FeedStatsPublisher() = delete;
+    explicit FeedStatsPublisher(const std::string &name,
+                                std::chrono::milliseconds interval = std::chrono::milliseconds(1000));
+    ~FeedStatsPublisher();
+
+    FeedStatsPublisher(const FeedStatsPublisher &) = delete;
+    FeedStatsPublisher &operator=(FeedStatsPublisher const &) = delete;
+
+    // sockets and ring must outlive the publisher or be removed first. ring may be null,
+    // e.g. for sockets drained by io_uring into a ring counted elsewhere.
+    void add_source(const MulticastSocketSet &sockets, const RingCounters *ring);
+    void remove_source(const MulticastSocketSet &sockets);
+
+    // A BasicAggregatedPacketReader, its sockets and its ring.
+    template <typename PacketReader>
+    void add_reader(const PacketReader &reader)
+    {
+        add_source(reader, &reader.ring_counters());
+    }
+
+    // Snapshots and publishes now, on the calling thread.
+    void publish_now();
+
+  private:
+    struct stats_source {
+        const MulticastSocketSet *m_sockets;
+        const RingCounters *m_ring;
+    };
+
+    void run();
+
+    std::string m_path;
+    std::chrono::milliseconds m_interval;
+    FeedStatsPage *m_page;
+    std::vector<stats_source> m_sources;
+    std::mutex m_sources_lock;
+
+    std::atomic<bool> m_running;
+    std::thread m_thread;
+};
+
+// Read only view of a page published by FeedStatsPublisher.
+class FeedStatsReader
+{
+  public:
+    FeedStatsReader() = delete;
+    explicit FeedStatsReader(const std::string &name);
+    ~FeedStatsReader();
+
+    FeedStatsReader(const FeedStatsReader &) = delete;
+    FeedStatsReader &operator=(FeedStatsReader const &) = delete;
+
+    // Copies the latest complete snapshot into data, false when none came out whole after
+    // a few tries or nothing was published yet.
+    bool read(FeedStatsData &data) const;
+
+    int32_t publisher_pid() const
+    {
+        return m_page->publisher_pid;
+    }
+
+    uint32_t interval_ms() const
+    {
+        return m_page->interval_ms;
+    }
+
+  private:
+    const FeedStatsPage *m_page;
+};
+}
+
+#endif // __ZNS_FEED_STATS_H
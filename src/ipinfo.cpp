@@ -0,0 +1,21 @@
+#include "ipinfo.hpp"
+
+// FO market tick by tick feeds
+std::map<short, single_stream_info> stream_id_net_config{
+    { 1, single_stream_info(1, 17741, 10831, "239.70.70.41", "239.70.70.31") },
+    { 2, single_stream_info(2, 17742, 10832, "239.70.70.42", "239.70.70.32") },
+    { 3, single_stream_info(3, 17743, 10833, "239.70.70.43", "239.70.70.33") },
+    { 4, single_stream_info(4, 17744, 10834, "239.70.70.44", "239.70.70.34") },
+    { 5, single_stream_info(5, 17745, 10835, "239.70.70.45", "239.70.70.35") },
+    { 6, single_stream_info(6, 17746, 10836, "239.70.70.46", "239.70.70.36") },
+    { 7, single_stream_info(7, 17747, 10837, "239.70.70.47", "239.70.70.37") },
+    { 8, single_stream_info(8, 17748, 10838, "239.70.70.48", "239.70.70.38") },
+    { 9, single_stream_info(9, 17749, 10839, "239.70.70.49", "239.70.70.39") },
+    { 10, single_stream_info(10, 17750, 10840, "239.70.70.50", "239.70.70.40") },
+    { 11, single_stream_info(11, 17761, 10871, "239.70.70.61", "239.70.70.71") },
+    { 12, single_stream_info(12, 17762, 10872, "239.70.70.62", "239.70.70.72") },
+    { 13, single_stream_info(13, 17763, 10873, "239.70.70.63", "239.70.70.73") },
+    { 14, single_stream_info(14, 17764, 10874, "239.70.70.64", "239.70.70.74") },
+    { 15, single_stream_info(15, 17765, 10875, "239.70.70.65", "239.70.70.75") },
+    { 16, single_stream_info(16, 17766, 10876, "239.70.70.66", "239.70.70.76") },
+};
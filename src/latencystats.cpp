@@ -0,0 +1,199 @@
+#include "latencystats.hpp"
+#include "timeutil.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define ZNS_LATENCY_UNIX_PREFIX "unix:"
+
+namespace znsreader
+{
+namespace
+{
+double calibrate_tsc()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    const int64_t start_ns = monotonic_ns();
+    const uint64_t start_ticks = TscClock::ticks();
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    const int64_t end_ns = monotonic_ns();
+    const uint64_t end_ticks = TscClock::ticks();
+    return (double)(end_ns - start_ns) / (double)(end_ticks - start_ticks);
+#else
+    return 1.0;
+#endif
+}
+}
+
+const char *latency_stage_name(LatencyStage stage)
+{
+    switch (stage) {
+    case LatencyStage::receive:
+        return "receive";
+    case LatencyStage::ring:
+        return "ring";
+    case LatencyStage::callback:
+        return "callback";
+    case LatencyStage::total:
+        return "total";
+    }
+    return "unknown";
+}
+
+double TscClock::ns_per_tick()
+{
+    static const double rate = calibrate_tsc();
+    return rate;
+}
+
+int64_t LatencyHistogram::percentile(const counts_type &counts, uint64_t total, double fraction)
+{
+    if (total == 0) {
+        return 0;
+    }
+
+    // Rank of the value asked for, from 1, so fraction 1.0 is the largest one.
+    const uint64_t rank = std::max<uint64_t>(1, (uint64_t)((fraction * total) + 0.5));
+    uint64_t seen = 0;
+
+    for (std::size_t i = 0; i < bucket_count; i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return bucket_max(i);
+        }
+    }
+    return bucket_max(bucket_count - 1);
+}
+
+LatencyExporter::LatencyExporter(const LatencyRecorder &recorder, const std::string &target,
+                                 std::chrono::milliseconds interval)
+    : m_recorder(recorder),
+      m_interval(interval),
+      m_previous(ZNS_LATENCY_STAGES * ZNS_LATENCY_MAX_STREAMS),
+      m_running(true)
+{
+    const std::string prefix = ZNS_LATENCY_UNIX_PREFIX;
+
+    m_datagram = target.compare(0, prefix.size(), prefix) == 0;
+    if (m_datagram) {
+        const std::string path = target.substr(prefix.size());
+        struct sockaddr_un addr;
+
+        if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+            throw std::runtime_error("Latency export socket path is empty or too long");
+        }
+
+        m_fd = ::socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (m_fd < 0) {
+            perror("socket error:");
+            throw std::runtime_error("Failed to create latency export socket");
+        }
+
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path, path.c_str(), path.size());
+        // Nobody bound yet is fine, connect is retried on every send until someone is.
+        ::connect(m_fd, (struct sockaddr *)&addr, sizeof(addr));
+        m_path = path;
+    } else {
+        m_fd = ::open(target.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (m_fd < 0) {
+            perror("latency export open error:");
+            throw std::runtime_error("Failed to open latency export file");
+        }
+    }
+
+    for (auto &counts : m_previous) {
+        counts.fill(0);
+    }
+
+    m_thread = std::thread(&LatencyExporter::run, this);
+}
+
+LatencyExporter::~LatencyExporter()
+{
+    m_running.store(false, std::memory_order_release);
+    m_thread.join();
+    export_now();
+    ::close(m_fd);
+}
+
+void LatencyExporter::run()
+{
+    auto next = std::chrono::steady_clock::now() + m_interval;
+
+    while (m_running.load(std::memory_order_acquire)) {
+        // Short sleeps, so the destructor is not held up by a long interval.
+        std::this_thread::sleep_for(std::min(m_interval, std::chrono::milliseconds(50)));
+        if (std::chrono::steady_clock::now() >= next) {
+            export_now();
+            next += m_interval;
+        }
+    }
+}
+
+void LatencyExporter::export_now()
+{
+    std::lock_guard<std::mutex> guard(m_export_lock);
+    const int64_t now_ns = realtime_ns();
+    LatencyHistogram::counts_type counts;
+    char line[512];
+
+    for (std::size_t stage = 0; stage < ZNS_LATENCY_STAGES; stage++) {
+        for (std::size_t slot = 0; slot < ZNS_LATENCY_MAX_STREAMS; slot++) {
+            LatencyHistogram::counts_type &previous = m_previous[(stage * ZNS_LATENCY_MAX_STREAMS) + slot];
+            uint64_t total = 0;
+
+            m_recorder.histogram((LatencyStage)stage, slot).snapshot(counts);
+            for (std::size_t i = 0; i < LatencyHistogram::bucket_count; i++) {
+                const uint64_t current = counts[i];
+                counts[i] = current - previous[i];
+                previous[i] = current;
+                total += counts[i];
+            }
+
+            if (total == 0) {
+                continue;
+            }
+
+            const int len = ::snprintf(
+                line, sizeof(line),
+                "{\"ts_ns\": %ld, \"stream\": %zu, \"stage\": \"%s\", \"count\": %lu, \"p50_ns\": %ld, "
+                "\"p90_ns\": %ld, \"p99_ns\": %ld, \"p999_ns\": %ld, \"max_ns\": %ld, \"unstamped\": %lu}\n",
+                (long)now_ns, slot, latency_stage_name((LatencyStage)stage), (unsigned long)total,
+                (long)LatencyHistogram::percentile(counts, total, 0.50),
+                (long)LatencyHistogram::percentile(counts, total, 0.90),
+                (long)LatencyHistogram::percentile(counts, total, 0.99),
+                (long)LatencyHistogram::percentile(counts, total, 0.999),
+                (long)LatencyHistogram::percentile(counts, total, 1.0), (unsigned long)m_recorder.unstamped());
+            emit(line, std::min<std::size_t>(len, sizeof(line) - 1));
+        }
+    }
+}
+
+void LatencyExporter::emit(const char *line, std::size_t len)
+{
+    if (!m_datagram) {
+        if (::write(m_fd, line, len) < 0) {
+            perror("latency export write error:");
+        }
+        return;
+    }
+
+    if (::send(m_fd, line, len, 0) < 0 && (errno == ENOTCONN || errno == ECONNREFUSED || errno == ENOENT)) {
+        // The listener is not there (yet), try to reach it again for the next line.
+        struct sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path, m_path.c_str(), m_path.size());
+        ::connect(m_fd, (struct sockaddr *)&addr, sizeof(addr));
+    }
+}
+}
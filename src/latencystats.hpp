@@ -0,0 +1,346 @@
+#ifndef __ZNS_LATENCY_STATS_H
+#define __ZNS_LATENCY_STATS_H
+
+#include "ringrecord.hpp"
+#include "spscqueue.hpp"
+#include "timeutil.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Linear sub buckets per power of two, 2^5 keeps every bucket within about 3% of its values.
+#define ZNS_LATENCY_SUB_BITS 5
+// Values at or above 2^ZNS_LATENCY_MAX_MAGNITUDE ns, about 18 minutes, land in the last bucket.
+#define ZNS_LATENCY_MAX_MAGNITUDE 40
+// Stream ids below this get their own histograms, any other id shares slot 0.
+#define ZNS_LATENCY_MAX_STREAMS 64
+// Ring pushes the reader side can be behind on before push stamps are dropped.
+#define ZNS_LATENCY_STAMP_DEPTH 8192
+
+namespace znsreader
+{
+// Where a record's time went, each stage ending where the next starts: receive is the record's
+// recv_timestamp_ns to the ring push, ring the push to the pop, callback the pop to the
+// reader returning, total all three.
+enum class LatencyStage : uint8_t {
+    receive = 0,
+    ring = 1,
+    callback = 2,
+    total = 3,
+};
+
+inline constexpr std::size_t ZNS_LATENCY_STAGES = 4;
+
+const char *latency_stage_name(LatencyStage stage);
+
+// Time stamp counter ticks and their rate. Only differences are turned into ns, so the rate
+// being a few ppm off from CLOCK_MONOTONIC does not matter at feed latencies. Falls back to
+// CLOCK_MONOTONIC ns where there is no TSC.
+class TscClock
+{
+  public:
+    static uint64_t ticks()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return (uint64_t)monotonic_ns();
+#endif
+    }
+
+    // Measured once per process against CLOCK_MONOTONIC, the first call takes about 10ms.
+    static double ns_per_tick();
+
+    static int64_t to_ns(int64_t ticks)
+    {
+        static const double rate = ns_per_tick();
+        return (int64_t)(ticks * rate);
+    }
+};
+
+// HDR style log-linear histogram of ns values: values below 2 * 2^ZNS_LATENCY_SUB_BITS get a
+// bucket each, above that every power of two is split into 2^ZNS_LATENCY_SUB_BITS equal
+// buckets. Only one thread may record, any thread may read the counts meanwhile. Recording is
+// a plain load and store of one counter, no read-modify-write.
+class alignas(64) LatencyHistogram
+{
+  public:
+    static constexpr std::size_t sub_buckets = (std::size_t)1 << ZNS_LATENCY_SUB_BITS;
+    static constexpr std::size_t bucket_count =
+        (ZNS_LATENCY_MAX_MAGNITUDE - ZNS_LATENCY_SUB_BITS + 1) * sub_buckets;
+    using counts_type = std::array<uint64_t, bucket_count>;
+
+    LatencyHistogram()
+    {
+        for (auto &count : m_counts) {
+            count.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    LatencyHistogram(const LatencyHistogram &) = delete;
+    LatencyHistogram &operator=(LatencyHistogram const &) = delete;
+
+    void record(int64_t value_ns)
+    {
+        std::atomic<uint64_t> &count = m_counts[bucket_index(value_ns)];
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    // Counts as of now, from any thread.
+    void snapshot(counts_type &counts) const
+    {
+        for (std::size_t i = 0; i < bucket_count; i++) {
+            counts[i] = m_counts[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    static std::size_t bucket_index(int64_t value_ns)
+    {
+        constexpr uint64_t max_value = ((uint64_t)1 << ZNS_LATENCY_MAX_MAGNITUDE) - 1;
+        const uint64_t value = (value_ns < 0) ? 0 : std::min((uint64_t)value_ns, max_value);
+
+        if (value < 2 * sub_buckets) {
+            return value;
+        }
+
+        const unsigned magnitude = std::bit_width(value) - 1;
+        const unsigned shift = magnitude - ZNS_LATENCY_SUB_BITS;
+        return ((magnitude - ZNS_LATENCY_SUB_BITS + 1) * sub_buckets) + ((value >> shift) - sub_buckets);
+    }
+
+    // Largest value that lands in bucket index.
+    static int64_t bucket_max(std::size_t index)
+    {
+        if (index < 2 * sub_buckets) {
+            return index;
+        }
+
+        const unsigned shift = (index / sub_buckets) - 1;
+        return (int64_t)(((sub_buckets + (index % sub_buckets) + 1) << shift) - 1);
+    }
+
+    // Value at or below which fraction of counts lie, bucket_max of its bucket. 0 when empty.
+    static int64_t percentile(const counts_type &counts, uint64_t total, double fraction);
+
+  private:
+    std::array<std::atomic<uint64_t>, bucket_count> m_counts;
+};
+
+// Time of one ring push, over the bytes [m_start, m_end) in the order they were pushed.
+struct LatencyPushStamp {
+    uint64_t m_start;
+    uint64_t m_end;
+    uint64_t m_ticks;
+    int64_t m_realtime_ns;
+};
+
+// Per stream, per stage histograms of the records passing one ring, filled by a
+// TimedRecordWriter and TimedRecordReader pair. The receive thread only queues a push stamp
+// per push, every histogram is written by the ring's reader thread. A LatencyExporter, or
+// anything else, reads them from its own thread.
+class LatencyRecorder
+{
+  public:
+    LatencyRecorder() : m_histograms(ZNS_LATENCY_STAGES * ZNS_LATENCY_MAX_STREAMS), m_unstamped(0)
+    {
+        // Calibrates the TSC here rather than on the reader's first records.
+        TscClock::to_ns(0);
+    }
+
+    LatencyRecorder(const LatencyRecorder &) = delete;
+    LatencyRecorder &operator=(LatencyRecorder const &) = delete;
+
+    static std::size_t stream_slot(int16_t stream_id)
+    {
+        return ((uint16_t)stream_id < ZNS_LATENCY_MAX_STREAMS) ? (uint16_t)stream_id : 0;
+    }
+
+    LatencyHistogram &histogram(LatencyStage stage, std::size_t slot)
+    {
+        return m_histograms[((std::size_t)stage * ZNS_LATENCY_MAX_STREAMS) + slot];
+    }
+
+    const LatencyHistogram &histogram(LatencyStage stage, std::size_t slot) const
+    {
+        return m_histograms[((std::size_t)stage * ZNS_LATENCY_MAX_STREAMS) + slot];
+    }
+
+    // Only for the ring's writer thread.
+    void stamp_push(const LatencyPushStamp &stamp)
+    {
+        // A full queue leaves those bytes unstamped, the reader skips their records.
+        m_stamps.try_push(stamp);
+    }
+
+    // Only for the ring's reader thread.
+    bool next_stamp(LatencyPushStamp &stamp)
+    {
+        return m_stamps.try_pop(stamp);
+    }
+
+    void add_unstamped(uint64_t records)
+    {
+        m_unstamped.store(m_unstamped.load(std::memory_order_relaxed) + records, std::memory_order_relaxed);
+    }
+
+    // Records that went by without a push stamp, and so without samples.
+    uint64_t unstamped() const
+    {
+        return m_unstamped.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::vector<LatencyHistogram> m_histograms;
+    SpscQueue<LatencyPushStamp, ZNS_LATENCY_STAMP_DEPTH> m_stamps;
+    alignas(64) std::atomic<uint64_t> m_unstamped;
+};
+
+// Record mode writer policy that stamps every push for a LatencyRecorder. Wraps the real
+// policy, e.g. RecordRecvWriter, build it with BasicAggregatedPacketReader's writer factory
+// constructor.
+template <typename Writer>
+class TimedRecordWriter
+{
+  public:
+    static constexpr std::size_t push_size = Writer::push_size;
+
+    TimedRecordWriter(Writer writer, LatencyRecorder &recorder)
+        : m_writer(std::move(writer)), m_recorder(&recorder), m_written(0)
+    {
+    }
+
+    std::size_t operator()(int fd, unsigned char *buf, std::size_t bufLen)
+    {
+        const std::size_t written = m_writer(fd, buf, bufLen);
+
+        if (written != 0) {
+            m_recorder->stamp_push({ m_written, m_written + written, TscClock::ticks(), realtime_ns() });
+            m_written += written;
+        }
+
+        return written;
+    }
+
+    void wait_completions(int timeout_ms)
+        requires requires(Writer &writer) { writer.wait_completions(0); }
+    {
+        m_writer.wait_completions(timeout_ms);
+    }
+
+  private:
+    Writer m_writer;
+    LatencyRecorder *m_recorder;
+    uint64_t m_written;
+};
+
+// Ring reader that times Reader, a record mode reader such as RingRecordReader<Handler>, and
+// files every record it was handed under its stream and each stage. The callback stage is
+// the whole call, shared by every record in it. Pairs with a TimedRecordWriter on a
+// BasicRingBuffer, which hands the reader every byte once and in order.
+template <typename Reader>
+class TimedRecordReader
+{
+  public:
+    TimedRecordReader(Reader reader, LatencyRecorder &recorder)
+        : m_reader(std::move(reader)), m_recorder(&recorder), m_read(0), m_stamp{ 0, 0, 0, 0 }
+    {
+    }
+
+    std::size_t operator()(const unsigned char *data, std::size_t size)
+    {
+        const uint64_t pop_ticks = TscClock::ticks();
+        const std::size_t consumed = m_reader(data, size);
+        const uint64_t done_ticks = TscClock::ticks();
+        const int64_t callback_ns = TscClock::to_ns((int64_t)(done_ticks - pop_ticks));
+        uint64_t unstamped = 0;
+
+        for (const RingRecord record : RingRecordRange(data, size)) {
+            const uint64_t offset = m_read + (record.data() - data);
+
+            while (m_stamp.m_end <= offset && m_recorder->next_stamp(m_stamp)) {
+            }
+            if (offset < m_stamp.m_start || offset >= m_stamp.m_end) {
+                unstamped++;
+                continue;
+            }
+
+            const std::size_t slot = LatencyRecorder::stream_slot(record.header().stream_id);
+            const int64_t receive_ns = m_stamp.m_realtime_ns - record.header().recv_timestamp_ns;
+            const int64_t ring_ns = TscClock::to_ns((int64_t)(pop_ticks - m_stamp.m_ticks));
+
+            m_recorder->histogram(LatencyStage::receive, slot).record(receive_ns);
+            m_recorder->histogram(LatencyStage::ring, slot).record(ring_ns);
+            m_recorder->histogram(LatencyStage::callback, slot).record(callback_ns);
+            m_recorder->histogram(LatencyStage::total, slot).record(receive_ns + ring_ns + callback_ns);
+        }
+
+        if (unstamped != 0) {
+            m_recorder->add_unstamped(unstamped);
+        }
+        m_read += size;
+        return consumed;
+    }
+
+    Reader &reader()
+    {
+        return m_reader;
+    }
+
+  private:
+    Reader m_reader;
+    LatencyRecorder *m_recorder;
+    uint64_t m_read;
+    LatencyPushStamp m_stamp;
+};
+
+// Snapshots a LatencyRecorder every interval on its own thread and writes, for every stream
+// and stage that saw records in the interval, one JSON line with the interval's count and
+// percentiles. target is a file, appended to, or unix:<path> for a local datagram socket
+// someone may be bound to, one line per datagram. Lines nobody receives are dropped.
+class LatencyExporter
+{
+  public:
+    LatencyExporter() = delete;
+    LatencyExporter(const LatencyRecorder &recorder, const std::string &target,
+                    std::chrono::milliseconds interval = std::chrono::milliseconds(1000));
+    ~LatencyExporter();
+
+    LatencyExporter(const LatencyExporter &) = delete;
+    LatencyExporter &operator=(LatencyExporter const &) = delete;
+
+    // Snapshots and writes one interval now, on the calling thread.
+    void export_now();
+
+  private:
+    void run();
+    void emit(const char *line, std::size_t len);
+
+    const LatencyRecorder &m_recorder;
+    std::chrono::milliseconds m_interval;
+    int m_fd;
+    bool m_datagram;
+    std::string m_path; // socket path when m_datagram
+    // Last snapshot of each histogram, the next interval is the difference.
+    std::vector<LatencyHistogram::counts_type> m_previous;
+    std::mutex m_export_lock;
+
+    std::atomic<bool> m_running;
+    std::thread m_thread;
+};
+}
+
+#endif // __ZNS_LATENCY_STATS_H
@@ -0,0 +1,280 @@
+#ifndef __ZNS_LINE_ARBITRATOR_H
+#define __ZNS_LINE_ARBITRATOR_H
+
+#include "ipinfo.hpp"
+#include "nsetypes.hpp"
+#include "ringrecord.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace znsreader
+{
+// Missing sequence numbers [start_seq, end_seq] on one stream.
+struct SequenceGap {
+    short stream_id;
+    int64_t start_seq;
+    int64_t end_seq;
+};
+
+struct ArbitrationStats {
+    uint64_t delivered;
+    uint64_t duplicates;
+    uint64_t gaps;
+    uint64_t missing;
+};
+
+// Merges the primary and secondary copies of every stream into one in-order sequence.
+// The first copy of each (stream, seqNo) is delivered and the other dropped. Packets that
+// arrive ahead of a hole are held in a Window deep reorder buffer per stream; the hole is
+// reported as a gap once the window overflows or the oldest held packet is older than
+// max_hold_ns. Packets with seqNo 0 are not sequenced and pass straight through.
+//
+// Handler needs on_record(const RingRecord &) and on_gap(const SequenceGap &). Usable as
+// the handler of RingRecordReader, or as a RecordReaderCallBack through std::ref.
+template <typename Handler, std::size_t Window = 64, std::size_t SlotSize = 128>
+class LineArbitrator
+{
+    static_assert((Window & (Window - 1)) == 0, "Window must be a power of two");
+    static_assert(SlotSize > sizeof(RingRecordHeader) + sizeof(StreamHeader), "SlotSize too small");
+
+  public:
+    LineArbitrator() = delete;
+    LineArbitrator(const std::map<short, single_stream_info> &stream_config, Handler handler,
+                   int64_t max_hold_ns = 1000000)
+        : m_handler(std::move(handler)), m_max_hold_ns(max_hold_ns)
+    {
+        short max_stream_id = 0;
+        for (auto &one_stream : stream_config) {
+            if (one_stream.first > max_stream_id) {
+                max_stream_id = one_stream.first;
+            }
+        }
+
+        if (max_stream_id <= 0) {
+            throw std::runtime_error("stream ids are incorrect in config");
+        }
+
+        m_streams.resize(max_stream_id + 1);
+        m_slots.resize((max_stream_id + 1) * Window * SlotSize);
+        m_stats.resize(max_stream_id + 1);
+    }
+
+    std::size_t operator()(RingRecordRange records)
+    {
+        int64_t latest_ns = 0;
+
+        for (const RingRecord record : records) {
+            arbitrate(record);
+            latest_ns = record.header().recv_timestamp_ns;
+        }
+
+        if (m_holding != 0) {
+            expire_held(latest_ns);
+        }
+
+        return records.size_bytes();
+    }
+
+    const ArbitrationStats &stats(short stream_id) const
+    {
+        return m_stats[stream_id];
+    }
+
+    Handler &handler()
+    {
+        return m_handler;
+    }
+
+  private:
+    struct stream_state {
+        int64_t next_seq = 0; // 0 until the first sequenced packet
+        int64_t held_since_ns = 0;
+        uint32_t held_count = 0;
+        uint8_t occupied[Window] = {};
+    };
+
+    void arbitrate(const RingRecord &record)
+    {
+        const short stream_id = record.header().stream_id;
+        if (record.payload_len() < sizeof(StreamHeader) || stream_id <= 0
+            || (std::size_t)stream_id >= m_streams.size()) {
+            m_handler.on_record(record);
+            return;
+        }
+
+        const int64_t seq = (uint32_t)((const StreamHeader *)record.payload())->seqNo;
+        if (seq == 0) {
+            m_handler.on_record(record);
+            return;
+        }
+
+        stream_state &state = m_streams[stream_id];
+
+        if (state.next_seq == 0) {
+            state.next_seq = seq;
+        }
+
+        if (seq < state.next_seq) {
+            m_stats[stream_id].duplicates++;
+            return;
+        }
+
+        if (seq - state.next_seq >= (int64_t)Window) {
+            // Slide the window up to seq. Only what falls out of it is lost, holes still
+            // inside it can arrive on the other line.
+            skip_to(stream_id, state, seq - Window + 1);
+        }
+
+        if (seq == state.next_seq) {
+            deliver(stream_id, record);
+            state.next_seq++;
+            drain_in_order(stream_id, state);
+            return;
+        }
+
+        hold(stream_id, state, record);
+    }
+
+    // Only [next_seq, next_seq + Window) can be parked, slots alias beyond that.
+    static bool is_held(const stream_state &state, int64_t seq)
+    {
+        return state.held_count != 0 && seq < (state.next_seq + (int64_t)Window)
+               && state.occupied[seq & (Window - 1)];
+    }
+
+    void deliver(short stream_id, const RingRecord &record)
+    {
+        m_stats[stream_id].delivered++;
+        m_handler.on_record(record);
+    }
+
+    unsigned char *slot(short stream_id, int64_t seq)
+    {
+        return m_slots.data() + ((stream_id * Window) + (seq & (Window - 1))) * SlotSize;
+    }
+
+    void hold(short stream_id, stream_state &state, const RingRecord &record)
+    {
+        const int64_t seq = (uint32_t)((const StreamHeader *)record.payload())->seqNo;
+        const std::size_t index = seq & (Window - 1);
+
+        if (state.occupied[index]) {
+            m_stats[stream_id].duplicates++;
+            return;
+        }
+
+        if (record.record_size() > SlotSize) {
+            // Cannot park it, so stop waiting for the hole in front of it.
+            skip_to(stream_id, state, seq);
+            deliver(stream_id, record);
+            state.next_seq++;
+            drain_in_order(stream_id, state);
+            return;
+        }
+
+        ::memcpy(slot(stream_id, seq), record.data(), record.record_size());
+        state.occupied[index] = 1;
+
+        if (state.held_count++ == 0) {
+            state.held_since_ns = record.header().recv_timestamp_ns;
+            m_holding++;
+        }
+    }
+
+    void release(short stream_id, stream_state &state, int64_t seq)
+    {
+        state.occupied[seq & (Window - 1)] = 0;
+        deliver(stream_id, RingRecord(slot(stream_id, seq)));
+
+        if (--state.held_count == 0) {
+            m_holding--;
+        }
+    }
+
+    void drain_in_order(short stream_id, stream_state &state)
+    {
+        while (state.held_count != 0 && state.occupied[state.next_seq & (Window - 1)]) {
+            release(stream_id, state, state.next_seq);
+            state.next_seq++;
+        }
+    }
+
+    // Advance next_seq to new_next, releasing held packets and reporting holes on the way.
+    void skip_to(short stream_id, stream_state &state, int64_t new_next)
+    {
+        int64_t gap_start = 0;
+
+        while (state.next_seq < new_next) {
+            if (is_held(state, state.next_seq)) {
+                if (gap_start != 0) {
+                    report_gap(stream_id, gap_start, state.next_seq - 1);
+                    gap_start = 0;
+                }
+                release(stream_id, state, state.next_seq);
+                state.next_seq++;
+            } else if (state.held_count == 0) {
+                // Nothing else held, the rest of the range is one hole.
+                if (gap_start == 0) {
+                    gap_start = state.next_seq;
+                }
+                state.next_seq = new_next;
+            } else {
+                if (gap_start == 0) {
+                    gap_start = state.next_seq;
+                }
+                state.next_seq++;
+            }
+        }
+
+        if (gap_start != 0) {
+            report_gap(stream_id, gap_start, new_next - 1);
+        }
+
+        drain_in_order(stream_id, state);
+    }
+
+    void expire_held(int64_t now_ns)
+    {
+        for (std::size_t stream_id = 1; stream_id < m_streams.size(); stream_id++) {
+            stream_state &state = m_streams[stream_id];
+
+            while (state.held_count != 0 && (now_ns - state.held_since_ns) > m_max_hold_ns) {
+                int64_t first_held = state.next_seq;
+                while (!state.occupied[first_held & (Window - 1)]) {
+                    first_held++;
+                }
+
+                skip_to(stream_id, state, first_held);
+
+                // Whatever is still parked waits behind a newer hole, restart its clock.
+                if (state.held_count != 0) {
+                    state.held_since_ns = now_ns;
+                }
+            }
+        }
+    }
+
+    void report_gap(short stream_id, int64_t start_seq, int64_t end_seq)
+    {
+        m_stats[stream_id].gaps++;
+        m_stats[stream_id].missing += (end_seq - start_seq + 1);
+        m_handler.on_gap(SequenceGap{ stream_id, start_seq, end_seq });
+    }
+
+    Handler m_handler;
+    int64_t m_max_hold_ns;
+    // Streams currently holding at least one packet.
+    std::size_t m_holding = 0;
+    // All indexed by stream id, slots are Window * SlotSize bytes per stream.
+    std::vector<stream_state> m_streams;
+    std::vector<unsigned char> m_slots;
+    std::vector<ArbitrationStats> m_stats;
+};
+}
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef __ZNS_MSG_DECODER_H
+#define __ZNS_MSG_DECODER_H
+
+#include "nsetypes.hpp"
+#include "ringrecord.hpp"
+#include <cstddef>
+#include <utility>
+
+namespace znsreader
+{
+// Typed views handed to a handler. They reference the packed structs in the caller's
+// buffer, the compiler emits unaligned loads for their members, nothing is copied.
+struct OrderMessage {
+    const StreamHeader &header;
+    nseMsgType type; // newOrderMsg, modOrderMsg or cancelOrderMsg
+    const OrderData &order;
+};
+
+struct TradeMessage {
+    const StreamHeader &header;
+    const TradeData &trade;
+};
+
+struct SpreadOrderMessage {
+    const StreamHeader &header;
+    nseMsgType type; // newSpreadOrderMsg, modSpreadOrderMsg or cancelSpreadOrderMsg
+    const SpreadOrderData &order;
+};
+
+struct SpreadTradeMessage {
+    const StreamHeader &header;
+    const SpreadTradeData &trade;
+};
+
+struct HeartbeatMessage {
+    const StreamHeader &header;
+    const HeartBeatData &heartbeat;
+};
+
+// A packet that is too short for its header or its cMsgType, or whose cMsgType is not a
+// feed message.
+struct InvalidMessage {
+    const unsigned char *packet;
+    std::size_t length;
+};
+
+template <typename Handler, typename Message>
+concept MessageHandler = requires(Handler &handler, const Message &message) { handler.on_message(message); };
+
+// Packet bytes a message kind needs, msgLen has to cover at least this much.
+template <typename Body>
+constexpr std::size_t message_size()
+{
+    return sizeof(StreamHeader) + sizeof(char) + sizeof(Body);
+}
+
+// Hands one StreamPacket of packet_len bytes to Handler::on_message for its kind. Handler
+// only overloads on_message for the kinds it wants, the rest are skipped at compile time.
+// Returns false for an InvalidMessage.
+template <typename Handler>
+inline bool decode_packet(const unsigned char *packet, std::size_t packet_len, Handler &handler)
+{
+    if (packet_len < sizeof(StreamHeader) + sizeof(char)) {
+        if constexpr (MessageHandler<Handler, InvalidMessage>) {
+            handler.on_message(InvalidMessage{ packet, packet_len });
+        }
+        return false;
+    }
+
+    const StreamPacket *stream_packet = (const StreamPacket *)packet;
+    const StreamHeader &header = stream_packet->streamHdr;
+    const nseMsgType type = (nseMsgType)stream_packet->streamData.cMsgType;
+
+    switch (type) {
+    case newOrderMsg:
+    case modOrderMsg:
+    case cancelOrderMsg:
+        if (packet_len < message_size<OrderData>()) {
+            break;
+        }
+        if constexpr (MessageHandler<Handler, OrderMessage>) {
+            handler.on_message(OrderMessage{ header, type, stream_packet->streamData.p.orderData });
+        }
+        return true;
+    case tradeMesg:
+        if (packet_len < message_size<TradeData>()) {
+            break;
+        }
+        if constexpr (MessageHandler<Handler, TradeMessage>) {
+            handler.on_message(TradeMessage{ header, stream_packet->streamData.p.tradeData });
+        }
+        return true;
+    case newSpreadOrderMsg:
+    case modSpreadOrderMsg:
+    case cancelSpreadOrderMsg:
+        if (packet_len < message_size<SpreadOrderData>()) {
+            break;
+        }
+        if constexpr (MessageHandler<Handler, SpreadOrderMessage>) {
+            handler.on_message(SpreadOrderMessage{ header, type, stream_packet->streamData.p.spdOrderData });
+        }
+        return true;
+    case spreadTradeMsg:
+        if (packet_len < message_size<SpreadTradeData>()) {
+            break;
+        }
+        if constexpr (MessageHandler<Handler, SpreadTradeMessage>) {
+            handler.on_message(SpreadTradeMessage{ header, stream_packet->streamData.p.spdTradeData });
+        }
+        return true;
+    case heartBeatMsg:
+        if (packet_len < message_size<HeartBeatData>()) {
+            break;
+        }
+        if constexpr (MessageHandler<Handler, HeartbeatMessage>) {
+            handler.on_message(HeartbeatMessage{ header, stream_packet->streamData.p.hbData });
+        }
+        return true;
+    default:
+        break;
+    }
+
+    if constexpr (MessageHandler<Handler, InvalidMessage>) {
+        handler.on_message(InvalidMessage{ packet, packet_len });
+    }
+    return false;
+}
+
+// Walks StreamPackets laid back to back, as in .bin captures, each sized by its msgLen.
+// Returns the bytes consumed, short of buf_len when the rest is a partial packet or a
+// msgLen too small to step over.
+template <typename Handler>
+inline std::size_t decode_packets(const unsigned char *buf, std::size_t buf_len, Handler &handler)
+{
+    std::size_t offset = 0;
+
+    while (offset + sizeof(StreamHeader) <= buf_len) {
+        const short msg_len = ((const StreamHeader *)(buf + offset))->msgLen;
+        if (msg_len < (short)sizeof(StreamHeader) || offset + msg_len > buf_len) {
+            break;
+        }
+
+        decode_packet(buf + offset, msg_len, handler);
+        offset += msg_len;
+    }
+
+    return offset;
+}
+
+// Decodes ring records for Handler. Works as the handler of a RingRecordReader, taking
+// RingRecordRanges, and of LineArbitrator or RecoverySplicer, taking single records and
+// passing gaps on when Handler has on_gap.
+template <typename Handler>
+class MessageDecoder
+{
+  public:
+    explicit MessageDecoder(Handler handler = Handler()) : m_handler(std::forward<Handler>(handler))
+    {
+    }
+
+    std::size_t operator()(RingRecordRange records)
+    {
+        for (const RingRecord record : records) {
+            decode_packet(record.payload(), record.payload_len(), m_handler);
+        }
+        return records.size_bytes();
+    }
+
+    void on_record(const RingRecord &record)
+    {
+        decode_packet(record.payload(), record.payload_len(), m_handler);
+    }
+
+    template <typename Gap>
+    void on_gap(const Gap &gap)
+        requires requires(Handler &handler) { handler.on_gap(gap); }
+    {
+        m_handler.on_gap(gap);
+    }
+
+    Handler &handler()
+    {
+        return m_handler;
+    }
+
+  private:
+    [[no_unique_address]] Handler m_handler;
+};
+}
+
+#endif // __ZNS_MSG_DECODER_H
@@ -1,93 +1,110 @@
 #include "nsereader.hpp"
+#include "binlog.hpp"
+#include "feedstats.hpp"
 #include "ipinfo.hpp"
+#include "latencystats.hpp"
+#include "linearbitrator.hpp"
 #include "nsetypes.hpp"
+#include "timeutil.hpp"
 #include "udpreader.hpp"
 #include <cstdio>
-#include <fstream>
+#include <ctime>
 #include <memory>
 #include <pthread.h>
 #include <stdexcept>
 #include <thread>
 #include <vector>
 
-// FO market tick by tick feeds
-std::map<short, single_stream_info> stream_id_net_config{
-    { 1, single_stream_info(1, 17741, 10831, "239.70.70.41", "239.70.70.31") },
-    { 2, single_stream_info(2, 17742, 10832, "239.70.70.42", "239.70.70.32") },
-    { 3, single_stream_info(3, 17743, 10833, "239.70.70.43", "239.70.70.33") },
-    { 4, single_stream_info(4, 17744, 10834, "239.70.70.44", "239.70.70.34") },
-    { 5, single_stream_info(5, 17745, 10835, "239.70.70.45", "239.70.70.35") },
-    { 6, single_stream_info(6, 17746, 10836, "239.70.70.46", "239.70.70.36") },
-    { 7, single_stream_info(7, 17747, 10837, "239.70.70.47", "239.70.70.37") },
-    { 8, single_stream_info(8, 17748, 10838, "239.70.70.48", "239.70.70.38") },
-    { 9, single_stream_info(9, 17749, 10839, "239.70.70.49", "239.70.70.39") },
-    { 10, single_stream_info(10, 17750, 10840, "239.70.70.50", "239.70.70.40") },
-    { 11, single_stream_info(11, 17761, 10871, "239.70.70.61", "239.70.70.71") },
-    { 12, single_stream_info(12, 17762, 10872, "239.70.70.62", "239.70.70.72") },
-    { 13, single_stream_info(13, 17763, 10873, "239.70.70.63", "239.70.70.73") },
-    { 14, single_stream_info(14, 17764, 10874, "239.70.70.64", "239.70.70.74") },
-    { 15, single_stream_info(15, 17765, 10875, "239.70.70.65", "239.70.70.75") },
-    { 16, single_stream_info(16, 17766, 10876, "239.70.70.66", "239.70.70.76") },
-};
-
 namespace znsreader
 {
-SubscriptionManager::SubscriptionManager(std::map<short, single_stream_info> &stream_config, bool use_huge_pages,
-                                         ZnsReadCallBack reader_cbk)
-    : m_aggr_reader(stream_config, use_huge_pages, reader_cbk)
+namespace
+{
+// Publishes data in pieces of at most half the shared ring, each ending where next_boundary
+// says a packet or record ends.
+template <typename NextBoundary>
+void publish_in_pieces(ShmFeedPublisher &publisher, const unsigned char *data, std::size_t size,
+                       NextBoundary next_boundary)
 {
-    m_reader_thread = std::thread(start_reader, std::ref(*this));
-    m_writer_thread = std::thread(start_writer, std::ref(*this));
+    const std::size_t limit = publisher.capacity() / 2;
+    std::size_t start = 0;
 
-    int ret = zns_set_thread_affinity(m_reader_thread, 0);
-    if (ret < 0) {
-        throw std::runtime_error("writer setaffinity error:");
+    while (size - start > limit) {
+        std::size_t end = start;
+        for (std::size_t next = next_boundary(end); next <= start + limit && next > end; next = next_boundary(end)) {
+            end = next;
+        }
+        if (end == start) {
+            // A single unit larger than half the ring cannot be published whole.
+            throw std::runtime_error("Shared feed unit exceeds half the ring");
+        }
+        publisher.publish(data + start, end - start);
+        start = end;
     }
 
-    ret = zns_set_thread_affinity(m_writer_thread, 1);
-    if (ret < 0) {
-        throw std::runtime_error("reader setaffinity error:");
+    if (size > start) {
+        publisher.publish(data + start, size - start);
     }
 }
 
-SubscriptionManager::~SubscriptionManager()
+SubscriptionManager::ZnsReadCallBack publishing_callback(std::shared_ptr<ShmFeedPublisher> publisher,
+                                                         SubscriptionManager::ZnsReadCallBack reader_cbk)
 {
-    m_writer_thread.join();
-    m_reader_thread.join();
+    return [publisher, reader_cbk](const unsigned char *data, std::size_t size) -> std::size_t {
+        publish_in_pieces(*publisher, data, size, [data](std::size_t offset) {
+            return offset + ((const StreamHeader *)(data + offset))->msgLen;
+        });
+        return reader_cbk ? reader_cbk(data, size) : size;
+    };
 }
 
-void SubscriptionManager::start_reader(SubscriptionManager &sub_mgr)
+SubscriptionManager::ZnsRecordCallBack publishing_callback(std::shared_ptr<ShmFeedPublisher> publisher,
+                                                           SubscriptionManager::ZnsRecordCallBack record_cbk)
 {
-    sub_mgr.m_aggr_reader.read_packets_from_ringbuf();
+    return [publisher, record_cbk](RingRecordRange records) -> std::size_t {
+        publish_in_pieces(*publisher, records.data(), records.size_bytes(), [&records](std::size_t offset) {
+            return offset + RingRecord(records.data() + offset).record_size();
+        });
+        return record_cbk ? record_cbk(records) : records.size_bytes();
+    };
+}
 }
 
-void SubscriptionManager::start_writer(SubscriptionManager &sub_mgr)
+SubscriptionManager::SubscriptionManager(std::map<short, single_stream_info> &stream_config, bool use_huge_pages,
+                                         ZnsReadCallBack reader_cbk)
+    : BasicSubscriptionManager(stream_config, use_huge_pages, reader_cbk)
 {
-    sub_mgr.m_aggr_reader.write_packets_to_ringbuf();
 }
 
-int SubscriptionManager::zns_set_thread_affinity(std::thread &target_thread, int32_t cpu_core)
+SubscriptionManager::SubscriptionManager(std::map<short, single_stream_info> &stream_config, bool use_huge_pages,
+                                         ZnsRecordCallBack record_cbk)
+    : BasicSubscriptionManager(stream_config, use_huge_pages, record_cbk)
 {
-    if (cpu_core < 0) {
-        return -1;
-    }
-
-    cpu_set_t reader_set;
-    CPU_ZERO(&reader_set);
-    CPU_SET(cpu_core, &reader_set);
-
-    int rc = pthread_setaffinity_np(target_thread.native_handle(), sizeof(cpu_set_t), &reader_set);
-    if (rc != 0) {
-        perror("pthread_setaffinity_np error:");
-        throw std::runtime_error("failed to set cpu affinity");
-    }
+}
 
-    return rc;
+// The callbacks own the publisher, so it outlives the reader thread.
+SubscriptionManager::SubscriptionManager(std::map<short, single_stream_info> &stream_config, bool use_huge_pages,
+                                         ZnsReadCallBack reader_cbk, const std::string &shm_name,
+                                         std::size_t shm_size)
+    : BasicSubscriptionManager(stream_config, use_huge_pages,
+                               publishing_callback(std::make_shared<ShmFeedPublisher>(
+                                                       shm_name, ShmFeedFormat::stream_packets, shm_size, use_huge_pages),
+                                                   std::move(reader_cbk)))
+{
 }
 
+SubscriptionManager::SubscriptionManager(std::map<short, single_stream_info> &stream_config, bool use_huge_pages,
+                                         ZnsRecordCallBack record_cbk, const std::string &shm_name,
+                                         std::size_t shm_size)
+    : BasicSubscriptionManager(stream_config, use_huge_pages,
+                               publishing_callback(std::make_shared<ShmFeedPublisher>(
+                                                       shm_name, ShmFeedFormat::ring_records, shm_size, use_huge_pages),
+                                                   std::move(record_cbk)))
+{
+}
 }
 
-std::fstream logFile("logs.txt");
+// Hot path logging goes through per thread queues, render logs.bin with binlog_decode.
+znsreader::BinaryLogger feedLog("logs.bin");
 
 size_t ringbuf_packet_processor(const unsigned char *buf, std::size_t bufLen)
 {
@@ -97,7 +114,7 @@ size_t ringbuf_packet_processor(const unsigned char *buf, std::size_t bufLen)
         const StreamPacket *full_packet = (StreamPacket *)packet;
         const StreamMsg *msgPtr = (StreamMsg *)(&full_packet->streamData);
 
-        logFile << full_packet->streamHdr.streamId << ":" << full_packet->streamHdr.seqNo << std::endl;
+        ZNS_LOG(feedLog, "{}:{}", full_packet->streamHdr.streamId, full_packet->streamHdr.seqNo);
 
         if (full_packet->streamHdr.msgLen > 0) {
             packet += full_packet->streamHdr.msgLen;
@@ -106,10 +123,71 @@ size_t ringbuf_packet_processor(const unsigned char *buf, std::size_t bufLen)
         }
     }
 
-    return (buf - packet);
+    return (packet - buf);
+}
+
+size_t ringbuf_record_processor(znsreader::RingRecordRange records)
+{
+    for (const znsreader::RingRecord record : records) {
+        if (record.payload_len() < sizeof(StreamHeader)) {
+            continue;
+        }
+
+        const StreamPacket *full_packet = (const StreamPacket *)record.payload();
+
+        ZNS_LOG(feedLog, "{}:{}:{}", record.header().stream_id, full_packet->streamHdr.seqNo,
+                record.header().line);
+    }
+
+    return records.size_bytes();
 }
 
+// Logs stream:seq:line:latency, latency being kernel receive to handler in ns.
+struct FeedLogger {
+    void on_record(const znsreader::RingRecord &record)
+    {
+        const StreamPacket *full_packet = (const StreamPacket *)record.payload();
+
+        const int64_t latency_ns = znsreader::realtime_ns() - record.header().recv_timestamp_ns;
+
+        ZNS_LOG(feedLog, "{}:{}:{}:{}", record.header().stream_id, full_packet->streamHdr.seqNo,
+                record.header().line, latency_ns);
+    }
+
+    void on_gap(const znsreader::SequenceGap &gap)
+    {
+        ZNS_LOG(feedLog, "{}:gap:{}-{}", gap.stream_id, gap.start_seq, gap.end_seq);
+    }
+};
+
+using FeedArbitrator = znsreader::LineArbitrator<FeedLogger>;
+
+using FeedWriter = znsreader::TimedRecordWriter<znsreader::RecordRecvWriter<1>>;
+using FeedReader = znsreader::TimedRecordReader<znsreader::RingRecordReader<FeedArbitrator>>;
+
+// Socket -> ring -> arbitration -> logger chain fully resolved at compile time.
+using FeedSubscription = znsreader::BasicSubscriptionManager<
+    znsreader::BasicAggregatedPacketReader<FeedWriter, FeedReader, znsreader::ZNS_DEFAULT_RING_SIZE>>;
+
 int main()
 {
-    znsreader::SubscriptionManager zns_sub_manager(stream_id_net_config, true, ringbuf_packet_processor);
+    // Per stream percentiles of every latency stage, appended to latency.jsonl each second.
+    znsreader::LatencyRecorder latency;
+    znsreader::LatencyExporter latency_export(latency, "latency.jsonl");
+
+    FeedSubscription zns_sub_manager(
+        stream_id_net_config, true,
+        [&latency](const znsreader::MulticastSocketSet &sockets) {
+            return FeedWriter(znsreader::RecordRecvWriter<1>(sockets), latency);
+        },
+        FeedReader(znsreader::RingRecordReader<FeedArbitrator>(FeedArbitrator(stream_id_net_config, FeedLogger())),
+                   latency));
+
+    // Drops, gaps and ring occupancy, read live with feed_stats zns_feed_stats.
+    znsreader::FeedStatsPublisher feed_stats("zns_feed_stats");
+    feed_stats.add_reader(zns_sub_manager.packet_reader());
+
+    // Runs for the life of the feed, the counters stay published until it ends.
+    zns_sub_manager.wait();
+    feed_stats.remove_source(zns_sub_manager.packet_reader());
 }
@@ -1,36 +1,382 @@
 #ifndef __SUBSCRIPTION_MGR_H
 #define __SUBSCRIPTION_MGR_H
 
+#include "broadcastring.hpp"
 #include "ipinfo.hpp"
 #include "ringbuffer.hpp"
+#include "shmfeed.hpp"
 #include "udpreader.hpp"
+#include <atomic>
 #include <cstdio>
+#include <functional>
+#include <map>
 #include <memory>
+#include <pthread.h>
 #include <stdexcept>
+#include <string>
 #include <thread>
+#include <utility>
 #include <vector>
 
 namespace znsreader
 {
-class SubscriptionManager
+inline int zns_set_thread_affinity(std::thread &target_thread, int32_t cpu_core)
+{
+    if (cpu_core < 0) {
+        return -1;
+    }
+
+    cpu_set_t reader_set;
+    CPU_ZERO(&reader_set);
+    CPU_SET(cpu_core, &reader_set);
+
+    int rc = pthread_setaffinity_np(target_thread.native_handle(), sizeof(cpu_set_t), &reader_set);
+    if (rc != 0) {
+        perror("pthread_setaffinity_np error:");
+        throw std::runtime_error("failed to set cpu affinity");
+    }
+
+    return rc;
+}
+
+// Runs PacketReader's writer and reader loops on their own pinned threads.
+template <typename PacketReader>
+class BasicSubscriptionManager
 {
   public:
-    using ZnsReadCallBack = RingBuffer::ReaderCallBack;
-    SubscriptionManager() = delete;
-    SubscriptionManager(std::map<short, single_stream_info> &, bool use_huge_pages, ZnsReadCallBack);
-    ~SubscriptionManager();
+    BasicSubscriptionManager() = delete;
+    template <typename... ReaderArgs>
+    explicit BasicSubscriptionManager(ReaderArgs &&...reader_args)
+        : m_aggr_reader(std::forward<ReaderArgs>(reader_args)...)
+    {
+        m_reader_thread = std::thread(start_reader, std::ref(*this));
+        m_writer_thread = std::thread(start_writer, std::ref(*this));
 
-    void add_reader_callback(ZnsReadCallBack);
+        int ret = zns_set_thread_affinity(m_reader_thread, 0);
+        if (ret < 0) {
+            throw std::runtime_error("writer setaffinity error:");
+        }
+
+        ret = zns_set_thread_affinity(m_writer_thread, 1);
+        if (ret < 0) {
+            throw std::runtime_error("reader setaffinity error:");
+        }
+    }
+
+    ~BasicSubscriptionManager()
+    {
+        wait();
+    }
+
+    // Lets both threads run out, the destructor still waits for them.
+    void stop()
+    {
+        m_aggr_reader.stop();
+    }
+
+    // Blocks until both threads have run out, i.e. for the whole feed unless stop() is called.
+    void wait()
+    {
+        if (m_writer_thread.joinable()) {
+            m_writer_thread.join();
+        }
+        if (m_reader_thread.joinable()) {
+            m_reader_thread.join();
+        }
+    }
+
+    // Sockets and ring of the subscription, e.g. for FeedStatsPublisher::add_reader.
+    const PacketReader &packet_reader() const
+    {
+        return m_aggr_reader;
+    }
 
   private:
-    static void start_writer(SubscriptionManager &sub_mgr);
-    static void start_reader(SubscriptionManager &sub_mgr);
-    static int zns_set_thread_affinity(std::thread &target_thread, int32_t cpu_core);
+    static void start_writer(BasicSubscriptionManager &sub_mgr)
+    {
+        sub_mgr.m_aggr_reader.write_packets_to_ringbuf();
+    }
+
+    static void start_reader(BasicSubscriptionManager &sub_mgr)
+    {
+        sub_mgr.m_aggr_reader.read_packets_from_ringbuf();
+    }
 
     std::thread m_reader_thread;
     std::thread m_writer_thread;
-    AggregatedPacketReader m_aggr_reader;
-    std::vector<ZnsReadCallBack> m_read_callbacks;
+    PacketReader m_aggr_reader;
+};
+
+// Streams handled by one receive thread of ShardedSubscriptionManager. cpu_core < 0
+// leaves the thread unpinned.
+struct ReceiveShard {
+    std::vector<short> m_stream_ids;
+    int32_t m_cpu_core;
+};
+
+// Deals the configured streams over shard_count shards, pinned from first_core upwards.
+inline std::vector<ReceiveShard> round_robin_shards(const std::map<short, single_stream_info> &stream_config,
+                                                    std::size_t shard_count, int32_t first_core)
+{
+    std::vector<ReceiveShard> shards(shard_count);
+    std::size_t next = 0;
+
+    for (std::size_t i = 0; i < shard_count; i++) {
+        shards[i].m_cpu_core = (first_core < 0) ? -1 : (first_core + (int32_t)i);
+    }
+
+    for (auto &one_stream : stream_config) {
+        shards[next++ % shard_count].m_stream_ids.push_back(one_stream.first);
+    }
+
+    return shards;
+}
+
+// Splits the streams over several receive threads, each with its own epoll set and SPSC
+// ring, and merges every ring into one consumer thread calling Reader. A stream and both
+// its lines always stay on one shard, so per stream order is kept.
+template <typename Writer, typename Reader, std::size_t Capacity = ZNS_DYNAMIC_CAPACITY>
+class ShardedSubscriptionManager
+{
+    // Every shard's ring forwards to the one Reader, only the consumer thread calls it.
+    class ShardReader
+    {
+      public:
+        explicit ShardReader(Reader *reader) : m_reader(reader)
+        {
+        }
+
+        std::size_t operator()(const unsigned char *data, std::size_t size)
+        {
+            return (*m_reader)(data, size);
+        }
+
+      private:
+        Reader *m_reader;
+    };
+
+  public:
+    using shard_reader_type = BasicAggregatedPacketReader<Writer, ShardReader, Capacity>;
+
+    ShardedSubscriptionManager() = delete;
+    ShardedSubscriptionManager(const std::map<short, single_stream_info> &stream_config,
+                               const std::vector<ReceiveShard> &shards, int32_t consumer_core, bool use_huge_pages,
+                               Reader reader_fn, std::size_t ring_size = ZNS_DEFAULT_RING_SIZE,
+                               const ReceivePolicy &policy = ReceivePolicy())
+        : m_running(true), m_reader(std::move(reader_fn))
+    {
+        for (const ReceiveShard &shard : shards) {
+            std::map<short, single_stream_info> shard_config;
+            for (short stream_id : shard.m_stream_ids) {
+                auto it = stream_config.find(stream_id);
+                if (it == stream_config.end()) {
+                    throw std::runtime_error("shard stream id is not in config");
+                }
+                shard_config.insert(*it);
+            }
+
+            if (!shard_config.empty()) {
+                m_shards.push_back(std::make_unique<shard_reader_type>(shard_config, use_huge_pages,
+                                                                       ShardReader(&m_reader), ring_size, policy));
+                m_shard_cores.push_back(shard.m_cpu_core);
+            }
+        }
+
+        m_consumer_thread = std::thread(&ShardedSubscriptionManager::consume, this);
+        pin(m_consumer_thread, consumer_core);
+
+        for (std::size_t i = 0; i < m_shards.size(); i++) {
+            m_writer_threads.emplace_back(&shard_reader_type::write_packets_to_ringbuf, m_shards[i].get());
+            pin(m_writer_threads.back(), m_shard_cores[i]);
+        }
+    }
+
+    ~ShardedSubscriptionManager()
+    {
+        for (auto &writer_thread : m_writer_threads) {
+            writer_thread.join();
+        }
+        m_consumer_thread.join();
+    }
+
+    void stop()
+    {
+        for (auto &shard : m_shards) {
+            shard->stop();
+        }
+        m_running.store(false, std::memory_order_relaxed);
+    }
+
+    std::size_t shard_count() const
+    {
+        return m_shards.size();
+    }
+
+    const shard_reader_type &shard(std::size_t index) const
+    {
+        return *m_shards[index];
+    }
+
+  private:
+    static void pin(std::thread &target_thread, int32_t cpu_core)
+    {
+        if (cpu_core >= 0) {
+            zns_set_thread_affinity(target_thread, cpu_core);
+        }
+    }
+
+    void consume()
+    {
+        while (m_running.load(std::memory_order_relaxed)) {
+            std::size_t popped = 0;
+            for (auto &shard : m_shards) {
+                popped += shard->drain_ringbuf();
+            }
+
+            if (popped == 0) {
+                std::this_thread::yield();
+            }
+        }
+
+        // Whatever the writers pushed before stopping.
+        for (auto &shard : m_shards) {
+            shard->drain_ringbuf();
+        }
+    }
+
+    std::atomic<bool> m_running;
+    Reader m_reader;
+    std::vector<std::unique_ptr<shard_reader_type>> m_shards;
+    std::vector<int32_t> m_shard_cores;
+    std::vector<std::thread> m_writer_threads;
+    std::thread m_consumer_thread;
+};
+
+// One receive thread feeding several independent readers, e.g. strategies, through a
+// BroadcastRingBuffer, so they share one set of multicast joins. Every consumer runs on its
+// own thread pinned to its m_cpu_core and reads at its own pace, a block consumer holds the
+// receive thread back when it falls a ring behind, a drop consumer is skipped ahead instead.
+template <typename Writer, typename Reader, std::size_t Capacity = ZNS_DYNAMIC_CAPACITY>
+class FanoutSubscriptionManager
+{
+  public:
+    using consumer_type = BroadcastConsumer<Reader>;
+    using packet_reader_type =
+        BasicAggregatedPacketReader<Writer, std::vector<consumer_type>, Capacity, BroadcastRingBuffer>;
+
+    FanoutSubscriptionManager() = delete;
+    FanoutSubscriptionManager(const std::map<short, single_stream_info> &stream_config, int32_t writer_core,
+                              bool use_huge_pages, std::vector<consumer_type> consumers,
+                              std::size_t ring_size = ZNS_DEFAULT_RING_SIZE,
+                              const ReceivePolicy &policy = ReceivePolicy())
+        : m_running(true), m_packet_reader(stream_config, use_huge_pages, std::move(consumers), ring_size, policy)
+    {
+        // A failed pin leaves threads running, stop and join them before the exception
+        // unwinds the members they use.
+        try {
+            for (std::size_t i = 0; i < m_packet_reader.ring().consumer_count(); i++) {
+                m_consumer_threads.emplace_back(&FanoutSubscriptionManager::consume, this, i);
+                pin(m_consumer_threads.back(), m_packet_reader.ring().consumer(i).m_cpu_core);
+            }
+
+            m_writer_thread = std::thread(&packet_reader_type::write_packets_to_ringbuf, &m_packet_reader);
+            pin(m_writer_thread, writer_core);
+        } catch (...) {
+            stop();
+            join();
+            throw;
+        }
+    }
+
+    ~FanoutSubscriptionManager()
+    {
+        join();
+    }
+
+    // Consumers read what was pushed before the receive thread stopped, then return.
+    void stop()
+    {
+        m_packet_reader.stop();
+        m_running.store(false, std::memory_order_relaxed);
+    }
+
+    std::size_t consumer_count() const
+    {
+        return m_consumer_threads.size();
+    }
+
+    uint64_t dropped_bytes(std::size_t consumer) const
+    {
+        return m_packet_reader.ring().dropped_bytes(consumer);
+    }
+
+    uint64_t overruns(std::size_t consumer) const
+    {
+        return m_packet_reader.ring().overruns(consumer);
+    }
+
+    const packet_reader_type &packet_reader() const
+    {
+        return m_packet_reader;
+    }
+
+  private:
+    static void pin(std::thread &target_thread, int32_t cpu_core)
+    {
+        if (cpu_core >= 0) {
+            zns_set_thread_affinity(target_thread, cpu_core);
+        }
+    }
+
+    void join()
+    {
+        if (m_writer_thread.joinable()) {
+            m_writer_thread.join();
+        }
+        for (auto &consumer_thread : m_consumer_threads) {
+            if (consumer_thread.joinable()) {
+                consumer_thread.join();
+            }
+        }
+    }
+
+    void consume(std::size_t consumer)
+    {
+        auto &ring = m_packet_reader.ring();
+
+        while (m_running.load(std::memory_order_relaxed)) {
+            if (ring.pop_all(consumer) == 0) {
+                std::this_thread::yield();
+            }
+        }
+
+        // Whatever the writer pushed before stopping.
+        ring.pop_all(consumer);
+    }
+
+    std::atomic<bool> m_running;
+    packet_reader_type m_packet_reader;
+    std::thread m_writer_thread;
+    std::vector<std::thread> m_consumer_threads;
+};
+
+// One callback per manager. Readers that each need the whole feed on their own thread go
+// through FanoutSubscriptionManager instead.
+class SubscriptionManager : public BasicSubscriptionManager<AggregatedPacketReader>
+{
+  public:
+    using ZnsReadCallBack = RingBuffer::ReaderCallBack;
+    using ZnsRecordCallBack = AggregatedPacketReader::RecordReaderCallBack;
+    SubscriptionManager() = delete;
+    SubscriptionManager(std::map<short, single_stream_info> &, bool use_huge_pages, ZnsReadCallBack);
+    SubscriptionManager(std::map<short, single_stream_info> &, bool use_huge_pages, ZnsRecordCallBack);
+    // Also publishes everything the reader thread pops to other processes under shm_name,
+    // for ShmFeedReader to attach to. The callback may be empty in a process that only
+    // publishes.
+    SubscriptionManager(std::map<short, single_stream_info> &, bool use_huge_pages, ZnsReadCallBack,
+                        const std::string &shm_name, std::size_t shm_size = ZNS_SHM_FEED_DEFAULT_SIZE);
+    SubscriptionManager(std::map<short, single_stream_info> &, bool use_huge_pages, ZnsRecordCallBack,
+                        const std::string &shm_name, std::size_t shm_size = ZNS_SHM_FEED_DEFAULT_SIZE);
 };
 }
 
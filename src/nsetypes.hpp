@@ -98,6 +98,8 @@ typedef struct streamMsg {
         OrderData orderData;
         SpreadOrderData spdOrderData;
         SpreadTradeData spdTradeData;
+        TickRecReqData recReqData;
+        TickRecRspData recRspData;
     } p;
 } ZNS_GCC_PACKED_ATTRIBUTE StreamMsg;
 
@@ -0,0 +1,304 @@
+#include "orderbook.hpp"
+#include <algorithm>
+#include <bit>
+
+namespace znsreader
+{
+namespace
+{
+// Levels are kept in ascending key order, worst price first, so the best one is at the back.
+int64_t level_key(BookSide side, int32_t price)
+{
+    return (side == BookSide::buy) ? (int64_t)price : -(int64_t)price;
+}
+
+// Index of the first level whose key is not below price's, as std::lower_bound. Most
+// updates land near the top of the book, so the last few levels are scanned before
+// falling back to a binary search.
+std::size_t find_level(const std::vector<PriceLevel> &levels, BookSide side, int32_t price)
+{
+    const int64_t key = level_key(side, price);
+    std::size_t n = levels.size();
+    const std::size_t stop = (n > 8) ? n - 8 : 0;
+
+    while (n > stop && level_key(side, levels[n - 1].price) >= key) {
+        n--;
+    }
+    if (n != stop || n == 0 || level_key(side, levels[n - 1].price) < key) {
+        return n;
+    }
+
+    return std::lower_bound(levels.begin(), levels.begin() + n, key,
+                            [side](const PriceLevel &level, int64_t k) { return level_key(side, level.price) < k; })
+           - levels.begin();
+}
+
+BookSide order_side(char order_type)
+{
+    return (order_type == 'S') ? BookSide::sell : BookSide::buy;
+}
+}
+
+FlatIndexMap::FlatIndexMap(std::size_t expected) : m_size(0)
+{
+    std::size_t capacity = 16;
+    while (capacity < expected * 2) {
+        capacity <<= 1;
+    }
+
+    m_slots.assign(capacity, Slot{ 0, npos });
+    m_mask = capacity - 1;
+    m_shift = 64 - std::countr_zero(capacity);
+}
+
+void FlatIndexMap::insert(uint64_t key, uint32_t value)
+{
+    if ((m_size + 1) * 2 > m_slots.size()) {
+        grow();
+    }
+
+    for (std::size_t slot = home(key);; slot = (slot + 1) & m_mask) {
+        Slot &entry = m_slots[slot];
+        if (entry.value == npos) {
+            entry = Slot{ key, value };
+            m_size++;
+            return;
+        }
+        if (entry.key == key) {
+            entry.value = value;
+            return;
+        }
+    }
+}
+
+uint32_t FlatIndexMap::erase(uint64_t key)
+{
+    std::size_t hole = home(key);
+    for (;; hole = (hole + 1) & m_mask) {
+        if (m_slots[hole].value == npos) {
+            return npos;
+        }
+        if (m_slots[hole].key == key) {
+            break;
+        }
+    }
+
+    const uint32_t value = m_slots[hole].value;
+
+    // Pull later entries of the probe run back into the hole, unless their home slot lies
+    // cyclically between the hole and where they sit.
+    for (std::size_t slot = (hole + 1) & m_mask; m_slots[slot].value != npos; slot = (slot + 1) & m_mask) {
+        const std::size_t slot_home = home(m_slots[slot].key);
+        if (((slot - slot_home) & m_mask) >= ((slot - hole) & m_mask)) {
+            m_slots[hole] = m_slots[slot];
+            hole = slot;
+        }
+    }
+
+    m_slots[hole].value = npos;
+    m_size--;
+    return value;
+}
+
+void FlatIndexMap::grow()
+{
+    std::vector<Slot> slots(m_slots.size() * 2, Slot{ 0, npos });
+    slots.swap(m_slots);
+    m_mask = m_slots.size() - 1;
+    m_shift--;
+    m_size = 0;
+
+    for (const Slot &entry : slots) {
+        if (entry.value != npos) {
+            insert(entry.key, entry.value);
+        }
+    }
+}
+
+void OrderBook::add(BookSide side, int32_t price, int64_t quantity)
+{
+    std::vector<PriceLevel> &levels = m_levels[(int)side];
+    const std::size_t n = find_level(levels, side, price);
+
+    if (n < levels.size() && levels[n].price == price) {
+        levels[n].orders++;
+        levels[n].quantity += quantity;
+    } else {
+        levels.insert(levels.begin() + n, PriceLevel{ price, 1, quantity });
+    }
+}
+
+void OrderBook::remove(BookSide side, int32_t price, int64_t quantity, uint32_t orders)
+{
+    std::vector<PriceLevel> &levels = m_levels[(int)side];
+    const std::size_t n = find_level(levels, side, price);
+
+    if (n == levels.size() || levels[n].price != price) {
+        return;
+    }
+
+    levels[n].orders -= orders;
+    levels[n].quantity -= quantity;
+    if (levels[n].orders == 0) {
+        levels.erase(levels.begin() + n);
+    }
+}
+
+OrderBookEngine::OrderBookEngine(std::size_t expected_orders)
+    : m_books_by_token(4096), m_orders_by_id(expected_orders)
+{
+    m_books.reserve(4096);
+    m_orders.reserve(expected_orders);
+}
+
+void OrderBookEngine::on_message(const OrderMessage &message)
+{
+    apply_order(message.type, message.order, false);
+}
+
+void OrderBookEngine::on_message(const TradeMessage &message)
+{
+    apply_trade(message.trade, false);
+}
+
+void OrderBookEngine::on_message(const SpreadOrderMessage &message)
+{
+    apply_order(message.type, message.order, true);
+}
+
+void OrderBookEngine::on_message(const SpreadTradeMessage &message)
+{
+    apply_trade(message.trade, true);
+}
+
+uint32_t OrderBookEngine::book_index(int32_t token_id, bool spread)
+{
+    const uint64_t key = token_key(token_id, spread);
+    uint32_t index = m_books_by_token.find(key);
+
+    if (index == FlatIndexMap::npos) {
+        index = m_books.size();
+        m_books.emplace_back(token_id, spread);
+        m_books_by_token.insert(key, index);
+    }
+
+    return index;
+}
+
+template <typename Data>
+void OrderBookEngine::apply_order(nseMsgType type, const Data &data, bool spread)
+{
+    const uint64_t id = std::bit_cast<uint64_t>((double)data.orderID);
+    const uint32_t book = book_index(data.tokenID, spread);
+    const uint32_t node = m_orders_by_id.find(id);
+
+    m_books[book].m_last_update_ns = data.timeStamp;
+
+    switch (type) {
+    case newOrderMsg:
+    case newSpreadOrderMsg:
+        if (node != FlatIndexMap::npos) {
+            m_stats.duplicate_orders++;
+            move_order(node, book, order_side(data.orderType), data.price, data.quantity);
+        } else {
+            m_stats.orders_added++;
+            add_order(id, book, order_side(data.orderType), data.price, data.quantity);
+        }
+        break;
+    case modOrderMsg:
+    case modSpreadOrderMsg:
+        if (node != FlatIndexMap::npos) {
+            m_stats.orders_modified++;
+            move_order(node, book, order_side(data.orderType), data.price, data.quantity);
+        } else {
+            m_stats.unknown_orders++;
+            add_order(id, book, order_side(data.orderType), data.price, data.quantity);
+        }
+        break;
+    case cancelOrderMsg:
+    case cancelSpreadOrderMsg:
+        if (node != FlatIndexMap::npos) {
+            m_stats.orders_cancelled++;
+            remove_order(node);
+        } else {
+            m_stats.unknown_orders++;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void OrderBookEngine::add_order(uint64_t id, uint32_t book, BookSide side, int32_t price, int32_t quantity)
+{
+    uint32_t node;
+    if (m_free_orders.empty()) {
+        node = m_orders.size();
+        m_orders.emplace_back();
+    } else {
+        node = m_free_orders.back();
+        m_free_orders.pop_back();
+    }
+
+    m_orders[node] = order_node{ id, book, price, quantity, side };
+    m_orders_by_id.insert(id, node);
+    m_books[book].add(side, price, quantity);
+}
+
+// Requeues a resting order at its new price and quantity, it keeps its pool slot and entry.
+void OrderBookEngine::move_order(uint32_t node, uint32_t book, BookSide side, int32_t price, int32_t quantity)
+{
+    order_node &order = m_orders[node];
+
+    m_books[order.book].remove(order.side, order.price, order.quantity, 1);
+    order.book = book;
+    order.side = side;
+    order.price = price;
+    order.quantity = quantity;
+    m_books[book].add(side, price, quantity);
+}
+
+void OrderBookEngine::remove_order(uint32_t node)
+{
+    const order_node &order = m_orders[node];
+
+    m_books[order.book].remove(order.side, order.price, order.quantity, 1);
+    m_orders_by_id.erase(order.id);
+    m_free_orders.push_back(node);
+}
+
+void OrderBookEngine::fill_order(double order_id, int32_t quantity)
+{
+    if (order_id == 0) {
+        return;
+    }
+
+    const uint32_t node = m_orders_by_id.find(std::bit_cast<uint64_t>(order_id));
+    if (node == FlatIndexMap::npos) {
+        m_stats.unknown_orders++;
+        return;
+    }
+
+    order_node &order = m_orders[node];
+    if (order.quantity <= quantity) {
+        remove_order(node);
+    } else {
+        m_books[order.book].remove(order.side, order.price, quantity, 0);
+        order.quantity -= quantity;
+    }
+}
+
+template <typename Data>
+void OrderBookEngine::apply_trade(const Data &data, bool spread)
+{
+    OrderBook &book = m_books[book_index(data.tokenID, spread)];
+
+    book.m_last_trade_price = data.tradePrice;
+    book.m_traded_quantity += data.quantity;
+    book.m_last_update_ns = data.timeStamp;
+    m_stats.trades++;
+
+    fill_order(data.buyOrderID, data.quantity);
+    fill_order(data.sellOrderID, data.quantity);
+}
+}
@@ -0,0 +1,240 @@
+#ifndef __ZNS_ORDER_BOOK_H
+#define __ZNS_ORDER_BOOK_H
+
+#include "msgdecoder.hpp"
+#include "nsetypes.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Orders the engine reserves room for up front, the order table doubles past half of it.
+#define ZNS_BOOK_DEFAULT_ORDERS (1 << 20)
+
+namespace znsreader
+{
+// Open addressing map from a 64 bit key to a 32 bit value, linear probing with backward
+// shift deletion so lookups never wade through tombstones. Keys are spread by Fibonacci
+// hashing, order ids and token ids are far from uniform in their low bits.
+class FlatIndexMap
+{
+  public:
+    static constexpr uint32_t npos = UINT32_MAX;
+
+    explicit FlatIndexMap(std::size_t expected = 16);
+
+    uint32_t find(uint64_t key) const
+    {
+        for (std::size_t slot = home(key);; slot = (slot + 1) & m_mask) {
+            const Slot &entry = m_slots[slot];
+            if (entry.value == npos || entry.key == key) {
+                return entry.value;
+            }
+        }
+    }
+
+    // Adds key, or overwrites its value when it is already present.
+    void insert(uint64_t key, uint32_t value);
+    // Returns the value key had, npos when it was not present.
+    uint32_t erase(uint64_t key);
+
+    std::size_t size() const
+    {
+        return m_size;
+    }
+
+  private:
+    struct Slot {
+        uint64_t key;
+        uint32_t value; // npos marks an empty slot
+    };
+
+    std::size_t home(uint64_t key) const
+    {
+        return (key * 0x9e3779b97f4a7c15ULL) >> m_shift;
+    }
+
+    void grow();
+
+    std::vector<Slot> m_slots;
+    std::size_t m_mask;
+    unsigned int m_shift;
+    std::size_t m_size;
+};
+
+enum class BookSide : uint8_t {
+    buy = 0,
+    sell = 1,
+};
+
+// Total resting quantity and order count at one price.
+struct PriceLevel {
+    int32_t price;
+    uint32_t orders;
+    int64_t quantity;
+};
+
+// Price levels for one token, aggregated from the order by order feed. Each side is a flat
+// array sorted with its best price at the back, so the busy top of the book is touched by
+// appends and short memmoves near the end.
+class OrderBook
+{
+  public:
+    OrderBook(int32_t token_id, bool spread) : m_token_id(token_id), m_spread(spread)
+    {
+    }
+
+    int32_t token_id() const
+    {
+        return m_token_id;
+    }
+
+    bool spread() const
+    {
+        return m_spread;
+    }
+
+    std::size_t depth(BookSide side) const
+    {
+        return m_levels[(int)side].size();
+    }
+
+    // Level 0 is the best price. Nullptr past the depth of the side.
+    const PriceLevel *level(BookSide side, std::size_t n) const
+    {
+        const std::vector<PriceLevel> &levels = m_levels[(int)side];
+        return (n < levels.size()) ? &levels[levels.size() - 1 - n] : nullptr;
+    }
+
+    const PriceLevel *best_bid() const
+    {
+        return level(BookSide::buy, 0);
+    }
+
+    const PriceLevel *best_ask() const
+    {
+        return level(BookSide::sell, 0);
+    }
+
+    int32_t last_trade_price() const
+    {
+        return m_last_trade_price;
+    }
+
+    int64_t traded_quantity() const
+    {
+        return m_traded_quantity;
+    }
+
+    int64_t last_update_ns() const
+    {
+        return m_last_update_ns;
+    }
+
+  private:
+    friend class OrderBookEngine;
+
+    void add(BookSide side, int32_t price, int64_t quantity);
+    // orders is 1 when an order leaves the level, 0 when a trade only takes part of it.
+    void remove(BookSide side, int32_t price, int64_t quantity, uint32_t orders);
+
+    int32_t m_token_id;
+    bool m_spread;
+    int32_t m_last_trade_price = 0;
+    int64_t m_traded_quantity = 0;
+    int64_t m_last_update_ns = 0;
+    std::vector<PriceLevel> m_levels[2];
+};
+
+struct OrderBookStats {
+    uint64_t orders_added = 0;
+    uint64_t orders_modified = 0;
+    uint64_t orders_cancelled = 0;
+    uint64_t trades = 0;
+    // Modifies, cancels and trade sides for orders the engine never saw added, e.g. when
+    // it joins mid session. A modify of an unknown order adds it.
+    uint64_t unknown_orders = 0;
+    // New orders whose id is already resting, applied as a modify.
+    uint64_t duplicate_orders = 0;
+};
+
+// Books for every token on the feed, normal and spread, built from the tick by tick order
+// messages. Takes them as the on_message handler of decode_packet or, by reference, of a
+// MessageDecoder fed by the reader callback:
+//
+//     OrderBookEngine engine;
+//     MessageDecoder<OrderBookEngine &> decoder(engine);
+//
+// Orders live in a pool indexed through a FlatIndexMap keyed by the bits of their double
+// orderID. Token ids are remapped to dense book indexes the first time they appear. A
+// trade takes its quantity off both resting orders and drops the ones it fills, the feed
+// does not cancel them separately. Single threaded.
+class OrderBookEngine
+{
+  public:
+    explicit OrderBookEngine(std::size_t expected_orders = ZNS_BOOK_DEFAULT_ORDERS);
+
+    OrderBookEngine(const OrderBookEngine &) = delete;
+    OrderBookEngine &operator=(OrderBookEngine const &) = delete;
+
+    void on_message(const OrderMessage &message);
+    void on_message(const TradeMessage &message);
+    void on_message(const SpreadOrderMessage &message);
+    void on_message(const SpreadTradeMessage &message);
+
+    // Nullptr for a token no order has been seen for yet. Valid until a message for a token
+    // the engine has not seen before.
+    const OrderBook *book(int32_t token_id, bool spread = false) const
+    {
+        const uint32_t index = m_books_by_token.find(token_key(token_id, spread));
+        return (index == FlatIndexMap::npos) ? nullptr : &m_books[index];
+    }
+
+    const std::vector<OrderBook> &books() const
+    {
+        return m_books;
+    }
+
+    std::size_t resting_orders() const
+    {
+        return m_orders_by_id.size();
+    }
+
+    const OrderBookStats &stats() const
+    {
+        return m_stats;
+    }
+
+  private:
+    struct order_node {
+        uint64_t id;
+        uint32_t book;
+        int32_t price;
+        int32_t quantity;
+        BookSide side;
+    };
+
+    static uint64_t token_key(int32_t token_id, bool spread)
+    {
+        return ((uint64_t)spread << 32) | (uint32_t)token_id;
+    }
+
+    uint32_t book_index(int32_t token_id, bool spread);
+    template <typename Data>
+    void apply_order(nseMsgType type, const Data &data, bool spread);
+    void add_order(uint64_t id, uint32_t book, BookSide side, int32_t price, int32_t quantity);
+    void move_order(uint32_t node, uint32_t book, BookSide side, int32_t price, int32_t quantity);
+    void remove_order(uint32_t node);
+    void fill_order(double order_id, int32_t quantity);
+    template <typename Data>
+    void apply_trade(const Data &data, bool spread);
+
+    std::vector<OrderBook> m_books;
+    FlatIndexMap m_books_by_token;
+    std::vector<order_node> m_orders;
+    std::vector<uint32_t> m_free_orders;
+    FlatIndexMap m_orders_by_id;
+    OrderBookStats m_stats;
+};
+}
+
+#endif // __ZNS_ORDER_BOOK_H
@@ -0,0 +1,213 @@
+#include "packetring.hpp"
+#include <cerrno>
+#include <linux/filter.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace znsreader
+{
+PacketRingSocket::PacketRingSocket(const std::map<short, single_stream_info> &stream_config,
+                                   const PacketRingConfig &ring_config)
+    : m_ring_config(ring_config), m_packet_fd(-1), m_ring(nullptr), m_ring_len(0)
+{
+    std::vector<uint16_t> ports;
+
+    for (auto &one_stream : stream_config) {
+        add_source(one_stream.second.m_primary_ip, one_stream.second.m_primary_port, one_stream.first,
+                   FeedLine::primary);
+        add_source(one_stream.second.m_secondary_ip, one_stream.second.m_secondary_port, one_stream.first,
+                   FeedLine::secondary);
+        ports.push_back(one_stream.second.m_primary_port);
+        ports.push_back(one_stream.second.m_secondary_port);
+    }
+
+    m_packet_fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_IP));
+    if (m_packet_fd < 0) {
+        perror("AF_PACKET socket error:");
+        throw std::runtime_error("Failed to create packet socket, CAP_NET_RAW is required");
+    }
+
+    int version = TPACKET_V3;
+    if (setsockopt(m_packet_fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+        perror("setsockopt PACKET_VERSION failed");
+        throw std::runtime_error("Failed to select TPACKET_V3");
+    }
+
+    // Frames start 16 byte aligned plus this reserve, which puts the 16 byte record header
+    // written in front of an option-less UDP payload on an 8 byte boundary.
+    unsigned int reserve = 4;
+    if (setsockopt(m_packet_fd, SOL_PACKET, PACKET_RESERVE, &reserve, sizeof(reserve)) < 0) {
+        perror("setsockopt PACKET_RESERVE failed");
+        throw std::runtime_error("Failed to set packet reserve");
+    }
+
+    // On loopback every datagram is seen leaving and arriving, keep only the arrival.
+    int ignoreOutgoing = 1;
+    if (setsockopt(m_packet_fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &ignoreOutgoing, sizeof(ignoreOutgoing)) < 0) {
+        perror("setsockopt PACKET_IGNORE_OUTGOING failed");
+        throw std::runtime_error("Failed to ignore outgoing packets");
+    }
+
+    attach_port_filter(ports);
+
+    struct tpacket_req3 req;
+    std::memset(&req, 0, sizeof(req));
+    req.tp_block_size = m_ring_config.m_block_size;
+    req.tp_block_nr = m_ring_config.m_block_count;
+    req.tp_frame_size = m_ring_config.m_frame_size;
+    req.tp_frame_nr = (m_ring_config.m_block_size / m_ring_config.m_frame_size) * m_ring_config.m_block_count;
+    req.tp_retire_blk_tov = m_ring_config.m_retire_timeout_ms;
+    req.tp_feature_req_word = 0;
+
+    if (setsockopt(m_packet_fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+        perror("setsockopt PACKET_RX_RING failed");
+        throw std::runtime_error("Failed to set up TPACKET_V3 ring");
+    }
+
+    m_ring_len = (std::size_t)req.tp_block_size * req.tp_block_nr;
+    m_ring = (unsigned char *)mmap(nullptr, m_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED | MAP_POPULATE,
+                                   m_packet_fd, 0);
+    if (m_ring == MAP_FAILED) {
+        // MAP_LOCKED needs RLIMIT_MEMLOCK headroom, an unlocked ring still works.
+        m_ring = (unsigned char *)mmap(nullptr, m_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                       m_packet_fd, 0);
+    }
+    if (m_ring == MAP_FAILED) {
+        perror("mmap error:");
+        throw std::runtime_error("Failed to map packet ring");
+    }
+
+    struct sockaddr_ll local;
+    std::memset(&local, 0, sizeof(local));
+    local.sll_family = AF_PACKET;
+    local.sll_protocol = htons(ETH_P_IP);
+    local.sll_ifindex = 0;
+
+    if (!m_ring_config.m_interface.empty()) {
+        local.sll_ifindex = if_nametoindex(m_ring_config.m_interface.c_str());
+        if (local.sll_ifindex == 0) {
+            perror("if_nametoindex error:");
+            throw std::runtime_error("Unknown interface: " + m_ring_config.m_interface);
+        }
+    }
+
+    if (bind(m_packet_fd, (struct sockaddr *)&local, sizeof(local)) < 0) {
+        perror("bind failed:");
+        throw std::runtime_error("Failed to bind packet socket");
+    }
+
+    for (auto &one_stream : stream_config) {
+        join_group(one_stream.second.m_primary_ip);
+        join_group(one_stream.second.m_secondary_ip);
+    }
+}
+
+PacketRingSocket::~PacketRingSocket()
+{
+    for (int join_fd : m_join_sockets) {
+        close(join_fd);
+    }
+
+    if (m_ring != nullptr && m_ring != MAP_FAILED) {
+        munmap(m_ring, m_ring_len);
+    }
+
+    if (m_packet_fd >= 0) {
+        close(m_packet_fd);
+    }
+}
+
+PacketRingStats PacketRingSocket::kernel_stats()
+{
+    struct tpacket_stats_v3 kernel;
+    socklen_t len = sizeof(kernel);
+    std::memset(&kernel, 0, sizeof(kernel));
+
+    // The kernel resets its counters on every read.
+    if (getsockopt(m_packet_fd, SOL_PACKET, PACKET_STATISTICS, &kernel, &len) < 0) {
+        perror("getsockopt PACKET_STATISTICS failed");
+    }
+
+    PacketRingStats result;
+    std::memset(&result, 0, sizeof(result));
+    result.kernel_packets = kernel.tp_packets;
+    result.kernel_drops = kernel.tp_drops;
+    return result;
+}
+
+void PacketRingSocket::add_source(std::string_view ipv4Addr, uint16_t udpPort, short stream_id, FeedLine line)
+{
+    uint32_t dst_ip = 0;
+    if (!ipv4Addr.empty()) {
+        dst_ip = inet_addr(std::string(ipv4Addr).c_str());
+    }
+
+    if (!m_sources.emplace(source_key(dst_ip, udpPort), stream_source{ stream_id, line }).second) {
+        throw std::runtime_error("Two stream lines share address and port");
+    }
+}
+
+// Accepts unfragmented IPv4 UDP to any configured port, everything else stays in the kernel.
+void PacketRingSocket::attach_port_filter(const std::vector<uint16_t> &ports)
+{
+    // Each port test jumps forward to the accept at the end, jt is only 8 bits wide.
+    if (ports.empty() || ports.size() > 250) {
+        return;
+    }
+
+    const uint8_t port_count = ports.size();
+    std::vector<struct sock_filter> code = {
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),                            // ethertype
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETHERTYPE_IP, 0, (uint8_t)(port_count + 6)),
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 23),                            // ip protocol
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, (uint8_t)(port_count + 4)),
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 20),                            // flags and fragment offset
+        BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x3fff, (uint8_t)(port_count + 2), 0),
+        BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 14),                           // ip header length
+        BPF_STMT(BPF_LD | BPF_H | BPF_IND, 16),                            // udp destination port
+    };
+
+    for (uint8_t i = 0; i < port_count; i++) {
+        code.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ports[i], (uint8_t)(port_count - i), 0));
+    }
+
+    code.push_back(BPF_STMT(BPF_RET | BPF_K, 0));
+    code.push_back(BPF_STMT(BPF_RET | BPF_K, 0x40000));
+
+    struct sock_fprog prog;
+    prog.len = code.size();
+    prog.filter = code.data();
+
+    if (setsockopt(m_packet_fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0) {
+        perror("setsockopt SO_ATTACH_FILTER failed");
+        throw std::runtime_error("Failed to attach port filter");
+    }
+}
+
+// The NIC and switches only forward groups somebody joined, the packet socket cannot do
+// that itself. A socket that is never bound to the port gets no copy of the traffic.
+void PacketRingSocket::join_group(std::string_view ipv4Addr)
+{
+    if (ipv4Addr.empty()) {
+        return;
+    }
+
+    int joinSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (joinSocket < 0) {
+        perror("Failed to create socket");
+        throw std::runtime_error("Failed to create join socket");
+    }
+    m_join_sockets.push_back(joinSocket);
+
+    struct ip_mreq group;
+    group.imr_multiaddr.s_addr = inet_addr(std::string(ipv4Addr).c_str());
+    group.imr_interface.s_addr = INADDR_ANY;
+    if (setsockopt(joinSocket, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char *)&group, sizeof(group)) < 0) {
+        perror("setsockopt failed");
+        throw std::runtime_error("Failed to join multicast group");
+    }
+}
+}
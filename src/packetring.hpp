@@ -0,0 +1,236 @@
+#ifndef __ZNS_PACKET_RING_H
+#define __ZNS_PACKET_RING_H
+
+#include "ipinfo.hpp"
+#include "ringrecord.hpp"
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <linux/if_packet.h>
+#include <map>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Added in Linux 4.20, older headers lack it.
+#ifndef PACKET_IGNORE_OUTGOING
+#define PACKET_IGNORE_OUTGOING 23
+#endif
+
+namespace znsreader
+{
+// Geometry of the TPACKET_V3 ring. A block is handed back to the kernel as a whole, so
+// retire_timeout_ms bounds how long a packet can wait in a partly filled block.
+struct PacketRingConfig {
+    std::string m_interface = ""; // empty captures on every interface
+    uint32_t m_block_size = 1 << 22;
+    uint32_t m_block_count = 64;
+    uint32_t m_frame_size = 2048;
+    uint32_t m_retire_timeout_ms = 1;
+};
+
+struct PacketRingStats {
+    uint64_t delivered;
+    uint64_t unmatched; // passed the filter but matched no configured stream
+    uint64_t kernel_packets;
+    uint64_t kernel_drops;
+};
+
+// One AF_PACKET socket with a TPACKET_V3 block ring, in place of a UDP socket per stream
+// line. A classic BPF filter keeps only IPv4 UDP to the configured ports, the groups are
+// joined by small unbound UDP sockets that never receive anything themselves.
+class PacketRingSocket
+{
+  public:
+    PacketRingSocket() = delete;
+    PacketRingSocket(const std::map<short, single_stream_info> &stream_config, const PacketRingConfig &ring_config);
+    ~PacketRingSocket();
+
+    PacketRingSocket(const PacketRingSocket &) = delete;
+    PacketRingSocket &operator=(PacketRingSocket const &) = delete;
+
+    // Only the kernel counters, the reader adds its own.
+    PacketRingStats kernel_stats();
+
+  protected:
+    struct stream_source {
+        short m_stream_id;
+        FeedLine m_line;
+    };
+
+    // Group or unicast destination, an empty ip in the config matches on port only.
+    static uint64_t source_key(uint32_t dst_ip, uint16_t dst_port)
+    {
+        return ((uint64_t)dst_ip << 16) | dst_port;
+    }
+
+    const stream_source *find_source(uint32_t dst_ip, uint16_t dst_port) const
+    {
+        auto it = m_sources.find(source_key(dst_ip, dst_port));
+        if (it == m_sources.end()) {
+            it = m_sources.find(source_key(0, dst_port));
+            if (it == m_sources.end()) {
+                return nullptr;
+            }
+        }
+        return &it->second;
+    }
+
+    struct tpacket_block_desc *block(uint32_t index) const
+    {
+        return (struct tpacket_block_desc *)(m_ring + ((std::size_t)index * m_ring_config.m_block_size));
+    }
+
+    PacketRingConfig m_ring_config;
+    int m_packet_fd;
+    unsigned char *m_ring;
+    std::size_t m_ring_len;
+    std::vector<int> m_join_sockets;
+    std::unordered_map<uint64_t, stream_source> m_sources;
+
+  private:
+    void add_source(std::string_view ipv4Addr, uint16_t udpPort, short stream_id, FeedLine line);
+    void attach_port_filter(const std::vector<uint16_t> &ports);
+    void join_group(std::string_view ipv4Addr);
+};
+
+// Walks the block ring and hands every matching UDP payload to Handler as a single record
+// RingRecordRange, the same call RingRecordReader makes. The record header is written over
+// the IP/UDP headers in front of the payload, so nothing is copied out of the ring unless
+// IP options leave the header misaligned. Records are only valid inside the call.
+template <typename Handler>
+class BasicPacketRingReader : public PacketRingSocket
+{
+  public:
+    BasicPacketRingReader() = delete;
+    BasicPacketRingReader(const std::map<short, single_stream_info> &stream_config,
+                          const PacketRingConfig &ring_config, Handler handler)
+        : PacketRingSocket(stream_config, ring_config), m_running(true), m_handler(std::move(handler))
+    {
+    }
+
+    void read_packets()
+    {
+        uint32_t current = 0;
+
+        while (m_running.load(std::memory_order_relaxed)) {
+            struct tpacket_block_desc *desc = block(current);
+
+            if ((__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+                // Only bounds how long an idle reader takes to notice stop().
+                struct pollfd pfd;
+                pfd.fd = m_packet_fd;
+                pfd.events = POLLIN | POLLERR;
+                pfd.revents = 0;
+                ::poll(&pfd, 1, 100);
+                continue;
+            }
+
+            walk_block(desc);
+
+            __atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+            current = (current + 1) % m_ring_config.m_block_count;
+        }
+    }
+
+    void stop()
+    {
+        m_running.store(false, std::memory_order_relaxed);
+    }
+
+    PacketRingStats stats()
+    {
+        PacketRingStats result = kernel_stats();
+        result.delivered = m_delivered;
+        result.unmatched = m_unmatched;
+        return result;
+    }
+
+    Handler &handler()
+    {
+        return m_handler;
+    }
+
+  private:
+    void walk_block(struct tpacket_block_desc *desc)
+    {
+        const uint32_t num_pkts = desc->hdr.bh1.num_pkts;
+        unsigned char *pos = (unsigned char *)desc + desc->hdr.bh1.offset_to_first_pkt;
+
+        for (uint32_t i = 0; i < num_pkts; i++) {
+            struct tpacket3_hdr *frame = (struct tpacket3_hdr *)pos;
+            deliver(frame);
+            pos += frame->tp_next_offset;
+        }
+    }
+
+    void deliver(struct tpacket3_hdr *frame)
+    {
+        unsigned char *ip = (unsigned char *)frame + frame->tp_net;
+        const unsigned char *end = (unsigned char *)frame + frame->tp_mac + frame->tp_snaplen;
+
+        // The BPF filter already leaves only unfragmented IPv4 UDP, unless it had too many
+        // ports to be attached.
+        if ((ip[0] >> 4) != 4 || ip[9] != IPPROTO_UDP) {
+            return;
+        }
+
+        const std::size_t ip_len = (ip[0] & 0x0f) * 4;
+        unsigned char *udp = ip + ip_len;
+        unsigned char *payload = udp + 8;
+        if (payload > end) {
+            return;
+        }
+
+        uint32_t dst_ip;
+        uint16_t dst_port, udp_len;
+        ::memcpy(&dst_ip, ip + 16, sizeof(dst_ip));
+        ::memcpy(&dst_port, udp + 2, sizeof(dst_port));
+        ::memcpy(&udp_len, udp + 4, sizeof(udp_len));
+
+        const stream_source *source = find_source(dst_ip, ntohs(dst_port));
+        if (source == nullptr) {
+            m_unmatched++;
+            return;
+        }
+
+        std::size_t payload_len = ntohs(udp_len) - 8;
+        if (payload + payload_len > end) {
+            payload_len = end - payload;
+        }
+
+        RingRecordHeader hdr;
+        hdr.length = payload_len;
+        hdr.line = source->m_line;
+        hdr.flags = ZNS_RECORD_KERNEL_TS;
+        hdr.stream_id = source->m_stream_id;
+        hdr.reserved2 = 0;
+        hdr.recv_timestamp_ns = (int64_t)frame->tp_sec * 1000000000 + frame->tp_nsec;
+
+        unsigned char *record = payload - sizeof(RingRecordHeader);
+        if (((uintptr_t)record % alignof(RingRecordHeader)) != 0) {
+            // IP options moved the payload, frame it in scratch space instead.
+            record = m_scratch;
+            ::memcpy(record + sizeof(RingRecordHeader), payload, payload_len);
+        }
+
+        ::memcpy(record, &hdr, sizeof(hdr));
+        m_delivered++;
+        m_handler(RingRecordRange(record, ring_record_size(payload_len)));
+    }
+
+    std::atomic<bool> m_running;
+    Handler m_handler;
+    uint64_t m_delivered = 0;
+    uint64_t m_unmatched = 0;
+    alignas(RingRecordHeader) unsigned char m_scratch[sizeof(RingRecordHeader) + 65536];
+};
+}
+
+#endif
@@ -0,0 +1,166 @@
+#include "pcapfile.hpp"
+#include "capturewriter.hpp"
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <net/ethernet.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <pcap/dlt.h>
+#include <pcap/pcap.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace znsreader
+{
+static_assert(sizeof(PcapRecordHeader) == ZNS_PCAP_RECORD_HEADER_SIZE, "ZNS_PCAP_RECORD_HEADER_SIZE is wrong");
+
+static inline uint16_t load_be16(const unsigned char *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+// Offset of the IPv4 header behind an Ethernet header and up to two VLAN tags, 0 for none.
+static inline std::size_t ethernet_ip_offset(const unsigned char *frame, uint32_t caplen)
+{
+    std::size_t type_offset = 12;
+
+    for (int tags = 0; tags <= 2 && (type_offset + 2) <= caplen; tags++) {
+        const uint16_t ether_type = load_be16(frame + type_offset);
+        if (ether_type == ETHERTYPE_IP) {
+            return type_offset + 2;
+        }
+        if (ether_type != ETHERTYPE_VLAN && ether_type != 0x88a8) {
+            return 0;
+        }
+        type_offset += 4;
+    }
+
+    return 0;
+}
+
+bool parse_udp_frame(uint32_t linktype, const unsigned char *frame, uint32_t caplen, PcapPacket &packet)
+{
+    std::size_t ip_offset = 0;
+
+    switch (linktype) {
+    case DLT_EN10MB:
+        ip_offset = ethernet_ip_offset(frame, caplen);
+        break;
+    case DLT_NULL:
+    case DLT_LOOP: {
+        if (caplen < 4) {
+            return false;
+        }
+        // Host order family for DLT_NULL, network order for DLT_LOOP.
+        uint32_t family;
+        std::memcpy(&family, frame, sizeof(family));
+        if (family != AF_INET && ntohl(family) != AF_INET) {
+            return false;
+        }
+        ip_offset = 4;
+        break;
+    }
+    case DLT_LINUX_SLL:
+        if (caplen < 16 || load_be16(frame + 14) != ETHERTYPE_IP) {
+            return false;
+        }
+        ip_offset = 16;
+        break;
+    case DLT_RAW:
+    case ZNS_LINKTYPE_RAW:
+        ip_offset = 0;
+        if (caplen < 1 || (frame[0] >> 4) != 4) {
+            return false;
+        }
+        break;
+    default:
+        return false;
+    }
+
+    if ((ip_offset == 0 && linktype != DLT_RAW && linktype != ZNS_LINKTYPE_RAW)
+        || (ip_offset + sizeof(struct ip)) > caplen) {
+        return false;
+    }
+
+    const struct ip *ip_hdr = (const struct ip *)(frame + ip_offset);
+    const std::size_t ip_len = ip_hdr->ip_hl * 4;
+
+    // Fragments would need reassembly, the feed never sends datagrams that large.
+    if (ip_hdr->ip_v != 4 || ip_hdr->ip_p != IPPROTO_UDP || ip_len < sizeof(struct ip)
+        || (ntohs(ip_hdr->ip_off) & (IP_MF | IP_OFFMASK)) != 0
+        || (ip_offset + ip_len + sizeof(struct udphdr)) > caplen) {
+        return false;
+    }
+
+    const struct udphdr *udp_hdr = (const struct udphdr *)(frame + ip_offset + ip_len);
+    const std::size_t udp_len = ntohs(udp_hdr->len);
+    if (udp_len < sizeof(struct udphdr)) {
+        return false;
+    }
+
+    const std::size_t payload_offset = ip_offset + ip_len + sizeof(struct udphdr);
+    const std::size_t captured = caplen - payload_offset;
+
+    packet.frame = frame;
+    packet.caplen = caplen;
+    packet.payload = frame + payload_offset;
+    packet.payload_len = (udp_len - sizeof(struct udphdr)) < captured ? (udp_len - sizeof(struct udphdr)) : captured;
+    packet.src_ip = ip_hdr->ip_src;
+    packet.dst_ip = ip_hdr->ip_dst;
+    packet.src_port = ntohs(udp_hdr->source);
+    packet.dst_port = ntohs(udp_hdr->dest);
+
+    return true;
+}
+
+PcapFileReader::PcapFileReader(const std::filesystem::path &file_name)
+    : m_offset(sizeof(struct pcap_file_header)), m_skipped(0)
+{
+    int fd = ::open(file_name.c_str(), O_RDONLY);
+    if (fd < 0) {
+        perror("open error:");
+        throw std::runtime_error("Failed to open capture: " + file_name.string());
+    }
+
+    struct stat file_stat;
+    if (::fstat(fd, &file_stat) != 0 || (std::size_t)file_stat.st_size < sizeof(struct pcap_file_header)) {
+        ::close(fd);
+        throw std::runtime_error("Not a pcap capture: " + file_name.string());
+    }
+
+    m_size = file_stat.st_size;
+    void *data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        perror("mmap error:");
+        throw std::runtime_error("Failed to map capture: " + file_name.string());
+    }
+    ::madvise(data, m_size, MADV_SEQUENTIAL);
+    m_data = (const unsigned char *)data;
+
+    const struct pcap_file_header *file_header = (const struct pcap_file_header *)m_data;
+    if (file_header->magic != 0xa1b2c3d4 && file_header->magic != 0xa1b23c4d) {
+        ::munmap(data, m_size);
+        throw std::runtime_error("Unsupported pcap magic: " + file_name.string());
+    }
+
+    m_nanosecond = (file_header->magic == 0xa1b23c4d);
+    m_linktype = file_header->linktype;
+}
+
+PcapFileReader::~PcapFileReader()
+{
+    ::munmap((void *)m_data, m_size);
+}
+
+void PcapFileReader::rewind()
+{
+    m_offset = sizeof(struct pcap_file_header);
+    m_skipped = 0;
+}
+}
@@ -0,0 +1,118 @@
+#ifndef __ZNS_PCAP_FILE_H
+#define __ZNS_PCAP_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <netinet/in.h>
+
+// pcap files store LINKTYPE_RAW, DLT_RAW differs between platforms.
+#define ZNS_LINKTYPE_RAW 101
+// tv_sec, tv_usec or tv_nsec, caplen, len, as in PcapRecordHeader.
+#define ZNS_PCAP_RECORD_HEADER_SIZE 16
+
+namespace znsreader
+{
+// One captured UDP datagram. The pointers view the mapped file.
+struct PcapPacket {
+    int64_t timestamp_ns;
+    const unsigned char *frame; // link layer header onwards
+    uint32_t caplen;
+    const unsigned char *payload;
+    std::size_t payload_len; // UDP length, cut to what was captured
+    struct in_addr src_ip;
+    struct in_addr dst_ip;
+    uint16_t src_port; // host order
+    uint16_t dst_port; // host order
+};
+
+// Finds the UDP payload in one captured frame. Handles Ethernet with up to two VLAN tags,
+// BSD loopback (DLT_NULL, DLT_LOOP), Linux cooked and raw IP, and a variable IPv4 header
+// length. Frames that are not unfragmented IPv4/UDP return false.
+bool parse_udp_frame(uint32_t linktype, const unsigned char *frame, uint32_t caplen, PcapPacket &packet);
+
+// Zero copy reader for pcap files in the host's byte order, microsecond or nanosecond
+// magic. The file is mapped whole and read front to back with next().
+class PcapFileReader
+{
+  public:
+    PcapFileReader() = delete;
+    explicit PcapFileReader(const std::filesystem::path &file_name);
+    ~PcapFileReader();
+
+    PcapFileReader(const PcapFileReader &) = delete;
+    PcapFileReader &operator=(PcapFileReader const &) = delete;
+
+    // Next UDP datagram, false at the end of the file or at a truncated record. Records
+    // that are not UDP are counted in skipped() and passed over.
+    bool next(PcapPacket &packet)
+    {
+        for (;;) {
+            int64_t timestamp_ns;
+            if (!peek_timestamp(timestamp_ns)) {
+                return false;
+            }
+
+            const uint32_t caplen = record_caplen();
+            const unsigned char *frame = m_data + m_offset + ZNS_PCAP_RECORD_HEADER_SIZE;
+            m_offset += ZNS_PCAP_RECORD_HEADER_SIZE + caplen;
+
+            if (parse_udp_frame(m_linktype, frame, caplen, packet)) {
+                packet.timestamp_ns = timestamp_ns;
+                return true;
+            }
+            m_skipped++;
+        }
+    }
+
+    // Capture time of the record next() looks at first, false when there is none.
+    bool peek_timestamp(int64_t &timestamp_ns) const
+    {
+        if (m_offset + ZNS_PCAP_RECORD_HEADER_SIZE > m_size
+            || m_offset + ZNS_PCAP_RECORD_HEADER_SIZE + record_caplen() > m_size) {
+            return false;
+        }
+
+        const uint32_t *hdr = (const uint32_t *)(m_data + m_offset);
+        timestamp_ns = (int64_t)hdr[0] * 1000000000 + (m_nanosecond ? hdr[1] : (int64_t)hdr[1] * 1000);
+        return true;
+    }
+
+    void rewind();
+
+    uint32_t linktype() const
+    {
+        return m_linktype;
+    }
+
+    bool nanosecond() const
+    {
+        return m_nanosecond;
+    }
+
+    std::size_t size_bytes() const
+    {
+        return m_size;
+    }
+
+    uint64_t skipped() const
+    {
+        return m_skipped;
+    }
+
+  private:
+    uint32_t record_caplen() const
+    {
+        return ((const uint32_t *)(m_data + m_offset))[2];
+    }
+
+    const unsigned char *m_data;
+    std::size_t m_size;
+    std::size_t m_offset;
+    uint32_t m_linktype;
+    bool m_nanosecond;
+    uint64_t m_skipped;
+};
+}
+
+#endif // __ZNS_PCAP_FILE_H
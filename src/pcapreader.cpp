@@ -1,19 +1,14 @@
 #include "pcapreader.hpp"
+#include <cstdio>
 #include <cstring>
+#include <stdexcept>
 
 namespace znsreader
 {
 PcapPacketServer::PcapPacketServer(const std::filesystem::path &filename, const std::string &destAddr,
                                    uint16_t destPort, short streamID)
-    : m_relayAddress(destAddr), m_relayPort(destPort), m_streamID(streamID)
+    : m_capture(filename), m_streamID(streamID), m_relayPort(destPort), m_relayAddress(destAddr)
 {
-    // open the pcap file
-    char errbuf[PCAP_ERRBUF_SIZE];
-    m_pcap = pcap_open_offline(filename.c_str(), errbuf);
-    if (m_pcap == nullptr) {
-        throw std::runtime_error(errbuf);
-    }
-
     // create the UDP socket
     m_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
     if (m_sock < 0) {
@@ -29,11 +24,21 @@ PcapPacketServer::PcapPacketServer(const std::filesystem::path &filename, const
 PcapPacketServer::~PcapPacketServer()
 {
     close(m_sock);
-    pcap_close(m_pcap);
 }
 
 void PcapPacketServer::relayPackets()
 {
-    pcap_loop(m_pcap, 0, handlePacket, reinterpret_cast<unsigned char *>(this));
+    PcapPacket packet;
+
+    m_capture.rewind();
+    while (m_capture.next(packet)) {
+        // send the packet over the UDP socket
+        int res = sendto(m_sock, packet.payload, packet.payload_len, 0, (struct sockaddr *)&m_sockAddr,
+                         sizeof(m_sockAddr));
+        if (res < 0) {
+            perror("sendto failed");
+            throw std::runtime_error("sendto failed:");
+        }
+    }
 }
 }
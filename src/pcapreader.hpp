@@ -2,8 +2,13 @@
 #define __PCAP_READER_H
 
 #include "nsetypes.hpp"
+#include "pcapfile.hpp"
+#include <arpa/inet.h>
 #include <filesystem>
-#include <pcap/pcap.h>
+#include <netinet/in.h>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
 #include <unistd.h>
 
 namespace znsreader
@@ -18,22 +23,7 @@ class PcapPacketServer
     void relayPackets();
 
   private:
-    static void handlePacket(unsigned char *user, const struct pcap_pkthdr *h, const unsigned char *bytes)
-    {
-        PcapPacketServer *relay = reinterpret_cast<PcapPacketServer *>(user);
-
-        size_t headersLen = sizeof(struct ether_header) + sizeof(struct ip) + sizeof(struct udphdr);
-
-        // send the packet over the UDP socket
-        int res = sendto(relay->m_sock, bytes + headersLen, (h->caplen - headersLen), 0,
-                         (struct sockaddr *)&relay->m_sockAddr, sizeof(m_sockAddr));
-        if (res < 0) {
-            perror("sendto failed");
-            throw std::runtime_error("sendto failed:");
-        }
-    }
-
-    pcap_t *m_pcap;
+    PcapFileReader m_capture;
     int m_sock;
     short m_streamID;
     uint16_t m_relayPort;
@@ -3,6 +3,7 @@
 #include <arpa/inet.h>
 #include <asm-generic/errno-base.h>
 #include <cassert>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
 #include <fcntl.h>
@@ -13,6 +14,7 @@
 #include <stdexcept>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 namespace znsreader
@@ -30,45 +32,15 @@ PacketToFileWriter::PacketToFileWriter(const std::map<short, StreamPortIPInfo> &
     m_file_fds.resize(max_stream_id + 1);
     m_file_names.resize(max_stream_id + 1);
     m_latest_seq_no.resize(max_stream_id + 1);
+    m_net_hdrs.resize(max_stream_id + 1);
 
     for (auto &stream_info : m_stream_info) {
-        const std::string &filename = generate_filename(stream_info.first);
-        int fd;
+        const std::string &filename = capture_file_name(stream_info.second, stream_info.first, m_write_to_pcap);
+        int fd = open_capture_file(filename, m_write_to_pcap, m_append_to_existing);
 
         m_file_names.insert(m_file_names.begin() + stream_info.first, filename);
-
-        if (m_append_to_existing) {
-            fd = ::open(filename.c_str(), O_RDWR | O_APPEND);
-        } else {
-            fd = ::open(filename.c_str(), O_CREAT | O_RDWR | O_TRUNC, (S_IRUSR | S_IWUSR | S_IWGRP | S_IRGRP));
-            if (fd < 0) {
-                perror("open error:");
-                if (errno == EEXIST) {
-                    fd = ::open(filename.c_str(), O_RDWR | O_APPEND);
-                }
-            }
-        }
-
-        if (fd < 0) {
-            throw std::runtime_error("Failed to create/open file: " + filename);
-        }
-
-        if (!m_append_to_existing && fd > 0) {
-            struct pcap_file_header file_header;
-
-            file_header.magic = 0xa1b23c4d; // 0xa1b2c3d4
-            file_header.version_major = 2;
-            file_header.version_minor = 4;
-            file_header.thiszone = 0;
-            file_header.sigfigs = 0;
-            file_header.snaplen = 0x10000;
-            file_header.linktype = DLT_NULL;
-
-            size_t ret = ::write(fd, (void *)&file_header, sizeof(struct pcap_file_header));
-            assert(ret == sizeof(struct pcap_file_header));
-        }
-
         m_file_fds.insert(m_file_fds.begin() + stream_info.first, fd);
+        fill_capture_net_header(stream_info.second, m_net_hdrs[stream_info.first].data());
     }
 }
 
@@ -83,7 +55,12 @@ PacketToFileWriter::~PacketToFileWriter()
     m_latest_seq_no.clear();
 }
 
-int PacketToFileWriter::ingest_packet(const unsigned char *packet, size_t packet_len)
+int PacketToFileWriter::ingest_record(const RingRecord &record)
+{
+    return ingest_packet(record.payload(), record.payload_len(), record.header().recv_timestamp_ns);
+}
+
+int PacketToFileWriter::ingest_packet(const unsigned char *packet, size_t packet_len, int64_t recv_timestamp_ns)
 {
     short stream_id = ((StreamPacket *)packet)->streamHdr.streamId;
     int seq_number = ((StreamPacket *)packet)->streamHdr.seqNo;
@@ -98,56 +75,27 @@ int PacketToFileWriter::ingest_packet(const unsigned char *packet, size_t packet
         }
     }
 
-    if (m_write_to_pcap) {
-        // Create a pcap packet and update result and sz.
-        struct pcap_packet_hdr pcap_hdr;
-        struct ether_header eth_hdr;
-        struct ip ip_hdr;
-        struct udphdr udp_hdr;
-
-        {
-            size_t total_len = sizeof(pcap_hdr) + sizeof(eth_hdr) + sizeof(ip_hdr) + sizeof(udp_hdr) + packet_len;
-            int64_t time_in_nanos = time_point_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now())
-                                        .time_since_epoch()
-                                        .count();
-            pcap_hdr.tv_sec = time_in_nanos / 1e9;
-            pcap_hdr.tv_usec = time_in_nanos - (1e9 * pcap_hdr.tv_sec);
-            pcap_hdr.caplen = total_len;
-            pcap_hdr.len = total_len;
-
-            ::write(active_fd, &pcap_hdr, sizeof(pcap_hdr));
-        }
-
-        {
-            eth_hdr.ether_type = ETHERTYPE_IP;
-            ::write(active_fd, &eth_hdr, sizeof(eth_hdr));
-        }
+    unsigned char prefix[sizeof(PcapRecordHeader) + ZNS_CAPTURE_NET_HDR_SIZE];
+    struct iovec iovs[2];
+    int iov_count = 0;
 
-        {
-            ip_hdr.ip_hl = 5;
-            ip_hdr.ip_v = 4;
-            ip_hdr.ip_p = IPPROTO_UDP;
-            ip_hdr.ip_dst.s_addr = inet_addr(std::string(m_stream_info.find(stream_id)->second.m_primary_ip).c_str());
-            ::write(active_fd, &ip_hdr, sizeof(ip_hdr));
-        }
-
-        {
-            udp_hdr.dest = m_stream_info.find(stream_id)->second.m_primary_port;
-            udp_hdr.len = sizeof(udp_hdr) + packet_len;
-
-            ::write(active_fd, &udp_hdr, sizeof(udp_hdr));
-        }
+    if (m_write_to_pcap) {
+        fill_capture_record_prefix(m_net_hdrs[stream_id].data(), packet_len, recv_timestamp_ns, prefix);
+        iovs[iov_count].iov_base = prefix;
+        iovs[iov_count].iov_len = sizeof(prefix);
+        iov_count++;
     }
+    iovs[iov_count].iov_base = (void *)packet;
+    iovs[iov_count].iov_len = packet_len;
+    iov_count++;
 
-    ssize_t written = ::write(active_fd, packet, packet_len);
+    // One write per record, so a short write never leaves half a header in the file.
+    const ssize_t expected = (m_write_to_pcap ? sizeof(prefix) : 0) + packet_len;
+    const ssize_t written = ::writev(active_fd, iovs, iov_count);
     if (written < 0) {
         throw std::runtime_error("Failed to write");
     }
 
-    if (written < packet_len) {
-        return -1;
-    } else {
-        return written;
-    }
+    return (written < expected) ? -1 : (int)packet_len;
 }
 }
@@ -0,0 +1,134 @@
+#include "recoveryserver.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <netinet/in.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace znsreader
+{
+TickRecoveryServer::TickRecoveryServer(const std::filesystem::path &filename, uint16_t listenPort)
+    : m_listenPort(listenPort)
+{
+    std::ifstream capture(filename, std::ios::binary);
+    if (!capture) {
+        throw std::runtime_error("Failed to open capture: " + filename.string());
+    }
+
+    m_capture.assign(std::istreambuf_iterator<char>(capture), std::istreambuf_iterator<char>());
+
+    for (std::size_t offset = 0; offset + sizeof(StreamHeader) <= m_capture.size();) {
+        const StreamHeader *hdr = (const StreamHeader *)(m_capture.data() + offset);
+        if (hdr->msgLen < (short)sizeof(StreamHeader) || offset + hdr->msgLen > m_capture.size()) {
+            throw std::runtime_error("Found invalid msgLen in capture");
+        }
+
+        if (hdr->streamId > 0 && hdr->seqNo != 0) {
+            if ((std::size_t)hdr->streamId >= m_index.size()) {
+                m_index.resize(hdr->streamId + 1);
+            }
+            m_index[hdr->streamId].push_back(packet_ref{ (uint32_t)hdr->seqNo, offset });
+        }
+
+        offset += hdr->msgLen;
+    }
+
+    for (auto &stream : m_index) {
+        std::stable_sort(stream.begin(), stream.end(),
+                         [](const packet_ref &a, const packet_ref &b) { return a.seq_no < b.seq_no; });
+    }
+
+    m_listenSock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (m_listenSock < 0) {
+        throw std::runtime_error("Failed to create socket");
+    }
+
+    int reuse = 1;
+    setsockopt(m_listenSock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in localSock;
+    std::memset(&localSock, 0, sizeof(localSock));
+    localSock.sin_family = AF_INET;
+    localSock.sin_port = htons(listenPort);
+    localSock.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(m_listenSock, (struct sockaddr *)&localSock, sizeof(localSock)) < 0 || listen(m_listenSock, 16) < 0) {
+        perror("bind/listen failed:");
+        close(m_listenSock);
+        throw std::runtime_error("Failed to listen on recovery port");
+    }
+
+    socklen_t len = sizeof(localSock);
+    getsockname(m_listenSock, (struct sockaddr *)&localSock, &len);
+    m_listenPort = ntohs(localSock.sin_port);
+}
+
+TickRecoveryServer::~TickRecoveryServer()
+{
+    close(m_listenSock);
+}
+
+void TickRecoveryServer::serveRequests()
+{
+    for (;;) {
+        int clientFd = accept(m_listenSock, nullptr, nullptr);
+        if (clientFd < 0) {
+            perror("accept failed:");
+            continue;
+        }
+
+        answer(clientFd);
+        close(clientFd);
+    }
+}
+
+void TickRecoveryServer::answer(int clientFd)
+{
+    const std::size_t request_len = sizeof(StreamHeader) + sizeof(char) + sizeof(TickRecReqData);
+    StreamPacket request;
+
+    std::size_t got = 0;
+    while (got < request_len) {
+        ssize_t ret = recv(clientFd, (unsigned char *)&request + got, request_len - got, 0);
+        if (ret <= 0) {
+            return;
+        }
+        got += ret;
+    }
+
+    const short stream_id = request.streamData.p.recReqData.streamID;
+    const int64_t start_seq = (uint32_t)request.streamData.p.recReqData.startSeqNo;
+    const int64_t end_seq = (uint32_t)request.streamData.p.recReqData.endSeqNo;
+
+    const bool valid = request.streamData.cMsgType == recoveryRequestMsg && stream_id > 0
+                       && (std::size_t)stream_id < m_index.size() && start_seq <= end_seq;
+
+    StreamPacket response;
+    const std::size_t response_len = sizeof(StreamHeader) + sizeof(char) + sizeof(TickRecRspData);
+    response.streamHdr.msgLen = response_len;
+    response.streamHdr.streamId = stream_id;
+    response.streamHdr.seqNo = 0;
+    response.streamData.cMsgType = recoveryResponseMsg;
+    response.streamData.p.recRspData.reqStatus = valid ? 'S' : 'E';
+
+    if (send(clientFd, &response, response_len, MSG_NOSIGNAL) != (ssize_t)response_len || !valid) {
+        return;
+    }
+
+    const auto &stream = m_index[stream_id];
+    auto it = std::lower_bound(stream.begin(), stream.end(), start_seq,
+                               [](const packet_ref &ref, int64_t seq) { return ref.seq_no < seq; });
+
+    for (; it != stream.end() && it->seq_no <= end_seq; ++it) {
+        const StreamHeader *hdr = (const StreamHeader *)(m_capture.data() + it->offset);
+        if (send(clientFd, hdr, hdr->msgLen, MSG_NOSIGNAL) != hdr->msgLen) {
+            return;
+        }
+    }
+}
+}
@@ -0,0 +1,46 @@
+#ifndef __ZNS_RECOVERY_SERVER_H
+#define __ZNS_RECOVERY_SERVER_H
+
+#include "nsetypes.hpp"
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+namespace znsreader
+{
+// Local stand-in for the exchange tick recovery server, answering 'R' requests from a
+// .bin capture written by PacketToFileWriter (StreamPackets back to back).
+class TickRecoveryServer
+{
+  public:
+    TickRecoveryServer() = delete;
+    TickRecoveryServer(const std::filesystem::path &filename, uint16_t listenPort);
+    ~TickRecoveryServer();
+
+    TickRecoveryServer(const TickRecoveryServer &) = delete;
+    TickRecoveryServer &operator=(TickRecoveryServer const &) = delete;
+
+    // Accepts and answers one request per connection, forever.
+    void serveRequests();
+    uint16_t port() const
+    {
+        return m_listenPort;
+    }
+
+  private:
+    struct packet_ref {
+        int64_t seq_no;
+        std::size_t offset;
+    };
+
+    void answer(int clientFd);
+
+    std::vector<unsigned char> m_capture;
+    // Indexed by stream id, sorted by seqNo.
+    std::vector<std::vector<packet_ref>> m_index;
+    int m_listenSock;
+    uint16_t m_listenPort;
+};
+}
+
+#endif
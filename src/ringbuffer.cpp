@@ -1,125 +1,59 @@
 #include "ringbuffer.hpp"
 #include <cstddef>
+#include <cstdint>
 #include <cstring>
 #include <iostream>
+#include <stdexcept>
 #include <string>
 #include <unistd.h>
 
 // SPSC model
 namespace znsreader
 {
-RingBuffer::RingBuffer(std::size_t max_size, bool use_huge_pages, WriterCallBack writerFn, ReaderCallBack readerFn)
-    : m_use_huge_pages(use_huge_pages),
-      m_max_size(max_size),
-      m_write_index(0),
-      m_read_index(0),
-      m_reader(readerFn),
-      m_writer(writerFn)
+MirroredMapping::MirroredMapping(std::size_t size, bool use_huge_pages)
 {
-    const size_t rounded_size = align_size(max_size, m_use_huge_pages);
+    const size_t page = page_size(use_huge_pages);
+    const size_t rounded_size = (size + (page - 1)) & ~(page - 1);
 
-    if (m_use_huge_pages) {
-        m_start = (unsigned char *)::mmap(nullptr, rounded_size, ZNS_MMAP_PERMS, ZNS_MMAP_FLAGS, -1, 0);
-        if (m_start == MAP_FAILED) {
-            throw std::runtime_error("Failed to mmap");
-        }
-    } else {
-        // TODO : posix_memalign?
-        m_start = (unsigned char *)::malloc(rounded_size);
-        if (m_start == nullptr) {
-            throw std::runtime_error("Failed to malloc");
-        }
+    int memfd = ::memfd_create("zns_ringbuffer", MFD_CLOEXEC | (use_huge_pages ? MFD_HUGETLB : 0));
+    if (memfd < 0) {
+        perror("memfd_create error:");
+        throw std::runtime_error("Failed to create ring buffer memfd");
     }
 
-    m_end = (unsigned char *)m_start + m_max_size;
-    m_allocated_size = rounded_size;
-
-    std::cout << "Requested: " << max_size << ": Allocated: " << rounded_size << std::endl;
-}
-
-RingBuffer::~RingBuffer()
-{
-    if (m_use_huge_pages) {
-        ::munmap((void *)m_start, m_allocated_size);
-    } else {
-        ::free(m_start);
+    if (::ftruncate(memfd, rounded_size) < 0) {
+        perror("ftruncate error:");
+        ::close(memfd);
+        throw std::runtime_error("Failed to size ring buffer memfd");
     }
-}
 
-std::size_t RingBuffer::push(int fd, std::size_t max_bytes)
-{
-    const size_t write_index = m_write_index.load(std::memory_order_relaxed);
-    const size_t read_index = m_read_index.load(std::memory_order_acquire);
-    const size_t avail = write_available(write_index, read_index, m_max_size);
-
-    if (avail < max_bytes) {
-        return 0;
+    // Reserve address space for both views, with slack so the first view lands on a page boundary.
+    m_mapping_size = (2 * rounded_size) + page;
+    m_mapping = ::mmap(nullptr, m_mapping_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (m_mapping == MAP_FAILED) {
+        ::close(memfd);
+        throw std::runtime_error("Failed to reserve ring buffer address space");
     }
 
-    size_t new_write_index = write_index + max_bytes;
-
-    if (new_write_index > m_max_size) {
-        size_t written_bytes = m_writer(fd, m_start + write_index, 131072);
+    unsigned char *base = (unsigned char *)(((uintptr_t)m_mapping + (page - 1)) & ~(uintptr_t)(page - 1));
 
-        if ((written_bytes + write_index) > m_max_size) {
-            const size_t count0 = m_max_size - write_index;
-            const size_t count1 = written_bytes - count0;
+    void *first = ::mmap(base, rounded_size, ZNS_MMAP_PERMS, ZNS_MMAP_FLAGS, memfd, 0);
+    void *second = ::mmap(base + rounded_size, rounded_size, ZNS_MMAP_PERMS, ZNS_MMAP_FLAGS, memfd, 0);
+    ::close(memfd);
 
-            ::memmove(m_start, (unsigned char *)m_end, count1);
-            new_write_index = count1;
-        } else {
-            new_write_index = write_index + written_bytes;
-        }
-    } else {
-        std::size_t written_bytes = m_writer(fd, m_start + write_index, max_bytes);
-
-        if ((written_bytes + write_index) == m_max_size) {
-            new_write_index = 0;
-        } else {
-            new_write_index = write_index + written_bytes;
-        }
+    if (first == MAP_FAILED || second == MAP_FAILED) {
+        ::munmap(m_mapping, m_mapping_size);
+        throw std::runtime_error("Failed to mmap");
     }
 
-    m_write_index.store(new_write_index, std::memory_order_release);
+    m_start = base;
+    m_size = rounded_size;
 
-    return max_bytes;
+    std::cout << "Requested: " << size << ": Allocated: " << rounded_size << std::endl;
 }
 
-std::size_t RingBuffer::pop_all()
+MirroredMapping::~MirroredMapping()
 {
-    const size_t write_index = m_write_index.load(std::memory_order_acquire);
-    const size_t read_index = m_read_index.load(std::memory_order_relaxed);
-    const size_t avail = read_available(write_index, read_index, m_max_size);
-
-    if (avail == 0) {
-        return 0;
-    }
-
-    const size_t output_count = avail;
-    size_t new_read_index = read_index + output_count;
-
-    if (new_read_index > m_max_size) {
-        const size_t count0 = m_max_size - read_index;
-        const size_t count1 = output_count - count0;
-
-        // TODO : make one at begining and cache.
-        void *temp_buffer = ::malloc(count0 + count1);
-        ::memcpy(temp_buffer, (unsigned char *)m_start + read_index, count0);
-        ::memcpy((unsigned char *)temp_buffer + count0, (const unsigned char *)m_start, count1);
-
-        m_reader((const unsigned char *)temp_buffer, (count0 + count1));
-        ::free(temp_buffer);
-
-        new_read_index -= m_max_size;
-    } else {
-        m_reader((const unsigned char *)m_start + read_index, output_count);
-
-        if (new_read_index == m_max_size) {
-            new_read_index = 0;
-        }
-    }
-
-    m_read_index.store(new_read_index, std::memory_order_release);
-    return output_count;
+    ::munmap(m_mapping, m_mapping_size);
 }
 }
@@ -1,70 +1,209 @@
 #ifndef __ZNS_RING_BUFFER_H
 #define __ZNS_RING_BUFFER_H
 
+#include <algorithm>
 #include <atomic>
+#include <bit>
+#include <cstddef>
 #include <functional>
+#include <stdexcept>
 #include <sys/mman.h>
+#include <sys/types.h>
 
-#define ZNS_MMAP_FLAGS (MAP_HUGETLB | MAP_ANONYMOUS | MAP_SHARED)
+#define ZNS_MMAP_FLAGS (MAP_SHARED | MAP_FIXED)
 #define ZNS_MMAP_PERMS (PROT_READ | PROT_WRITE)
 
 namespace znsreader
 {
-class RingBuffer
+// Capacity value selecting a ring sized at runtime.
+inline constexpr std::size_t ZNS_DYNAMIC_CAPACITY = 0;
+
+// Pages of one memfd mapped twice back to back, so any region starting inside the
+// buffer is contiguous in memory up to size() bytes and wraps need no copies.
+class MirroredMapping
 {
   public:
-    using WriterCallBack = std::function<::size_t(int fd, unsigned char *data, size_t size)>;
-    using ReaderCallBack = std::function<::size_t(const unsigned char *data, size_t size)>;
-    RingBuffer() = delete;
-    RingBuffer(std::size_t max_size, bool use_huge_pages, WriterCallBack writer_fn, ReaderCallBack reader_fn);
-    ~RingBuffer();
+    MirroredMapping() = delete;
+    MirroredMapping(std::size_t size, bool use_huge_pages);
+    ~MirroredMapping();
 
-    ::ssize_t free_space();
-    std::size_t push(int fd, std::size_t max_bytes);
-    std::size_t pop_all();
-    void reset();
+    MirroredMapping(const MirroredMapping &) = delete;
+    MirroredMapping &operator=(MirroredMapping const &) = delete;
+
+    unsigned char *data() const
+    {
+        return m_start;
+    }
+
+    std::size_t size() const
+    {
+        return m_size;
+    }
+
+    static inline size_t page_size(bool huge_page)
+    {
+        if (huge_page) {
+            return (1 << 21); // 2MB
+        }
+
+        return (1 << 12); // 4K
+    }
 
   private:
-    static inline size_t write_available(size_t write_index, size_t read_index, size_t max_size)
+    unsigned char *m_start;
+    void *m_mapping;
+    size_t m_size;
+    size_t m_mapping_size;
+};
+
+// SPSC byte ring. Writer is called as writer(fd, dst, max_bytes) and returns bytes written,
+// reader as reader(src, size). Both are stored by value and called directly, so plain
+// function objects inline into push()/pop_all(). Capacity is a power of two, either fixed
+// at compile time or rounded up from the size given at construction.
+template <typename Writer, typename Reader, std::size_t Capacity = ZNS_DYNAMIC_CAPACITY>
+class BasicRingBuffer
+{
+    static_assert(Capacity == ZNS_DYNAMIC_CAPACITY || std::has_single_bit(Capacity),
+                  "RingBuffer capacity must be a power of two");
+
+  public:
+    BasicRingBuffer() = delete;
+    // max_size is ignored when Capacity is fixed at compile time.
+    BasicRingBuffer(std::size_t max_size, bool use_huge_pages, Writer writer_fn, Reader reader_fn)
+        : m_read_index(0),
+          m_reader(std::move(reader_fn)),
+          m_writer(std::move(writer_fn)),
+          m_memory(ring_size(max_size, use_huge_pages), use_huge_pages),
+          m_mask(m_memory.size() - 1),
+          m_write_index(0),
+          m_push_occupancy(0)
+    {
+    }
+
+    BasicRingBuffer(const BasicRingBuffer &) = delete;
+    BasicRingBuffer &operator=(BasicRingBuffer const &) = delete;
+
+    std::size_t capacity() const
+    {
+        return mask() + 1;
+    }
+
+    ::ssize_t free_space() const
+    {
+        const size_t write_index = m_write_index.load(std::memory_order_relaxed);
+        const size_t read_index = m_read_index.load(std::memory_order_acquire);
+        return capacity() - (write_index - read_index);
+    }
+
+    std::size_t push(int fd, std::size_t max_bytes)
+    {
+        const size_t write_index = m_write_index.load(std::memory_order_relaxed);
+        const size_t read_index = m_read_index.load(std::memory_order_acquire);
+
+        if ((capacity() - (write_index - read_index)) < max_bytes) {
+            return 0;
+        }
+
+        // Writes past the end land in the mirror, i.e. at the start of the buffer.
+        const std::size_t written_bytes = m_writer(fd, m_memory.data() + (write_index & mask()), max_bytes);
+
+        m_write_index.store(write_index + written_bytes, std::memory_order_release);
+        m_push_occupancy = (write_index + written_bytes) - read_index;
+
+        return max_bytes;
+    }
+
+    // Only for the writer thread.
+    Writer &writer()
+    {
+        return m_writer;
+    }
+
+    // Bytes waiting as of the last successful push, against the read index it saw. Only for
+    // the writer thread.
+    std::size_t occupancy() const
     {
-        size_t ret = read_index - write_index - 1;
-        if (write_index >= read_index) {
-            ret += max_size;
+        return m_push_occupancy;
+    }
+
+    // Total bytes ever written, only meaningful on the writer thread.
+    std::size_t write_position() const
+    {
+        return m_write_index.load(std::memory_order_relaxed);
+    }
+
+    std::size_t pop_all()
+    {
+        const size_t write_index = m_write_index.load(std::memory_order_acquire);
+        const size_t read_index = m_read_index.load(std::memory_order_relaxed);
+        const size_t avail = write_index - read_index;
+
+        if (avail == 0) {
+            return 0;
         }
 
-        return ret;
+        // Readable region may run into the mirror, reader still sees it as one span.
+        m_reader((const unsigned char *)m_memory.data() + (read_index & mask()), avail);
+
+        m_read_index.store(read_index + avail, std::memory_order_release);
+        return avail;
     }
 
-    static inline size_t read_available(size_t write_index, size_t read_index, size_t max_size)
+    // Only valid while neither side is running.
+    void reset()
     {
-        if (write_index >= read_index) {
-            return write_index - read_index;
+        m_write_index.store(0, std::memory_order_relaxed);
+        m_read_index.store(0, std::memory_order_relaxed);
+    }
+
+  private:
+    static inline size_t ring_size(size_t max_size, bool huge_page)
+    {
+        const size_t page = MirroredMapping::page_size(huge_page);
+
+        if constexpr (Capacity != ZNS_DYNAMIC_CAPACITY) {
+            if (Capacity < page) {
+                throw std::runtime_error("RingBuffer capacity is smaller than a page");
+            }
+            return Capacity;
         }
 
-        const size_t ret = write_index + max_size - read_index;
-        return ret;
+        return std::bit_ceil(std::max(max_size, page));
     }
 
-    static inline size_t align_size(size_t max_size, bool huge_page)
+    inline size_t mask() const
     {
-        size_t page_size = (1 << 12); // 4K
-        if (huge_page) {
-            page_size = (1 << 21); // 2MB
+        if constexpr (Capacity != ZNS_DYNAMIC_CAPACITY) {
+            return Capacity - 1;
         }
 
-        // TODO : Find a way to include ARG_MAX
-        return ((max_size + 131072) + (page_size - 1)) & ~(page_size - 1);
+        return m_mask;
     }
 
+    // Indices run freely, only masked when turned into an address.
     alignas(64) std::atomic<size_t> m_read_index;
-    ReaderCallBack m_reader;
-    WriterCallBack m_writer;
-    unsigned char *m_start;
-    unsigned char *m_end;
-    size_t m_max_size;
-    size_t m_allocated_size;
-    bool m_use_huge_pages;
+    [[no_unique_address]] Reader m_reader;
+    [[no_unique_address]] Writer m_writer;
+    MirroredMapping m_memory;
+    size_t m_mask;
     alignas(64) std::atomic<size_t> m_write_index;
+    // Writer thread only, next to the index it already writes.
+    size_t m_push_occupancy;
+};
+
+// Type-erased ring kept for callers that pick callbacks at runtime.
+class RingBuffer : public BasicRingBuffer<std::function<::size_t(int fd, unsigned char *data, size_t size)>,
+                                          std::function<::size_t(const unsigned char *data, size_t size)>>
+{
+  public:
+    using WriterCallBack = std::function<::size_t(int fd, unsigned char *data, size_t size)>;
+    using ReaderCallBack = std::function<::size_t(const unsigned char *data, size_t size)>;
+
+    RingBuffer() = delete;
+    RingBuffer(std::size_t max_size, bool use_huge_pages, WriterCallBack writer_fn, ReaderCallBack reader_fn)
+        : BasicRingBuffer(max_size, use_huge_pages, std::move(writer_fn), std::move(reader_fn))
+    {
+    }
 };
 
 }
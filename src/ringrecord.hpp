@@ -0,0 +1,171 @@
+#ifndef __ZNS_RING_RECORD_H
+#define __ZNS_RING_RECORD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+
+namespace znsreader
+{
+enum class FeedLine : uint8_t {
+    primary = 0,
+    secondary = 1,
+    recovery = 2, // fetched from the tick recovery server
+};
+
+// RingRecordHeader::flags, recv_timestamp_ns was taken by the kernel (SO_TIMESTAMPNS)
+// rather than read from CLOCK_REALTIME after the receive call returned.
+#define ZNS_RECORD_KERNEL_TS 0x01
+
+// Fixed header written ahead of every datagram in record mode. Records are padded to
+// ZNS_RECORD_ALIGN so the next header is always aligned.
+struct alignas(8) RingRecordHeader {
+    uint16_t length; // payload bytes, excludes header and padding
+    FeedLine line;
+    uint8_t flags;
+    int16_t stream_id;
+    uint16_t reserved2;
+    int64_t recv_timestamp_ns; // CLOCK_REALTIME
+};
+
+static_assert(sizeof(RingRecordHeader) == 16, "Type: RingRecordHeader size is not 16 bytes");
+
+#define ZNS_RECORD_ALIGN 8
+
+static inline std::size_t ring_record_size(std::size_t payload_len)
+{
+    return (sizeof(RingRecordHeader) + payload_len + (ZNS_RECORD_ALIGN - 1)) & ~(std::size_t)(ZNS_RECORD_ALIGN - 1);
+}
+
+class RingRecord
+{
+  public:
+    explicit RingRecord(const unsigned char *record) : m_hdr(reinterpret_cast<const RingRecordHeader *>(record))
+    {
+    }
+
+    const RingRecordHeader &header() const
+    {
+        return *m_hdr;
+    }
+
+    // Start of the whole record, header included.
+    const unsigned char *data() const
+    {
+        return reinterpret_cast<const unsigned char *>(m_hdr);
+    }
+
+    const unsigned char *payload() const
+    {
+        return reinterpret_cast<const unsigned char *>(m_hdr) + sizeof(RingRecordHeader);
+    }
+
+    std::size_t payload_len() const
+    {
+        return m_hdr->length;
+    }
+
+    std::size_t record_size() const
+    {
+        return ring_record_size(m_hdr->length);
+    }
+
+  private:
+    const RingRecordHeader *m_hdr;
+};
+
+// Walks a span of ring memory holding whole records, as handed to the reader.
+class RingRecordRange
+{
+  public:
+    class iterator
+    {
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = RingRecord;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = RingRecord;
+
+        iterator() = default;
+        explicit iterator(const unsigned char *pos) : m_pos(pos)
+        {
+        }
+
+        RingRecord operator*() const
+        {
+            return RingRecord(m_pos);
+        }
+
+        iterator &operator++()
+        {
+            m_pos += RingRecord(m_pos).record_size();
+            return *this;
+        }
+
+        iterator operator++(int)
+        {
+            iterator prev = *this;
+            ++(*this);
+            return prev;
+        }
+
+        bool operator==(const iterator &other) const
+        {
+            return m_pos == other.m_pos;
+        }
+
+      private:
+        const unsigned char *m_pos = nullptr;
+    };
+
+    RingRecordRange(const unsigned char *data, std::size_t size) : m_data(data), m_size(size)
+    {
+    }
+
+    iterator begin() const
+    {
+        return iterator(m_data);
+    }
+
+    iterator end() const
+    {
+        return iterator(m_data + m_size);
+    }
+
+    const unsigned char *data() const
+    {
+        return m_data;
+    }
+
+    std::size_t size_bytes() const
+    {
+        return m_size;
+    }
+
+  private:
+    const unsigned char *m_data;
+    std::size_t m_size;
+};
+
+// Ring reader that hands popped bytes to Handler as a RingRecordRange.
+template <typename Handler>
+class RingRecordReader
+{
+  public:
+    explicit RingRecordReader(Handler handler = Handler()) : m_handler(std::move(handler))
+    {
+    }
+
+    std::size_t operator()(const unsigned char *data, std::size_t size)
+    {
+        return m_handler(RingRecordRange(data, size));
+    }
+
+  private:
+    [[no_unique_address]] Handler m_handler;
+};
+}
+
+#endif
@@ -0,0 +1,225 @@
+#include "shmfeed.hpp"
+#include "ringbuffer.hpp"
+#include "timeutil.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ZNS_SHM_DIR "/dev/shm"
+
+namespace znsreader
+{
+namespace
+{
+// First hugetlbfs mount in /proc/mounts, empty when there is none.
+std::string hugetlbfs_mount()
+{
+    std::ifstream mounts("/proc/mounts");
+    std::string line;
+
+    while (std::getline(mounts, line)) {
+        std::istringstream fields(line);
+        std::string device, dir, type;
+        if ((fields >> device >> dir >> type) && type == "hugetlbfs") {
+            return dir;
+        }
+    }
+
+    return std::string();
+}
+}
+
+ShmFeedMapping::ShmFeedMapping(int fd, std::size_t header_size, std::size_t capacity, bool writable)
+    : m_header_size(header_size)
+{
+    const int perms = writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+
+    // Reserve address space for header, ring and mirror, with slack to align the header.
+    m_mapping_size = header_size + (2 * capacity) + header_size;
+    m_mapping = ::mmap(nullptr, m_mapping_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (m_mapping == MAP_FAILED) {
+        perror("mmap error:");
+        throw std::runtime_error("Failed to reserve shared feed address space");
+    }
+
+    m_base = (unsigned char *)(((uintptr_t)m_mapping + (header_size - 1)) & ~(uintptr_t)(header_size - 1));
+
+    void *first = ::mmap(m_base, header_size + capacity, perms, ZNS_MMAP_FLAGS, fd, 0);
+    void *second = ::mmap(m_base + header_size + capacity, capacity, perms, ZNS_MMAP_FLAGS, fd, header_size);
+
+    if (first == MAP_FAILED || second == MAP_FAILED) {
+        perror("mmap error:");
+        ::munmap(m_mapping, m_mapping_size);
+        throw std::runtime_error("Failed to map shared feed");
+    }
+}
+
+ShmFeedMapping::~ShmFeedMapping()
+{
+    ::munmap(m_mapping, m_mapping_size);
+}
+
+ShmFeedPublisher::ShmFeedPublisher(const std::string &name, ShmFeedFormat format, std::size_t capacity,
+                                   bool use_huge_pages)
+{
+    if (name.empty() || name.find('/') != std::string::npos) {
+        throw std::runtime_error("Shared feed name must be a plain file name");
+    }
+
+    const std::string huge_dir = use_huge_pages ? hugetlbfs_mount() : std::string();
+    int fd = -1;
+    std::string tmp_path;
+
+    // hugetlbfs first when asked for, /dev/shm when that is missing or out of huge pages.
+    for (const bool huge : { true, false }) {
+        if (huge && huge_dir.empty()) {
+            continue;
+        }
+
+        const std::size_t page = MirroredMapping::page_size(huge);
+        const std::string dir = huge ? huge_dir : ZNS_SHM_DIR;
+        m_capacity = std::bit_ceil(std::max(capacity, page));
+        m_huge_pages = huge;
+        m_path = dir + "/" + name;
+        tmp_path = dir + "/." + name + "." + std::to_string(::getpid());
+
+        fd = ::open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd >= 0 && ::ftruncate(fd, page + m_capacity) == 0) {
+            try {
+                m_mapping = std::make_unique<ShmFeedMapping>(fd, page, m_capacity, true);
+                break;
+            } catch (const std::runtime_error &) {
+            }
+        }
+
+        perror("shared feed segment error:");
+        if (fd >= 0) {
+            ::close(fd);
+            ::unlink(tmp_path.c_str());
+            fd = -1;
+        }
+        if (huge) {
+            std::cout << "Huge pages unavailable for shared feed " << name << ", using " ZNS_SHM_DIR << std::endl;
+        }
+    }
+
+    if (fd < 0) {
+        throw std::runtime_error("Failed to create shared feed segment");
+    }
+    ::close(fd);
+
+    ShmFeedHeader *header = m_mapping->header();
+    header->magic = ZNS_SHM_FEED_MAGIC;
+    header->version = ZNS_SHM_FEED_VERSION;
+    header->header_size = MirroredMapping::page_size(m_huge_pages);
+    header->capacity = m_capacity;
+    header->format = format;
+    header->publisher_pid = ::getpid();
+    header->generation = realtime_ns();
+    header->state.store(ShmFeedState::live, std::memory_order_relaxed);
+    header->write_index.store(0, std::memory_order_relaxed);
+    header->claim_index.store(0, std::memory_order_relaxed);
+
+    // Readers only find the name once the header is complete. A segment left by a publisher
+    // that died is replaced, and one in the other directory removed.
+    if (::rename(tmp_path.c_str(), m_path.c_str()) < 0) {
+        perror("rename error:");
+        ::unlink(tmp_path.c_str());
+        throw std::runtime_error("Failed to publish shared feed segment");
+    }
+    if (m_huge_pages) {
+        ::unlink((ZNS_SHM_DIR "/" + name).c_str());
+    } else if (!huge_dir.empty()) {
+        ::unlink((huge_dir + "/" + name).c_str());
+    }
+
+    std::cout << "Publishing shared feed " << m_path << ": " << m_capacity << " bytes" << std::endl;
+}
+
+ShmFeedPublisher::~ShmFeedPublisher()
+{
+    m_mapping->header()->state.store(ShmFeedState::closed, std::memory_order_release);
+    ::unlink(m_path.c_str());
+}
+
+void ShmFeedPublisher::publish(const unsigned char *data, std::size_t size)
+{
+    if (size > m_capacity / 2) {
+        throw std::runtime_error("Shared feed publish exceeds half the ring");
+    }
+
+    ShmFeedHeader *header = m_mapping->header();
+    const uint64_t write_index = header->write_index.load(std::memory_order_relaxed);
+
+    // Readers must see the claim before any byte it covers changes.
+    header->claim_index.store(write_index + size, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    // Copies past the end land in the mirror, i.e. at the start of the ring.
+    ::memcpy(m_mapping->ring() + (write_index & (m_capacity - 1)), data, size);
+
+    header->write_index.store(write_index + size, std::memory_order_release);
+}
+
+ShmFeedReader::ShmFeedReader(const std::string &name, bool from_start) : m_overruns(0), m_dropped_bytes(0)
+{
+    const std::string huge_dir = hugetlbfs_mount();
+    int fd = -1;
+
+    if (!huge_dir.empty()) {
+        fd = ::open((huge_dir + "/" + name).c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (fd < 0) {
+        fd = ::open((ZNS_SHM_DIR "/" + name).c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (fd < 0) {
+        perror("shared feed open error:");
+        throw std::runtime_error("Shared feed is not published");
+    }
+
+    // The fixed fields sit at the start of the first page whatever its size.
+    ShmFeedHeader fixed;
+    struct stat st;
+    if (::pread(fd, &fixed, offsetof(ShmFeedHeader, state), 0) != (ssize_t)offsetof(ShmFeedHeader, state)
+        || ::fstat(fd, &st) < 0) {
+        perror("shared feed header error:");
+        ::close(fd);
+        throw std::runtime_error("Failed to read shared feed header");
+    }
+
+    if (fixed.magic != ZNS_SHM_FEED_MAGIC || fixed.version != ZNS_SHM_FEED_VERSION
+        || !std::has_single_bit(fixed.capacity) || (std::size_t)st.st_size != fixed.header_size + fixed.capacity) {
+        ::close(fd);
+        throw std::runtime_error("Shared feed header does not match this reader");
+    }
+
+    try {
+        m_mapping = std::make_unique<ShmFeedMapping>(fd, fixed.header_size, fixed.capacity, false);
+    } catch (const std::runtime_error &) {
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+
+    m_capacity = fixed.capacity;
+    m_scratch.reset(new unsigned char[m_capacity / 2]);
+
+    // Only index 0 is known to start a packet or record, later ones come from write_index.
+    const uint64_t write_index = m_mapping->header()->write_index.load(std::memory_order_acquire);
+    m_read_index = (from_start && write_index <= m_capacity / 2) ? 0 : write_index;
+}
+
+ShmFeedReader::~ShmFeedReader()
+{
+}
+}
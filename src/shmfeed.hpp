@@ -0,0 +1,211 @@
+#ifndef __ZNS_SHM_FEED_H
+#define __ZNS_SHM_FEED_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#define ZNS_SHM_FEED_MAGIC        0x4445454653534e5aULL // "ZNSSFEED"
+#define ZNS_SHM_FEED_VERSION      1
+#define ZNS_SHM_FEED_DEFAULT_SIZE ((std::size_t)1 << 30)
+
+namespace znsreader
+{
+// What the published bytes are, as handed to a ring reader.
+enum class ShmFeedFormat : uint32_t {
+    stream_packets = 0, // StreamPackets back to back
+    ring_records = 1,   // RingRecordHeader framed records, read them with RingRecordReader
+};
+
+enum class ShmFeedState : uint32_t {
+    live = 0,
+    closed = 1, // the publisher is gone, nothing more will be written
+};
+
+// First page of a feed segment, the ring follows it. Every field before write_index is set
+// once by the publisher before it makes the name visible.
+struct ShmFeedHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t header_size; // ring offset in the segment, one page
+    uint64_t capacity;    // ring bytes, a power of two
+    ShmFeedFormat format;
+    int32_t publisher_pid;
+    // CLOCK_REALTIME at creation, a restarted publisher makes a new segment under the name.
+    int64_t generation;
+    std::atomic<ShmFeedState> state;
+    // Indices run freely like BasicRingBuffer's, only masked into an offset.
+    alignas(64) std::atomic<uint64_t> write_index;
+    // write_index plus the copy in progress, readers check what they read against it.
+    alignas(64) std::atomic<uint64_t> claim_index;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared feed indices must be lock free");
+
+// Segment, header page and ring mapped twice back to back, of a feed published by
+// ShmFeedPublisher or attached to by ShmFeedReader.
+class ShmFeedMapping
+{
+  public:
+    ShmFeedMapping() = delete;
+    ShmFeedMapping(int fd, std::size_t header_size, std::size_t capacity, bool writable);
+    ~ShmFeedMapping();
+
+    ShmFeedMapping(const ShmFeedMapping &) = delete;
+    ShmFeedMapping &operator=(ShmFeedMapping const &) = delete;
+
+    ShmFeedHeader *header() const
+    {
+        return (ShmFeedHeader *)m_base;
+    }
+
+    unsigned char *ring() const
+    {
+        return m_base + m_header_size;
+    }
+
+  private:
+    unsigned char *m_base;
+    void *m_mapping;
+    std::size_t m_mapping_size;
+    std::size_t m_header_size;
+};
+
+// Publishes a feed to other processes on the host under name: in hugetlbfs when
+// use_huge_pages is set and a hugetlbfs mount is found, as a POSIX shared memory object
+// otherwise. Readers never hold the publisher back, a reader that falls a ring behind is
+// skipped ahead. The name is removed again when the publisher goes, readers still attached
+// keep their mapping and see ShmFeedState::closed.
+class ShmFeedPublisher
+{
+  public:
+    ShmFeedPublisher() = delete;
+    ShmFeedPublisher(const std::string &name, ShmFeedFormat format, std::size_t capacity = ZNS_SHM_FEED_DEFAULT_SIZE,
+                     bool use_huge_pages = true);
+    ~ShmFeedPublisher();
+
+    ShmFeedPublisher(const ShmFeedPublisher &) = delete;
+    ShmFeedPublisher &operator=(ShmFeedPublisher const &) = delete;
+
+    // Copies size bytes, whole packets or records, into the ring and makes them visible.
+    // Only for one thread. size must not exceed half the capacity.
+    void publish(const unsigned char *data, std::size_t size);
+
+    std::size_t capacity() const
+    {
+        return m_capacity;
+    }
+
+    bool huge_pages() const
+    {
+        return m_huge_pages;
+    }
+
+  private:
+    std::string m_path;
+    bool m_huge_pages;
+    std::size_t m_capacity;
+    std::unique_ptr<ShmFeedMapping> m_mapping;
+};
+
+// Read only view of a published feed with its own cursor. poll() copies what was published
+// since the last call out of the shared ring into the reader's own scratch, checks that the
+// publisher did not claim any of it meanwhile, and only then hands the copy to the reader as
+// one span like a ring reader gets. A lapped copy is never seen: poll() counts an overrun,
+// tells a reader with on_overrun(bytes) and moves the cursor to the newest data. A reader
+// more than half a ring behind is moved there before it reads.
+class ShmFeedReader
+{
+  public:
+    ShmFeedReader() = delete;
+    // from_start reads the feed from its first byte while the ring still holds it, otherwise
+    // only what comes next.
+    explicit ShmFeedReader(const std::string &name, bool from_start = false);
+    ~ShmFeedReader();
+
+    ShmFeedReader(const ShmFeedReader &) = delete;
+    ShmFeedReader &operator=(ShmFeedReader const &) = delete;
+
+    template <typename Reader>
+    std::size_t poll(Reader &reader)
+    {
+        ShmFeedHeader *header = m_mapping->header();
+        const uint64_t write_index = header->write_index.load(std::memory_order_acquire);
+        const uint64_t avail = write_index - m_read_index;
+
+        if (avail == 0) {
+            return 0;
+        }
+        if (avail > m_capacity / 2) {
+            skip(reader, write_index);
+            return 0;
+        }
+
+        // The publisher may be overwriting any of this, only a copy that passes the claim
+        // check is whole records.
+        ::memcpy(m_scratch.get(), m_mapping->ring() + (m_read_index & (m_capacity - 1)), avail);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (header->claim_index.load(std::memory_order_relaxed) - m_read_index > m_capacity) {
+            skip(reader, header->write_index.load(std::memory_order_acquire));
+            return 0;
+        }
+
+        reader((const unsigned char *)m_scratch.get(), avail);
+        m_read_index = write_index;
+        return avail;
+    }
+
+    ShmFeedFormat format() const
+    {
+        return m_mapping->header()->format;
+    }
+
+    bool closed() const
+    {
+        return m_mapping->header()->state.load(std::memory_order_acquire) == ShmFeedState::closed;
+    }
+
+    int64_t generation() const
+    {
+        return m_mapping->header()->generation;
+    }
+
+    uint64_t overruns() const
+    {
+        return m_overruns;
+    }
+
+    uint64_t dropped_bytes() const
+    {
+        return m_dropped_bytes;
+    }
+
+  private:
+    template <typename Reader>
+    void skip(Reader &reader, uint64_t write_index)
+    {
+        const uint64_t skipped = write_index - m_read_index;
+
+        m_overruns++;
+        m_dropped_bytes += skipped;
+        m_read_index = write_index;
+
+        if constexpr (requires { reader.on_overrun(std::size_t()); }) {
+            reader.on_overrun(skipped);
+        }
+    }
+
+    std::unique_ptr<ShmFeedMapping> m_mapping;
+    std::size_t m_capacity;
+    // Half the ring, left uninitialised so only what a poll copies is ever touched.
+    std::unique_ptr<unsigned char[]> m_scratch;
+    uint64_t m_read_index;
+    uint64_t m_overruns;
+    uint64_t m_dropped_bytes;
+};
+}
+
+#endif // __ZNS_SHM_FEED_H
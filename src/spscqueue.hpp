@@ -0,0 +1,77 @@
+#ifndef __ZNS_SPSC_QUEUE_H
+#define __ZNS_SPSC_QUEUE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace znsreader
+{
+// Bounded single producer, single consumer queue of objects. Neither side ever blocks,
+// try_push fails when full and try_pop when empty.
+template <typename T, std::size_t Capacity>
+class SpscQueue
+{
+    static_assert(Capacity != 0 && (Capacity & (Capacity - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+  public:
+    SpscQueue() : m_read_index(0), m_write_index(0)
+    {
+    }
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(SpscQueue const &) = delete;
+
+    bool try_push(T &&item)
+    {
+        const size_t write_index = m_write_index.load(std::memory_order_relaxed);
+        const size_t read_index = m_read_index.load(std::memory_order_acquire);
+
+        if ((write_index - read_index) == Capacity) {
+            return false;
+        }
+
+        m_items[write_index & (Capacity - 1)] = std::move(item);
+        m_write_index.store(write_index + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_push(const T &item)
+    {
+        T copy = item;
+        return try_push(std::move(copy));
+    }
+
+    bool try_pop(T &item)
+    {
+        const size_t read_index = m_read_index.load(std::memory_order_relaxed);
+        const size_t write_index = m_write_index.load(std::memory_order_acquire);
+
+        if (read_index == write_index) {
+            return false;
+        }
+
+        item = std::move(m_items[read_index & (Capacity - 1)]);
+        m_read_index.store(read_index + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const
+    {
+        return m_read_index.load(std::memory_order_acquire) == m_write_index.load(std::memory_order_acquire);
+    }
+
+    std::size_t size() const
+    {
+        return m_write_index.load(std::memory_order_acquire) - m_read_index.load(std::memory_order_acquire);
+    }
+
+  private:
+    alignas(64) std::atomic<size_t> m_read_index;
+    alignas(64) std::atomic<size_t> m_write_index;
+    alignas(64) std::array<T, Capacity> m_items;
+};
+}
+
+#endif
@@ -0,0 +1,245 @@
+#include "tickrecovery.hpp"
+#include "nsetypes.hpp"
+#include "timeutil.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+namespace znsreader
+{
+namespace
+{
+bool read_exact(int fd, void *buf, std::size_t len)
+{
+    std::size_t done = 0;
+
+    while (done < len) {
+        ssize_t ret = ::recv(fd, (unsigned char *)buf + done, len - done, 0);
+        if (ret <= 0) {
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        done += ret;
+    }
+
+    return true;
+}
+
+bool write_exact(int fd, const void *buf, std::size_t len)
+{
+    std::size_t done = 0;
+
+    while (done < len) {
+        ssize_t ret = ::send(fd, (const unsigned char *)buf + done, len - done, MSG_NOSIGNAL);
+        if (ret <= 0) {
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        done += ret;
+    }
+
+    return true;
+}
+}
+
+TickRecoveryClient::TickRecoveryClient(std::string_view server_ip, uint16_t server_port,
+                                       std::chrono::milliseconds timeout)
+    : m_server_ip(server_ip),
+      m_server_port(server_port),
+      m_timeout(timeout),
+      m_running(true),
+      m_requests_pending(0),
+      m_requests(std::make_unique<SpscQueue<SequenceGap, 4096>>()),
+      m_results(std::make_unique<SpscQueue<RecoveryResult, 1024>>())
+{
+    m_worker = std::thread(&TickRecoveryClient::run, this);
+}
+
+TickRecoveryClient::~TickRecoveryClient()
+{
+    m_running.store(false, std::memory_order_release);
+    m_requests_pending.fetch_add(1, std::memory_order_release);
+    m_requests_pending.notify_one();
+    m_worker.join();
+}
+
+bool TickRecoveryClient::request(const SequenceGap &gap)
+{
+    if (!m_requests->try_push(gap)) {
+        return false;
+    }
+
+    m_requests_pending.fetch_add(1, std::memory_order_release);
+    m_requests_pending.notify_one();
+    return true;
+}
+
+bool TickRecoveryClient::poll(RecoveryResult &result)
+{
+    return m_results->try_pop(result);
+}
+
+void TickRecoveryClient::run()
+{
+    std::vector<SequenceGap> batch;
+
+    while (m_running.load(std::memory_order_acquire)) {
+        m_requests_pending.wait(0, std::memory_order_acquire);
+        m_requests_pending.exchange(0, std::memory_order_acq_rel);
+
+        batch.clear();
+        SequenceGap gap;
+        while (m_requests->try_pop(gap)) {
+            batch.push_back(gap);
+        }
+
+        // Merge overlapping and adjacent gaps of a stream into one range.
+        std::sort(batch.begin(), batch.end(), [](const SequenceGap &a, const SequenceGap &b) {
+            return (a.stream_id != b.stream_id) ? (a.stream_id < b.stream_id) : (a.start_seq < b.start_seq);
+        });
+
+        std::size_t merged = 0;
+        for (std::size_t i = 0; i < batch.size(); i++) {
+            if (merged != 0 && batch[merged - 1].stream_id == batch[i].stream_id
+                && batch[i].start_seq <= batch[merged - 1].end_seq + 1) {
+                batch[merged - 1].end_seq = std::max(batch[merged - 1].end_seq, batch[i].end_seq);
+            } else {
+                batch[merged++] = batch[i];
+            }
+        }
+        batch.resize(merged);
+
+        for (const SequenceGap &range : batch) {
+            RecoveryResult result;
+            result.stream_id = range.stream_id;
+            result.start_seq = range.start_seq;
+            result.end_seq = range.end_seq;
+            result.ok = true;
+
+            for (int64_t start = range.start_seq; start <= range.end_seq; start += ZNS_MAX_RECOVERY_SPAN) {
+                const int64_t end = std::min<int64_t>(range.end_seq, start + ZNS_MAX_RECOVERY_SPAN - 1);
+                fetch(range.stream_id, start, end, result);
+            }
+
+            while (!m_results->try_push(std::move(result))) {
+                if (!m_running.load(std::memory_order_acquire)) {
+                    return;
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
+    }
+}
+
+int TickRecoveryClient::connect_to_server()
+{
+    int fd = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0) {
+        perror("recovery socket error:");
+        return -1;
+    }
+
+    struct timeval tv;
+    tv.tv_sec = m_timeout.count() / 1000;
+    tv.tv_usec = (m_timeout.count() % 1000) * 1000;
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    int nodelay = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    struct sockaddr_in server;
+    std::memset(&server, 0, sizeof(server));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(m_server_port);
+    server.sin_addr.s_addr = inet_addr(m_server_ip.c_str());
+
+    if (::connect(fd, (struct sockaddr *)&server, sizeof(server)) < 0) {
+        perror("recovery connect error:");
+        ::close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// One request per connection, the server answers 'Y', streams the packets and closes.
+void TickRecoveryClient::fetch(short stream_id, int64_t start_seq, int64_t end_seq, RecoveryResult &result)
+{
+    int fd = connect_to_server();
+    if (fd < 0) {
+        result.ok = false;
+        return;
+    }
+
+    const std::size_t request_len = sizeof(StreamHeader) + sizeof(char) + sizeof(TickRecReqData);
+    StreamPacket request;
+    std::memset(&request, 0, sizeof(request));
+    request.streamHdr.msgLen = request_len;
+    request.streamHdr.streamId = stream_id;
+    request.streamHdr.seqNo = 0;
+    request.streamData.cMsgType = recoveryRequestMsg;
+    request.streamData.p.recReqData.streamID = stream_id;
+    request.streamData.p.recReqData.startSeqNo = start_seq;
+    request.streamData.p.recReqData.endSeqNo = end_seq;
+
+    const std::size_t response_len = sizeof(StreamHeader) + sizeof(char) + sizeof(TickRecRspData);
+    StreamPacket response;
+
+    if (!write_exact(fd, &request, request_len) || !read_exact(fd, &response, response_len)
+        || response.streamData.cMsgType != recoveryResponseMsg || response.streamData.p.recRspData.reqStatus != 'S') {
+        result.ok = false;
+        ::close(fd);
+        return;
+    }
+
+    RingRecordHeader hdr;
+    hdr.line = FeedLine::recovery;
+    hdr.flags = 0;
+    hdr.stream_id = stream_id;
+    hdr.reserved2 = 0;
+    hdr.recv_timestamp_ns = realtime_ns();
+
+    unsigned char packet[ZNS_MAX_RECOVERY_PACKET];
+    for (;;) {
+        StreamHeader *stream_hdr = (StreamHeader *)packet;
+        if (!read_exact(fd, stream_hdr, sizeof(StreamHeader))) {
+            break;
+        }
+
+        if (stream_hdr->msgLen < (short)sizeof(StreamHeader) || stream_hdr->msgLen > ZNS_MAX_RECOVERY_PACKET) {
+            result.ok = false;
+            break;
+        }
+
+        if (!read_exact(fd, packet + sizeof(StreamHeader), stream_hdr->msgLen - sizeof(StreamHeader))) {
+            break;
+        }
+
+        hdr.length = stream_hdr->msgLen;
+        const std::size_t offset = result.records.size();
+        result.records.resize(offset + ring_record_size(hdr.length));
+        ::memcpy(result.records.data() + offset, &hdr, sizeof(hdr));
+        ::memcpy(result.records.data() + offset + sizeof(hdr), packet, hdr.length);
+
+        if ((uint32_t)stream_hdr->seqNo >= end_seq) {
+            break;
+        }
+    }
+
+    ::close(fd);
+}
+}
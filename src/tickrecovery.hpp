@@ -0,0 +1,275 @@
+#ifndef __ZNS_TICK_RECOVERY_H
+#define __ZNS_TICK_RECOVERY_H
+
+#include "ipinfo.hpp"
+#include "linearbitrator.hpp"
+#include "nsetypes.hpp"
+#include "ringrecord.hpp"
+#include "spscqueue.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// NSE serves at most this many packets per recovery request.
+#define ZNS_MAX_RECOVERY_SPAN   10000
+#define ZNS_MAX_RECOVERY_PACKET 512
+
+namespace znsreader
+{
+// Outcome of recovering [start_seq, end_seq] on one stream. records holds whatever the
+// server returned, framed as ring records on FeedLine::recovery and ordered by seqNo.
+struct RecoveryResult {
+    short stream_id = 0;
+    int64_t start_seq = 0;
+    int64_t end_seq = 0;
+    bool ok = false;
+    std::vector<unsigned char> records;
+};
+
+// Fetches missing ranges from the exchange tick recovery server on its own thread.
+// request() and poll() are meant for the single consumer thread and never block it.
+// Queued gaps are merged per stream, split into spans the server accepts, and each span
+// is one 'R' request on its own TCP connection.
+class TickRecoveryClient
+{
+  public:
+    TickRecoveryClient() = delete;
+    TickRecoveryClient(std::string_view server_ip, uint16_t server_port,
+                       std::chrono::milliseconds timeout = std::chrono::milliseconds(2000));
+    ~TickRecoveryClient();
+
+    TickRecoveryClient(const TickRecoveryClient &) = delete;
+    TickRecoveryClient &operator=(TickRecoveryClient const &) = delete;
+
+    // False when the request queue is full, the gap is then not going to be recovered.
+    bool request(const SequenceGap &gap);
+    bool poll(RecoveryResult &result);
+
+  private:
+    void run();
+    void fetch(short stream_id, int64_t start_seq, int64_t end_seq, RecoveryResult &result);
+    int connect_to_server();
+
+    std::string m_server_ip;
+    uint16_t m_server_port;
+    std::chrono::milliseconds m_timeout;
+    std::atomic<bool> m_running;
+    std::atomic<uint32_t> m_requests_pending;
+    std::unique_ptr<SpscQueue<SequenceGap, 4096>> m_requests;
+    std::unique_ptr<SpscQueue<RecoveryResult, 1024>> m_results;
+    std::thread m_worker;
+};
+
+// Handler stage for LineArbitrator that repairs gaps through a TickRecoveryClient.
+// Once a stream has an outstanding gap its live packets are parked, and when the
+// recovered packets come back they are delivered in seqNo order ahead of the parked
+// ones. Ranges the server could not supply, or that were pending while more than
+// max_spill_bytes piled up behind them, reach Handler as on_gap.
+template <typename Handler>
+class RecoverySplicer
+{
+  public:
+    RecoverySplicer() = delete;
+    RecoverySplicer(const std::map<short, single_stream_info> &stream_config, TickRecoveryClient &client,
+                    Handler handler, std::size_t max_spill_bytes = 64 * 1024 * 1024)
+        : m_client(&client), m_handler(std::move(handler)), m_max_spill_bytes(max_spill_bytes)
+    {
+        short max_stream_id = 0;
+        for (auto &one_stream : stream_config) {
+            if (one_stream.first > max_stream_id) {
+                max_stream_id = one_stream.first;
+            }
+        }
+
+        m_streams.resize(max_stream_id + 1);
+    }
+
+    void on_record(const RingRecord &record)
+    {
+        if (m_recovering != 0) {
+            poll();
+        }
+
+        const short stream_id = record.header().stream_id;
+        if (stream_id <= 0 || (std::size_t)stream_id >= m_streams.size() || m_streams[stream_id].items.empty()) {
+            m_handler.on_record(record);
+            return;
+        }
+
+        stream_recovery &state = m_streams[stream_id];
+        state.items.push_back(spill_item{ false, false, SequenceGap{}, state.spill.size() });
+        state.spill.insert(state.spill.end(), record.data(), record.data() + record.record_size());
+
+        if (state.spill.size() > m_max_spill_bytes) {
+            abandon(stream_id);
+        }
+    }
+
+    void on_gap(const SequenceGap &gap)
+    {
+        if (m_recovering != 0) {
+            poll();
+        }
+
+        if (gap.stream_id <= 0 || (std::size_t)gap.stream_id >= m_streams.size()) {
+            m_handler.on_gap(gap);
+            return;
+        }
+
+        stream_recovery &state = m_streams[gap.stream_id];
+        if (!m_client->request(gap)) {
+            if (state.items.empty()) {
+                m_handler.on_gap(gap);
+                return;
+            }
+
+            // Packets are parked behind an earlier gap, this one waits its turn as a
+            // recovery that returned nothing.
+            state.items.push_back(spill_item{ true, true, gap, state.results.size() });
+            state.results.push_back(RecoveryResult{ gap.stream_id, gap.start_seq, gap.end_seq, false, {} });
+            return;
+        }
+
+        if (state.items.empty()) {
+            m_recovering++;
+        }
+
+        state.items.push_back(spill_item{ true, false, gap, 0 });
+    }
+
+    // Applies finished recoveries. Called on every packet while anything is pending; call
+    // it from the consumer loop as well if the feed can go quiet.
+    void poll()
+    {
+        RecoveryResult result;
+        while (m_client->poll(result)) {
+            resolve(std::move(result));
+        }
+    }
+
+    Handler &handler()
+    {
+        return m_handler;
+    }
+
+  private:
+    struct spill_item {
+        bool is_gap;
+        bool resolved;
+        SequenceGap gap;
+        std::size_t offset; // into spill for parked packets, into results for resolved gaps
+    };
+
+    struct stream_recovery {
+        std::deque<spill_item> items; // gaps and parked packets in arrival order
+        std::vector<unsigned char> spill;
+        std::vector<RecoveryResult> results;
+    };
+
+    void resolve(RecoveryResult &&result)
+    {
+        const short stream_id = result.stream_id;
+        if (stream_id <= 0 || (std::size_t)stream_id >= m_streams.size()) {
+            return;
+        }
+
+        stream_recovery &state = m_streams[stream_id];
+        bool matched = false;
+
+        for (spill_item &item : state.items) {
+            if (item.is_gap && !item.resolved && item.gap.start_seq >= result.start_seq
+                && item.gap.end_seq <= result.end_seq) {
+                item.resolved = true;
+                item.offset = state.results.size();
+                matched = true;
+            }
+        }
+
+        // Late answer for a gap that was already abandoned.
+        if (!matched) {
+            return;
+        }
+
+        state.results.push_back(std::move(result));
+        drain(state);
+    }
+
+    void drain(stream_recovery &state)
+    {
+        while (!state.items.empty()) {
+            const spill_item &item = state.items.front();
+
+            if (!item.is_gap) {
+                m_handler.on_record(RingRecord(state.spill.data() + item.offset));
+            } else if (item.resolved) {
+                deliver_recovered(item.gap, state.results[item.offset]);
+            } else {
+                return;
+            }
+
+            state.items.pop_front();
+        }
+
+        state.spill.clear();
+        state.results.clear();
+        m_recovering--;
+    }
+
+    void deliver_recovered(const SequenceGap &gap, const RecoveryResult &result)
+    {
+        int64_t expected = gap.start_seq;
+
+        for (const RingRecord record : RingRecordRange(result.records.data(), result.records.size())) {
+            const int64_t seq = (uint32_t)((const StreamHeader *)record.payload())->seqNo;
+            if (seq < expected || seq > gap.end_seq) {
+                continue;
+            }
+
+            if (seq > expected) {
+                m_handler.on_gap(SequenceGap{ gap.stream_id, expected, seq - 1 });
+            }
+
+            m_handler.on_record(record);
+            expected = seq + 1;
+        }
+
+        if (expected <= gap.end_seq) {
+            m_handler.on_gap(SequenceGap{ gap.stream_id, expected, gap.end_seq });
+        }
+    }
+
+    // Too much piled up behind a pending gap, report it lost and catch up.
+    void abandon(short stream_id)
+    {
+        stream_recovery &state = m_streams[stream_id];
+
+        for (spill_item &item : state.items) {
+            if (item.is_gap && !item.resolved) {
+                item.resolved = true;
+                item.offset = state.results.size();
+            }
+        }
+
+        // An empty failed result turns every abandoned gap into on_gap.
+        state.results.push_back(RecoveryResult{ stream_id, 0, 0, false, {} });
+        drain(state);
+    }
+
+    TickRecoveryClient *m_client;
+    Handler m_handler;
+    std::size_t m_max_spill_bytes;
+    // Streams with at least one gap still pending.
+    std::size_t m_recovering = 0;
+    // Indexed by stream id.
+    std::vector<stream_recovery> m_streams;
+};
+}
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef __ZNS_TIME_UTIL_H
+#define __ZNS_TIME_UTIL_H
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <thread>
+
+namespace znsreader
+{
+// Wall clock, the timebase of recv_timestamp_ns and everything logged or published.
+inline int64_t realtime_ns()
+{
+    struct timespec now;
+    ::clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// For intervals and pacing, never steps.
+inline int64_t monotonic_ns()
+{
+    struct timespec now;
+    ::clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Waits for monotonic_ns() to reach due_ns. Sleeps most of the way and spins the rest, a
+// sleep alone overshoots by tens of microseconds.
+inline void wait_until(int64_t due_ns)
+{
+    for (;;) {
+        const int64_t now = monotonic_ns();
+        if (now >= due_ns) {
+            return;
+        }
+        if ((due_ns - now) > 200000) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(due_ns - now - 100000));
+        }
+    }
+}
+}
+
+#endif
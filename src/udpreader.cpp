@@ -1,16 +1,21 @@
 #include "udpreader.hpp"
 #include "ipinfo.hpp"
+#include "nsetypes.hpp"
 #include "ringbuffer.hpp"
+#include "timeutil.hpp"
+#include <algorithm>
 #include <arpa/inet.h>
 #include <chrono>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <functional>
 #include <iostream>
 #include <iterator>
 #include <netinet/in.h>
 #include <stdexcept>
 #include <sys/epoll.h>
+#include <sys/uio.h>
 #include <sys/socket.h>
 #include <thread>
 #include <unistd.h>
@@ -18,25 +23,58 @@
 namespace znsreader
 {
 AggregatedPacketReader::AggregatedPacketReader(const std::map<short, single_stream_info> &ip_port_config,
-                                               bool use_huge_pages, RingBuffer::ReaderCallBack reader_fn)
-    : m_spsc_buffer(1024 * 1024 * 1024, use_huge_pages, socket_to_ringbuf_writer, reader_fn)
+                                               bool use_huge_pages, RingBuffer::ReaderCallBack reader_fn,
+                                               std::size_t recv_batch_size)
+    : BasicAggregatedPacketReader(
+          ip_port_config, use_huge_pages,
+          (recv_batch_size > 1) ? socket_to_ringbuf_batch_writer : socket_to_ringbuf_writer, reader_fn,
+          (recv_batch_size > 1)
+              ? std::min<std::size_t>(recv_batch_size, ZNS_MAX_RECV_BATCH) * ZNS_MAX_DATAGRAM_SIZE
+              : SingleRecvWriter::push_size)
 {
+}
+
+AggregatedPacketReader::AggregatedPacketReader(const std::map<short, single_stream_info> &ip_port_config,
+                                               bool use_huge_pages, RecordReaderCallBack record_fn,
+                                               std::size_t recv_batch_size)
+    : BasicAggregatedPacketReader(
+          ip_port_config, use_huge_pages,
+          [this](int fd, unsigned char *buf, std::size_t bufLen) {
+              return socket_to_ringbuf_record_writer(fd, buf, bufLen);
+          },
+          RingRecordReader<RecordReaderCallBack>(record_fn),
+          std::clamp<std::size_t>(recv_batch_size, 1, ZNS_MAX_RECV_BATCH) * ZNS_MAX_DATAGRAM_SIZE)
+{
+}
+
+MulticastSocketSet::MulticastSocketSet(const std::map<short, single_stream_info> &ip_port_config,
+                                       const ReceivePolicy &policy)
+{
+    auto add_socket_source = [this](int fd, short stream_id, FeedLine line) {
+        if (m_socket_sources.size() <= (std::size_t)fd) {
+            m_socket_sources.resize(fd + 1);
+        }
+        m_socket_sources[fd] = { stream_id, line };
+    };
+
     for (auto &one_stream : ip_port_config) {
-        int p_socket = create_udp_socket(one_stream.second.m_primary_ip, one_stream.second.m_primary_port);
+        int p_socket = create_udp_socket(one_stream.second.m_primary_ip, one_stream.second.m_primary_port, policy);
         if (p_socket < 0) {
             perror("Failed to create socket");
             throw std::runtime_error("Failed to create primary socket");
         }
 
         m_sockets.push_back(p_socket);
+        add_socket_source(p_socket, one_stream.first, FeedLine::primary);
 
-        int s_socket = create_udp_socket(one_stream.second.m_secondary_ip, one_stream.second.m_secondary_port);
+        int s_socket = create_udp_socket(one_stream.second.m_secondary_ip, one_stream.second.m_secondary_port, policy);
         if (s_socket < 0) {
             perror("Failed to create socket");
             throw std::runtime_error("Failed to create secondary socket");
         }
 
         m_sockets.push_back(s_socket);
+        add_socket_source(s_socket, one_stream.first, FeedLine::secondary);
     }
 
     // Setup epoll structures.
@@ -60,9 +98,12 @@ AggregatedPacketReader::AggregatedPacketReader(const std::map<short, single_stre
             }
         }
     }
+
+    // Indexed by fd like m_socket_sources, every block starts on its own cache line.
+    m_socket_counters = std::make_unique<SocketCounters[]>(m_socket_sources.size());
 }
 
-AggregatedPacketReader::~AggregatedPacketReader()
+MulticastSocketSet::~MulticastSocketSet()
 {
     for (auto &udp_socket_fd : m_sockets) {
         close(udp_socket_fd);
@@ -73,38 +114,67 @@ AggregatedPacketReader::~AggregatedPacketReader()
     m_sockets.clear();
 }
 
-void AggregatedPacketReader::write_packets_to_ringbuf()
-{
-    struct epoll_event eventList[1024];
-
-    struct timespec epollTimeout;
-    epollTimeout.tv_nsec = 10;
-    epollTimeout.tv_sec = 0;
+static_assert(CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(uint32_t)) <= ZNS_RECV_CONTROL_SIZE,
+              "ZNS_RECV_CONTROL_SIZE too small");
 
-    for (;;) {
-        int activeFds = epoll_pwait2(m_epollfd, eventList, 1024, nullptr, nullptr);
-        if (activeFds < 0) {
-            perror("epoll_wait error:");
-            throw std::runtime_error("epoll_wait error");
-        } else {
-            for (int i = 0; i < activeFds; i++) {
-                while (m_spsc_buffer.push(eventList[i].data.fd, 131072) == 0) {
-                }
-            }
+int64_t MulticastSocketSet::kernel_timestamp_ns(const struct msghdr *msg)
+{
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(const_cast<struct msghdr *>(msg), cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec stamp;
+            ::memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+            return (int64_t)stamp.tv_sec * 1000000000 + stamp.tv_nsec;
         }
     }
+
+    return 0;
 }
 
-void AggregatedPacketReader::read_packets_from_ringbuf()
+void MulticastSocketSet::count_datagram(int fd, const unsigned char *payload, std::size_t len,
+                                        const struct msghdr *msg) const
 {
-    for (;;) {
-        while (m_spsc_buffer.pop_all() != 0) {
-            std::this_thread::sleep_for(std::chrono::microseconds(1));
+    SocketCounters &counters = m_socket_counters[fd];
+
+    counter_add(counters.packets, 1);
+    counter_add(counters.bytes, len);
+
+    // The kernel attaches the socket's drop count only once it is non zero.
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(const_cast<struct msghdr *>(msg), cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+            uint32_t drops;
+            ::memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+            counter_max(counters.kernel_drops, drops);
         }
     }
+
+    if (len < sizeof(StreamHeader)) {
+        return;
+    }
+
+    StreamHeader hdr;
+    ::memcpy(&hdr, payload, sizeof(hdr));
+    const int64_t seq = (uint32_t)hdr.seqNo;
+
+    // seqNo 0 is not sequenced, as in LineArbitrator.
+    if (seq == 0) {
+        return;
+    }
+    const int64_t last_seq = counters.last_seq.load(std::memory_order_relaxed);
+    if (last_seq != 0 && seq <= last_seq) {
+        counter_add(counters.duplicates, 1);
+        return;
+    }
+    if (last_seq != 0 && seq > last_seq + 1) {
+        counter_add(counters.seq_gaps, 1);
+        counter_add(counters.seq_missing, seq - last_seq - 1);
+    }
+    counters.last_seq.store(seq, std::memory_order_relaxed);
 }
 
-int AggregatedPacketReader::create_udp_socket(const std::string_view &ipv4Addr, uint16_t udpPort)
+int MulticastSocketSet::create_udp_socket(const std::string_view &ipv4Addr, uint16_t udpPort,
+                                          const ReceivePolicy &policy)
 {
     int udpSocket;
 
@@ -127,6 +197,36 @@ int AggregatedPacketReader::create_udp_socket(const std::string_view &ipv4Addr,
         throw std::runtime_error("Failed to set socket option");
     }
 
+    // Software receive timestamp on every datagram, read back by the record writer.
+    int timestampNs = 1;
+    if (0 != setsockopt(udpSocket, SOL_SOCKET, SO_TIMESTAMPNS, &timestampNs, sizeof(timestampNs))) {
+        perror("setsockopt failed");
+        throw std::runtime_error("Failed to set socket option");
+    }
+
+    // Count of datagrams the socket queue dropped, attached to received ones for the counters.
+    int rxqOverflow = 1;
+    if (0 != setsockopt(udpSocket, SOL_SOCKET, SO_RXQ_OVFL, &rxqOverflow, sizeof(rxqOverflow))) {
+        perror("setsockopt failed");
+        throw std::runtime_error("Failed to set socket option");
+    }
+
+    // Busy polling is only a latency hint, raising it past net.core.busy_read needs
+    // CAP_NET_ADMIN, so a refusal is reported and the socket is used as is.
+    if (policy.m_busy_poll_us != 0) {
+        int busyPollUs = policy.m_busy_poll_us;
+        if (0 != setsockopt(udpSocket, SOL_SOCKET, SO_BUSY_POLL, &busyPollUs, sizeof(busyPollUs))) {
+            perror("setsockopt SO_BUSY_POLL failed");
+        }
+    }
+
+    if (policy.m_prefer_busy_poll) {
+        int preferBusyPoll = 1;
+        if (0 != setsockopt(udpSocket, SOL_SOCKET, SO_PREFER_BUSY_POLL, &preferBusyPoll, sizeof(preferBusyPoll))) {
+            perror("setsockopt SO_PREFER_BUSY_POLL failed");
+        }
+    }
+
     struct sockaddr_in localSock;
     localSock.sin_family = AF_INET;
     localSock.sin_port = htons(udpPort);
@@ -151,7 +251,7 @@ int AggregatedPacketReader::create_udp_socket(const std::string_view &ipv4Addr,
     return udpSocket;
 }
 
-std::size_t AggregatedPacketReader::socket_to_ringbuf_writer(int fd, unsigned char *buf, std::size_t bufLen)
+std::size_t MulticastSocketSet::socket_to_ringbuf_writer(int fd, unsigned char *buf, std::size_t bufLen)
 {
     ssize_t read_bytes = recv(fd, buf, bufLen, 0);
     if (read_bytes < 0) {
@@ -161,4 +261,112 @@ std::size_t AggregatedPacketReader::socket_to_ringbuf_writer(int fd, unsigned ch
 
     return read_bytes;
 }
+
+std::size_t MulticastSocketSet::socket_to_ringbuf_batch_writer(int fd, unsigned char *buf, std::size_t bufLen)
+{
+    struct mmsghdr msgs[ZNS_MAX_RECV_BATCH];
+    struct iovec iovecs[ZNS_MAX_RECV_BATCH];
+
+    const unsigned int batch = std::min<std::size_t>(bufLen / ZNS_MAX_DATAGRAM_SIZE, ZNS_MAX_RECV_BATCH);
+    if (batch == 0) {
+        return 0;
+    }
+
+    // Each datagram gets its own slot directly in ring memory.
+    for (unsigned int i = 0; i < batch; i++) {
+        iovecs[i].iov_base = buf + (i * ZNS_MAX_DATAGRAM_SIZE);
+        iovecs[i].iov_len = ZNS_MAX_DATAGRAM_SIZE;
+
+        msgs[i].msg_hdr.msg_name = nullptr;
+        msgs[i].msg_hdr.msg_namelen = 0;
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = nullptr;
+        msgs[i].msg_hdr.msg_controllen = 0;
+        msgs[i].msg_hdr.msg_flags = 0;
+    }
+
+    int received = recvmmsg(fd, msgs, batch, MSG_DONTWAIT, nullptr);
+    if (received <= 0) {
+        // NOTE : Might have to handle this error, returning zero for now.
+        return 0;
+    }
+
+    // Reader expects packets back to back, so pull every slot down behind the previous datagram.
+    std::size_t written = msgs[0].msg_len;
+    for (int i = 1; i < received; i++) {
+        ::memmove(buf + written, iovecs[i].iov_base, msgs[i].msg_len);
+        written += msgs[i].msg_len;
+    }
+
+    return written;
+}
+
+std::size_t MulticastSocketSet::socket_to_ringbuf_record_writer(int fd, unsigned char *buf, std::size_t bufLen) const
+{
+    struct mmsghdr msgs[ZNS_MAX_RECV_BATCH];
+    struct iovec iovecs[ZNS_MAX_RECV_BATCH];
+
+    const unsigned int batch = std::min<std::size_t>(bufLen / ZNS_MAX_DATAGRAM_SIZE, ZNS_MAX_RECV_BATCH);
+    if (batch == 0) {
+        return 0;
+    }
+
+    // Kernel receive timestamp of every datagram comes back as SCM_TIMESTAMPNS.
+    alignas(struct cmsghdr) unsigned char controls[ZNS_MAX_RECV_BATCH][ZNS_RECV_CONTROL_SIZE];
+
+    // Leave room for the record header at the start of every slot.
+    for (unsigned int i = 0; i < batch; i++) {
+        iovecs[i].iov_base = buf + (i * ZNS_MAX_DATAGRAM_SIZE) + sizeof(RingRecordHeader);
+        iovecs[i].iov_len = ZNS_MAX_DATAGRAM_SIZE - sizeof(RingRecordHeader);
+
+        msgs[i].msg_hdr.msg_name = nullptr;
+        msgs[i].msg_hdr.msg_namelen = 0;
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = controls[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+        msgs[i].msg_hdr.msg_flags = 0;
+    }
+
+    int received = recvmmsg(fd, msgs, batch, MSG_DONTWAIT, nullptr);
+    if (received <= 0) {
+        // NOTE : Might have to handle this error, returning zero for now.
+        return 0;
+    }
+
+    // Fallback for datagrams that come without a kernel timestamp.
+    const int64_t now_ns = realtime_ns();
+
+    RingRecordHeader hdr;
+    hdr.line = m_socket_sources[fd].m_line;
+    hdr.stream_id = m_socket_sources[fd].m_stream_id;
+    hdr.reserved2 = 0;
+
+    // Pack records back to back, the first one is already in place.
+    std::size_t written = 0;
+    for (int i = 0; i < received; i++) {
+        unsigned char *record = buf + written;
+        const unsigned char *payload = (const unsigned char *)iovecs[i].iov_base;
+
+        hdr.length = msgs[i].msg_len;
+        hdr.recv_timestamp_ns = kernel_timestamp_ns(&msgs[i].msg_hdr);
+        if (hdr.recv_timestamp_ns != 0) {
+            hdr.flags = ZNS_RECORD_KERNEL_TS;
+        } else {
+            hdr.flags = 0;
+            hdr.recv_timestamp_ns = now_ns;
+        }
+
+        if (payload != record + sizeof(RingRecordHeader)) {
+            ::memmove(record + sizeof(RingRecordHeader), payload, msgs[i].msg_len);
+        }
+        ::memcpy(record, &hdr, sizeof(hdr));
+        count_datagram(fd, record + sizeof(RingRecordHeader), msgs[i].msg_len, &msgs[i].msg_hdr);
+
+        written += ring_record_size(msgs[i].msg_len);
+    }
+
+    return written;
+}
 }
@@ -1,37 +1,393 @@
 #ifndef __UDP_READER_H
 #define __UDP_READER_H
 
+#include "feedcounters.hpp"
 #include "ipinfo.hpp"
 #include "ringbuffer.hpp"
+#include "ringrecord.hpp"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <functional>
 #include <map>
+#include <memory>
+#include <stdexcept>
 #include <string_view>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
+// Slot reserved per datagram when receiving in batches, NSE packets are far smaller.
+#define ZNS_MAX_DATAGRAM_SIZE 2048
+#define ZNS_MAX_RECV_BATCH    64
+// Ancillary data room per datagram, holds the SCM_TIMESTAMPNS timespec and SO_RXQ_OVFL count.
+#define ZNS_RECV_CONTROL_SIZE 64
+
+// Older libc headers predate the preferred busy poll options (Linux 5.11).
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+
 namespace znsreader
 {
-class AggregatedPacketReader
+inline constexpr std::size_t ZNS_DEFAULT_RING_SIZE = 1024 * 1024 * 1024;
+
+// blocking sleeps in epoll, spin polls every socket in a loop and never sleeps, hybrid
+// spins for m_spin_us after the last packet and then falls back to epoll.
+enum class ReceiveMode : uint8_t {
+    blocking = 0,
+    spin = 1,
+    hybrid = 2,
+};
+
+struct ReceivePolicy {
+    ReceiveMode m_mode = ReceiveMode::blocking;
+    uint32_t m_spin_us = 50;
+    // SO_BUSY_POLL on every socket, 0 leaves the system default.
+    uint32_t m_busy_poll_us = 0;
+    bool m_prefer_busy_poll = false;
+};
+
+// Primary and secondary sockets for every configured stream, in one epoll set.
+class MulticastSocketSet
 {
   public:
-    AggregatedPacketReader() = delete;
-    AggregatedPacketReader(const std::map<short, single_stream_info> &, bool, RingBuffer::ReaderCallBack);
-    ~AggregatedPacketReader();
-
-    AggregatedPacketReader(const AggregatedPacketReader &) = delete;
-    AggregatedPacketReader &operator=(AggregatedPacketReader const &) = delete;
+    MulticastSocketSet() = delete;
+    explicit MulticastSocketSet(const std::map<short, single_stream_info> &,
+                                const ReceivePolicy &policy = ReceivePolicy());
+    ~MulticastSocketSet();
 
-    void write_packets_to_ringbuf();
-    void read_packets_from_ringbuf();
+    MulticastSocketSet(const MulticastSocketSet &) = delete;
+    MulticastSocketSet &operator=(MulticastSocketSet const &) = delete;
 
     static std::size_t socket_to_ringbuf_writer(int fd, unsigned char *buf, std::size_t bufLen);
+    static std::size_t socket_to_ringbuf_batch_writer(int fd, unsigned char *buf, std::size_t bufLen);
+    std::size_t socket_to_ringbuf_record_writer(int fd, unsigned char *buf, std::size_t bufLen) const;
 
-  private:
-    int create_udp_socket(const std::string_view &ipv4Addr, uint16_t udpPort);
+    struct socket_source {
+        short m_stream_id;
+        FeedLine m_line;
+    };
+
+    const std::vector<int> &sockets() const
+    {
+        return m_sockets;
+    }
+
+    const socket_source &source(int fd) const
+    {
+        return m_socket_sources[fd];
+    }
+
+    // SCM_TIMESTAMPNS of a received message in ns, 0 when the kernel attached none.
+    static int64_t kernel_timestamp_ns(const struct msghdr *msg);
+
+    // Counts a datagram received on fd: packets, bytes, SO_RXQ_OVFL drops from msg, and the
+    // seqNo of the StreamPacket in payload. Only for the thread receiving on fd.
+    void count_datagram(int fd, const unsigned char *payload, std::size_t len, const struct msghdr *msg) const;
+
+    const SocketCounters &socket_counters(int fd) const
+    {
+        return m_socket_counters[fd];
+    }
+
+  protected:
+    int create_udp_socket(const std::string_view &ipv4Addr, uint16_t udpPort, const ReceivePolicy &policy);
 
     int m_epollfd;
     std::vector<int> m_sockets;
-    RingBuffer m_spsc_buffer;
+    // Indexed by socket fd.
+    std::vector<socket_source> m_socket_sources;
+    std::unique_ptr<SocketCounters[]> m_socket_counters;
+};
+
+// Writer policies for BasicAggregatedPacketReader, push_size is the space reserved per push.
+// A policy with wait_completions() is completion based: it ignores the fd, drains whatever
+// has completed, and replaces epoll as the place the writer thread sleeps.
+template <typename Writer>
+concept CompletionWriter = requires(Writer &writer) { writer.wait_completions(0); };
+
+struct SingleRecvWriter {
+    static constexpr std::size_t push_size = 131072;
+
+    std::size_t operator()(int fd, unsigned char *buf, std::size_t bufLen) const
+    {
+        return MulticastSocketSet::socket_to_ringbuf_writer(fd, buf, bufLen);
+    }
+};
+
+template <std::size_t Batch>
+struct BatchRecvWriter {
+    static_assert(Batch > 1 && Batch <= ZNS_MAX_RECV_BATCH, "Batch must be within 2..ZNS_MAX_RECV_BATCH");
+    static constexpr std::size_t push_size = Batch * ZNS_MAX_DATAGRAM_SIZE;
+
+    std::size_t operator()(int fd, unsigned char *buf, std::size_t bufLen) const
+    {
+        return MulticastSocketSet::socket_to_ringbuf_batch_writer(fd, buf, bufLen);
+    }
+};
+
+template <std::size_t Batch>
+class RecordRecvWriter
+{
+    static_assert(Batch > 0 && Batch <= ZNS_MAX_RECV_BATCH, "Batch must be within 1..ZNS_MAX_RECV_BATCH");
+
+  public:
+    static constexpr std::size_t push_size = Batch * ZNS_MAX_DATAGRAM_SIZE;
+
+    explicit RecordRecvWriter(const MulticastSocketSet &sockets) : m_sockets(&sockets)
+    {
+    }
+
+    std::size_t operator()(int fd, unsigned char *buf, std::size_t bufLen) const
+    {
+        return m_sockets->socket_to_ringbuf_record_writer(fd, buf, bufLen);
+    }
+
+  private:
+    const MulticastSocketSet *m_sockets;
+};
+
+// Socket -> ring -> reader chain with every callback resolved at compile time. Ring is
+// BasicRingBuffer, or BroadcastRingBuffer with Reader its consumer list.
+template <typename Writer, typename Reader, std::size_t Capacity = ZNS_DYNAMIC_CAPACITY,
+          template <typename, typename, std::size_t> class Ring = BasicRingBuffer>
+class BasicAggregatedPacketReader : public MulticastSocketSet
+{
+  public:
+    using ring_type = Ring<Writer, Reader, Capacity>;
+
+    BasicAggregatedPacketReader() = delete;
+    // Writer policy is built here, from the socket set when it takes one.
+    BasicAggregatedPacketReader(const std::map<short, single_stream_info> &ip_port_config, bool use_huge_pages,
+                                Reader reader_fn, std::size_t ring_size = ZNS_DEFAULT_RING_SIZE,
+                                const ReceivePolicy &policy = ReceivePolicy())
+        : MulticastSocketSet(ip_port_config, policy),
+          m_running(true),
+          m_policy(policy),
+          m_push_size(Writer::push_size),
+          m_spsc_buffer(ring_size, use_huge_pages, make_writer(use_huge_pages), std::move(reader_fn))
+    {
+        m_ring_counters.capacity.store(m_spsc_buffer.capacity(), std::memory_order_relaxed);
+    }
+
+    BasicAggregatedPacketReader(const std::map<short, single_stream_info> &ip_port_config, bool use_huge_pages,
+                                Writer writer_fn, Reader reader_fn, std::size_t push_size,
+                                const ReceivePolicy &policy = ReceivePolicy())
+        : MulticastSocketSet(ip_port_config, policy),
+          m_running(true),
+          m_policy(policy),
+          m_push_size(push_size),
+          m_spsc_buffer(ZNS_DEFAULT_RING_SIZE, use_huge_pages, std::move(writer_fn), std::move(reader_fn))
+    {
+        m_ring_counters.capacity.store(m_spsc_buffer.capacity(), std::memory_order_relaxed);
+    }
+
+    // For writer policies that need more than the socket set, e.g. a wrapped policy with
+    // state of its own: make_writer_fn builds the policy from the socket set.
+    template <typename MakeWriter>
+    requires std::is_invocable_r_v<Writer, MakeWriter, const MulticastSocketSet &>
+    BasicAggregatedPacketReader(const std::map<short, single_stream_info> &ip_port_config, bool use_huge_pages,
+                                MakeWriter make_writer_fn, Reader reader_fn,
+                                std::size_t ring_size = ZNS_DEFAULT_RING_SIZE,
+                                const ReceivePolicy &policy = ReceivePolicy())
+        : MulticastSocketSet(ip_port_config, policy),
+          m_running(true),
+          m_policy(policy),
+          m_push_size(Writer::push_size),
+          m_spsc_buffer(ring_size, use_huge_pages, make_writer_fn(static_cast<const MulticastSocketSet &>(*this)),
+                        std::move(reader_fn))
+    {
+        m_ring_counters.capacity.store(m_spsc_buffer.capacity(), std::memory_order_relaxed);
+    }
+
+    void write_packets_to_ringbuf()
+    {
+        switch (m_policy.m_mode) {
+        case ReceiveMode::spin:
+            while (m_running.load(std::memory_order_relaxed)) {
+                poll_input();
+            }
+            break;
+
+        case ReceiveMode::hybrid: {
+            const auto spin_for = std::chrono::microseconds(m_policy.m_spin_us);
+            auto last_packet = std::chrono::steady_clock::now();
+
+            while (m_running.load(std::memory_order_relaxed)) {
+                if (poll_input()) {
+                    last_packet = std::chrono::steady_clock::now();
+                } else if ((std::chrono::steady_clock::now() - last_packet) > spin_for) {
+                    wait_input();
+                    last_packet = std::chrono::steady_clock::now();
+                }
+            }
+            break;
+        }
+
+        case ReceiveMode::blocking:
+        default:
+            while (m_running.load(std::memory_order_relaxed)) {
+                wait_input();
+            }
+            break;
+        }
+    }
+
+    void read_packets_from_ringbuf()
+    {
+        while (m_running.load(std::memory_order_relaxed)) {
+            while (drain_ringbuf() != 0) {
+                std::this_thread::sleep_for(std::chrono::microseconds(1));
+            }
+        }
+    }
+
+    // One pop_all on the ring, for consumers that run their own loop.
+    std::size_t drain_ringbuf()
+    {
+        return m_spsc_buffer.pop_all();
+    }
+
+    // Both loops return shortly after this.
+    void stop()
+    {
+        m_running.store(false, std::memory_order_relaxed);
+    }
+
+    // Written by the receive thread, readable from any.
+    const RingCounters &ring_counters() const
+    {
+        return m_ring_counters;
+    }
+
+    // For consumers that drain the ring themselves, e.g. one thread per broadcast cursor.
+    ring_type &ring()
+    {
+        return m_spsc_buffer;
+    }
+
+    const ring_type &ring() const
+    {
+        return m_spsc_buffer;
+    }
+
+  private:
+    // True if anything arrived, never sleeps.
+    bool poll_input()
+    {
+        if constexpr (CompletionWriter<Writer>) {
+            const std::size_t before = m_spsc_buffer.write_position();
+            push_socket(-1);
+            return m_spsc_buffer.write_position() != before;
+        } else {
+            return poll_sockets();
+        }
+    }
+
+    // Sleeps until something arrives or the stop check timeout passes.
+    void wait_input()
+    {
+        if constexpr (CompletionWriter<Writer>) {
+            if (!poll_input()) {
+                m_spsc_buffer.writer().wait_completions(100);
+                poll_input();
+            }
+        } else {
+            wait_and_push();
+        }
+    }
+
+    // One epoll wait, then every ready socket into the ring. Returns the ready count.
+    int wait_and_push()
+    {
+        struct epoll_event eventList[1024];
+
+        // Only bounds how long an idle writer takes to notice stop().
+        struct timespec stopCheckTimeout;
+        stopCheckTimeout.tv_nsec = 100000000;
+        stopCheckTimeout.tv_sec = 0;
+
+        int activeFds = epoll_pwait2(m_epollfd, eventList, 1024, &stopCheckTimeout, nullptr);
+        if (activeFds < 0) {
+            if (errno == EINTR) {
+                return 0;
+            }
+            perror("epoll_wait error:");
+            throw std::runtime_error("epoll_wait error");
+        }
+
+        for (int i = 0; i < activeFds; i++) {
+            push_socket(eventList[i].data.fd);
+        }
+
+        return activeFds;
+    }
+
+    // Non-blocking read of every socket without asking epoll, true if anything arrived.
+    bool poll_sockets()
+    {
+        const std::size_t before = m_spsc_buffer.write_position();
+
+        for (int fd : m_sockets) {
+            push_socket(fd);
+        }
+
+        return m_spsc_buffer.write_position() != before;
+    }
+
+    void push_socket(int fd)
+    {
+        if (m_spsc_buffer.push(fd, m_push_size) == 0) [[unlikely]] {
+            uint64_t spins = 1;
+            while (m_spsc_buffer.push(fd, m_push_size) == 0 && m_running.load(std::memory_order_relaxed)) {
+                spins++;
+            }
+            counter_add(m_ring_counters.full_stalls, 1);
+            counter_add(m_ring_counters.stall_spins, spins);
+        }
+
+        if constexpr (requires { m_spsc_buffer.occupancy(); }) {
+            const std::size_t used = m_spsc_buffer.occupancy();
+            m_ring_counters.used.store(used, std::memory_order_relaxed);
+            counter_max(m_ring_counters.high_watermark, used);
+        }
+    }
+
+    Writer make_writer(bool use_huge_pages) const
+    {
+        if constexpr (std::is_constructible_v<Writer, const MulticastSocketSet &, bool>) {
+            return Writer(static_cast<const MulticastSocketSet &>(*this), use_huge_pages);
+        } else if constexpr (std::is_constructible_v<Writer, const MulticastSocketSet &>) {
+            return Writer(static_cast<const MulticastSocketSet &>(*this));
+        } else {
+            return Writer();
+        }
+    }
+
+    std::atomic<bool> m_running;
+    ReceivePolicy m_policy;
+    std::size_t m_push_size;
+    ring_type m_spsc_buffer;
+    RingCounters m_ring_counters;
+};
+
+// Type-erased reader, receive mode and callback picked at runtime.
+class AggregatedPacketReader
+    : public BasicAggregatedPacketReader<RingBuffer::WriterCallBack, RingBuffer::ReaderCallBack>
+{
+  public:
+    using RecordReaderCallBack = std::function<::size_t(RingRecordRange records)>;
+    AggregatedPacketReader() = delete;
+    AggregatedPacketReader(const std::map<short, single_stream_info> &, bool, RingBuffer::ReaderCallBack,
+                           std::size_t recv_batch_size = 1);
+    // Record mode, every datagram is framed with a RingRecordHeader in the ring.
+    AggregatedPacketReader(const std::map<short, single_stream_info> &, bool, RecordReaderCallBack,
+                           std::size_t recv_batch_size = 1);
 };
 }
 
@@ -0,0 +1,461 @@
+#include "uringrecv.hpp"
+#include "ringrecord.hpp"
+#include "timeutil.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace znsreader
+{
+namespace
+{
+int io_uring_setup(unsigned int entries, struct io_uring_params *params)
+{
+    return (int)::syscall(__NR_io_uring_setup, entries, params);
+}
+
+int io_uring_enter(int ring_fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags, void *arg,
+                   std::size_t arg_size)
+{
+    return (int)::syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+int io_uring_register(int ring_fd, unsigned int opcode, void *arg, unsigned int nr_args)
+{
+    return (int)::syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+}
+
+static_assert((ZNS_URING_BUFFER_COUNT & (ZNS_URING_BUFFER_COUNT - 1)) == 0, "buffer count must be a power of two");
+static_assert(sizeof(struct io_uring_recvmsg_out) + ZNS_RECV_CONTROL_SIZE + ZNS_MAX_DATAGRAM_SIZE
+                  <= ZNS_URING_BUFFER_SIZE,
+              "ZNS_URING_BUFFER_SIZE too small");
+
+UringReceiver::UringReceiver(const MulticastSocketSet &sockets, bool use_huge_pages)
+    : m_sockets(&sockets),
+      m_ring_fd(-1),
+      m_ring_mapping(MAP_FAILED),
+      m_sqes((struct io_uring_sqe *)MAP_FAILED),
+      m_to_submit(0),
+      m_buf_ring((struct io_uring_buf_ring *)MAP_FAILED),
+      m_buf_tail(0),
+      m_use_buf_ring(false),
+      m_recycle_first(0),
+      m_recycle_count(0),
+      m_buffers((std::size_t)ZNS_URING_BUFFER_COUNT * ZNS_URING_BUFFER_SIZE, use_huge_pages)
+{
+    struct io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    // Room for a completion from every buffer at once, plus one per PROVIDE_BUFFERS request.
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = ZNS_URING_BUFFER_COUNT * 4;
+
+    m_ring_fd = io_uring_setup(ZNS_URING_SQ_ENTRIES, &params);
+    if (m_ring_fd < 0) {
+        perror("io_uring_setup error:");
+        throw std::runtime_error("Failed to set up io_uring");
+    }
+
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+        ::close(m_ring_fd);
+        throw std::runtime_error("io_uring is too old, needs single mmap and extended wait arguments");
+    }
+
+    // Submission and completion rings share one mapping.
+    m_ring_mapping_len = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned int),
+                                params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+    m_ring_mapping = ::mmap(nullptr, m_ring_mapping_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            m_ring_fd, IORING_OFF_SQ_RING);
+
+    m_sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    m_sqes = (struct io_uring_sqe *)::mmap(nullptr, m_sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                           m_ring_fd, IORING_OFF_SQES);
+
+    if (m_ring_mapping == MAP_FAILED || m_sqes == MAP_FAILED) {
+        perror("io_uring mmap error:");
+        release();
+        throw std::runtime_error("Failed to map io_uring");
+    }
+
+    unsigned char *sq = (unsigned char *)m_ring_mapping;
+    m_sq_head = (unsigned int *)(sq + params.sq_off.head);
+    m_sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+    m_sq_array = (unsigned int *)(sq + params.sq_off.array);
+    m_sq_mask = *(unsigned int *)(sq + params.sq_off.ring_mask);
+    m_sq_entries = *(unsigned int *)(sq + params.sq_off.ring_entries);
+
+    unsigned char *cq = (unsigned char *)m_ring_mapping;
+    m_cq_head = (unsigned int *)(cq + params.cq_off.head);
+    m_cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+    m_cq_mask = *(unsigned int *)(cq + params.cq_off.ring_mask);
+    m_cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // Registered buffer ring where the kernel takes it, PROVIDE_BUFFERS everywhere else.
+    m_use_buf_ring = setup_buffer_ring();
+    if (!m_use_buf_ring) {
+        provide_buffers(0, ZNS_URING_BUFFER_COUNT);
+    }
+
+    // Multishot recvmsg takes the name and control lengths from here, no name is wanted.
+    std::memset(&m_msg_template, 0, sizeof(m_msg_template));
+    m_msg_template.msg_controllen = ZNS_RECV_CONTROL_SIZE;
+
+    // Only queued here, the first drain or wait submits them. Retries of a request run as
+    // task work of the thread that submitted it, which has to be the receive thread.
+    for (int fd : m_sockets->sockets()) {
+        arm(fd);
+    }
+
+    std::cout << "io_uring receive on " << m_sockets->sockets().size() << " sockets, "
+              << (m_use_buf_ring ? "registered buffer ring" : "provided buffers") << std::endl;
+}
+
+UringReceiver::~UringReceiver()
+{
+    release();
+}
+
+void UringReceiver::release()
+{
+    // Closing the ring cancels every armed receive.
+    if (m_ring_fd >= 0) {
+        ::close(m_ring_fd);
+        m_ring_fd = -1;
+    }
+
+    if (m_buf_ring != MAP_FAILED) {
+        ::munmap(m_buf_ring, m_buf_ring_len);
+        m_buf_ring = (struct io_uring_buf_ring *)MAP_FAILED;
+    }
+
+    if (m_sqes != MAP_FAILED) {
+        ::munmap(m_sqes, m_sqes_len);
+        m_sqes = (struct io_uring_sqe *)MAP_FAILED;
+    }
+
+    if (m_ring_mapping != MAP_FAILED) {
+        ::munmap(m_ring_mapping, m_ring_mapping_len);
+        m_ring_mapping = MAP_FAILED;
+    }
+}
+
+bool UringReceiver::setup_buffer_ring()
+{
+    // The kernel takes buffers from the head of this ring and we refill the tail.
+    m_buf_ring_len = ZNS_URING_BUFFER_COUNT * sizeof(struct io_uring_buf);
+    m_buf_ring = (struct io_uring_buf_ring *)::mmap(nullptr, m_buf_ring_len, PROT_READ | PROT_WRITE,
+                                                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (m_buf_ring == MAP_FAILED) {
+        perror("mmap error:");
+        return false;
+    }
+
+    struct io_uring_buf_reg reg;
+    std::memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)m_buf_ring;
+    reg.ring_entries = ZNS_URING_BUFFER_COUNT;
+    reg.bgid = ZNS_URING_BUFFER_GROUP;
+
+    // Older than 5.19, no buffer rings at all.
+    if (io_uring_register(m_ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        ::munmap(m_buf_ring, m_buf_ring_len);
+        m_buf_ring = (struct io_uring_buf_ring *)MAP_FAILED;
+        return false;
+    }
+
+    m_use_buf_ring = true;
+    for (uint16_t bid = 0; bid < ZNS_URING_BUFFER_COUNT; bid++) {
+        recycle(bid);
+    }
+    __atomic_store_n(&m_buf_ring->tail, m_buf_tail, __ATOMIC_RELEASE);
+
+    if (buffer_ring_works()) {
+        return true;
+    }
+
+    // Some kernels accept the registration and then never hand a buffer out.
+    io_uring_register(m_ring_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    ::munmap(m_buf_ring, m_buf_ring_len);
+    m_buf_ring = (struct io_uring_buf_ring *)MAP_FAILED;
+    m_use_buf_ring = false;
+    return false;
+}
+
+bool UringReceiver::buffer_ring_works()
+{
+    // One byte read through the ring from a pipe, before any socket is armed.
+    int pipe_fds[2];
+    if (::pipe2(pipe_fds, O_CLOEXEC) < 0) {
+        return false;
+    }
+
+    const char probe = 0;
+    bool works = false;
+
+    if (::write(pipe_fds[1], &probe, sizeof(probe)) == sizeof(probe)) {
+        struct io_uring_sqe *sqe = next_sqe();
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = pipe_fds[0];
+        sqe->len = sizeof(probe);
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = ZNS_URING_BUFFER_GROUP;
+        sqe->user_data = ZNS_URING_BUFFER_OP_TAG;
+        queue_sqe();
+
+        if (enter(m_to_submit, 1, 1000) >= 0) {
+            unsigned int head = *m_cq_head;
+            const unsigned int tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+
+            for (; head != tail; head++) {
+                const struct io_uring_cqe *cqe = &m_cqes[head & m_cq_mask];
+                if (cqe->flags & IORING_CQE_F_BUFFER) {
+                    recycle(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+                    __atomic_store_n(&m_buf_ring->tail, m_buf_tail, __ATOMIC_RELEASE);
+                }
+                works = works || (cqe->res == sizeof(probe));
+            }
+
+            __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+        }
+    }
+
+    ::close(pipe_fds[0]);
+    ::close(pipe_fds[1]);
+    return works;
+}
+
+struct io_uring_sqe *UringReceiver::next_sqe()
+{
+    const unsigned int tail = *m_sq_tail;
+    while ((tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE)) == m_sq_entries) {
+        if (enter(m_to_submit, 0, 0) < 0) {
+            perror("io_uring_enter error:");
+            throw std::runtime_error("io_uring submit error");
+        }
+    }
+
+    const unsigned int index = tail & m_sq_mask;
+    struct io_uring_sqe *sqe = &m_sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    m_sq_array[index] = index;
+    return sqe;
+}
+
+void UringReceiver::queue_sqe()
+{
+    __atomic_store_n(m_sq_tail, *m_sq_tail + 1, __ATOMIC_RELEASE);
+    m_to_submit++;
+}
+
+void UringReceiver::arm(int fd)
+{
+    struct io_uring_sqe *sqe = next_sqe();
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)&m_msg_template;
+    sqe->len = 1;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = ZNS_URING_BUFFER_GROUP;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = fd;
+    queue_sqe();
+}
+
+void UringReceiver::provide_buffers(uint16_t first_bid, uint16_t count)
+{
+    struct io_uring_sqe *sqe = next_sqe();
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = count;
+    sqe->addr = (uint64_t)(uintptr_t)(m_buffers.data() + ((std::size_t)first_bid * ZNS_URING_BUFFER_SIZE));
+    sqe->len = ZNS_URING_BUFFER_SIZE;
+    sqe->off = first_bid;
+    sqe->buf_group = ZNS_URING_BUFFER_GROUP;
+    sqe->user_data = ZNS_URING_BUFFER_OP_TAG;
+    queue_sqe();
+}
+
+int UringReceiver::enter(unsigned int to_submit, unsigned int min_complete, int timeout_ms)
+{
+    unsigned int flags = 0;
+    struct __kernel_timespec timeout;
+    struct io_uring_getevents_arg arg;
+    std::memset(&arg, 0, sizeof(arg));
+
+    if (min_complete != 0) {
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = (uint64_t)(uintptr_t)&timeout;
+        flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    }
+
+    int ret = io_uring_enter(m_ring_fd, to_submit, min_complete, flags, (flags != 0) ? &arg : nullptr,
+                             (flags != 0) ? sizeof(arg) : 0);
+    if (ret >= 0) {
+        m_to_submit -= std::min<unsigned int>(m_to_submit, ret);
+        return ret;
+    }
+
+    // Timeouts and signals only end the wait early.
+    if (errno == ETIME || errno == EINTR || errno == EBUSY) {
+        return 0;
+    }
+
+    return -1;
+}
+
+void UringReceiver::recycle(uint16_t bid)
+{
+    if (!m_use_buf_ring) {
+        // Consecutive ids go back in one request.
+        if (m_recycle_count != 0 && bid == (uint16_t)(m_recycle_first + m_recycle_count)) {
+            m_recycle_count++;
+        } else {
+            flush_recycled();
+            m_recycle_first = bid;
+            m_recycle_count = 1;
+        }
+        return;
+    }
+
+    struct io_uring_buf *slot = &m_buf_ring->bufs[m_buf_tail & (ZNS_URING_BUFFER_COUNT - 1)];
+    slot->addr = (uint64_t)(uintptr_t)(m_buffers.data() + ((std::size_t)bid * ZNS_URING_BUFFER_SIZE));
+    slot->len = ZNS_URING_BUFFER_SIZE;
+    slot->bid = bid;
+    m_buf_tail++;
+}
+
+void UringReceiver::flush_recycled()
+{
+    if (m_recycle_count != 0) {
+        provide_buffers(m_recycle_first, m_recycle_count);
+        m_recycle_count = 0;
+    }
+}
+
+void UringReceiver::wait_completions(int timeout_ms)
+{
+    if (*m_cq_head != __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    if (enter(m_to_submit, 1, timeout_ms) < 0) {
+        perror("io_uring_enter error:");
+        throw std::runtime_error("io_uring wait error");
+    }
+}
+
+std::size_t UringReceiver::completions_to_ringbuf(unsigned char *buf, std::size_t bufLen)
+{
+    unsigned int head = *m_cq_head;
+    const unsigned int tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+    const std::size_t payload_offset =
+        sizeof(struct io_uring_recvmsg_out) + m_msg_template.msg_namelen + m_msg_template.msg_controllen;
+
+    if (head == tail) {
+        if (m_to_submit != 0 && enter(m_to_submit, 0, 0) < 0) {
+            perror("io_uring_enter error:");
+            throw std::runtime_error("io_uring submit error");
+        }
+        return 0;
+    }
+
+    // Fallback for datagrams that come without a kernel timestamp.
+    const int64_t now_ns = realtime_ns();
+
+    std::size_t written = 0;
+    const uint16_t buf_tail_before = m_buf_tail;
+
+    for (; head != tail; head++) {
+        // Everything before this one is consumed, so a full SQ can be flushed mid drain.
+        __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+        const struct io_uring_cqe *cqe = &m_cqes[head & m_cq_mask];
+
+        if (cqe->user_data == ZNS_URING_BUFFER_OP_TAG) {
+            // Under sustained overload the kernel's per group buffer count can report the
+            // list as full (EOVERFLOW) while it still hands every buffer out, so only other
+            // failures are worth a message.
+            if (cqe->res < 0 && cqe->res != -EOVERFLOW) {
+                errno = -cqe->res;
+                perror("io_uring provide buffers error:");
+            }
+            continue;
+        }
+
+        const int fd = (int)cqe->user_data;
+
+        // A failed receive has its buffer put back by the kernel.
+        if ((cqe->flags & IORING_CQE_F_BUFFER) && cqe->res > 0) {
+            const uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            unsigned char *slot = m_buffers.data() + ((std::size_t)bid * ZNS_URING_BUFFER_SIZE);
+            const struct io_uring_recvmsg_out *out = (const struct io_uring_recvmsg_out *)slot;
+            const std::size_t payload_len =
+                std::min<std::size_t>(out->payloadlen, ZNS_URING_BUFFER_SIZE - payload_offset);
+
+            if (written + ring_record_size(payload_len) > bufLen) {
+                break;
+            }
+
+            struct msghdr control;
+            std::memset(&control, 0, sizeof(control));
+            control.msg_control = slot + sizeof(struct io_uring_recvmsg_out) + m_msg_template.msg_namelen;
+            control.msg_controllen = out->controllen;
+
+            const MulticastSocketSet::socket_source &source = m_sockets->source(fd);
+            RingRecordHeader hdr;
+            hdr.length = payload_len;
+            hdr.line = source.m_line;
+            hdr.stream_id = source.m_stream_id;
+            hdr.reserved2 = 0;
+            hdr.recv_timestamp_ns = MulticastSocketSet::kernel_timestamp_ns(&control);
+            if (hdr.recv_timestamp_ns != 0) {
+                hdr.flags = ZNS_RECORD_KERNEL_TS;
+            } else {
+                hdr.flags = 0;
+                hdr.recv_timestamp_ns = now_ns;
+            }
+
+            ::memcpy(buf + written, &hdr, sizeof(hdr));
+            ::memcpy(buf + written + sizeof(hdr), slot + payload_offset, payload_len);
+            m_sockets->count_datagram(fd, buf + written + sizeof(hdr), payload_len, &control);
+            written += ring_record_size(payload_len);
+            recycle(bid);
+        }
+
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            // The kernel ended this multishot, ENOBUFS just means we fell behind.
+            if (cqe->res >= 0 || cqe->res == -ENOBUFS) {
+                // Recycled buffers are queued ahead of the new receive.
+                flush_recycled();
+                arm(fd);
+            } else {
+                errno = -cqe->res;
+                perror("io_uring recvmsg error:");
+            }
+        }
+    }
+
+    __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+    flush_recycled();
+
+    if (m_buf_tail != buf_tail_before) {
+        __atomic_store_n(&m_buf_ring->tail, m_buf_tail, __ATOMIC_RELEASE);
+    }
+
+    // Buffers are back before a re-armed receive can ask for one.
+    if (m_to_submit != 0) {
+        enter(m_to_submit, 0, 0);
+    }
+
+    return written;
+}
+}
@@ -0,0 +1,122 @@
+#ifndef __ZNS_URING_RECV_H
+#define __ZNS_URING_RECV_H
+
+#include "ringbuffer.hpp"
+#include "udpreader.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+#include <memory>
+#include <sys/socket.h>
+
+// Provided buffers the kernel picks from, each holds one datagram plus the recvmsg header
+// and control data io_uring puts in front of it.
+#define ZNS_URING_BUFFER_COUNT 4096
+#define ZNS_URING_BUFFER_SIZE  (ZNS_MAX_DATAGRAM_SIZE + 128)
+#define ZNS_URING_SQ_ENTRIES   256
+#define ZNS_URING_BUFFER_GROUP 0
+// user_data of our own buffer bookkeeping requests, receive completions carry the fd.
+#define ZNS_URING_BUFFER_OP_TAG (~(uint64_t)0)
+
+namespace znsreader
+{
+// io_uring with one multishot recvmsg armed per socket of a MulticastSocketSet, feeding a
+// provided buffer ring. Armed once, every datagram then completes on its own without a
+// syscall; the only syscalls left are the wait when idle and re-arming a socket whose
+// multishot was ended by the kernel (e.g. the buffers ran out). Where a registered buffer
+// ring cannot be used, buffers go back with IORING_OP_PROVIDE_BUFFERS instead, batched
+// into the submission that follows each drain.
+//
+// This path costs one copy per datagram. The kernel fills fixed size slots of m_buffers,
+// its own pool of ZNS_URING_BUFFER_COUNT slots, with the recvmsg header and control data in
+// front of the payload, and slots come back in any order. The packet ring needs records
+// back to back, so each payload is copied out of its slot behind a RingRecordHeader and the
+// slot recycled. What it saves is the receive syscalls, not the copy.
+class UringReceiver
+{
+  public:
+    UringReceiver() = delete;
+    UringReceiver(const MulticastSocketSet &sockets, bool use_huge_pages);
+    ~UringReceiver();
+
+    UringReceiver(const UringReceiver &) = delete;
+    UringReceiver &operator=(UringReceiver const &) = delete;
+
+    // Frames completed datagrams as ring records into buf, like the record writer. Stops at
+    // the first one that does not fit, it stays queued for the next call.
+    std::size_t completions_to_ringbuf(unsigned char *buf, std::size_t bufLen);
+    // Sleeps until at least one completion is queued or timeout_ms passes.
+    void wait_completions(int timeout_ms);
+
+  private:
+    void release();
+    bool setup_buffer_ring();
+    bool buffer_ring_works();
+    struct io_uring_sqe *next_sqe();
+    void queue_sqe();
+    void arm(int fd);
+    int enter(unsigned int to_submit, unsigned int min_complete, int timeout_ms);
+    void recycle(uint16_t bid);
+    void flush_recycled();
+    void provide_buffers(uint16_t first_bid, uint16_t count);
+
+    const MulticastSocketSet *m_sockets;
+    int m_ring_fd;
+    struct msghdr m_msg_template;
+
+    // Submission and completion rings, both in one mapping.
+    void *m_ring_mapping;
+    std::size_t m_ring_mapping_len;
+    struct io_uring_sqe *m_sqes;
+    std::size_t m_sqes_len;
+
+    unsigned int *m_sq_head;
+    unsigned int *m_sq_tail;
+    unsigned int *m_sq_array;
+    unsigned int m_sq_mask;
+    unsigned int m_sq_entries;
+    unsigned int m_to_submit;
+
+    unsigned int *m_cq_head;
+    unsigned int *m_cq_tail;
+    unsigned int m_cq_mask;
+    struct io_uring_cqe *m_cqes;
+
+    struct io_uring_buf_ring *m_buf_ring;
+    std::size_t m_buf_ring_len;
+    uint16_t m_buf_tail;
+    bool m_use_buf_ring;
+    // Run of buffers waiting for a PROVIDE_BUFFERS request when the ring is not used.
+    uint16_t m_recycle_first;
+    uint16_t m_recycle_count;
+    MirroredMapping m_buffers;
+};
+
+// Writer policy putting UringReceiver behind BasicAggregatedPacketReader, so it runs under
+// BasicSubscriptionManager like the epoll writers. The fd passed by push() is ignored.
+class UringRecvWriter
+{
+  public:
+    static constexpr std::size_t push_size = ZNS_MAX_RECV_BATCH * ZNS_MAX_DATAGRAM_SIZE;
+
+    UringRecvWriter(const MulticastSocketSet &sockets, bool use_huge_pages)
+        : m_receiver(std::make_unique<UringReceiver>(sockets, use_huge_pages))
+    {
+    }
+
+    std::size_t operator()(int, unsigned char *buf, std::size_t bufLen)
+    {
+        return m_receiver->completions_to_ringbuf(buf, bufLen);
+    }
+
+    void wait_completions(int timeout_ms)
+    {
+        m_receiver->wait_completions(timeout_ms);
+    }
+
+  private:
+    std::unique_ptr<UringReceiver> m_receiver;
+};
+}
+
+#endif
@@ -0,0 +1,204 @@
+// Compares two runs of the bench suite, the JSON lines the benches print, and flags every
+// metric that moved past the threshold the wrong way. A line is matched by its bench, its
+// string fields and how many such lines came before it, so the same binaries with the same
+// arguments line up run to run. Metrics are the numeric fields named as timings (_ns,
+// ns_per_, _sec) where lower is better, and rates (_per_sec) where higher is better; counts
+// and parameters are left alone. Prints one JSON line per metric and exits 1 on a regression.
+//   bench_compare <baseline.jsonl> <current.jsonl> [threshold_pct]
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace
+{
+struct BenchLine {
+    std::string key;
+    std::vector<std::pair<std::string, double>> numbers;
+};
+
+// Flat objects as znsbench::BenchResult writes them, false for anything else.
+bool parse_line(const std::string &text, std::vector<std::pair<std::string, std::string>> &strings,
+                std::vector<std::pair<std::string, double>> &numbers)
+{
+    std::size_t pos = text.find_first_not_of(" \t");
+    if (pos == std::string::npos || text[pos] != '{') {
+        return false;
+    }
+    pos++;
+
+    auto read_string = [&text, &pos](std::string &out) {
+        pos = text.find('"', pos);
+        const std::size_t end = (pos == std::string::npos) ? pos : text.find('"', pos + 1);
+        if (end == std::string::npos) {
+            return false;
+        }
+        out = text.substr(pos + 1, end - pos - 1);
+        pos = end + 1;
+        return true;
+    };
+
+    while (true) {
+        std::string key;
+        if (!read_string(key)) {
+            return false;
+        }
+        pos = text.find(':', pos);
+        if (pos == std::string::npos) {
+            return false;
+        }
+        pos = text.find_first_not_of(" \t", pos + 1);
+        if (pos == std::string::npos) {
+            return false;
+        }
+
+        if (text[pos] == '"') {
+            std::string value;
+            if (!read_string(value)) {
+                return false;
+            }
+            strings.emplace_back(std::move(key), std::move(value));
+        } else {
+            char *end = nullptr;
+            const double value = std::strtod(text.c_str() + pos, &end);
+            if (end == text.c_str() + pos) {
+                return false;
+            }
+            numbers.emplace_back(std::move(key), value);
+            pos = end - text.c_str();
+        }
+
+        pos = text.find_first_not_of(" \t", pos);
+        if (pos == std::string::npos) {
+            return false;
+        }
+        if (text[pos] == '}') {
+            return true;
+        }
+        if (text[pos] != ',') {
+            return false;
+        }
+        pos++;
+    }
+}
+
+// Lines in file order, keyed so that repeated cases get their ordinal appended.
+std::vector<BenchLine> load_run(const char *path)
+{
+    std::ifstream file(path);
+    if (!file) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        std::exit(2);
+    }
+
+    std::vector<BenchLine> lines;
+    std::map<std::string, int> seen;
+    std::string text;
+
+    while (std::getline(file, text)) {
+        std::vector<std::pair<std::string, std::string>> strings;
+        std::vector<std::pair<std::string, double>> numbers;
+        if (!parse_line(text, strings, numbers)) {
+            continue;
+        }
+
+        std::string key;
+        for (const auto &[name, value] : strings) {
+            key += (key.empty() ? "" : " ") + name + "=" + value;
+        }
+        key += " #" + std::to_string(seen[key]++);
+        lines.push_back({ std::move(key), std::move(numbers) });
+    }
+
+    return lines;
+}
+
+bool ends_with(std::string_view name, std::string_view suffix)
+{
+    return name.size() >= suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// +1 when higher is better, -1 when lower is, 0 when the field is not a metric.
+int metric_direction(std::string_view name)
+{
+    if (ends_with(name, "_per_sec")) {
+        return 1;
+    }
+    if (ends_with(name, "_ns") || name.starts_with("ns_per_") || name == "sec" || ends_with(name, "_sec")) {
+        return -1;
+    }
+    return 0;
+}
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <baseline.jsonl> <current.jsonl> [threshold_pct]\n", argv[0]);
+        return 2;
+    }
+
+    const double threshold = (argc > 3) ? std::atof(argv[3]) : 10.0;
+    const std::vector<BenchLine> baseline = load_run(argv[1]);
+    const std::vector<BenchLine> current = load_run(argv[2]);
+
+    std::map<std::string, const BenchLine *> baseline_by_key;
+    for (const BenchLine &line : baseline) {
+        baseline_by_key[line.key] = &line;
+    }
+
+    std::size_t compared = 0;
+    std::size_t regressions = 0;
+    std::size_t improvements = 0;
+    std::size_t unmatched = 0;
+
+    for (const BenchLine &line : current) {
+        auto it = baseline_by_key.find(line.key);
+        if (it == baseline_by_key.end()) {
+            printf("{\"key\": \"%s\", \"verdict\": \"new\"}\n", line.key.c_str());
+            unmatched++;
+            continue;
+        }
+
+        std::map<std::string, double> before(it->second->numbers.begin(), it->second->numbers.end());
+        baseline_by_key.erase(it);
+
+        for (const auto &[name, value] : line.numbers) {
+            const int direction = metric_direction(name);
+            auto previous = before.find(name);
+            if (direction == 0 || previous == before.end() || previous->second == 0) {
+                continue;
+            }
+
+            const double change_pct = (value - previous->second) * 100.0 / std::fabs(previous->second);
+            const char *verdict = "same";
+            if (change_pct * direction < -threshold) {
+                verdict = "regression";
+                regressions++;
+            } else if (change_pct * direction > threshold) {
+                verdict = "improvement";
+                improvements++;
+            }
+            compared++;
+
+            printf("{\"key\": \"%s\", \"metric\": \"%s\", \"baseline\": %.3f, \"current\": %.3f, "
+                   "\"change_pct\": %.1f, \"verdict\": \"%s\"}\n",
+                   line.key.c_str(), name.c_str(), previous->second, value, change_pct, verdict);
+        }
+    }
+
+    for (const auto &[key, line] : baseline_by_key) {
+        printf("{\"key\": \"%s\", \"verdict\": \"missing\"}\n", key.c_str());
+        unmatched++;
+    }
+
+    fprintf(stderr, "%zu metrics compared at %.1f%%: %zu regressions, %zu improvements, %zu lines unmatched\n",
+            compared, threshold, regressions, improvements, unmatched);
+    return (regressions != 0) ? 1 : 0;
+}
@@ -0,0 +1,16 @@
+// Renders a binary log written by BinaryLogger as text on stdout.
+//   binlog_decode <logs.bin>
+
+#include "binlog.hpp"
+#include <cstdio>
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <logs.bin>\n", argv[0]);
+        return 2;
+    }
+
+    const std::size_t records = znsreader::decode_binary_log(argv[1], stdout);
+    fprintf(stderr, "Decoded %zu records\n", records);
+}
@@ -0,0 +1,26 @@
+// Replays pcap captures to the UDP destinations recorded in them, merged by capture time.
+//   capture_replay <speed> <capture.pcap>...
+// speed 1 keeps the captured pacing, N plays N times faster and 0 sends at the maximum rate.
+
+#include "capturereplay.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <vector>
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <speed> <capture.pcap>...\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<std::filesystem::path> files(argv + 2, argv + argc);
+    znsreader::CaptureReplayServer server(files, std::atof(argv[1]));
+    const znsreader::ReplayStats stats = server.replay();
+
+    printf("Sent %lu packets in %lu batches, skipped %lu\n", stats.packets_sent, stats.batches, stats.packets_skipped);
+    printf("Capture span %.3fs replayed in %.3fs, %.0f pkts/s achieved against %.0f pkts/s target\n",
+           stats.capture_span_sec, stats.elapsed_sec, stats.achieved_pps, stats.target_pps);
+    printf("Send lag mean %ldns, max %ldns\n", stats.mean_lag_ns, stats.max_lag_ns);
+}
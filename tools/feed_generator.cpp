@@ -0,0 +1,147 @@
+// Publishes a synthetic tick by tick feed on both lines of the streams in stream_id_net_config,
+// for load testing the reader beyond recorded rates and exercising its loss handling.
+//   feed_generator [-r pps] [-n packets] [-s first:last] [-t tokens] [-z skew] [-b factor:ms:period_ms]
+//                  [-g gap] [-d duplicate] [-o reorder[:depth]] [-k ab_skew_us] [-i interface_ip] [-l ttl]
+//                  [-S seed]
+// -r 0 sends as fast as the socket takes them and -n 0 runs until interrupted. Fault rates are
+// per packet per line. The default TTL 0 keeps the feed on this host.
+
+#include "feedgenerator.hpp"
+#include "ipinfo.hpp"
+#include <climits>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <unistd.h>
+
+namespace
+{
+znsreader::SyntheticFeedGenerator *running = nullptr;
+
+void on_signal(int)
+{
+    if (running != nullptr) {
+        running->stop();
+    }
+}
+
+void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-r pps] [-n packets] [-s first:last] [-t tokens] [-z skew] [-b factor:ms:period_ms]\n"
+            "          [-g gap] [-d duplicate] [-o reorder[:depth]] [-k ab_skew_us] [-i interface_ip] [-l ttl]\n"
+            "          [-S seed]\n",
+            name);
+}
+}
+
+int main(int argc, char **argv)
+{
+    double rate_pps = 100000;
+    uint64_t packets = 1000000;
+    short first_stream = 0;
+    short last_stream = SHRT_MAX;
+    std::string interface_ip;
+    int ttl = 0;
+    uint64_t seed = 1;
+    znsreader::FeedModel model;
+    znsreader::FeedFaults faults;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:n:s:t:z:b:g:d:o:k:i:l:S:")) != -1) {
+        char *rest = nullptr;
+        switch (opt) {
+        case 'r':
+            rate_pps = std::atof(optarg);
+            break;
+        case 'n':
+            packets = std::strtoull(optarg, nullptr, 10);
+            break;
+        case 's':
+            first_stream = std::strtol(optarg, &rest, 10);
+            last_stream = (*rest == ':') ? std::strtol(rest + 1, nullptr, 10) : first_stream;
+            break;
+        case 't':
+            model.tokens = std::atoi(optarg);
+            break;
+        case 'z':
+            model.token_skew = std::atof(optarg);
+            break;
+        case 'b':
+            model.burst_factor = std::strtod(optarg, &rest);
+            if (*rest == ':') {
+                model.burst_ms = std::strtoul(rest + 1, &rest, 10);
+            }
+            if (*rest == ':') {
+                model.burst_period_ms = std::strtoul(rest + 1, nullptr, 10);
+            }
+            break;
+        case 'g':
+            faults.gap = std::atof(optarg);
+            break;
+        case 'd':
+            faults.duplicate = std::atof(optarg);
+            break;
+        case 'o':
+            faults.reorder = std::strtod(optarg, &rest);
+            if (*rest == ':') {
+                faults.reorder_depth = std::strtoul(rest + 1, nullptr, 10);
+            }
+            break;
+        case 'k':
+            faults.ab_skew_us = std::strtoll(optarg, nullptr, 10);
+            break;
+        case 'i':
+            interface_ip = optarg;
+            break;
+        case 'l':
+            ttl = std::atoi(optarg);
+            break;
+        case 'S':
+            seed = std::strtoull(optarg, nullptr, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    std::map<short, single_stream_info> streams;
+    for (const auto &[stream_id, info] : stream_id_net_config) {
+        if (stream_id >= first_stream && stream_id <= last_stream) {
+            streams.emplace(stream_id, info);
+        }
+    }
+    if (streams.empty()) {
+        fprintf(stderr, "No streams in %d:%d\n", first_stream, last_stream);
+        return 2;
+    }
+
+    znsreader::SyntheticFeedGenerator generator(streams, model, faults, seed, interface_ip, ttl);
+    running = &generator;
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+
+    printf("Generating on %zu streams at %.0f pkts/s%s\n", streams.size(), rate_pps,
+           (rate_pps == 0) ? " (unpaced)" : "");
+    const znsreader::GeneratorStats stats = generator.run(rate_pps, packets);
+    running = nullptr;
+
+    printf("Sent %lu packets and %lu heartbeats as %lu datagrams in %lu batches\n", stats.packets, stats.heartbeats,
+           stats.datagrams, stats.batches);
+    printf("%.3fs, %.0f pkts/s achieved against %.0f pkts/s target\n", stats.elapsed_sec, stats.achieved_pps,
+           stats.target_pps);
+    printf("Mix:");
+    for (const char type : { 'N', 'M', 'X', 'T', 'G', 'H', 'J', 'K' }) {
+        printf(" %c %lu", type, stats.by_type[(int)type]);
+    }
+    printf("\n");
+    for (int line = 0; line < 2; line++) {
+        printf("%s line: %lu gaps, %lu duplicates, %lu reordered\n", (line == 0) ? "Primary" : "Secondary",
+               stats.gaps[line], stats.duplicates[line], stats.reordered[line]);
+    }
+    printf("Lost on both lines: %lu\n", stats.lost);
+}
@@ -0,0 +1,108 @@
+// Prints the feed counters a FeedStatsPublisher publishes, refreshed every interval, with
+// packet rates since the previous refresh. Runs until interrupted, or once with interval 0.
+//   feed_stats <name> [interval_ms]
+
+#include "feedstats.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <utility>
+
+namespace
+{
+const char *line_name(znsreader::FeedLine line)
+{
+    switch (line) {
+    case znsreader::FeedLine::primary:
+        return "primary";
+    case znsreader::FeedLine::secondary:
+        return "secondary";
+    case znsreader::FeedLine::recovery:
+        return "recovery";
+    }
+    return "?";
+}
+
+double per_second(uint64_t now, uint64_t before, double seconds)
+{
+    return (seconds > 0 && now >= before) ? (now - before) / seconds : 0;
+}
+
+void print_stats(const znsreader::FeedStatsData &data, const znsreader::FeedStatsData *previous)
+{
+    const double seconds = (previous != nullptr) ? (data.updated_ns - previous->updated_ns) / 1e9 : 0;
+
+    printf("%6s %9s %14s %10s %14s %8s %10s %10s %12s\n", "stream", "line", "packets", "pkt/s", "bytes", "drops",
+           "gaps", "missing", "duplicates");
+    for (uint32_t i = 0; i < data.stream_count; i++) {
+        const znsreader::FeedStreamStats &stream = data.streams[i];
+        const uint64_t before = (previous != nullptr && i < previous->stream_count) ? previous->streams[i].packets
+                                                                                     : stream.packets;
+
+        printf("%6d %9s %14lu %10.0f %14lu %8lu %10lu %10lu %12lu\n", stream.stream_id, "all",
+               (unsigned long)stream.packets, per_second(stream.packets, before, seconds),
+               (unsigned long)stream.bytes, (unsigned long)stream.kernel_drops, (unsigned long)stream.seq_gaps,
+               (unsigned long)stream.seq_missing, (unsigned long)stream.duplicates);
+
+        for (uint32_t j = 0; j < data.line_count; j++) {
+            const znsreader::FeedLineStats &line = data.lines[j];
+            if (line.stream_id != stream.stream_id) {
+                continue;
+            }
+
+            const uint64_t line_before =
+                (previous != nullptr && j < previous->line_count && previous->lines[j].fd == line.fd)
+                    ? previous->lines[j].packets
+                    : line.packets;
+            printf("%6s %9s %14lu %10.0f %14lu %8lu %10lu %10lu %12lu\n", "", line_name(line.line),
+                   (unsigned long)line.packets, per_second(line.packets, line_before, seconds),
+                   (unsigned long)line.bytes, (unsigned long)line.kernel_drops, (unsigned long)line.seq_gaps,
+                   (unsigned long)line.seq_missing, (unsigned long)line.duplicates);
+        }
+    }
+
+    printf("\n%4s %14s %14s %14s %6s %12s %12s\n", "ring", "capacity", "used", "high_water", "peak%", "full_stalls",
+           "stall_spins");
+    for (uint32_t i = 0; i < data.ring_count; i++) {
+        const znsreader::FeedRingStats &ring = data.rings[i];
+        printf("%4u %14lu %14lu %14lu %6.1f %12lu %12lu\n", i, (unsigned long)ring.capacity,
+               (unsigned long)ring.used, (unsigned long)ring.high_watermark,
+               (ring.capacity > 0) ? (100.0 * ring.high_watermark / ring.capacity) : 0.0,
+               (unsigned long)ring.full_stalls, (unsigned long)ring.stall_spins);
+    }
+}
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <name> [interval_ms]\n", argv[0]);
+        return 2;
+    }
+
+    znsreader::FeedStatsReader reader(argv[1]);
+    const long interval_ms = (argc > 2) ? std::atol(argv[2]) : (long)reader.interval_ms();
+    // Snapshots are some 25KB, kept off the stack.
+    auto current = std::make_unique<znsreader::FeedStatsData>();
+    auto previous = std::make_unique<znsreader::FeedStatsData>();
+    bool have_previous = false;
+
+    while (true) {
+        if (!reader.read(*current)) {
+            fprintf(stderr, "No snapshot from pid %d yet\n", reader.publisher_pid());
+        } else if (!have_previous || current->snapshots != previous->snapshots) {
+            printf("\npid %d, snapshot %lu\n", reader.publisher_pid(), (unsigned long)current->snapshots);
+            print_stats(*current, have_previous ? previous.get() : nullptr);
+            fflush(stdout);
+            std::swap(current, previous);
+            have_previous = true;
+        }
+
+        if (interval_ms <= 0) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+    }
+}
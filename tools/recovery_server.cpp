@@ -0,0 +1,18 @@
+// Serves tick recovery requests from a .bin capture, stand-in for the exchange server.
+//   recovery_server <capture.bin> <port>
+
+#include "recoveryserver.hpp"
+#include <cstdio>
+#include <cstdlib>
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s <capture.bin> <port>\n", argv[0]);
+        return 2;
+    }
+
+    znsreader::TickRecoveryServer server(argv[1], std::atoi(argv[2]));
+    printf("Serving recovery for %s on port %u\n", argv[1], server.port());
+    server.serveRequests();
+}